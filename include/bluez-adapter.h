@@ -29,21 +29,86 @@ extern "C"
 #include <gio/gio.h>
 
 #include "bluez-common.h"
+#include "bluez-scheduler.h"
+#include "bluez-uuid.h"
 
 struct bluez_adapter;
 struct bluez_device;
 
+enum bluez_transport {
+	BLUEZ_TRANSPORT_AUTO,
+	BLUEZ_TRANSPORT_BREDR,
+	BLUEZ_TRANSPORT_LE,
+};
+
+/* Arguments of SetDiscoveryFilter, zero fields are left out */
+struct bluez_discovery_filter {
+	const gchar **uuids;		/* NULL terminated, NULL for any */
+	gint16 rssi;			/* minimum RSSI */
+	guint16 pathloss;		/* maximum, exclusive with rssi */
+	enum bluez_transport transport;
+	gboolean filter_duplicates;	/* DuplicateData off */
+	const gchar *pattern;		/* address or name prefix */
+};
+
 typedef void (*adapter_property_watch) (struct bluez_adapter *adapter,
 							gchar **prop_names);
 
+typedef void (*adapter_changed_notify) (struct bluez_adapter *adapter,
+				gchar **prop_names, gpointer user_data);
+
 /* adapter methods */
 BTResult bluez_adapter_start_discovery(struct bluez_adapter *adapter);
 
 BTResult bluez_adapter_stop_discovery(struct bluez_adapter *adapter);
 
+/*
+ * Scheduled as klass, see bluez-scheduler.h. Discovery sessions from the
+ * manager are preferred, they share one scan between users.
+ */
+void bluez_adapter_start_discovery_with_reply(struct bluez_adapter *adapter,
+				enum bluez_call_class klass,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *user_data);
+
+void bluez_adapter_stop_discovery_with_reply(struct bluez_adapter *adapter,
+				enum bluez_call_class klass,
+				bluez_response_cb cb, void *user_data);
+
+/*
+ * Applies to discovery started by this process, a NULL filter clears it.
+ * Prefer the filter of a manager discovery session, BlueZ keeps a single
+ * filter per client and sessions merge theirs.
+ */
+BTResult bluez_adapter_set_discovery_filter(struct bluez_adapter *adapter,
+				const struct bluez_discovery_filter *filter);
+
+void bluez_adapter_set_discovery_filter_with_reply(
+				struct bluez_adapter *adapter,
+				const struct bluez_discovery_filter *filter,
+				enum bluez_call_class klass,
+				bluez_response_cb cb, void *user_data);
+
 BTResult bluez_adapter_remove_device(struct bluez_adapter *adapter,
 						struct bluez_device *device);
 
+/* Scheduled as klass, see bluez-scheduler.h */
+void bluez_adapter_remove_device_with_reply(struct bluez_adapter *adapter,
+				const gchar *device_path,
+				enum bluez_call_class klass,
+				bluez_response_cb cb, void *user_data);
+
+/*
+ * AdvertisementMonitorManager1, app_path is the object manager root of
+ * the monitors. BT_RESULT_NOT_SUPPORTED when BlueZ lacks the interface.
+ */
+void bluez_adapter_register_monitor_with_reply(struct bluez_adapter *adapter,
+				const gchar *app_path,
+				bluez_response_cb cb, void *user_data);
+
+void bluez_adapter_unregister_monitor(struct bluez_adapter *adapter,
+						const gchar *app_path);
+
 gchar **bluez_adapter_get_property_names(struct bluez_adapter *adapter);
 
 /* Get adapter propperties */
@@ -54,6 +119,9 @@ void bluez_adapter_get_powered(struct bluez_adapter *adapter,
 
 gchar *bluez_adapter_get_address(struct bluez_adapter *adapter);
 
+gboolean bluez_adapter_get_addr(struct bluez_adapter *adapter,
+						bluez_addr_t *addr);
+
 void bluez_adapter_get_class(struct bluez_adapter *adapter,
 							guint32 *class);
 
@@ -71,6 +139,11 @@ void bluez_adapter_get_discovering(struct bluez_adapter *adapter,
 
 gchar **bluez_adapter_get_uuids(struct bluez_adapter *adapter);
 
+gboolean bluez_adapter_has_uuid(struct bluez_adapter *adapter,
+					const bluez_uuid_t *uuid);
+
+const gchar *bluez_adapter_get_path(struct bluez_adapter *adapter);
+
 /* Set adapter properties */
 BTResult bluez_adapter_set_powered(struct bluez_adapter *adapter,
 							gboolean powered);
@@ -90,6 +163,12 @@ BTResult bluez_adapter_set_discoverable_timeout(struct bluez_adapter *adapter,
 void bluez_adapter_set_properties_watch(struct bluez_adapter *adapter,
 				adapter_property_watch func, gpointer user_data);
 
+void bluez_adapter_set_changed_notify(struct bluez_adapter *adapter,
+			adapter_changed_notify func, gpointer user_data);
+
+void bluez_adapter_set_scheduler(struct bluez_adapter *adapter,
+				struct bluez_scheduler *scheduler);
+
 struct bluez_adapter *bluez_adapter_new(GDBusObject *object);
 
 void bluez_adapter_free(struct bluez_adapter *adapter);
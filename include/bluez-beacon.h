@@ -0,0 +1,86 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_BEACON_H__
+#define __BLUEZ_BEACON_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <glib.h>
+
+/*
+ * Decoders for common beacon formats, fed with the ManufacturerData and
+ * ServiceData views of bluez-device.h. Nothing is allocated.
+ */
+#define BLUEZ_COMPANY_APPLE		0x004c
+#define BLUEZ_UUID_EDDYSTONE		0xfeaa
+
+/* Apple iBeacon, the manufacturer data of BLUEZ_COMPANY_APPLE */
+struct bluez_ibeacon {
+	guint8 uuid[16];
+	guint16 major;
+	guint16 minor;
+	gint8 measured_power;		/* RSSI at 1 m */
+};
+
+gboolean bluez_beacon_parse_ibeacon(const guint8 *data, gsize len,
+					struct bluez_ibeacon *beacon);
+
+/* Google Eddystone, the service data of BLUEZ_UUID_EDDYSTONE */
+enum bluez_eddystone_frame {
+	BLUEZ_EDDYSTONE_UID = 0x00,
+	BLUEZ_EDDYSTONE_URL = 0x10,
+	BLUEZ_EDDYSTONE_TLM = 0x20,
+	BLUEZ_EDDYSTONE_EID = 0x30,
+};
+
+/* Longest expansion of the 17 encoded bytes, and the terminating NUL */
+#define BLUEZ_EDDYSTONE_URL_MAX		(12 + 17 * 6 + 1)
+
+struct bluez_eddystone {
+	enum bluez_eddystone_frame frame;
+	gint8 tx_power;			/* at 0 m, all but TLM */
+	union {
+		struct {
+			guint8 namespace_id[10];
+			guint8 instance_id[6];
+		} uid;
+		gchar url[BLUEZ_EDDYSTONE_URL_MAX];
+		struct {
+			guint16 battery;	/* mV, 0 if not supported */
+			gint16 temperature;	/* 1/256 degree Celsius */
+			guint32 adv_count;
+			guint32 uptime;		/* 0.1 s */
+		} tlm;
+		guint8 eid[8];
+	} value;
+};
+
+/* Unknown frames and encrypted TLM are rejected */
+gboolean bluez_beacon_parse_eddystone(const guint8 *data, gsize len,
+					struct bluez_eddystone *beacon);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
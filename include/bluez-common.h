@@ -31,11 +31,14 @@ extern "C" {
 #define BLUEZ_SERVICE_NAME "org.bluez"
 #define BLUEZ_MANAGER_PATH "/"
 #define AGENT_PATH "/org/bluez/agent"
+#define MONITOR_PATH "/org/bluez/monitor"
 #define ADAPTER_INTERFACE "org.bluez.Adapter1"
 #define DEVICE_INTERFACE "org.bluez.Device1"
 #define SERVICE_INTERFACE "org.bluez.Service1"
 #define AGENT_INTERFACE "org.bluez.AgentManager1"
 #define PROFILE_INTERFACE "org.bluez.ProfileManager1"
+#define MONITOR_MANAGER_INTERFACE "org.bluez.AdvertisementMonitorManager1"
+#define MONITOR_INTERFACE "org.bluez.AdvertisementMonitor1"
 #define PROPERTIES_INTERFACE "org.freedesktop.DBus.Properties"
 
 typedef enum {
@@ -52,11 +55,81 @@ typedef enum {
 	BT_RESULT_NO_ADAPTER,
 	BT_RESULT_NO_AGENT,
 	BT_RESULT_NOT_AUTHORIZED,
-	BT_RESULT_FAILED
+	BT_RESULT_FAILED,
+	BT_RESULT_TIMEOUT,
+	BT_RESULT_CANCELLED
 } BTResult;
 
 const gchar *ret2str(BTResult ret);
 
+BTResult error_to_result(GError *error);
+
+/* Well known properties, used to describe changes as a bit mask */
+enum bluez_property {
+	BLUEZ_PROPERTY_ADDRESS		= 1 << 0,
+	BLUEZ_PROPERTY_ADDRESS_TYPE	= 1 << 1,
+	BLUEZ_PROPERTY_NAME		= 1 << 2,
+	BLUEZ_PROPERTY_ALIAS		= 1 << 3,
+	BLUEZ_PROPERTY_CLASS		= 1 << 4,
+	BLUEZ_PROPERTY_APPEARANCE	= 1 << 5,
+	BLUEZ_PROPERTY_ICON		= 1 << 6,
+	BLUEZ_PROPERTY_POWERED		= 1 << 7,
+	BLUEZ_PROPERTY_DISCOVERABLE	= 1 << 8,
+	BLUEZ_PROPERTY_PAIRABLE		= 1 << 9,
+	BLUEZ_PROPERTY_DISCOVERABLE_TIMEOUT = 1 << 10,
+	BLUEZ_PROPERTY_DISCOVERING	= 1 << 11,
+	BLUEZ_PROPERTY_UUIDS		= 1 << 12,
+	BLUEZ_PROPERTY_PAIRED		= 1 << 13,
+	BLUEZ_PROPERTY_CONNECTED	= 1 << 14,
+	BLUEZ_PROPERTY_TRUSTED		= 1 << 15,
+	BLUEZ_PROPERTY_BLOCKED		= 1 << 16,
+	BLUEZ_PROPERTY_RSSI		= 1 << 17,
+	BLUEZ_PROPERTY_TX_POWER		= 1 << 18,
+	BLUEZ_PROPERTY_MANUFACTURER_DATA = 1 << 19,
+	BLUEZ_PROPERTY_SERVICE_DATA	= 1 << 20,
+	BLUEZ_PROPERTY_SERVICES_RESOLVED = 1 << 21,
+	BLUEZ_PROPERTY_LEGACY_PAIRING	= 1 << 22,
+	BLUEZ_PROPERTY_MODALIAS		= 1 << 23,
+	BLUEZ_PROPERTY_ADAPTER		= 1 << 24,
+	BLUEZ_PROPERTY_STATE		= 1 << 25,
+	BLUEZ_PROPERTY_DEVICE		= 1 << 26,
+	BLUEZ_PROPERTY_REMOTE_UUID	= 1 << 27,
+	BLUEZ_PROPERTY_OTHER		= 1 << 30,
+};
+
+guint32 bluez_property_from_name(const gchar *name);
+
+guint32 bluez_property_mask(gchar **names);
+
+/*
+ * Process wide, reference counted string interning. Every distinct
+ * string is stored once, interned strings compare equal by pointer.
+ * Each bluez_intern() is balanced by one bluez_intern_unref().
+ */
+const gchar *bluez_intern(const gchar *str);
+
+void bluez_intern_unref(const gchar *str);
+
+/* NULL terminated vectors of interned strings */
+void bluez_intern_strv_free(gchar **strv);
+
+/* Keys of an a{sv} dictionary, e.g. changed properties */
+gchar **bluez_intern_property_names(GVariant *properties);
+
+/*
+ * Stable object handle: slot index in the low 32 bits, slot generation
+ * in the high 32 bits. A handle goes stale when its object is removed,
+ * resolving it then fails instead of touching freed memory. The index
+ * is dense and may key caller side arrays.
+ */
+typedef guint64 bluez_handle_t;
+
+#define BLUEZ_HANDLE_INVALID		((bluez_handle_t) 0)
+#define BLUEZ_HANDLE(index, generation)	\
+		(((bluez_handle_t) (generation) << 32) | (guint32) (index))
+#define BLUEZ_HANDLE_INDEX(handle)	((guint32) ((handle) & 0xffffffff))
+#define BLUEZ_HANDLE_GENERATION(handle)	((guint32) ((handle) >> 32))
+
 typedef void (*bluez_response_cb) (BTResult ret,
 				GVariant *data, void *user_data);
 
@@ -79,8 +152,44 @@ gchar *property_get_string(GDBusProxy *proxy, const gchar *name);
 
 gchar **property_get_strings(GDBusProxy *proxy, const gchar *name);
 
+const gchar *property_peek_string(GDBusProxy *proxy, const gchar *name);
+
+gchar **property_get_interned_strings(GDBusProxy *proxy, const gchar *name);
+
 BTResult property_set_variant(GDBusProxy *proxy, GVariant *variant);
 
+/*
+ * Bluetooth device address, most significant byte first as printed.
+ * Parsing accepts ':' or '_' (object path) separators.
+ */
+enum bluez_addr_type {
+	BLUEZ_ADDR_PUBLIC,
+	BLUEZ_ADDR_RANDOM,
+};
+
+typedef struct {
+	guint8 b[6];
+	guint8 type;			/* enum bluez_addr_type */
+} bluez_addr_t;
+
+/* "XX:XX:XX:XX:XX:XX" and the terminating NUL */
+#define BLUEZ_ADDR_STRLEN 18
+
+gboolean bluez_addr_parse(const gchar *str, bluez_addr_t *addr);
+
+void bluez_addr_format(const bluez_addr_t *addr,
+					gchar str[BLUEZ_ADDR_STRLEN]);
+
+/* Parses the trailing dev_XX_XX_XX_XX_XX_XX component of a device path */
+gboolean bluez_addr_from_path(const gchar *path, bluez_addr_t *addr);
+
+/* Compares the address bytes, the type is not significant */
+gboolean bluez_addr_equal(gconstpointer a, gconstpointer b);
+
+guint bluez_addr_hash(gconstpointer addr);
+
+gint bluez_addr_compare(const bluez_addr_t *a, const bluez_addr_t *b);
+
 gchar *get_addrstr_from_path(const gchar *path);
 
 #ifdef __cplusplus
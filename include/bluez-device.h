@@ -26,12 +26,20 @@ extern "C"
 #endif
 
 #include "bluez-common.h"
+#include "bluez-scheduler.h"
+#include "bluez-uuid.h"
+
+#define BLUEZ_RSSI_UNKNOWN 127
 
 struct bluez_device;
+struct bluez_device_info;
 
 typedef void (*device_property_watch) (struct bluez_device *device,
 							gchar **prop_names);
 
+typedef void (*device_changed_notify) (struct bluez_device *device,
+				gchar **prop_names, gpointer user_data);
+
 void bluez_device_set_properties_watch(struct bluez_device *device,
 				device_property_watch func, gpointer user_data);
 
@@ -45,6 +53,51 @@ BTResult bluez_device_connect_profile(struct bluez_device *device,
 BTResult bluez_device_disconnect_profile(struct bluez_device *device,
 							const gchar *uuid);
 
+/*
+ * Raw asynchronous call through the scheduler of the owning manager, see
+ * bluez-scheduler.h. A timeout of 0 waits as long as D-Bus does.
+ */
+void bluez_device_call_with_reply(struct bluez_device *device,
+				const gchar *name, GVariant *parameter,
+				enum bluez_call_class klass, guint timeout_ms,
+				bluez_response_cb cb, void *user_data);
+
+enum bluez_device_op {
+	BLUEZ_DEVICE_OP_CONNECT,
+	BLUEZ_DEVICE_OP_DISCONNECT,
+	BLUEZ_DEVICE_OP_CONNECT_PROFILE,
+	BLUEZ_DEVICE_OP_DISCONNECT_PROFILE,
+	BLUEZ_DEVICE_OP_PAIR,
+};
+
+/*
+ * Queues an operation on the device, which runs one at a time. A repeat
+ * of the last queued or running operation shares its call and result, an
+ * opposite one (Connect, then Disconnect) cancels the queued operation
+ * with BT_RESULT_CANCELLED. Reaching the requested state already, e.g.
+ * AlreadyConnected, counts as success. uuid is for profile operations,
+ * retry may be NULL and is taken from the first of merged requests.
+ */
+void bluez_device_submit(struct bluez_device *device,
+				enum bluez_device_op type, const gchar *uuid,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *user_data);
+
+void bluez_device_connect_with_reply(struct bluez_device *device,
+					bluez_response_cb cb, void *user_data);
+
+void bluez_device_disconnect_with_reply(struct bluez_device *device,
+					bluez_response_cb cb, void *user_data);
+
+void bluez_device_connect_profile_with_reply(struct bluez_device *device,
+				const gchar *uuid,
+				bluez_response_cb cb, void *user_data);
+
+void bluez_device_disconnect_profile_with_reply(struct bluez_device *device,
+				const gchar *uuid,
+				bluez_response_cb cb, void *user_data);
+
 void bluez_device_pair_with_reply(struct bluez_device *device,
 					bluez_response_cb cb, void *user_data);
 
@@ -62,6 +115,9 @@ gchar *bluez_device_get_alias(struct bluez_device *device);
 
 gchar *bluez_device_get_address(struct bluez_device *device);
 
+/* Parsed once when the device appears, owned by the device */
+const bluez_addr_t *bluez_device_get_addr(struct bluez_device *device);
+
 void bluez_device_get_class(struct bluez_device *device, guint32 *class);
 
 void bluez_device_get_paired(struct bluez_device *device, gboolean *paired);
@@ -69,12 +125,76 @@ void bluez_device_get_paired(struct bluez_device *device, gboolean *paired);
 void bluez_device_get_connected(struct bluez_device *device,
 							gboolean *connected);
 
+void bluez_device_get_trusted(struct bluez_device *device, gboolean *trusted);
+
 void bluez_device_get_rssi(struct bluez_device *device, gint16 *rssi);
 
 gchar **bluez_device_get_uuids(struct bluez_device *device);
 
+/*
+ * Interned UUIDs owned by the device, no copy is made. Valid until the
+ * UUIDs property changes, compare entries against bluez_intern() values
+ * by pointer.
+ */
+const gchar * const *bluez_device_peek_uuids(struct bluez_device *device);
+
+/* Parsed once per UUIDs change, see bluez-uuid.h */
+const struct bluez_uuid_set *bluez_device_get_uuid_set(
+					struct bluez_device *device);
+
+gboolean bluez_device_has_uuid(struct bluez_device *device,
+					const bluez_uuid_t *uuid);
+
+/*
+ * Advertising data borrowed from the cached properties, no copy is made.
+ * Views stay valid while the property keeps its value.
+ */
+struct bluez_bytes {
+	const guint8 *data;
+	gsize len;
+};
+
+/*
+ * ManufacturerData entries, up to max companies and views. Returns the
+ * number of entries the device has.
+ */
+guint bluez_device_peek_manufacturer_data(struct bluez_device *device,
+				guint16 *companies, struct bluez_bytes *views,
+				guint max);
+
+/* ServiceData entries, same as above, unparsable UUIDs are skipped */
+guint bluez_device_peek_service_data(struct bluez_device *device,
+				bluez_uuid_t *uuids, struct bluez_bytes *views,
+				guint max);
+
+/* FALSE if the device does not advertise it */
+gboolean bluez_device_get_tx_power(struct bluez_device *device,
+							gint16 *tx_power);
+
 const gchar *bluez_device_get_path(struct bluez_device *device);
 
+void bluez_device_get_info(struct bluez_device *device,
+					struct bluez_device_info *info);
+
+/*
+ * Approximate memory held for the device: the record, its path and the
+ * cached property values. BlueZ keeps a similar amount per object.
+ */
+gsize bluez_device_get_footprint(struct bluez_device *device);
+
+/* BLUEZ_HANDLE_INVALID unless the device is owned by a manager */
+bluez_handle_t bluez_device_get_handle(struct bluez_device *device);
+
+/* device constructer */
+void bluez_device_set_changed_notify(struct bluez_device *device,
+			device_changed_notify func, gpointer user_data);
+
+void bluez_device_set_handle(struct bluez_device *device,
+						bluez_handle_t handle);
+
+void bluez_device_set_scheduler(struct bluez_device *device,
+				struct bluez_scheduler *scheduler);
+
 struct bluez_device *bluez_device_new(GDBusObject *object);
 
 void bluez_device_free(struct bluez_device *device);
@@ -26,13 +26,18 @@ extern "C"
 #endif
 
 #include <glib.h>
+#include <gio/gio.h>
 
 #include "bluez-common.h"
+#include "bluez-uuid.h"
+#include "bluez-scheduler.h"
 
 struct bluez_manager;
 struct bluez_adapter;
 struct bluez_device;
 struct bluez_service;
+struct bluez_snapshot;
+struct bluez_scheduler;
 
 enum agent_request_type {
 	AGENT_REQUEST_RELEASE,
@@ -46,6 +51,27 @@ enum agent_request_type {
 	AGENT_REQUEST_CANCEL,
 };
 
+enum bluez_change_type {
+	BLUEZ_CHANGE_ADDED,
+	BLUEZ_CHANGE_REMOVED,
+	BLUEZ_CHANGE_PROPERTIES,
+};
+
+enum bluez_object_type {
+	BLUEZ_OBJECT_ADAPTER,
+	BLUEZ_OBJECT_DEVICE,
+	BLUEZ_OBJECT_SERVICE,
+};
+
+struct bluez_change {
+	guint64 generation;
+	enum bluez_change_type type;
+	enum bluez_object_type object;
+	guint32 properties;		/* BLUEZ_PROPERTY_* changed */
+	bluez_handle_t handle;		/* devices only */
+	const gchar *path;		/* valid until events are processed */
+};
+
 typedef void (*bluez_adapter_added_cb) (struct bluez_adapter *adapter,
 						gpointer user_data);
 typedef void (*bluez_adapter_removed_cb) (struct bluez_adapter *adapter,
@@ -61,11 +87,62 @@ typedef void (*bluez_service_added_cb) (struct bluez_service *service,
 typedef void (*bluez_service_removed_cb) (struct bluez_service *service,
 						gpointer user_data);
 
+typedef void (*bluez_top_rssi_cb) (struct bluez_manager *manager,
+				const bluez_handle_t *handles, guint n_handles,
+				gpointer user_data);
+
+struct bluez_connect_stats;
+
+/* One per device as soon as its outcome is known */
+typedef void (*bluez_connect_cb) (struct bluez_manager *manager,
+				bluez_handle_t handle, BTResult result,
+				gpointer user_data);
+
+typedef void (*bluez_connect_done_cb) (struct bluez_manager *manager,
+				const struct bluez_connect_stats *stats,
+				gpointer user_data);
+
 typedef void (*agent_request_cb) (enum agent_request_type type,
 		gchar *device_path, void *request_data, void *user_data);
 
 struct bluez_manager *bluez_manager_new(void);
 
+/*
+ * Manager only tracking the given adapter and the objects below it, the
+ * bus daemon drops signals of other adapters before they reach us.
+ * adapter: "hci0" or "/org/bluez/hci0", NULL for all adapters.
+ */
+struct bluez_manager *bluez_manager_new_for_adapter(const gchar *adapter);
+
+/*
+ * Same on the given connection, path_namespace takes an adapter name or
+ * any object path ("/" for all). Events are handled in the thread
+ * default main context of the caller.
+ */
+struct bluez_manager *bluez_manager_new_for_connection(GDBusConnection *conn,
+						const gchar *path_namespace);
+
+/*
+ * Manager running on a private main context for applications without a
+ * GMainLoop. The context is made the thread default only while the
+ * library works in it, the caller's own default is left alone. Use the
+ * manager from the thread that created it:
+ *
+ *	timeout = bluez_manager_next_timeout(manager);
+ *	poll bluez_manager_get_fd(manager) for reading, up to timeout ms
+ *	bluez_manager_dispatch(manager, max_batches);
+ */
+struct bluez_manager *bluez_manager_new_pollable(void);
+
+int bluez_manager_get_fd(struct bluez_manager *manager);
+
+/* Milliseconds until the next timer is due, -1 if none */
+gint bluez_manager_next_timeout(struct bluez_manager *manager);
+
+/* Run up to max_batches dispatch rounds, returns the rounds run */
+guint bluez_manager_dispatch(struct bluez_manager *manager,
+							guint max_batches);
+
 void bluez_manager_free(struct bluez_manager *manager);
 
 void bluez_manager_refresh_objects(struct bluez_manager *manager);
@@ -91,9 +168,443 @@ BTResult bluez_manager_agent_reply(struct bluez_manager *manager,
 gboolean bluez_manager_register_agent(struct bluez_manager *manager,
 					agent_request_cb cb, void *user_data);
 
+/*
+ * Returns a referenced snapshot of the device table, release it with
+ * bluez_snapshot_unref(). Unlike the rest of the API this can be called
+ * from any thread, it never blocks the thread handling D-Bus events.
+ */
+struct bluez_snapshot *bluez_manager_get_snapshot(
+					struct bluez_manager *manager);
+
+/*
+ * Mirrors the device table into shared memory that other processes can
+ * open with bluez_shm_reader_new(name). capacity bounds the number of
+ * devices, updates beyond it are dropped.
+ */
+BTResult bluez_manager_publish_shm(struct bluez_manager *manager,
+					const gchar *name, guint capacity);
+
+/*
+ * Every added or removed object and every property change is stamped
+ * with a monotonically increasing generation. Pollers remember the last
+ * generation they saw and only fetch what changed since:
+ *
+ * BT_RESULT_OK: n_changes records newer than generation, oldest first,
+ * call again from the last one if max_changes were returned.
+ * BT_RESULT_NOT_AVAILABLE: the log no longer covers generation, resync
+ * from scratch and continue from bluez_manager_get_generation().
+ */
+guint64 bluez_manager_get_generation(struct bluez_manager *manager);
+
+BTResult bluez_manager_changes_since(struct bluez_manager *manager,
+				guint64 generation,
+				struct bluez_change *changes,
+				guint max_changes, guint *n_changes);
+
+/* Number of records kept, 4096 by default */
+BTResult bluez_manager_set_change_log_size(struct bluez_manager *manager,
+								guint size);
+
 struct bluez_device *find_device_by_address(struct bluez_manager *manager,
 							const gchar *address);
 
+/* Any adapter's record of the device */
+struct bluez_device *find_device_by_addr(struct bluez_manager *manager,
+						const bluez_addr_t *addr);
+
+struct bluez_device *find_device_by_path(struct bluez_manager *manager,
+							const gchar *path);
+
+/* adapter: "hci0" or "/org/bluez/hci0", NULL for any */
+struct bluez_device *find_adapter_device_by_addr(
+					struct bluez_manager *manager,
+					const gchar *adapter,
+					const bluez_addr_t *addr);
+
+/* Every adapter's record, copies up to max, returns how many there are */
+guint find_devices_by_addr(struct bluez_manager *manager,
+				const bluez_addr_t *addr,
+				struct bluez_device **devices, guint max);
+
+/*
+ * Resolves a handle from bluez_device_get_handle(), NULL once the device
+ * was removed. Handles are cheap to store and safe to keep across async
+ * replies, threads and queues where device pointers are not.
+ */
+struct bluez_device *bluez_manager_resolve_device(
+				struct bluez_manager *manager,
+				bluez_handle_t handle);
+
+/* Upper bound of BLUEZ_HANDLE_INDEX() for the manager's devices */
+guint bluez_manager_get_device_slots(struct bluez_manager *manager);
+
+enum bluez_device_state {
+	BLUEZ_DEVICE_CONNECTED		= 1 << 0,
+	BLUEZ_DEVICE_PAIRED		= 1 << 1,
+	BLUEZ_DEVICE_TRUSTED		= 1 << 2,
+	BLUEZ_DEVICE_BLOCKED		= 1 << 3,
+};
+
+#define BLUEZ_DEVICE_N_STATES 4
+
+/*
+ * Device query, all given conditions must hold. A zeroed query matches
+ * every device.
+ */
+struct bluez_device_query {
+	guint32 all_of;			/* BLUEZ_DEVICE_* that must be set */
+	guint32 none_of;		/* BLUEZ_DEVICE_* that must be clear */
+	guint32 any_of;			/* one of these set, ignored if 0 */
+	const gchar *adapter;		/* e.g. "hci0", NULL for any */
+	const bluez_uuid_t *uuid;	/* NULL for any */
+	guint seen_within;		/* seconds since last update, 0 any */
+	guint unseen_for;		/* no update for seconds, 0 any */
+};
+
+/*
+ * Evaluated on bitmap indexes kept up to date from PropertiesChanged.
+ * Copies up to max_handles handles, returns the number of matches.
+ */
+guint bluez_manager_query_devices(struct bluez_manager *manager,
+				const struct bluez_device_query *query,
+				bluez_handle_t *handles, guint max_handles);
+
+/* Whether one device matches query now, FALSE once it was removed */
+gboolean bluez_manager_device_matches(struct bluez_manager *manager,
+				const struct bluez_device_query *query,
+				bluez_handle_t handle);
+
+/*
+ * Up to k strongest devices, strongest first, optionally on one adapter
+ * only. Devices without an RSSI update for the maximum age (30 seconds
+ * by default) no longer count.
+ */
+guint bluez_manager_top_rssi(struct bluez_manager *manager, guint k,
+				const gchar *adapter, bluez_handle_t *handles);
+
+BTResult bluez_manager_set_rssi_max_age(struct bluez_manager *manager,
+							guint seconds);
+
+/*
+ * Calls func with the new top-K whenever a device enters or leaves it,
+ * reordering alone is not reported. A NULL func removes the watch.
+ */
+BTResult bluez_manager_set_top_rssi_watch(struct bluez_manager *manager,
+				guint k, const gchar *adapter,
+				bluez_top_rssi_cb func, gpointer user_data);
+
+enum bluez_search_mode {
+	BLUEZ_SEARCH_PREFIX,		/* name or alias starts with text */
+	BLUEZ_SEARCH_SUBSTRING,		/* name or alias contains text */
+};
+
+/*
+ * Case-insensitive search over device names and aliases, served from an
+ * index maintained from PropertiesChanged. Copies up to max_handles
+ * handles, returns the number of matches.
+ */
+guint bluez_manager_search_devices(struct bluez_manager *manager,
+				const gchar *text, enum bluez_search_mode mode,
+				bluez_handle_t *handles, guint max_handles);
+
+/*
+ * Stale device reaper, for the temporary devices BlueZ accumulates while
+ * scanning. Connected, paired and trusted devices are always kept, zero
+ * fields take the defaults in brackets.
+ */
+struct bluez_reaper_policy {
+	guint32 none_of;		/* more BLUEZ_DEVICE_* to keep */
+	const gchar *adapter;		/* e.g. "hci0", NULL for any */
+	guint unseen_for;		/* seconds without an update [600] */
+	guint max_in_flight;		/* concurrent RemoveDevice calls [8] */
+	guint max_per_second;		/* RemoveDevice calls per second [32] */
+	guint interval;			/* seconds between sweeps [60] */
+};
+
+struct bluez_reaper_stats {
+	guint64 removed;
+	guint64 failed;
+	guint64 bytes;			/* estimated, see footprint */
+	guint in_flight;
+	guint queued;
+};
+
+/*
+ * Scheduler behind the asynchronous calls of the manager's adapters and
+ * devices, for limits and metrics.
+ */
+struct bluez_scheduler *bluez_manager_get_scheduler(
+					struct bluez_manager *manager);
+
+/* Adapter the device belongs to */
+struct bluez_adapter *bluez_manager_get_device_adapter(
+					struct bluez_manager *manager,
+					struct bluez_device *device);
+
+/* Replaces a running reaper, its counters start over */
+BTResult bluez_manager_start_reaper(struct bluez_manager *manager,
+				const struct bluez_reaper_policy *policy);
+
+void bluez_manager_stop_reaper(struct bluez_manager *manager);
+
+BTResult bluez_manager_get_reaper_stats(struct bluez_manager *manager,
+				struct bluez_reaper_stats *stats);
+
+/*
+ * Bulk connection of known devices. Zero fields take the defaults in
+ * brackets, the timeout covers a call and any wait for Connected.
+ */
+struct bluez_connect_options {
+	guint per_adapter;		/* concurrent connects per adapter [3] */
+	const gchar *profile;		/* ConnectProfile UUID, NULL Connect */
+	enum bluez_call_class klass;	/* scheduling class [normal] */
+	guint timeout_ms;		/* per attempt [30000] */
+	const struct bluez_retry_policy *retry;	/* NULL single attempt */
+};
+
+struct bluez_connect_stats {
+	guint total;
+	guint connected;
+	guint failed;
+	guint pending;
+	gint64 start_time;		/* monotonic, usec */
+	gint64 elapsed;			/* until the latest outcome, usec */
+};
+
+struct bluez_connect_job;
+
+/*
+ * Connects the devices behind handles, reporting each outcome to func and
+ * the totals to done once none is pending. Devices already connected
+ * succeed without a call, InProgress waits for the Connected property.
+ * The job stays valid until bluez_manager_free_connect_job().
+ */
+struct bluez_connect_job *bluez_manager_connect_devices(
+				struct bluez_manager *manager,
+				const bluez_handle_t *handles, guint n_handles,
+				const struct bluez_connect_options *options,
+				bluez_connect_cb func, bluez_connect_done_cb done,
+				gpointer user_data);
+
+BTResult bluez_manager_get_connect_stats(struct bluez_manager *manager,
+				struct bluez_connect_job *job,
+				struct bluez_connect_stats *stats);
+
+/* Abandons devices still pending, no more callbacks are made */
+void bluez_manager_free_connect_job(struct bluez_manager *manager,
+				struct bluez_connect_job *job);
+
+/*
+ * Automatic reconnection of known devices. Failed attempts back off
+ * exponentially with jitter between the delays in brackets.
+ */
+enum bluez_reconnect_mode {
+	BLUEZ_RECONNECT_ALWAYS,		/* whenever the device object exists */
+	BLUEZ_RECONNECT_IN_RANGE,	/* on advertisements at min_rssi */
+};
+
+struct bluez_reconnect_policy {
+	enum bluez_reconnect_mode mode;
+	const gchar *adapter;		/* e.g. "hci0", NULL for any */
+	gint16 min_rssi;		/* in range only, 0 for any */
+	guint16 window_start;		/* minutes after local midnight, */
+	guint16 window_end;		/* equal for all day */
+	guint initial_delay_ms;		/* first retry [1000] */
+	guint max_delay_ms;		/* retry cap [300000] */
+};
+
+struct bluez_reconnect_stats {
+	guint known;
+	guint64 attempts;
+	guint64 reconnected;
+	guint64 failed;
+};
+
+/* A NULL policy forgets the device */
+BTResult bluez_manager_set_reconnect_policy(struct bluez_manager *manager,
+				const bluez_addr_t *addr,
+				const struct bluez_reconnect_policy *policy);
+
+/* Key file of one group per address, merged with the current policies */
+BTResult bluez_manager_load_reconnect_policies(struct bluez_manager *manager,
+						const gchar *filename);
+
+BTResult bluez_manager_save_reconnect_policies(struct bluez_manager *manager,
+						const gchar *filename);
+
+BTResult bluez_manager_get_reconnect_stats(struct bluez_manager *manager,
+				struct bluez_reconnect_stats *stats);
+
+/*
+ * Shared discovery. An adapter scans while any session on it is held,
+ * duty cycled sessions scan scan_ms out of every period_ms. With several
+ * sessions the adapter follows the shortest period at the highest duty
+ * ratio, a continuous session keeps it scanning throughout.
+ *
+ * Session filters are merged into the loosest one passing what any
+ * session asks for, sent with SetDiscoveryFilter and applied to new
+ * device objects as well: those failing it are dropped before the
+ * manager allocates anything for them, see bluez_discovery_filter.
+ */
+struct bluez_discovery_options {
+	guint scan_ms;			/* 0 for a continuous scan */
+	guint period_ms;
+	const struct bluez_discovery_filter *filter;	/* NULL for all */
+};
+
+struct bluez_discovery_stats {
+	guint sessions;
+	gboolean scanning;
+	guint64 calls;			/* Start/StopDiscovery issued */
+	guint64 windows;		/* scans started */
+	guint64 scan_time;		/* total scanning, usec */
+	guint64 devices_found;		/* summed over windows */
+	guint last_window_devices;	/* distinct devices heard */
+	guint current_window_devices;
+};
+
+struct bluez_discovery_session;
+
+/* adapter: "hci0" or "/org/bluez/hci0", the adapter may come later */
+struct bluez_discovery_session *bluez_manager_acquire_discovery(
+			struct bluez_manager *manager, const gchar *adapter,
+			const struct bluez_discovery_options *options);
+
+void bluez_manager_release_discovery(struct bluez_manager *manager,
+			struct bluez_discovery_session *session);
+
+BTResult bluez_manager_get_discovery_stats(struct bluez_manager *manager,
+			const gchar *adapter,
+			struct bluez_discovery_stats *stats);
+
+/*
+ * Advertisement monitors, matched inside BlueZ or offloaded to the
+ * controller, so presence tracking needs no discovery. A device is found
+ * once an advertisement matches any one pattern and its RSSI stays at or
+ * above rssi_high for rssi_high_timeout seconds, and lost once it stays
+ * below rssi_low for rssi_low_timeout. Zero fields are left to BlueZ,
+ * thresholds are set both or neither.
+ */
+struct bluez_monitor_pattern {
+	guint8 start;			/* offset into the AD data */
+	guint8 ad_type;			/* e.g. 0xff manufacturer data */
+	const guint8 *value;
+	guint8 len;			/* 1 to 31 */
+};
+
+struct bluez_monitor_options {
+	const struct bluez_monitor_pattern *patterns;
+	guint n_patterns;
+	gint16 rssi_low;
+	gint16 rssi_high;
+	guint16 rssi_low_timeout;	/* seconds */
+	guint16 rssi_high_timeout;	/* seconds */
+	guint16 rssi_sampling_period;	/* 100 ms units */
+};
+
+enum bluez_monitor_event {
+	BLUEZ_MONITOR_ACTIVATED,	/* accepted by BlueZ */
+	BLUEZ_MONITOR_RELEASED,		/* dropped by BlueZ */
+	BLUEZ_MONITOR_DEVICE_FOUND,
+	BLUEZ_MONITOR_DEVICE_LOST,
+};
+
+struct bluez_monitor;
+
+/*
+ * addr is NULL for activation and release, handle is BLUEZ_HANDLE_INVALID
+ * while the manager has no record of the device.
+ */
+typedef void (*bluez_monitor_cb) (struct bluez_manager *manager,
+				struct bluez_monitor *monitor,
+				enum bluez_monitor_event event,
+				const bluez_addr_t *addr, bluez_handle_t handle,
+				gpointer user_data);
+
+/*
+ * Exports the monitor on the manager's connection, the way the agent is,
+ * and registers it with every adapter. Adapters without monitor support
+ * never activate it.
+ */
+struct bluez_monitor *bluez_manager_add_monitor(
+				struct bluez_manager *manager,
+				const struct bluez_monitor_options *options,
+				bluez_monitor_cb func, gpointer user_data);
+
+void bluez_manager_remove_monitor(struct bluez_manager *manager,
+				struct bluez_monitor *monitor);
+
+/*
+ * Advertisement reports, one fixed size record per ManufacturerData or
+ * ServiceData entry, delivered in batches. A record repeating the address
+ * and payload of one reported within dedup_window_ms is suppressed. Zero
+ * options take the defaults: batches of 64 delivered within 100 ms, a
+ * one second dedup window.
+ */
+enum bluez_adv_data_type {
+	BLUEZ_ADV_MANUFACTURER_DATA,
+	BLUEZ_ADV_SERVICE_DATA,
+};
+
+/* Payload room of a legacy advertisement */
+#define BLUEZ_ADV_DATA_MAX 31
+
+/* RSSI or TX power not known, as HCI reports it */
+#define BLUEZ_ADV_POWER_UNKNOWN 127
+
+struct bluez_adv_report {
+	gint64 time;			/* monotonic, usec */
+	bluez_handle_t handle;
+	bluez_addr_t addr;
+	gint16 rssi;			/* dBm, or BLUEZ_ADV_POWER_UNKNOWN */
+	gint16 tx_power;
+	guint8 type;			/* enum bluez_adv_data_type */
+	guint8 len;
+	guint8 truncated;		/* longer than BLUEZ_ADV_DATA_MAX */
+	guint16 company;		/* manufacturer data */
+	bluez_uuid_t uuid;		/* service data */
+	guint8 data[BLUEZ_ADV_DATA_MAX];
+};
+
+struct bluez_adv_report_options {
+	guint batch_size;
+	guint max_latency_ms;
+	guint dedup_window_ms;
+	gboolean keep_duplicates;	/* no dedup at all */
+};
+
+struct bluez_adv_report_stats {
+	guint64 received;		/* records built */
+	guint64 suppressed;		/* duplicates dropped */
+	guint64 reported;
+	guint64 batches;
+};
+
+/* reports are only valid during the call */
+typedef void (*bluez_adv_report_cb) (struct bluez_manager *manager,
+				const struct bluez_adv_report *reports,
+				guint n_reports, gpointer user_data);
+
+/*
+ * Replaces the watch, the pending batch of the previous one is delivered
+ * first. A NULL func stops reporting.
+ */
+BTResult bluez_manager_set_adv_report_watch(struct bluez_manager *manager,
+				const struct bluez_adv_report_options *options,
+				bluez_adv_report_cb func, gpointer user_data);
+
+BTResult bluez_manager_get_adv_report_stats(struct bluez_manager *manager,
+				struct bluez_adv_report_stats *stats);
+
+/*
+ * Devices advertising uuid, from an index kept up to date as devices and
+ * their UUIDs change. Copies up to max_handles handles, returns how many
+ * devices match in total.
+ */
+guint bluez_manager_find_devices_by_uuid(struct bluez_manager *manager,
+				const bluez_uuid_t *uuid,
+				bluez_handle_t *handles, guint max_handles);
+
 #ifdef __cplusplus
 }
 #endif
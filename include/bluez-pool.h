@@ -0,0 +1,93 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_POOL_H__
+#define __BLUEZ_POOL_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <glib.h>
+
+#include "bluez-common.h"
+
+/*
+ * Records that come and go with discovery are carved out of fixed size
+ * pools. Memory is taken from the system in blocks and never given back,
+ * freed records are recycled through a free list, so churn does not
+ * fragment the heap. All pools are shared by every manager and shard.
+ */
+struct bluez_pool_stats {
+	const gchar *name;		/* "adapter", "device", "string-64", ... */
+	gsize object_size;
+	guint blocks;
+	guint capacity;			/* objects in all blocks */
+	guint in_use;
+	guint peak;
+	guint64 allocs;
+	guint64 failures;		/* allocations the system refused */
+};
+
+/* Fills up to max_stats entries, returns the number of pools */
+guint bluez_pool_get_stats(struct bluez_pool_stats *stats, guint max_stats);
+
+/* Grows the named pool up front so that n objects fit without a refill */
+BTResult bluez_pool_reserve(const gchar *name, guint n);
+
+/* pool internals, for the library's record types */
+struct bluez_pool {
+	const gchar *name;
+	gsize object_size;
+	guint block_objects;
+
+	GMutex lock;
+	gpointer free_list;
+	GSList *blocks;
+	gboolean registered;
+
+	guint capacity;
+	guint in_use;
+	guint peak;
+	guint64 allocs;
+	guint64 failures;
+};
+
+#define BLUEZ_POOL_INIT(pool_name, size, per_block) \
+	{ .name = (pool_name), .object_size = (size), \
+					.block_objects = (per_block) }
+
+gpointer bluez_pool_alloc0(struct bluez_pool *pool);
+
+void bluez_pool_free(struct bluez_pool *pool, gpointer object);
+
+/*
+ * Variable sized storage, served from 32 to 128 byte size class pools
+ * and from the heap beyond. Pass the allocation size back on free.
+ */
+gpointer bluez_pool_alloc_sized(gsize size);
+
+void bluez_pool_free_sized(gpointer object, gsize size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_SCHEDULER_H__
+#define __BLUEZ_SCHEDULER_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "bluez-common.h"
+
+/*
+ * Queues method calls toward bluetoothd so that bulk background work
+ * cannot starve interactive requests. Calls are dispatched strictly by
+ * class, each class in FIFO order, while the number of calls in flight
+ * stays under a global and a per adapter cap. Queued calls past their
+ * deadline are dropped with BT_RESULT_TIMEOUT.
+ */
+struct bluez_scheduler;
+struct bluez_timers;
+
+enum bluez_call_class {
+	BLUEZ_CALL_INTERACTIVE,		/* a user is waiting */
+	BLUEZ_CALL_NORMAL,
+	BLUEZ_CALL_BACKGROUND,		/* bulk work, e.g. the reaper */
+};
+
+#define BLUEZ_CALL_N_CLASSES 3
+
+struct bluez_scheduler_stats {
+	guint in_flight;
+	struct {
+		guint queued;			/* current queue depth */
+		guint max_queued;
+		guint in_flight;
+		guint64 dispatched;
+		guint64 expired;		/* dropped before dispatch */
+		guint64 retries;
+		guint64 wait_time;		/* total queued time, usec */
+		guint64 max_wait_time;		/* usec */
+	} classes[BLUEZ_CALL_N_CLASSES];
+};
+
+/*
+ * Replies are delivered in the context the scheduler's timers run in.
+ * A timeout of 0 never expires, otherwise it also bounds the D-Bus call
+ * once dispatched.
+ */
+void bluez_scheduler_call(struct bluez_scheduler *scheduler,
+				GDBusProxy *proxy, const gchar *name,
+				GVariant *parameter,
+				enum bluez_call_class klass, guint timeout_ms,
+				bluez_response_cb func, void *user_data);
+
+/*
+ * Retries a call failing with one of the retry_on results, after an
+ * exponential backoff with random jitter. Each retry queues again in the
+ * call's class. Zero fields take the defaults in brackets.
+ */
+struct bluez_retry_policy {
+	guint32 retry_on;		/* BLUEZ_RETRY_ON() mask [transient] */
+	guint max_attempts;		/* including the first one [4] */
+	guint initial_delay_ms;		/* [200] */
+	guint max_delay_ms;		/* [10000] */
+	guint jitter;			/* percent taken off a delay [50] */
+	guint deadline_ms;		/* all attempts, 0 unbounded */
+};
+
+#define BLUEZ_RETRY_ON(ret)		(1u << (ret))
+#define BLUEZ_RETRY_TRANSIENT		(BLUEZ_RETRY_ON(BT_RESULT_IN_PROGRESS) | \
+					BLUEZ_RETRY_ON(BT_RESULT_NOT_READY) | \
+					BLUEZ_RETRY_ON(BT_RESULT_FAILED))
+
+/* A NULL policy makes a single attempt, see bluez_scheduler_call() */
+void bluez_scheduler_call_with_retry(struct bluez_scheduler *scheduler,
+				GDBusProxy *proxy, const gchar *name,
+				GVariant *parameter,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *policy,
+				bluez_response_cb func, void *user_data);
+
+/* 0 leaves a limit unchanged */
+BTResult bluez_scheduler_set_limits(struct bluez_scheduler *scheduler,
+				guint max_in_flight, guint max_per_adapter);
+
+void bluez_scheduler_get_stats(struct bluez_scheduler *scheduler,
+				struct bluez_scheduler_stats *stats);
+
+/* scheduler constructer */
+/* Deadlines and backoff run on timers shared with the manager */
+struct bluez_scheduler *bluez_scheduler_new(struct bluez_timers *timers);
+
+/*
+ * Completes queued calls with BT_RESULT_CANCELLED, replies of calls in
+ * flight are still delivered
+ */
+void bluez_scheduler_free(struct bluez_scheduler *scheduler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
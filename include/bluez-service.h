@@ -32,6 +32,9 @@ struct bluez_service;
 typedef void (*service_property_watch) (struct bluez_service *service,
 							gchar **prop_names);
 
+typedef void (*service_changed_notify) (struct bluez_service *service,
+				gchar **prop_names, gpointer user_data);
+
 void bluez_service_set_properties_watch(struct bluez_service *service,
 				service_property_watch func, gpointer user_data);
 
@@ -47,6 +50,11 @@ gchar *bluez_service_get_state(struct bluez_service *service);
 
 gchar *bluez_service_get_remote_uuid(struct bluez_service *service);
 
+const gchar *bluez_service_get_path(struct bluez_service *service);
+
+void bluez_service_set_changed_notify(struct bluez_service *service,
+			service_changed_notify func, gpointer user_data);
+
 struct bluez_service *bluez_service_new(GDBusObject *object);
 
 void bluez_service_free(struct bluez_service *service);
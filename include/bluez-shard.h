@@ -0,0 +1,84 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_SHARD_H__
+#define __BLUEZ_SHARD_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <glib.h>
+
+#include "bluez-common.h"
+#include "bluez-snapshot.h"
+
+struct bluez_manager;
+
+/*
+ * A shard set runs one manager per adapter, each with its own D-Bus
+ * connection, main context and thread, and only subscribed to the
+ * signals below its adapter's object path.
+ *
+ * Shard managers must only be used from their own thread, either from
+ * their callbacks or through bluez_shard_set_invoke(). The aggregated
+ * queries below work from any thread.
+ */
+struct bluez_shard_set;
+
+/* adapters: NULL terminated, "hci0" or "/org/bluez/hci0" */
+struct bluez_shard_set *bluez_shard_set_new(const gchar * const *adapters);
+
+void bluez_shard_set_free(struct bluez_shard_set *set);
+
+/* Fetch objects on all shards, configure watches before calling this */
+void bluez_shard_set_start(struct bluez_shard_set *set);
+
+guint bluez_shard_set_get_n_shards(struct bluez_shard_set *set);
+
+struct bluez_manager *bluez_shard_set_get_manager(struct bluez_shard_set *set,
+								guint index);
+
+void bluez_shard_set_invoke(struct bluez_shard_set *set, guint index,
+					GSourceFunc func, gpointer user_data);
+
+guint bluez_shard_set_get_n_devices(struct bluez_shard_set *set);
+
+/*
+ * Look up a device on all shards. Returns the referenced snapshot the
+ * device info points into, or NULL if not found.
+ */
+struct bluez_snapshot *bluez_shard_set_find_device(
+				struct bluez_shard_set *set,
+				const gchar *address,
+				const struct bluez_device_info **info,
+				guint *index);
+
+struct bluez_snapshot *bluez_shard_set_find_device_addr(
+				struct bluez_shard_set *set,
+				const bluez_addr_t *addr,
+				const struct bluez_device_info **info,
+				guint *index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
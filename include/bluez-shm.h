@@ -0,0 +1,105 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_SHM_H__
+#define __BLUEZ_SHM_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <glib.h>
+
+#include "bluez-common.h"
+
+/*
+ * One process publishes its device table in a sealed memfd, processes
+ * of the same user attach read-only by name and look devices up without
+ * talking to D-Bus. Both ends check the peer's user before handing out
+ * or trusting the descriptor. Records are protected by per slot
+ * sequence counters, readers retry instead of locking.
+ */
+struct bluez_shm_publisher;
+struct bluez_shm_reader;
+struct bluez_device;
+
+#define BLUEZ_SHM_CONNECTED	(1 << 0)
+#define BLUEZ_SHM_PAIRED	(1 << 1)
+#define BLUEZ_SHM_TRUSTED	(1 << 2)
+#define BLUEZ_SHM_BLOCKED	(1 << 3)
+
+struct bluez_shm_device {
+	guint8 address[6];
+	gint16 rssi;			/* BLUEZ_RSSI_UNKNOWN if not known */
+	guint32 flags;			/* BLUEZ_SHM_* */
+	guint64 generation;		/* manager generation of last update */
+	gchar adapter[16];		/* e.g. "hci0" */
+	gchar name[48];			/* truncated */
+};
+
+typedef void (*bluez_shm_device_cb) (const struct bluez_shm_device *device,
+							gpointer user_data);
+
+struct bluez_shm_reader *bluez_shm_reader_new(const gchar *name);
+
+void bluez_shm_reader_free(struct bluez_shm_reader *reader);
+
+guint bluez_shm_reader_get_n_devices(struct bluez_shm_reader *reader);
+
+/*
+ * Devices are keyed by adapter and address, e.g. "hci0". A NULL adapter
+ * returns the first record of the address on any adapter.
+ *
+ * Lookups return BT_RESULT_NOT_EXIST for unknown devices and
+ * BT_RESULT_TIMEOUT when the table stays mid-update, e.g. after the
+ * publisher died while writing it.
+ */
+BTResult bluez_shm_reader_lookup(struct bluez_shm_reader *reader,
+				const gchar *adapter, const gchar *address,
+				struct bluez_shm_device *device);
+
+BTResult bluez_shm_reader_lookup_addr(struct bluez_shm_reader *reader,
+				const gchar *adapter, const bluez_addr_t *addr,
+				struct bluez_shm_device *device);
+
+/* Calls func with a consistent copy of every device */
+BTResult bluez_shm_reader_foreach(struct bluez_shm_reader *reader,
+			bluez_shm_device_cb func, gpointer user_data,
+			guint *n_devices);
+
+/* publisher, driven by the manager */
+struct bluez_shm_publisher *bluez_shm_publisher_new(const gchar *name,
+				guint capacity, GMainContext *context);
+
+void bluez_shm_publisher_free(struct bluez_shm_publisher *publisher);
+
+void bluez_shm_publisher_update(struct bluez_shm_publisher *publisher,
+				struct bluez_device *device,
+				guint64 generation);
+
+void bluez_shm_publisher_remove(struct bluez_shm_publisher *publisher,
+				struct bluez_device *device,
+				guint64 generation);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
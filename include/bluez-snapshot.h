@@ -0,0 +1,119 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_SNAPSHOT_H__
+#define __BLUEZ_SNAPSHOT_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <glib.h>
+
+#include "bluez-common.h"
+
+/*
+ * A snapshot is an immutable, reference counted copy of the device table.
+ * The manager publishes a new one after the table changed, readers on
+ * any thread take a reference without locking and keep it as long as
+ * they like, the snapshot stays consistent until it is unreferenced.
+ */
+struct bluez_snapshot;
+struct bluez_snapshot_domain;
+
+struct bluez_device_info {
+	bluez_handle_t handle;
+	const gchar *path;
+	bluez_addr_t addr;
+	const gchar *address;
+	const gchar *name;
+	const gchar *alias;
+	gint16 rssi;			/* BLUEZ_RSSI_UNKNOWN if not known */
+	gboolean connected;
+	gboolean paired;
+	gboolean trusted;
+	gboolean blocked;
+};
+
+struct bluez_snapshot *bluez_snapshot_ref(struct bluez_snapshot *snapshot);
+
+void bluez_snapshot_unref(struct bluez_snapshot *snapshot);
+
+guint64 bluez_snapshot_get_version(struct bluez_snapshot *snapshot);
+
+guint bluez_snapshot_get_n_devices(struct bluez_snapshot *snapshot);
+
+const struct bluez_device_info *bluez_snapshot_get_device(
+			struct bluez_snapshot *snapshot, guint index);
+
+const struct bluez_device_info *bluez_snapshot_find_device(
+			struct bluez_snapshot *snapshot, const gchar *address);
+
+const struct bluez_device_info *bluez_snapshot_find_device_addr(
+			struct bluez_snapshot *snapshot, const bluez_addr_t *addr);
+
+/* snapshot constructer */
+struct bluez_snapshot *bluez_snapshot_new(guint64 version);
+
+typedef gboolean (*bluez_snapshot_keep_func) (
+				const struct bluez_device_info *info,
+				gpointer user_data);
+
+/*
+ * Starts from the records of a sealed base that keep returns TRUE for.
+ * They are shared with base, not copied, so a change costs the records
+ * added back on top rather than the whole table.
+ */
+struct bluez_snapshot *bluez_snapshot_new_from(struct bluez_snapshot *base,
+				guint64 version, bluez_snapshot_keep_func keep,
+				gpointer user_data);
+
+void bluez_snapshot_add_device(struct bluez_snapshot *snapshot,
+				const struct bluez_device_info *info);
+
+void bluez_snapshot_seal(struct bluez_snapshot *snapshot);
+
+/*
+ * Publication domain. Only one thread publishes, any thread acquires.
+ * Replaced snapshots are released once no reader can still be in the
+ * middle of picking them up: both epoch reader counters have drained.
+ */
+struct bluez_snapshot_domain *bluez_snapshot_domain_new(void);
+
+void bluez_snapshot_domain_free(struct bluez_snapshot_domain *domain);
+
+void bluez_snapshot_domain_publish(struct bluez_snapshot_domain *domain,
+					struct bluez_snapshot *snapshot);
+
+/*
+ * Drops the retired snapshots readers are done picking up, TRUE while
+ * some are left. Publishing reclaims too, call it again until it
+ * returns FALSE when no publish may follow for a while.
+ */
+gboolean bluez_snapshot_domain_reclaim(struct bluez_snapshot_domain *domain);
+
+struct bluez_snapshot *bluez_snapshot_domain_acquire(
+				struct bluez_snapshot_domain *domain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_UUID_H__
+#define __BLUEZ_UUID_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <glib.h>
+
+#include "bluez-common.h"
+
+/*
+ * UUIDs in binary form. Values on the Bluetooth base UUID
+ * (0000xxxx-0000-1000-8000-00805F9B34FB) are kept in their 16 or 32-bit
+ * short form, so equal UUIDs always have equal representations.
+ */
+enum bluez_uuid_type {
+	BLUEZ_UUID_16 = 16,
+	BLUEZ_UUID_32 = 32,
+	BLUEZ_UUID_128 = 128,
+};
+
+typedef struct {
+	enum bluez_uuid_type type;
+	union {
+		guint16 u16;
+		guint32 u32;
+		guint8 u128[16];		/* big endian, as printed */
+	} value;
+} bluez_uuid_t;
+
+/* 36 characters and the terminating NUL */
+#define BLUEZ_UUID_STRLEN 37
+
+void bluez_uuid_from_16(bluez_uuid_t *uuid, guint16 value);
+
+/* Accepts the 128-bit form as well as 16 and 32-bit hex, "0x" optional */
+gboolean bluez_uuid_parse(const gchar *str, bluez_uuid_t *uuid);
+
+/* Always writes the full 128-bit form */
+void bluez_uuid_to_string(const bluez_uuid_t *uuid,
+					gchar str[BLUEZ_UUID_STRLEN]);
+
+gint bluez_uuid_compare(const bluez_uuid_t *a, const bluez_uuid_t *b);
+
+gboolean bluez_uuid_equal(gconstpointer a, gconstpointer b);
+
+guint bluez_uuid_hash(gconstpointer uuid);
+
+/*
+ * Compact UUID set: one bit per well-known 16-bit service (audio, HID,
+ * PAN, the common GATT services...) and a sorted array for the rest.
+ */
+struct bluez_uuid_set {
+	guint64 well_known;
+	guint n_others;
+	bluez_uuid_t *others;
+};
+
+void bluez_uuid_set_init(struct bluez_uuid_set *set);
+
+void bluez_uuid_set_clear(struct bluez_uuid_set *set);
+
+/* Replaces the content of set with the parsable entries of strv */
+void bluez_uuid_set_parse(struct bluez_uuid_set *set, gchar **strv);
+
+void bluez_uuid_set_copy(struct bluez_uuid_set *dest,
+				const struct bluez_uuid_set *src);
+
+gboolean bluez_uuid_set_contains(const struct bluez_uuid_set *set,
+					const bluez_uuid_t *uuid);
+
+guint bluez_uuid_set_size(const struct bluez_uuid_set *set);
+
+/* Calls func for each member, well-known ones first */
+void bluez_uuid_set_foreach(const struct bluez_uuid_set *set,
+		void (*func) (const bluez_uuid_t *uuid, gpointer user_data),
+		gpointer user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,15 +23,42 @@
 #include "bluez-common.h"
 #include "bluez-device.h"
 #include "bluez-adapter.h"
+#include "bluez-pool.h"
 
 struct bluez_adapter {
+	GDBusObject *object;
 	GDBusProxy *adapter_proxy;
 	GDBusProxy *properties_proxy;
 
 	adapter_property_watch property_func;
 	gpointer property_data;
+
+	/* Library internal watch, e.g. the owning manager */
+	adapter_changed_notify changed_func;
+	gpointer changed_data;
+
+	struct bluez_scheduler *scheduler;	/* NULL calls directly */
+
+	struct bluez_uuid_set uuid_set;		/* parsed on demand */
+	gboolean uuid_set_valid;
 };
 
+static struct bluez_pool adapter_pool = BLUEZ_POOL_INIT("adapter",
+					sizeof(struct bluez_adapter), 64);
+
+void bluez_adapter_set_changed_notify(struct bluez_adapter *adapter,
+			adapter_changed_notify func, gpointer user_data)
+{
+	adapter->changed_func = func;
+	adapter->changed_data = user_data;
+}
+
+void bluez_adapter_set_scheduler(struct bluez_adapter *adapter,
+				struct bluez_scheduler *scheduler)
+{
+	adapter->scheduler = scheduler;
+}
+
 void bluez_adapter_set_properties_watch(struct bluez_adapter *adapter,
 				adapter_property_watch func, gpointer user_data)
 {
@@ -49,6 +76,119 @@ BTResult bluez_adapter_stop_discovery(struct bluez_adapter *adapter)
 	return proxy_method_call(adapter->adapter_proxy, "StopDiscovery", NULL);
 }
 
+void bluez_adapter_start_discovery_with_reply(struct bluez_adapter *adapter,
+				enum bluez_call_class klass,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *user_data)
+{
+	bluez_scheduler_call_with_retry(adapter->scheduler,
+				adapter->adapter_proxy, "StartDiscovery", NULL,
+				klass, 0, retry, cb, user_data);
+}
+
+void bluez_adapter_stop_discovery_with_reply(struct bluez_adapter *adapter,
+				enum bluez_call_class klass,
+				bluez_response_cb cb, void *user_data)
+{
+	bluez_scheduler_call(adapter->scheduler, adapter->adapter_proxy,
+			"StopDiscovery", NULL, klass, 0, cb, user_data);
+}
+
+static GVariant *discovery_filter_parameter(
+				const struct bluez_discovery_filter *filter)
+{
+	static const gchar *transports[] = { NULL, "bredr", "le" };
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+	if (filter == NULL)
+		return g_variant_new("(a{sv})", &builder);
+
+	if (filter->uuids)
+		g_variant_builder_add(&builder, "{sv}", "UUIDs",
+				g_variant_new_strv(filter->uuids, -1));
+
+	if (filter->rssi)
+		g_variant_builder_add(&builder, "{sv}", "RSSI",
+				g_variant_new_int16(filter->rssi));
+	else if (filter->pathloss)
+		g_variant_builder_add(&builder, "{sv}", "Pathloss",
+				g_variant_new_uint16(filter->pathloss));
+
+	if (filter->transport == BLUEZ_TRANSPORT_BREDR ||
+				filter->transport == BLUEZ_TRANSPORT_LE)
+		g_variant_builder_add(&builder, "{sv}", "Transport",
+			g_variant_new_string(transports[filter->transport]));
+
+	if (filter->filter_duplicates)
+		g_variant_builder_add(&builder, "{sv}", "DuplicateData",
+				g_variant_new_boolean(FALSE));
+
+	if (filter->pattern)
+		g_variant_builder_add(&builder, "{sv}", "Pattern",
+				g_variant_new_string(filter->pattern));
+
+	return g_variant_new("(a{sv})", &builder);
+}
+
+BTResult bluez_adapter_set_discovery_filter(struct bluez_adapter *adapter,
+				const struct bluez_discovery_filter *filter)
+{
+	return proxy_method_call(adapter->adapter_proxy, "SetDiscoveryFilter",
+					discovery_filter_parameter(filter));
+}
+
+void bluez_adapter_set_discovery_filter_with_reply(
+				struct bluez_adapter *adapter,
+				const struct bluez_discovery_filter *filter,
+				enum bluez_call_class klass,
+				bluez_response_cb cb, void *user_data)
+{
+	bluez_scheduler_call(adapter->scheduler, adapter->adapter_proxy,
+			"SetDiscoveryFilter", discovery_filter_parameter(filter),
+			klass, 0, cb, user_data);
+}
+
+void bluez_adapter_register_monitor_with_reply(struct bluez_adapter *adapter,
+				const gchar *app_path,
+				bluez_response_cb cb, void *user_data)
+{
+	GDBusInterface *interface;
+
+	interface = g_dbus_object_get_interface(adapter->object,
+						MONITOR_MANAGER_INTERFACE);
+	if (interface == NULL) {
+		if (cb)
+			cb(BT_RESULT_NOT_SUPPORTED, NULL, user_data);
+		return;
+	}
+
+	/* BlueZ fetches the monitors before it replies, never block here */
+	bluez_scheduler_call(adapter->scheduler, G_DBUS_PROXY(interface),
+			"RegisterMonitor", g_variant_new("(o)", app_path),
+			BLUEZ_CALL_NORMAL, 0, cb, user_data);
+
+	g_object_unref(interface);
+}
+
+void bluez_adapter_unregister_monitor(struct bluez_adapter *adapter,
+						const gchar *app_path)
+{
+	GDBusInterface *interface;
+
+	interface = g_dbus_object_get_interface(adapter->object,
+						MONITOR_MANAGER_INTERFACE);
+	if (interface == NULL)
+		return;
+
+	bluez_scheduler_call(adapter->scheduler, G_DBUS_PROXY(interface),
+			"UnregisterMonitor", g_variant_new("(o)", app_path),
+			BLUEZ_CALL_NORMAL, 0, NULL, NULL);
+
+	g_object_unref(interface);
+}
+
 gchar **bluez_adapter_get_property_names(struct bluez_adapter *adapter)
 {
 	return g_dbus_proxy_get_cached_property_names(adapter->adapter_proxy);
@@ -67,6 +207,19 @@ BTResult bluez_adapter_remove_device(struct bluez_adapter *adapter,
 	return proxy_method_call(adapter->adapter_proxy, "RemoveDevice", parameter);
 }
 
+void bluez_adapter_remove_device_with_reply(struct bluez_adapter *adapter,
+				const gchar *device_path,
+				enum bluez_call_class klass,
+				bluez_response_cb cb, void *user_data)
+{
+	GVariant *parameter;
+
+	parameter = g_variant_new("(o)", device_path);
+
+	bluez_scheduler_call(adapter->scheduler, adapter->adapter_proxy,
+			"RemoveDevice", parameter, klass, 0, cb, user_data);
+}
+
 BTResult bluez_adapter_set_powered(struct bluez_adapter *adapter, gboolean powered)
 {
 	GVariant *value = g_variant_new("b", powered);
@@ -101,6 +254,20 @@ gchar *bluez_adapter_get_address(struct bluez_adapter *adapter)
 	return property_get_string(adapter->adapter_proxy, "Address");
 }
 
+gboolean bluez_adapter_get_addr(struct bluez_adapter *adapter,
+						bluez_addr_t *addr)
+{
+	if (!bluez_addr_parse(property_peek_string(adapter->adapter_proxy,
+							"Address"), addr))
+		return FALSE;
+
+	if (!g_strcmp0(property_peek_string(adapter->adapter_proxy,
+						"AddressType"), "random"))
+		addr->type = BLUEZ_ADDR_RANDOM;
+
+	return TRUE;
+}
+
 void bluez_adapter_get_class(struct bluez_adapter *adapter, guint32 *class)
 {
 	property_get_uint32(adapter->adapter_proxy, "Class", class);
@@ -173,31 +340,57 @@ gchar **bluez_adapter_get_uuids(struct bluez_adapter *adapter)
 	return property_get_strings(adapter->adapter_proxy, "UUIDs");
 }
 
+gboolean bluez_adapter_has_uuid(struct bluez_adapter *adapter,
+					const bluez_uuid_t *uuid)
+{
+	gchar **uuids;
+
+	if (adapter == NULL || uuid == NULL || adapter->adapter_proxy == NULL)
+		return FALSE;
+
+	if (!adapter->uuid_set_valid) {
+		uuids = property_get_interned_strings(adapter->adapter_proxy,
+								"UUIDs");
+		bluez_uuid_set_parse(&adapter->uuid_set, uuids);
+		bluez_intern_strv_free(uuids);
+
+		adapter->uuid_set_valid = TRUE;
+	}
+
+	return bluez_uuid_set_contains(&adapter->uuid_set, uuid);
+}
+
+static void drop_uuid_set(struct bluez_adapter *adapter)
+{
+	bluez_uuid_set_clear(&adapter->uuid_set);
+	adapter->uuid_set_valid = FALSE;
+}
+
+const gchar *bluez_adapter_get_path(struct bluez_adapter *adapter)
+{
+	return g_dbus_proxy_get_object_path(adapter->adapter_proxy);
+}
+
 static void adapter_properties_changed(GDBusProxy *proxy,
 					GVariant *changed_properties,
 					GStrv *invalidated_properties,
 					gpointer user_data)
 {
 	struct bluez_adapter *adapter = (struct bluez_adapter *) user_data;
-	GVariantIter iter;
-	gchar *key;
-	GPtrArray *p;
 	gchar **prop_names;
 
-	p = g_ptr_array_new();
+	prop_names = bluez_intern_property_names(changed_properties);
 
-	g_variant_iter_init(&iter, changed_properties);
-	while (g_variant_iter_next(&iter, "{sv}", &key, NULL))
-		g_ptr_array_add(p, key);
+	if (bluez_property_mask(prop_names) & BLUEZ_PROPERTY_UUIDS)
+		drop_uuid_set(adapter);
 
-	g_ptr_array_add(p, NULL);
-
-	prop_names = (gchar **) g_ptr_array_free(p, FALSE);
+	if (adapter->changed_func)
+		adapter->changed_func(adapter, prop_names, adapter->changed_data);
 
 	if (adapter->property_func)
 		adapter->property_func(adapter, prop_names);
 
-	g_strfreev(prop_names);
+	bluez_intern_strv_free(prop_names);
 }
 
 static void adapter_interface_added(GDBusObject *object,
@@ -209,10 +402,14 @@ static void adapter_interface_added(GDBusObject *object,
 
 	name = g_dbus_proxy_get_interface_name(proxy);
 	if (g_strcmp0(name, ADAPTER_INTERFACE) == 0) {
-		if (adapter->adapter_proxy)
+		if (adapter->adapter_proxy) {
+			g_signal_handlers_disconnect_by_data(adapter->adapter_proxy,
+								adapter);
 			g_object_unref(adapter->adapter_proxy);
+		}
 
 		adapter->adapter_proxy = g_object_ref(proxy);
+		drop_uuid_set(adapter);
 
 		/* connect signal */
 		g_signal_connect(adapter->adapter_proxy, "g-properties-changed",
@@ -235,8 +432,11 @@ static void adapter_interface_removed(GDBusObject *object,
 	name = g_dbus_proxy_get_interface_name(proxy);
 	if (g_strcmp0(name, ADAPTER_INTERFACE) == 0) {
 		if (adapter->adapter_proxy) {
+			g_signal_handlers_disconnect_by_data(adapter->adapter_proxy,
+								adapter);
 			g_object_unref(adapter->adapter_proxy);
 			adapter->adapter_proxy = NULL;
+			drop_uuid_set(adapter);
 		}
 	} else if (g_strcmp0(name, PROPERTIES_INTERFACE) == 0) {
 		if (adapter->properties_proxy) {
@@ -252,7 +452,7 @@ struct bluez_adapter *bluez_adapter_new(GDBusObject *object)
 	GDBusInterface *interface;
 	GDBusProxy *proxy;
 
-	adapter = g_try_new0(struct bluez_adapter, 1);
+	adapter = bluez_pool_alloc0(&adapter_pool);
 	if (!adapter)
 		return NULL;
 
@@ -270,6 +470,7 @@ struct bluez_adapter *bluez_adapter_new(GDBusObject *object)
 	g_signal_connect(adapter->adapter_proxy, "g-properties-changed",
 			G_CALLBACK(adapter_properties_changed), adapter);
 
+	adapter->object = g_object_ref(object);
 	g_signal_connect(object, "interface-added",
 			G_CALLBACK(adapter_interface_added), adapter);
 	g_signal_connect(object, "interface-removed",
@@ -283,10 +484,20 @@ void bluez_adapter_free(struct bluez_adapter *adapter)
 	if (!adapter)
 		return;
 
-	if (adapter->adapter_proxy)
+	/* The object and proxies may outlive us, stop their callbacks */
+	if (adapter->object) {
+		g_signal_handlers_disconnect_by_data(adapter->object, adapter);
+		g_object_unref(adapter->object);
+	}
+
+	if (adapter->adapter_proxy) {
+		g_signal_handlers_disconnect_by_data(adapter->adapter_proxy, adapter);
 		g_object_unref(adapter->adapter_proxy);
+	}
 	if (adapter->properties_proxy)
 		g_object_unref(adapter->properties_proxy);
 
-	g_free(adapter);
+	drop_uuid_set(adapter);
+
+	bluez_pool_free(&adapter_pool, adapter);
 }
@@ -0,0 +1,323 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-adv.h"
+#include "bluez-device.h"
+#include "bluez-timer.h"
+
+#define DEFAULT_BATCH_SIZE		64
+#define DEFAULT_MAX_LATENCY_MS		100
+#define DEFAULT_DEDUP_WINDOW_MS		1000
+
+/*
+ * Direct mapped, a colliding record evicts the older one. Evictions
+ * only let a duplicate through, a record is never wrongly suppressed
+ * short of a 64-bit hash collision.
+ */
+#define DEDUP_SLOTS			4096
+
+/* Entries per data property looked at, advertisements rarely carry two */
+#define MAX_ENTRIES			8
+
+#define FNV_OFFSET			G_GUINT64_CONSTANT(0xcbf29ce484222325)
+#define FNV_PRIME			G_GUINT64_CONSTANT(0x100000001b3)
+
+/* RSSI or TX power alone would only repeat the data already reported */
+#define WATCHED_PROPERTIES	(BLUEZ_PROPERTY_MANUFACTURER_DATA | \
+				BLUEZ_PROPERTY_SERVICE_DATA)
+
+struct dedup_slot {
+	guint64 key;
+	gint64 time;				/* monotonic, usec */
+};
+
+struct bluez_adv_reporter {
+	gint ref_count;
+	gboolean closed;
+	struct bluez_manager *manager;
+	struct bluez_timers *timers;
+	bluez_adv_report_cb func;
+	gpointer user_data;
+	struct bluez_adv_report_options options;
+
+	/* Filled while the other one is being delivered */
+	struct bluez_adv_report *batch;
+	struct bluez_adv_report *spare;
+	guint n_batch;
+	struct bluez_timer *flush_timer;
+
+	struct dedup_slot dedup[DEDUP_SLOTS];
+
+	struct bluez_adv_report_stats stats;
+};
+
+static void reporter_unref(struct bluez_adv_reporter *reporter)
+{
+	if (--reporter->ref_count > 0)
+		return;
+
+	g_free(reporter->batch);
+	g_free(reporter->spare);
+	g_free(reporter);
+}
+
+static guint64 fnv_add(guint64 hash, const guint8 *data, gsize len)
+{
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+/* Over the fields identifying the advertisement, RSSI aside */
+static guint64 report_key(const struct bluez_adv_report *report)
+{
+	guint64 hash = FNV_OFFSET;
+	guint8 head[4];
+
+	hash = fnv_add(hash, report->addr.b, sizeof(report->addr.b));
+
+	head[0] = report->type;
+	head[1] = report->len;
+
+	if (report->type == BLUEZ_ADV_MANUFACTURER_DATA) {
+		head[2] = report->company & 0xff;
+		head[3] = report->company >> 8;
+		hash = fnv_add(hash, head, 4);
+	} else {
+		head[2] = report->uuid.type;
+		hash = fnv_add(hash, head, 3);
+
+		switch (report->uuid.type) {
+		case BLUEZ_UUID_16:
+			hash = fnv_add(hash,
+				(const guint8 *) &report->uuid.value.u16, 2);
+			break;
+		case BLUEZ_UUID_32:
+			hash = fnv_add(hash,
+				(const guint8 *) &report->uuid.value.u32, 4);
+			break;
+		case BLUEZ_UUID_128:
+			hash = fnv_add(hash, report->uuid.value.u128, 16);
+			break;
+		}
+	}
+
+	return fnv_add(hash, report->data, report->len);
+}
+
+static gboolean is_duplicate(struct bluez_adv_reporter *reporter,
+				const struct bluez_adv_report *report)
+{
+	struct dedup_slot *slot;
+	guint64 key;
+
+	key = report_key(report);
+	slot = &reporter->dedup[key & (DEDUP_SLOTS - 1)];
+
+	/* Not refreshed, a steady advertiser is reported once per window */
+	if (slot->key == key && report->time - slot->time <
+		(gint64) reporter->options.dedup_window_ms * 1000)
+		return TRUE;
+
+	slot->key = key;
+	slot->time = report->time;
+
+	return FALSE;
+}
+
+static void flush(struct bluez_adv_reporter *reporter)
+{
+	struct bluez_adv_report *reports;
+	guint n;
+
+	bluez_timers_cancel(reporter->timers, reporter->flush_timer);
+	reporter->flush_timer = NULL;
+
+	if (reporter->n_batch == 0)
+		return;
+
+	reports = reporter->batch;
+	n = reporter->n_batch;
+
+	reporter->batch = reporter->spare;
+	reporter->spare = reports;
+	reporter->n_batch = 0;
+
+	reporter->stats.reported += n;
+	reporter->stats.batches++;
+
+	reporter->ref_count++;
+	reporter->func(reporter->manager, reports, n, reporter->user_data);
+	reporter_unref(reporter);
+}
+
+static void flush_timeout(gpointer user_data)
+{
+	struct bluez_adv_reporter *reporter = user_data;
+
+	reporter->flush_timer = NULL;
+	flush(reporter);
+}
+
+static void add_report(struct bluez_adv_reporter *reporter,
+				struct bluez_adv_report *report,
+				const struct bluez_bytes *view)
+{
+	reporter->stats.received++;
+
+	report->len = MIN(view->len, BLUEZ_ADV_DATA_MAX);
+	report->truncated = view->len > BLUEZ_ADV_DATA_MAX;
+	memcpy(report->data, view->data, report->len);
+	memset(report->data + report->len, 0,
+				BLUEZ_ADV_DATA_MAX - report->len);
+
+	if (!reporter->options.keep_duplicates &&
+					is_duplicate(reporter, report)) {
+		reporter->stats.suppressed++;
+		return;
+	}
+
+	reporter->batch[reporter->n_batch++] = *report;
+
+	if (reporter->n_batch >= reporter->options.batch_size)
+		flush(reporter);
+	else if (reporter->flush_timer == NULL)
+		reporter->flush_timer = bluez_timers_add(reporter->timers,
+					reporter->options.max_latency_ms,
+					flush_timeout, reporter);
+}
+
+void bluez_adv_reporter_device_changed(struct bluez_adv_reporter *reporter,
+				struct bluez_device *device,
+				guint32 properties)
+{
+	struct bluez_bytes views[MAX_ENTRIES];
+	guint16 companies[MAX_ENTRIES];
+	bluez_uuid_t uuids[MAX_ENTRIES];
+	struct bluez_adv_report report;
+	guint i, n;
+
+	if (!(properties & WATCHED_PROPERTIES))
+		return;
+
+	memset(&report, 0, sizeof(report));
+	report.time = g_get_monotonic_time();
+	report.handle = bluez_device_get_handle(device);
+	report.addr = *bluez_device_get_addr(device);
+	report.rssi = BLUEZ_ADV_POWER_UNKNOWN;
+	bluez_device_get_rssi(device, &report.rssi);
+	if (!bluez_device_get_tx_power(device, &report.tx_power))
+		report.tx_power = BLUEZ_ADV_POWER_UNKNOWN;
+
+	/* Flushing runs the callback, which may stop reporting */
+	reporter->ref_count++;
+
+	if (properties & BLUEZ_PROPERTY_MANUFACTURER_DATA) {
+		n = bluez_device_peek_manufacturer_data(device, companies,
+							views, MAX_ENTRIES);
+		report.type = BLUEZ_ADV_MANUFACTURER_DATA;
+		for (i = 0; i < MIN(n, MAX_ENTRIES) && !reporter->closed; i++) {
+			report.company = companies[i];
+			add_report(reporter, &report, &views[i]);
+		}
+
+		report.company = 0;
+	}
+
+	if (properties & BLUEZ_PROPERTY_SERVICE_DATA && !reporter->closed) {
+		n = bluez_device_peek_service_data(device, uuids, views,
+								MAX_ENTRIES);
+		report.type = BLUEZ_ADV_SERVICE_DATA;
+		for (i = 0; i < MIN(n, MAX_ENTRIES) && !reporter->closed; i++) {
+			report.uuid = uuids[i];
+			add_report(reporter, &report, &views[i]);
+		}
+	}
+
+	reporter_unref(reporter);
+}
+
+void bluez_adv_reporter_get_stats(struct bluez_adv_reporter *reporter,
+				struct bluez_adv_report_stats *stats)
+{
+	*stats = reporter->stats;
+}
+
+struct bluez_adv_reporter *bluez_adv_reporter_new(
+				struct bluez_manager *manager,
+				const struct bluez_adv_report_options *options,
+				bluez_adv_report_cb func, gpointer user_data,
+				struct bluez_timers *timers)
+{
+	struct bluez_adv_reporter *reporter;
+
+	reporter = g_try_new0(struct bluez_adv_reporter, 1);
+	if (!reporter)
+		return NULL;
+
+	reporter->ref_count = 1;
+	reporter->manager = manager;
+	reporter->timers = timers;
+	reporter->func = func;
+	reporter->user_data = user_data;
+
+	if (options)
+		reporter->options = *options;
+	if (reporter->options.batch_size == 0)
+		reporter->options.batch_size = DEFAULT_BATCH_SIZE;
+	if (reporter->options.max_latency_ms == 0)
+		reporter->options.max_latency_ms = DEFAULT_MAX_LATENCY_MS;
+	if (reporter->options.dedup_window_ms == 0)
+		reporter->options.dedup_window_ms = DEFAULT_DEDUP_WINDOW_MS;
+
+	reporter->batch = g_try_new(struct bluez_adv_report,
+					reporter->options.batch_size);
+	reporter->spare = g_try_new(struct bluez_adv_report,
+					reporter->options.batch_size);
+	if (!reporter->batch || !reporter->spare) {
+		reporter_unref(reporter);
+		return NULL;
+	}
+
+	return reporter;
+}
+
+void bluez_adv_reporter_free(struct bluez_adv_reporter *reporter,
+							gboolean flush_pending)
+{
+	if (!reporter)
+		return;
+
+	if (flush_pending && !reporter->closed)
+		flush(reporter);
+
+	bluez_timers_cancel(reporter->timers, reporter->flush_timer);
+	reporter->flush_timer = NULL;
+
+	reporter->closed = TRUE;
+	reporter_unref(reporter);
+}
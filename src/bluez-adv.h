@@ -0,0 +1,54 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_ADV_H__
+#define __BLUEZ_ADV_H__
+
+#include <glib.h>
+
+#include "bluez-manager.h"
+
+/*
+ * Turns device property changes into advertisement report batches.
+ * Duplicates are spotted in a fixed hash table of recent records and
+ * batches are preallocated, only arming the flush timer and walking the
+ * cached data variants allocate per change.
+ */
+struct bluez_adv_reporter;
+struct bluez_timers;
+
+struct bluez_adv_reporter *bluez_adv_reporter_new(
+				struct bluez_manager *manager,
+				const struct bluez_adv_report_options *options,
+				bluez_adv_report_cb func, gpointer user_data,
+				struct bluez_timers *timers);
+
+/* flush_pending delivers the pending batch first */
+void bluez_adv_reporter_free(struct bluez_adv_reporter *reporter,
+							gboolean flush_pending);
+
+/* properties is a BLUEZ_PROPERTY_* mask */
+void bluez_adv_reporter_device_changed(struct bluez_adv_reporter *reporter,
+				struct bluez_device *device,
+				guint32 properties);
+
+void bluez_adv_reporter_get_stats(struct bluez_adv_reporter *reporter,
+				struct bluez_adv_report_stats *stats);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-beacon.h"
+
+#define IBEACON_TYPE		0x02
+#define IBEACON_LEN		0x15
+
+static guint16 get_be16(const guint8 *data)
+{
+	return (data[0] << 8) | data[1];
+}
+
+static guint32 get_be32(const guint8 *data)
+{
+	return ((guint32) data[0] << 24) | (data[1] << 16) |
+						(data[2] << 8) | data[3];
+}
+
+gboolean bluez_beacon_parse_ibeacon(const guint8 *data, gsize len,
+					struct bluez_ibeacon *beacon)
+{
+	if (data == NULL || len < 2 + IBEACON_LEN ||
+			data[0] != IBEACON_TYPE || data[1] != IBEACON_LEN)
+		return FALSE;
+
+	memcpy(beacon->uuid, data + 2, sizeof(beacon->uuid));
+	beacon->major = get_be16(data + 18);
+	beacon->minor = get_be16(data + 20);
+	beacon->measured_power = (gint8) data[22];
+
+	return TRUE;
+}
+
+static const gchar *url_schemes[] = {
+	"http://www.",
+	"https://www.",
+	"http://",
+	"https://",
+};
+
+static const gchar *url_expansions[] = {
+	".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/",
+	".com", ".org", ".edu", ".net", ".info", ".biz", ".gov",
+};
+
+static gboolean decode_url(const guint8 *data, gsize len, gchar *url)
+{
+	gchar *end = url;
+	gsize i;
+
+	if (len < 1 || data[0] >= G_N_ELEMENTS(url_schemes) || len > 18)
+		return FALSE;
+
+	end = g_stpcpy(end, url_schemes[data[0]]);
+
+	for (i = 1; i < len; i++) {
+		if (data[i] < G_N_ELEMENTS(url_expansions))
+			end = g_stpcpy(end, url_expansions[data[i]]);
+		else if (data[i] > 0x20 && data[i] < 0x7f)
+			*end++ = data[i];
+		else
+			return FALSE;
+	}
+
+	*end = '\0';
+
+	return TRUE;
+}
+
+gboolean bluez_beacon_parse_eddystone(const guint8 *data, gsize len,
+					struct bluez_eddystone *beacon)
+{
+	if (data == NULL || len < 2)
+		return FALSE;
+
+	beacon->frame = data[0];
+	beacon->tx_power = (gint8) data[1];
+
+	switch (data[0]) {
+	case BLUEZ_EDDYSTONE_UID:
+		if (len < 18)
+			return FALSE;
+
+		memcpy(beacon->value.uid.namespace_id, data + 2, 10);
+		memcpy(beacon->value.uid.instance_id, data + 12, 6);
+		return TRUE;
+	case BLUEZ_EDDYSTONE_URL:
+		return decode_url(data + 2, len - 2, beacon->value.url);
+	case BLUEZ_EDDYSTONE_TLM:
+		/* Version 0 is plain, version 1 encrypted */
+		if (len < 14 || data[1] != 0x00)
+			return FALSE;
+
+		beacon->tx_power = 0;
+		beacon->value.tlm.battery = get_be16(data + 2);
+		beacon->value.tlm.temperature = (gint16) get_be16(data + 4);
+		beacon->value.tlm.adv_count = get_be32(data + 6);
+		beacon->value.tlm.uptime = get_be32(data + 10);
+		return TRUE;
+	case BLUEZ_EDDYSTONE_EID:
+		if (len < 10)
+			return FALSE;
+
+		memcpy(beacon->value.eid, data + 2, 8);
+		return TRUE;
+	}
+
+	return FALSE;
+}
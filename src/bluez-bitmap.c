@@ -0,0 +1,85 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-bitmap.h"
+
+void bluez_bitmap_init(struct bluez_bitmap *bitmap)
+{
+	bitmap->words = NULL;
+	bitmap->n_words = 0;
+}
+
+void bluez_bitmap_clear(struct bluez_bitmap *bitmap)
+{
+	g_free(bitmap->words);
+	bluez_bitmap_init(bitmap);
+}
+
+void bluez_bitmap_set(struct bluez_bitmap *bitmap, guint bit, gboolean value)
+{
+	guint n = bit / BLUEZ_BITMAP_WORD_BITS;
+	guint64 mask = G_GUINT64_CONSTANT(1) << (bit % BLUEZ_BITMAP_WORD_BITS);
+	guint n_words;
+
+	if (n >= bitmap->n_words) {
+		if (!value)
+			return;
+
+		n_words = MAX(n + 1, bitmap->n_words * 2);
+		bitmap->words = g_renew(guint64, bitmap->words, n_words);
+		memset(bitmap->words + bitmap->n_words, 0,
+			(n_words - bitmap->n_words) * sizeof(guint64));
+		bitmap->n_words = n_words;
+	}
+
+	if (value)
+		bitmap->words[n] |= mask;
+	else
+		bitmap->words[n] &= ~mask;
+}
+
+gboolean bluez_bitmap_test(const struct bluez_bitmap *bitmap, guint bit)
+{
+	guint n = bit / BLUEZ_BITMAP_WORD_BITS;
+
+	if (n >= bitmap->n_words)
+		return FALSE;
+
+	return (bitmap->words[n] >> (bit % BLUEZ_BITMAP_WORD_BITS)) & 1;
+}
+
+guint64 bluez_bitmap_word(const struct bluez_bitmap *bitmap, guint n)
+{
+	return n < bitmap->n_words ? bitmap->words[n] : 0;
+}
+
+gboolean bluez_bitmap_is_empty(const struct bluez_bitmap *bitmap)
+{
+	guint i;
+
+	for (i = 0; i < bitmap->n_words; i++) {
+		if (bitmap->words[i])
+			return FALSE;
+	}
+
+	return TRUE;
+}
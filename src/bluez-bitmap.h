@@ -0,0 +1,46 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_BITMAP_H__
+#define __BLUEZ_BITMAP_H__
+
+#include <glib.h>
+
+/* Growable bit set over device slot indexes */
+struct bluez_bitmap {
+	guint64 *words;
+	guint n_words;
+};
+
+#define BLUEZ_BITMAP_WORD_BITS 64
+
+void bluez_bitmap_init(struct bluez_bitmap *bitmap);
+
+void bluez_bitmap_clear(struct bluez_bitmap *bitmap);
+
+void bluez_bitmap_set(struct bluez_bitmap *bitmap, guint bit, gboolean value);
+
+gboolean bluez_bitmap_test(const struct bluez_bitmap *bitmap, guint bit);
+
+/* Word n, all zero beyond the end */
+guint64 bluez_bitmap_word(const struct bluez_bitmap *bitmap, guint n);
+
+gboolean bluez_bitmap_is_empty(const struct bluez_bitmap *bitmap);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <glib.h>
+
+#include "bluez-changelog.h"
+
+struct change_record {
+	guint64 generation;
+	enum bluez_change_type type;
+	enum bluez_object_type object;
+	guint32 properties;
+	bluez_handle_t handle;
+	const gchar *path;			/* interned */
+};
+
+struct bluez_change_log {
+	guint64 generation;			/* stamp of the last mutation */
+	guint64 dropped_generation;		/* newest overwritten record */
+	struct change_record *records;
+	guint size;
+	guint first;
+	guint len;
+};
+
+struct bluez_change_log *bluez_change_log_new(guint size)
+{
+	struct bluez_change_log *log;
+
+	log = g_new0(struct bluez_change_log, 1);
+
+	log->records = g_try_new0(struct change_record, size);
+	if (log->records)
+		log->size = size;
+
+	return log;
+}
+
+static struct change_record *change_at(struct bluez_change_log *log,
+								guint index)
+{
+	return &log->records[(log->first + index) % log->size];
+}
+
+static void clear_changes(struct bluez_change_log *log)
+{
+	guint i;
+
+	for (i = 0; i < log->len; i++)
+		bluez_intern_unref(change_at(log, i)->path);
+
+	log->first = 0;
+	log->len = 0;
+}
+
+void bluez_change_log_free(struct bluez_change_log *log)
+{
+	if (!log)
+		return;
+
+	clear_changes(log);
+	g_free(log->records);
+	g_free(log);
+}
+
+guint64 bluez_change_log_append(struct bluez_change_log *log,
+				enum bluez_change_type type,
+				enum bluez_object_type object,
+				bluez_handle_t handle,
+				const gchar *path, guint32 properties)
+{
+	struct change_record *record;
+
+	log->generation++;
+
+	if (log->size == 0) {
+		log->dropped_generation = log->generation;
+		return log->generation;
+	}
+
+	if (log->len > 0) {
+		record = change_at(log, log->len - 1);
+
+		/*
+		 * Fold bursts on one object into its latest record, it stays
+		 * the newest one so the log remains sorted by generation.
+		 */
+		if (type == BLUEZ_CHANGE_PROPERTIES && record->type == type &&
+					!g_strcmp0(record->path, path)) {
+			record->generation = log->generation;
+			record->properties |= properties;
+			return log->generation;
+		}
+	}
+
+	if (log->len == log->size) {
+		record = change_at(log, 0);
+		log->dropped_generation = record->generation;
+		bluez_intern_unref(record->path);
+
+		log->first = (log->first + 1) % log->size;
+		log->len--;
+	}
+
+	record = change_at(log, log->len++);
+	record->generation = log->generation;
+	record->type = type;
+	record->object = object;
+	record->properties = properties;
+	record->handle = handle;
+	record->path = bluez_intern(path);
+
+	return log->generation;
+}
+
+guint64 bluez_change_log_get_generation(struct bluez_change_log *log)
+{
+	return log->generation;
+}
+
+BTResult bluez_change_log_since(struct bluez_change_log *log,
+				guint64 generation,
+				struct bluez_change *changes,
+				guint max_changes, guint *n_changes)
+{
+	struct change_record *record;
+	guint low, high, mid, n;
+
+	*n_changes = 0;
+
+	if (generation > log->generation)
+		return BT_RESULT_INVALID_ARGS;
+
+	/* Records after generation were overwritten, caller must resync */
+	if (generation < log->dropped_generation)
+		return BT_RESULT_NOT_AVAILABLE;
+
+	/* First record newer than generation */
+	low = 0;
+	high = log->len;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+
+		if (change_at(log, mid)->generation <= generation)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	for (n = 0; n < max_changes && low + n < log->len; n++) {
+		record = change_at(log, low + n);
+
+		changes[n].generation = record->generation;
+		changes[n].type = record->type;
+		changes[n].object = record->object;
+		changes[n].properties = record->properties;
+		changes[n].handle = record->handle;
+		changes[n].path = record->path;
+	}
+
+	*n_changes = n;
+
+	return BT_RESULT_OK;
+}
+
+BTResult bluez_change_log_resize(struct bluez_change_log *log, guint size)
+{
+	struct change_record *records;
+
+	if (size == 0)
+		return BT_RESULT_INVALID_ARGS;
+
+	records = g_try_new0(struct change_record, size);
+	if (!records)
+		return BT_RESULT_FAILED;
+
+	/* Pollers resync once, simpler than carrying the records over */
+	clear_changes(log);
+	log->dropped_generation = log->generation;
+
+	g_free(log->records);
+	log->records = records;
+	log->size = size;
+
+	return BT_RESULT_OK;
+}
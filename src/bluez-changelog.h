@@ -0,0 +1,57 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_CHANGELOG_H__
+#define __BLUEZ_CHANGELOG_H__
+
+#include <glib.h>
+
+#include "bluez-manager.h"
+
+/*
+ * Ring of the latest mutations, each stamped with the next generation.
+ * Property changes of the object of the newest record fold into it, the
+ * oldest record is overwritten once the ring is full.
+ */
+struct bluez_change_log;
+
+/* A log of size 0 keeps nothing but still counts generations */
+struct bluez_change_log *bluez_change_log_new(guint size);
+
+void bluez_change_log_free(struct bluez_change_log *log);
+
+/* Returns the generation of the change, path is interned while kept */
+guint64 bluez_change_log_append(struct bluez_change_log *log,
+				enum bluez_change_type type,
+				enum bluez_object_type object,
+				bluez_handle_t handle,
+				const gchar *path, guint32 properties);
+
+guint64 bluez_change_log_get_generation(struct bluez_change_log *log);
+
+/* As bluez_manager_changes_since() */
+BTResult bluez_change_log_since(struct bluez_change_log *log,
+				guint64 generation,
+				struct bluez_change *changes,
+				guint max_changes, guint *n_changes);
+
+/* Drops every record, pollers resync once */
+BTResult bluez_change_log_resize(struct bluez_change_log *log, guint size);
+
+#endif
@@ -0,0 +1,962 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "bluez-common.h"
+#include "bluez-client.h"
+
+#define OBJECT_MANAGER_INTERFACE "org.freedesktop.DBus.ObjectManager"
+#define BLUEZ_ROOT_PATH "/org/bluez"
+
+/* GDBusObject implementation holding the interface proxies of one path */
+typedef struct {
+	GObject parent;
+
+	gchar *path;
+	GHashTable *interfaces;		/* interface name -> GDBusProxy */
+	gboolean announced;		/* object_added was emitted */
+} BluezObject;
+
+typedef struct {
+	GObjectClass parent_class;
+} BluezObjectClass;
+
+#define BLUEZ_TYPE_OBJECT (bluez_object_get_type())
+#define BLUEZ_OBJECT(o) \
+	(G_TYPE_CHECK_INSTANCE_CAST((o), BLUEZ_TYPE_OBJECT, BluezObject))
+
+GType bluez_object_get_type(void);
+
+static void bluez_object_iface_init(GDBusObjectIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(BluezObject, bluez_object, G_TYPE_OBJECT,
+		G_IMPLEMENT_INTERFACE(G_TYPE_DBUS_OBJECT,
+					bluez_object_iface_init))
+
+struct bluez_client {
+	GDBusConnection *conn;
+	gchar *path_namespace;
+	gchar *name_owner;
+
+	gchar **interfaces;		/* interfaces to track, NULL for all */
+
+	guint watch_id;
+	GSList *subscriptions;		/* signal subscription IDs */
+	GSList *match_rules;		/* manually added PropertiesChanged rules */
+
+	GCancellable *cancellable;	/* pending GetManagedObjects */
+	GHashTable *objects;		/* object path -> BluezObject */
+	gboolean ready;
+
+	bluez_client_ready_cb ready_cb;
+	bluez_client_object_cb object_added;
+	bluez_client_object_cb object_removed;
+	gpointer user_data;
+
+	/* Objects dropped by the filter */
+	gchar *filter_interface;
+	bluez_client_filter_cb filter;
+	gpointer filter_data;
+	GHashTable *dropped;		/* object path -> failed mask */
+	GCancellable *fetches;		/* GetAll and refilter calls */
+	gboolean refiltering;
+};
+
+/* Dropped object with a GetAll in flight, kept in the failed mask */
+#define DROPPED_FETCHING	(1u << 31)
+
+struct fetch {
+	struct bluez_client *client;
+	gchar *path;
+};
+
+static void bluez_object_finalize(GObject *gobject)
+{
+	BluezObject *object = BLUEZ_OBJECT(gobject);
+
+	g_hash_table_unref(object->interfaces);
+	g_free(object->path);
+
+	G_OBJECT_CLASS(bluez_object_parent_class)->finalize(gobject);
+}
+
+static void bluez_object_init(BluezObject *object)
+{
+	object->interfaces = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, g_object_unref);
+}
+
+static void bluez_object_class_init(BluezObjectClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+	gobject_class->finalize = bluez_object_finalize;
+}
+
+static const gchar *bluez_object_get_object_path(GDBusObject *_object)
+{
+	return BLUEZ_OBJECT(_object)->path;
+}
+
+static GList *bluez_object_get_interfaces(GDBusObject *_object)
+{
+	BluezObject *object = BLUEZ_OBJECT(_object);
+	GList *list, *l;
+
+	list = g_hash_table_get_values(object->interfaces);
+	for (l = list; l; l = l->next)
+		g_object_ref(l->data);
+
+	return list;
+}
+
+static GDBusInterface *bluez_object_get_interface(GDBusObject *_object,
+						const gchar *interface_name)
+{
+	BluezObject *object = BLUEZ_OBJECT(_object);
+	GDBusProxy *proxy;
+
+	proxy = g_hash_table_lookup(object->interfaces, interface_name);
+	if (proxy == NULL)
+		return NULL;
+
+	return G_DBUS_INTERFACE(g_object_ref(proxy));
+}
+
+static void bluez_object_iface_init(GDBusObjectIface *iface)
+{
+	iface->get_object_path = bluez_object_get_object_path;
+	iface->get_interfaces = bluez_object_get_interfaces;
+	iface->get_interface = bluez_object_get_interface;
+}
+
+static BluezObject *bluez_object_new(const gchar *path)
+{
+	BluezObject *object;
+
+	object = g_object_new(BLUEZ_TYPE_OBJECT, NULL);
+	object->path = g_strdup(path);
+
+	return object;
+}
+
+gboolean bluez_client_path_in_scope(const gchar *path_namespace,
+							const gchar *path)
+{
+	gsize len;
+
+	if (path_namespace == NULL || g_strcmp0(path_namespace, "/") == 0)
+		return TRUE;
+
+	/* Inside the namespace */
+	len = strlen(path_namespace);
+	if (strncmp(path, path_namespace, len) == 0 &&
+				(path[len] == '\0' || path[len] == '/'))
+		return TRUE;
+
+	/* An ancestor, e.g. /org/bluez carrying the agent manager */
+	len = strlen(path);
+	return strncmp(path_namespace, path, len) == 0 &&
+						path_namespace[len] == '/';
+}
+
+static void update_properties(GDBusProxy *proxy, GVariant *changed,
+					const gchar * const *invalidated)
+{
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *value;
+
+	g_variant_iter_init(&iter, changed);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+		g_dbus_proxy_set_cached_property(proxy, key, value);
+		g_variant_unref(value);
+	}
+
+	for (; invalidated && *invalidated; invalidated++)
+		g_dbus_proxy_set_cached_property(proxy, *invalidated, NULL);
+}
+
+static gboolean interface_wanted(struct bluez_client *client,
+							const gchar *name)
+{
+	if (client->interfaces == NULL)
+		return TRUE;
+
+	return g_strv_contains((const gchar * const *) client->interfaces,
+									name);
+}
+
+static gboolean has_wanted_interface(struct bluez_client *client,
+							GVariant *interfaces)
+{
+	GVariantIter iter;
+	const gchar *name;
+
+	g_variant_iter_init(&iter, interfaces);
+	while (g_variant_iter_next(&iter, "{&s@a{sv}}", &name, NULL)) {
+		if (interface_wanted(client, name))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean filter_drops(struct bluez_client *client, const gchar *path,
+						GVariant *interfaces)
+{
+	GVariant *properties;
+	guint32 failed;
+
+	if (client->filter == NULL) {
+		if (client->dropped)
+			g_hash_table_remove(client->dropped, path);
+		return FALSE;
+	}
+
+	properties = g_variant_lookup_value(interfaces,
+				client->filter_interface, G_VARIANT_TYPE_VARDICT);
+	if (properties == NULL) {
+		/* Another interface of an object dropped before */
+		return g_hash_table_contains(client->dropped, path);
+	}
+
+	failed = client->filter(path, properties, FALSE, client->filter_data);
+	g_variant_unref(properties);
+
+	if (failed == 0) {
+		g_hash_table_remove(client->dropped, path);
+		return FALSE;
+	}
+
+	g_hash_table_replace(client->dropped, g_strdup(path),
+				GUINT_TO_POINTER(failed & ~DROPPED_FETCHING));
+
+	return TRUE;
+}
+
+static void add_interfaces(struct bluez_client *client, const gchar *path,
+						GVariant *interfaces);
+
+static void get_all_reply(GObject *source, GAsyncResult *res,
+							gpointer user_data)
+{
+	struct fetch *fetch = user_data;
+	struct bluez_client *client = fetch->client;
+	GVariantBuilder builder;
+	GVariant *reply, *properties;
+	GError *error = NULL;
+	gpointer failed;
+
+	reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+								res, &error);
+	if (reply == NULL &&
+			g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		goto done;
+
+	/* Removed meanwhile, or the filter has been lifted */
+	if (!g_hash_table_lookup_extended(client->dropped, fetch->path,
+							NULL, &failed))
+		goto done;
+
+	g_hash_table_replace(client->dropped, g_strdup(fetch->path),
+		GUINT_TO_POINTER(GPOINTER_TO_UINT(failed) & ~DROPPED_FETCHING));
+
+	if (reply == NULL)
+		goto done;
+
+	g_variant_get(reply, "(@a{sv})", &properties);
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sa{sv}}"));
+	g_variant_builder_add(&builder, "{s@a{sv}}",
+				client->filter_interface, properties);
+	properties = g_variant_ref_sink(g_variant_builder_end(&builder));
+
+	add_interfaces(client, fetch->path, properties);
+
+	g_variant_unref(properties);
+
+done:
+	if (reply)
+		g_variant_unref(reply);
+	g_clear_error(&error);
+	g_free(fetch->path);
+	g_free(fetch);
+}
+
+/* PropertiesChanged of a dropped object, fetch it if it may pass now */
+static void filter_changed(struct bluez_client *client, const gchar *path,
+							GVariant *changed)
+{
+	struct fetch *fetch;
+	gpointer value;
+	guint32 failed, touched = 0;
+	GVariantIter iter;
+	const gchar *key;
+
+	if (!g_hash_table_lookup_extended(client->dropped, path, NULL, &value))
+		return;
+
+	failed = GPOINTER_TO_UINT(value);
+	if (failed & DROPPED_FETCHING)
+		return;
+
+	g_variant_iter_init(&iter, changed);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, NULL))
+		touched |= bluez_property_from_name(key);
+
+	/* e.g. RSSI updates of a device dropped for its UUIDs */
+	if (!(touched & failed))
+		return;
+
+	if (client->filter(path, changed, TRUE, client->filter_data))
+		return;
+
+	g_hash_table_replace(client->dropped, g_strdup(path),
+				GUINT_TO_POINTER(failed | DROPPED_FETCHING));
+
+	fetch = g_new0(struct fetch, 1);
+	fetch->client = client;
+	fetch->path = g_strdup(path);
+
+	g_dbus_connection_call(client->conn, client->name_owner, path,
+				PROPERTIES_INTERFACE, "GetAll",
+				g_variant_new("(s)", client->filter_interface),
+				G_VARIANT_TYPE("(a{sv})"),
+				G_DBUS_CALL_FLAGS_NONE, -1, client->fetches,
+				get_all_reply, fetch);
+}
+
+static void add_interfaces(struct bluez_client *client, const gchar *path,
+						GVariant *interfaces)
+{
+	BluezObject *object;
+	GVariantIter iter;
+	const gchar *name;
+	GVariant *properties;
+	GDBusProxy *proxy;
+	GError *error = NULL;
+	gboolean created = FALSE;
+
+	if (!bluez_client_path_in_scope(client->path_namespace, path))
+		return;
+
+	object = g_hash_table_lookup(client->objects, path);
+	if (object == NULL) {
+		/* GATT, media and other objects nobody asked for */
+		if (!has_wanted_interface(client, interfaces))
+			return;
+
+		if (filter_drops(client, path, interfaces))
+			return;
+
+		object = bluez_object_new(path);
+		g_hash_table_replace(client->objects, object->path, object);
+		created = TRUE;
+	}
+
+	g_variant_iter_init(&iter, interfaces);
+	while (g_variant_iter_next(&iter, "{&s@a{sv}}", &name, &properties)) {
+		if (!interface_wanted(client, name) &&
+				g_strcmp0(name, PROPERTIES_INTERFACE) != 0) {
+			g_variant_unref(properties);
+			continue;
+		}
+
+		proxy = g_hash_table_lookup(object->interfaces, name);
+		if (proxy) {
+			update_properties(proxy, properties, NULL);
+			g_variant_unref(properties);
+			continue;
+		}
+
+		/*
+		 * Same as the GIO object manager: the proxy neither loads
+		 * properties nor subscribes to signals, both are fed from
+		 * the signals this client already receives.
+		 */
+		proxy = g_dbus_proxy_new_sync(client->conn,
+				G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+				G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
+				NULL, client->name_owner, path, name,
+				NULL, &error);
+		if (proxy == NULL) {
+			printf("Failed to create proxy %s %s: %s\n",
+						path, name, error->message);
+			g_clear_error(&error);
+			g_variant_unref(properties);
+			continue;
+		}
+
+		update_properties(proxy, properties, NULL);
+		g_variant_unref(properties);
+
+		g_dbus_interface_set_object(G_DBUS_INTERFACE(proxy),
+							G_DBUS_OBJECT(object));
+		g_hash_table_replace(object->interfaces, g_strdup(name), proxy);
+
+		if (object->announced)
+			g_signal_emit_by_name(object, "interface-added", proxy);
+	}
+
+	if (!created || !client->ready)
+		return;
+
+	object->announced = TRUE;
+
+	if (client->object_added)
+		client->object_added(G_DBUS_OBJECT(object), client->user_data);
+}
+
+static void remove_object(struct bluez_client *client, BluezObject *object)
+{
+	/* Announce while the interfaces are still there to inspect */
+	if (object->announced && client->object_removed)
+		client->object_removed(G_DBUS_OBJECT(object),
+							client->user_data);
+
+	g_hash_table_remove(client->objects, object->path);
+}
+
+static void remove_interfaces(struct bluez_client *client, const gchar *path,
+						const gchar * const *names)
+{
+	BluezObject *object;
+	GDBusProxy *proxy;
+	guint i, n = 0;
+
+	object = g_hash_table_lookup(client->objects, path);
+	if (object == NULL) {
+		if (client->filter_interface && g_strv_contains(names,
+						client->filter_interface))
+			g_hash_table_remove(client->dropped, path);
+		return;
+	}
+
+	for (i = 0; names[i]; i++) {
+		if (g_hash_table_contains(object->interfaces, names[i]))
+			n++;
+	}
+
+	if (n == g_hash_table_size(object->interfaces)) {
+		remove_object(client, object);
+		return;
+	}
+
+	for (i = 0; names[i]; i++) {
+		proxy = g_hash_table_lookup(object->interfaces, names[i]);
+		if (proxy == NULL)
+			continue;
+
+		g_object_ref(proxy);
+		g_hash_table_remove(object->interfaces, names[i]);
+
+		if (object->announced)
+			g_signal_emit_by_name(object, "interface-removed", proxy);
+
+		g_dbus_interface_set_object(G_DBUS_INTERFACE(proxy), NULL);
+		g_object_unref(proxy);
+	}
+}
+
+static void interfaces_added(GDBusConnection *conn, const gchar *sender,
+				const gchar *path, const gchar *interface,
+				const gchar *signal, GVariant *parameters,
+				gpointer user_data)
+{
+	struct bluez_client *client = user_data;
+	const gchar *object_path;
+	GVariant *interfaces;
+
+	g_variant_get(parameters, "(&o@a{sa{sv}})", &object_path, &interfaces);
+
+	add_interfaces(client, object_path, interfaces);
+
+	g_variant_unref(interfaces);
+}
+
+static void interfaces_removed(GDBusConnection *conn, const gchar *sender,
+				const gchar *path, const gchar *interface,
+				const gchar *signal, GVariant *parameters,
+				gpointer user_data)
+{
+	struct bluez_client *client = user_data;
+	const gchar *object_path;
+	const gchar **names;
+
+	g_variant_get(parameters, "(&o^a&s)", &object_path, &names);
+
+	remove_interfaces(client, object_path, names);
+
+	g_free(names);
+}
+
+static void properties_changed(GDBusConnection *conn, const gchar *sender,
+				const gchar *path, const gchar *interface,
+				const gchar *signal, GVariant *parameters,
+				gpointer user_data)
+{
+	struct bluez_client *client = user_data;
+	BluezObject *object;
+	GDBusProxy *proxy;
+	const gchar *name;
+	const gchar **invalidated;
+	GVariant *changed;
+
+	/* The rule may be shared with other subscribers of the connection */
+	if (!bluez_client_path_in_scope(client->path_namespace, path))
+		return;
+
+	object = g_hash_table_lookup(client->objects, path);
+	if (object == NULL && client->filter == NULL)
+		return;
+
+	g_variant_get(parameters, "(&s@a{sv}^a&s)",
+					&name, &changed, &invalidated);
+
+	if (object == NULL) {
+		if (!g_strcmp0(name, client->filter_interface))
+			filter_changed(client, path, changed);
+
+		g_variant_unref(changed);
+		g_free(invalidated);
+		return;
+	}
+
+	/* Untracked interfaces have no proxy, nothing to decode */
+	proxy = g_hash_table_lookup(object->interfaces, name);
+	if (proxy) {
+		update_properties(proxy, changed, invalidated);
+
+		g_signal_emit_by_name(proxy, "g-properties-changed",
+							changed, invalidated);
+	}
+
+	g_variant_unref(changed);
+	g_free(invalidated);
+}
+
+static void subscribe(struct bluez_client *client, const gchar *member,
+			const gchar *arg0, GDBusSignalFlags flags,
+			GDBusSignalCallback callback)
+{
+	guint id;
+
+	id = g_dbus_connection_signal_subscribe(client->conn,
+				BLUEZ_SERVICE_NAME, OBJECT_MANAGER_INTERFACE,
+				member, BLUEZ_MANAGER_PATH, arg0, flags,
+				callback, client, NULL);
+
+	client->subscriptions = g_slist_prepend(client->subscriptions,
+							GUINT_TO_POINTER(id));
+}
+
+static void subscribe_object_signals(struct bluez_client *client,
+					const gchar *member,
+					GDBusSignalCallback callback)
+{
+	gchar *subtree;
+
+	if (g_strcmp0(client->path_namespace, "/") == 0) {
+		subscribe(client, member, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+								callback);
+		return;
+	}
+
+	/* arg0path only matches descendants when it ends with '/' */
+	subtree = g_strconcat(client->path_namespace, "/", NULL);
+	subscribe(client, member, subtree, G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH,
+								callback);
+	g_free(subtree);
+
+	subscribe(client, member, client->path_namespace,
+					G_DBUS_SIGNAL_FLAGS_NONE, callback);
+
+	if (g_str_has_prefix(client->path_namespace, BLUEZ_ROOT_PATH "/"))
+		subscribe(client, member, BLUEZ_ROOT_PATH,
+					G_DBUS_SIGNAL_FLAGS_NONE, callback);
+}
+
+static void call_bus(struct bluez_client *client, const gchar *method,
+							const gchar *rule)
+{
+	g_dbus_connection_call(client->conn, "org.freedesktop.DBus",
+				"/org/freedesktop/DBus", "org.freedesktop.DBus",
+				method, g_variant_new("(s)", rule), NULL,
+				G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+}
+
+static void add_properties_rule(struct bluez_client *client,
+						const gchar *interface)
+{
+	GString *rule;
+
+	rule = g_string_new(NULL);
+
+	g_string_append_printf(rule, "type='signal',sender='%s',"
+				"interface='%s',member='PropertiesChanged'",
+				BLUEZ_SERVICE_NAME, PROPERTIES_INTERFACE);
+
+	if (interface)
+		g_string_append_printf(rule, ",arg0='%s'", interface);
+
+	/* path_namespace='/' is a no-op and broken in old dbus-daemon */
+	if (g_strcmp0(client->path_namespace, "/") != 0)
+		g_string_append_printf(rule, ",path_namespace='%s'",
+						client->path_namespace);
+
+	call_bus(client, "AddMatch", rule->str);
+
+	client->match_rules = g_slist_prepend(client->match_rules,
+						g_string_free(rule, FALSE));
+}
+
+static void subscribe_signals(struct bluez_client *client)
+{
+	gchar **interface;
+	guint id;
+
+	subscribe_object_signals(client, "InterfacesAdded", interfaces_added);
+	subscribe_object_signals(client, "InterfacesRemoved",
+							interfaces_removed);
+
+	/*
+	 * GDBus can't express path_namespace in signal_subscribe(), so
+	 * install one rule per tracked interface by hand, the bus daemon
+	 * then drops PropertiesChanged of everything else (GATT, media
+	 * transports, other adapters) before it reaches us.
+	 */
+	if (client->interfaces == NULL)
+		add_properties_rule(client, NULL);
+
+	for (interface = client->interfaces; interface && *interface;
+								interface++)
+		add_properties_rule(client, *interface);
+
+	id = g_dbus_connection_signal_subscribe(client->conn,
+				BLUEZ_SERVICE_NAME, PROPERTIES_INTERFACE,
+				"PropertiesChanged", NULL, NULL,
+				G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE,
+				properties_changed, client, NULL);
+
+	client->subscriptions = g_slist_prepend(client->subscriptions,
+							GUINT_TO_POINTER(id));
+}
+
+static void unsubscribe_signals(struct bluez_client *client)
+{
+	GSList *list;
+
+	for (list = client->subscriptions; list; list = list->next)
+		g_dbus_connection_signal_unsubscribe(client->conn,
+					GPOINTER_TO_UINT(list->data));
+
+	g_slist_free(client->subscriptions);
+	client->subscriptions = NULL;
+
+	for (list = client->match_rules; list; list = list->next)
+		call_bus(client, "RemoveMatch", list->data);
+
+	g_slist_free_full(client->match_rules, g_free);
+	client->match_rules = NULL;
+}
+
+static void get_managed_objects_reply(GObject *source, GAsyncResult *res,
+							gpointer user_data)
+{
+	struct bluez_client *client = user_data;
+	GError *error = NULL;
+	GVariant *reply, *objects, *interfaces;
+	GVariantIter iter;
+	const gchar *path;
+	GHashTableIter objects_iter;
+	gpointer key, object;
+
+	reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+								res, &error);
+	if (reply == NULL) {
+		/* The client may be gone already if cancelled */
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			printf("GetManagedObjects failed: %s\n",
+							error->message);
+			g_object_unref(client->cancellable);
+			client->cancellable = NULL;
+		}
+
+		g_error_free(error);
+		return;
+	}
+
+	g_object_unref(client->cancellable);
+	client->cancellable = NULL;
+
+	g_variant_get(reply, "(@a{oa{sa{sv}}})", &objects);
+
+	g_variant_iter_init(&iter, objects);
+	while (g_variant_iter_next(&iter, "{&o@a{sa{sv}}}",
+						&path, &interfaces)) {
+		add_interfaces(client, path, interfaces);
+		g_variant_unref(interfaces);
+	}
+
+	g_variant_unref(objects);
+	g_variant_unref(reply);
+
+	/* Objects reported from now on are announced one by one */
+	g_hash_table_iter_init(&objects_iter, client->objects);
+	while (g_hash_table_iter_next(&objects_iter, &key, &object))
+		((BluezObject *) object)->announced = TRUE;
+
+	client->ready = TRUE;
+
+	if (client->ready_cb)
+		client->ready_cb(client->user_data);
+}
+
+static void refilter_reply(GObject *source, GAsyncResult *res,
+							gpointer user_data)
+{
+	struct bluez_client *client = user_data;
+	GError *error = NULL;
+	GVariant *reply, *objects, *interfaces;
+	GVariantIter iter;
+	const gchar *path;
+
+	reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+								res, &error);
+	if (reply == NULL) {
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			printf("GetManagedObjects failed: %s\n",
+							error->message);
+			client->refiltering = FALSE;
+		}
+
+		g_error_free(error);
+		return;
+	}
+
+	client->refiltering = FALSE;
+
+	g_variant_get(reply, "(@a{oa{sa{sv}}})", &objects);
+
+	g_variant_iter_init(&iter, objects);
+	while (g_variant_iter_next(&iter, "{&o@a{sa{sv}}}",
+						&path, &interfaces)) {
+		if (g_hash_table_contains(client->dropped, path))
+			add_interfaces(client, path, interfaces);
+		g_variant_unref(interfaces);
+	}
+
+	g_variant_unref(objects);
+	g_variant_unref(reply);
+}
+
+/* One GetManagedObjects beats a GetAll per dropped object */
+void bluez_client_refilter(struct bluez_client *client)
+{
+	if (client->dropped == NULL || client->refiltering ||
+			!client->ready ||
+			g_hash_table_size(client->dropped) == 0)
+		return;
+
+	client->refiltering = TRUE;
+
+	g_dbus_connection_call(client->conn, client->name_owner,
+				BLUEZ_MANAGER_PATH, OBJECT_MANAGER_INTERFACE,
+				"GetManagedObjects", NULL,
+				G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
+				G_DBUS_CALL_FLAGS_NONE, -1, client->fetches,
+				refilter_reply, client);
+}
+
+void bluez_client_set_filter(struct bluez_client *client,
+				const gchar *interface,
+				bluez_client_filter_cb filter, gpointer user_data)
+{
+	g_free(client->filter_interface);
+	client->filter_interface = g_strdup(interface);
+	client->filter = filter;
+	client->filter_data = user_data;
+
+	if (client->dropped == NULL)
+		client->dropped = g_hash_table_new_full(g_str_hash,
+						g_str_equal, g_free, NULL);
+
+	if (filter == NULL)
+		bluez_client_refilter(client);
+}
+
+static void name_appeared(GDBusConnection *conn, const gchar *name,
+				const gchar *name_owner, gpointer user_data)
+{
+	struct bluez_client *client = user_data;
+
+	g_free(client->name_owner);
+	client->name_owner = g_strdup(name_owner);
+
+	subscribe_signals(client);
+
+	client->cancellable = g_cancellable_new();
+
+	g_dbus_connection_call(client->conn, name_owner, BLUEZ_MANAGER_PATH,
+				OBJECT_MANAGER_INTERFACE, "GetManagedObjects",
+				NULL, G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
+				G_DBUS_CALL_FLAGS_NONE, -1,
+				client->cancellable,
+				get_managed_objects_reply, client);
+}
+
+static void remove_all_objects(struct bluez_client *client)
+{
+	GList *objects, *list;
+
+	objects = g_hash_table_get_values(client->objects);
+	for (list = objects; list; list = list->next)
+		remove_object(client, list->data);
+
+	g_list_free(objects);
+}
+
+static void cancel_fetches(struct bluez_client *client)
+{
+	g_cancellable_cancel(client->fetches);
+	g_object_unref(client->fetches);
+	client->fetches = g_cancellable_new();
+	client->refiltering = FALSE;
+}
+
+static void name_vanished(GDBusConnection *conn, const gchar *name,
+							gpointer user_data)
+{
+	struct bluez_client *client = user_data;
+
+	if (client->cancellable) {
+		g_cancellable_cancel(client->cancellable);
+		g_object_unref(client->cancellable);
+		client->cancellable = NULL;
+	}
+
+	unsubscribe_signals(client);
+
+	remove_all_objects(client);
+
+	cancel_fetches(client);
+	if (client->dropped)
+		g_hash_table_remove_all(client->dropped);
+
+	client->ready = FALSE;
+
+	g_free(client->name_owner);
+	client->name_owner = NULL;
+}
+
+struct bluez_client *bluez_client_new(GDBusConnection *conn,
+				const gchar *path_namespace,
+				const gchar * const *interfaces,
+				bluez_client_ready_cb ready,
+				bluez_client_object_cb object_added,
+				bluez_client_object_cb object_removed,
+				gpointer user_data)
+{
+	struct bluez_client *client;
+
+	client = g_try_new0(struct bluez_client, 1);
+	if (!client)
+		return NULL;
+
+	client->conn = g_object_ref(conn);
+	client->path_namespace = g_strdup(path_namespace ?
+					path_namespace : BLUEZ_MANAGER_PATH);
+	client->interfaces = g_strdupv((gchar **) interfaces);
+	client->objects = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, g_object_unref);
+
+	client->fetches = g_cancellable_new();
+
+	client->ready_cb = ready;
+	client->object_added = object_added;
+	client->object_removed = object_removed;
+	client->user_data = user_data;
+
+	return client;
+}
+
+void bluez_client_start(struct bluez_client *client)
+{
+	if (client->watch_id)
+		return;
+
+	client->watch_id = g_bus_watch_name_on_connection(client->conn,
+					BLUEZ_SERVICE_NAME,
+					G_BUS_NAME_WATCHER_FLAGS_NONE,
+					name_appeared, name_vanished,
+					client, NULL);
+}
+
+gboolean bluez_client_is_ready(struct bluez_client *client)
+{
+	return client->ready;
+}
+
+GList *bluez_client_get_objects(struct bluez_client *client)
+{
+	GList *list, *l;
+
+	list = g_hash_table_get_values(client->objects);
+	for (l = list; l; l = l->next)
+		g_object_ref(l->data);
+
+	return list;
+}
+
+void bluez_client_free(struct bluez_client *client)
+{
+	if (!client)
+		return;
+
+	if (client->watch_id)
+		g_bus_unwatch_name(client->watch_id);
+
+	if (client->cancellable) {
+		g_cancellable_cancel(client->cancellable);
+		g_object_unref(client->cancellable);
+	}
+
+	unsubscribe_signals(client);
+
+	g_cancellable_cancel(client->fetches);
+	g_object_unref(client->fetches);
+
+	if (client->dropped)
+		g_hash_table_unref(client->dropped);
+
+	g_hash_table_unref(client->objects);
+
+	g_free(client->name_owner);
+	g_free(client->path_namespace);
+	g_strfreev(client->interfaces);
+	g_free(client->filter_interface);
+	g_object_unref(client->conn);
+
+	g_free(client);
+}
@@ -0,0 +1,85 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_CLIENT_H__
+#define __BLUEZ_CLIENT_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/*
+ * Minimal replacement of GDBusObjectManagerClient for the BlueZ object
+ * tree. Unlike the GIO one it only subscribes to the signals it needs,
+ * restricted to one path namespace, so the bus daemon filters the rest.
+ * Callbacks run in the thread default context of the creating thread.
+ */
+struct bluez_client;
+
+typedef void (*bluez_client_object_cb) (GDBusObject *object,
+							gpointer user_data);
+typedef void (*bluez_client_ready_cb) (gpointer user_data);
+
+/*
+ * Judges an object's properties of the filtered interface, only those
+ * present, partial is set for a PropertiesChanged. Returns the
+ * BLUEZ_PROPERTY_* mask of properties that failed, 0 accepts.
+ */
+typedef guint32 (*bluez_client_filter_cb) (const gchar *path,
+				GVariant *properties, gboolean partial,
+				gpointer user_data);
+
+/*
+ * interfaces: NULL terminated list of interfaces to track, NULL for all.
+ * Objects carrying none of them are ignored altogether.
+ */
+struct bluez_client *bluez_client_new(GDBusConnection *conn,
+				const gchar *path_namespace,
+				const gchar * const *interfaces,
+				bluez_client_ready_cb ready,
+				bluez_client_object_cb object_added,
+				bluez_client_object_cb object_removed,
+				gpointer user_data);
+
+void bluez_client_free(struct bluez_client *client);
+
+/* Start watching org.bluez, ready is called once objects are fetched */
+void bluez_client_start(struct bluez_client *client);
+
+gboolean bluez_client_is_ready(struct bluez_client *client);
+
+/* Referenced objects, free with g_list_free_full(list, g_object_unref) */
+GList *bluez_client_get_objects(struct bluez_client *client);
+
+/*
+ * New objects carrying interface are dropped before any proxy is made
+ * when the filter rejects them, only their path and the failed mask are
+ * kept. A later PropertiesChanged touching a failed property that passes
+ * fetches the object again. Objects already accepted stay.
+ */
+void bluez_client_set_filter(struct bluez_client *client,
+				const gchar *interface,
+				bluez_client_filter_cb filter, gpointer user_data);
+
+/* The filter was relaxed, dropped objects are fetched again */
+void bluez_client_refilter(struct bluez_client *client);
+
+gboolean bluez_client_path_in_scope(const gchar *path_namespace,
+							const gchar *path);
+
+#endif
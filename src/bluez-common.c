@@ -23,6 +23,7 @@
 #include <glib.h>
 
 #include "bluez-common.h"
+#include "bluez-pool.h"
 
 /* This map match with BlueZ src/error.c */
 static const struct BTResult_Map {
@@ -43,10 +44,47 @@ static const struct BTResult_Map {
 	MAP(BT_RESULT_NO_ADAPTER, "org.bluez.Error.NoSuchAdapter"),
 	MAP(BT_RESULT_NO_AGENT, "org.bluez.Error.AgentNotAvailable"),
 	MAP(BT_RESULT_FAILED, "org.bluez.Error.Failed"),
+	MAP(BT_RESULT_TIMEOUT, "org.freedesktop.DBus.Error.NoReply"),
+	MAP(BT_RESULT_CANCELLED, "org.bluez.Error.AuthenticationCanceled"),
 #undef MAP
 	{0, NULL}
 };
 
+static const struct property_map {
+	guint32 property;
+	const gchar *name;
+} property_map[] = {
+	{ BLUEZ_PROPERTY_ADDRESS, "Address" },
+	{ BLUEZ_PROPERTY_ADDRESS_TYPE, "AddressType" },
+	{ BLUEZ_PROPERTY_NAME, "Name" },
+	{ BLUEZ_PROPERTY_ALIAS, "Alias" },
+	{ BLUEZ_PROPERTY_CLASS, "Class" },
+	{ BLUEZ_PROPERTY_APPEARANCE, "Appearance" },
+	{ BLUEZ_PROPERTY_ICON, "Icon" },
+	{ BLUEZ_PROPERTY_POWERED, "Powered" },
+	{ BLUEZ_PROPERTY_DISCOVERABLE, "Discoverable" },
+	{ BLUEZ_PROPERTY_PAIRABLE, "Pairable" },
+	{ BLUEZ_PROPERTY_DISCOVERABLE_TIMEOUT, "DiscoverableTimeout" },
+	{ BLUEZ_PROPERTY_DISCOVERING, "Discovering" },
+	{ BLUEZ_PROPERTY_UUIDS, "UUIDs" },
+	{ BLUEZ_PROPERTY_PAIRED, "Paired" },
+	{ BLUEZ_PROPERTY_CONNECTED, "Connected" },
+	{ BLUEZ_PROPERTY_TRUSTED, "Trusted" },
+	{ BLUEZ_PROPERTY_BLOCKED, "Blocked" },
+	{ BLUEZ_PROPERTY_RSSI, "RSSI" },
+	{ BLUEZ_PROPERTY_TX_POWER, "TxPower" },
+	{ BLUEZ_PROPERTY_MANUFACTURER_DATA, "ManufacturerData" },
+	{ BLUEZ_PROPERTY_SERVICE_DATA, "ServiceData" },
+	{ BLUEZ_PROPERTY_SERVICES_RESOLVED, "ServicesResolved" },
+	{ BLUEZ_PROPERTY_LEGACY_PAIRING, "LegacyPairing" },
+	{ BLUEZ_PROPERTY_MODALIAS, "Modalias" },
+	{ BLUEZ_PROPERTY_ADAPTER, "Adapter" },
+	{ BLUEZ_PROPERTY_STATE, "State" },
+	{ BLUEZ_PROPERTY_DEVICE, "Device" },
+	{ BLUEZ_PROPERTY_REMOTE_UUID, "RemoteUUID" },
+	{ 0, NULL }
+};
+
 struct proxy_reply {
 	bluez_response_cb cb;
 	void *user_data;
@@ -82,6 +120,123 @@ const gchar *ret2str(BTResult ret)
 	return "Failed";
 }
 
+guint32 bluez_property_from_name(const gchar *name)
+{
+	const struct property_map *iter;
+
+	for (iter = property_map; iter->name != NULL; ++iter) {
+		if (g_strcmp0(name, iter->name) == 0)
+			return iter->property;
+	}
+
+	return BLUEZ_PROPERTY_OTHER;
+}
+
+guint32 bluez_property_mask(gchar **names)
+{
+	guint32 mask = 0;
+
+	for (; names && *names; names++)
+		mask |= bluez_property_from_name(*names);
+
+	return mask;
+}
+
+struct intern_entry {
+	gint ref_count;
+	gchar str[];
+};
+
+static GMutex intern_lock;
+static GHashTable *intern_table;		/* str -> intern_entry */
+
+static gsize intern_size(const gchar *str)
+{
+	return sizeof(struct intern_entry) + strlen(str) + 1;
+}
+
+const gchar *bluez_intern(const gchar *str)
+{
+	struct intern_entry *entry;
+
+	if (str == NULL)
+		return NULL;
+
+	g_mutex_lock(&intern_lock);
+
+	if (!intern_table)
+		intern_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	entry = g_hash_table_lookup(intern_table, str);
+	if (entry) {
+		entry->ref_count++;
+		goto done;
+	}
+
+	entry = bluez_pool_alloc_sized(intern_size(str));
+	if (!entry)
+		goto done;
+
+	entry->ref_count = 1;
+	strcpy(entry->str, str);
+	g_hash_table_insert(intern_table, entry->str, entry);
+
+done:
+	g_mutex_unlock(&intern_lock);
+
+	return entry ? entry->str : NULL;
+}
+
+void bluez_intern_unref(const gchar *str)
+{
+	struct intern_entry *entry;
+
+	if (str == NULL)
+		return;
+
+	entry = (struct intern_entry *) (str - sizeof(struct intern_entry));
+
+	g_mutex_lock(&intern_lock);
+
+	if (--entry->ref_count == 0) {
+		g_hash_table_remove(intern_table, entry->str);
+		bluez_pool_free_sized(entry, intern_size(entry->str));
+	}
+
+	g_mutex_unlock(&intern_lock);
+}
+
+void bluez_intern_strv_free(gchar **strv)
+{
+	gchar **iter;
+
+	if (strv == NULL)
+		return;
+
+	for (iter = strv; *iter; iter++)
+		bluez_intern_unref(*iter);
+
+	g_free(strv);
+}
+
+gchar **bluez_intern_property_names(GVariant *properties)
+{
+	GVariantIter iter;
+	const gchar *key;
+	gchar **names;
+	gsize n = 0;
+
+	names = g_new(gchar *, g_variant_n_children(properties) + 1);
+
+	g_variant_iter_init(&iter, properties);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, NULL))
+		names[n++] = (gchar *) bluez_intern(key);
+
+	names[n] = NULL;
+
+	return names;
+}
+
 void proxy_method_call_reply(GObject *object, GAsyncResult *res,
 						gpointer user_data)
 {
@@ -227,21 +382,155 @@ gchar **property_get_strings(GDBusProxy *proxy, const char *property)
 	return strv;
 }
 
+/*
+ * Borrows the string from the proxy's cache. It stays valid while the
+ * property keeps its value, the cached variant holds it.
+ */
+const gchar *property_peek_string(GDBusProxy *proxy, const gchar *name)
+{
+	GVariant *value;
+	const gchar *str;
+
+	if (proxy == NULL)
+		return NULL;
+
+	value = g_dbus_proxy_get_cached_property(proxy, name);
+	if (value == NULL)
+		return NULL;
+
+	str = g_variant_get_string(value, NULL);
+
+	g_variant_unref(value);
+
+	return str;
+}
+
+gchar **property_get_interned_strings(GDBusProxy *proxy, const char *property)
+{
+	GVariant *string_v;
+	const gchar **strv;
+	gchar **interned;
+	gsize i, n;
+
+	string_v = g_dbus_proxy_get_cached_property(proxy, property);
+	if (string_v == NULL)
+		return NULL;
+
+	strv = g_variant_get_strv(string_v, &n);
+
+	interned = g_new(gchar *, n + 1);
+	for (i = 0; i < n; i++)
+		interned[i] = (gchar *) bluez_intern(strv[i]);
+	interned[n] = NULL;
+
+	g_free(strv);
+	g_variant_unref(string_v);
+
+	return interned;
+}
+
 BTResult property_set_variant(GDBusProxy *proxy, GVariant *variant)
 {
 	return proxy_method_call(proxy, "Set", variant);
 }
 
+/* Hex digit value with bit 4 set, 0 for anything else */
+#define HEX(c, v) [c] = 0x10 | (v)
+static const guint8 hex_table[256] = {
+	HEX('0', 0), HEX('1', 1), HEX('2', 2), HEX('3', 3), HEX('4', 4),
+	HEX('5', 5), HEX('6', 6), HEX('7', 7), HEX('8', 8), HEX('9', 9),
+	HEX('a', 10), HEX('b', 11), HEX('c', 12), HEX('d', 13), HEX('e', 14),
+	HEX('f', 15), HEX('A', 10), HEX('B', 11), HEX('C', 12), HEX('D', 13),
+	HEX('E', 14), HEX('F', 15),
+};
+#undef HEX
+
+static const guint8 sep_table[256] = { [':'] = 1, ['_'] = 1 };
+
+static const gchar hex_upper[] = "0123456789ABCDEF";
+
+gboolean bluez_addr_parse(const gchar *str, bluez_addr_t *addr)
+{
+	const guint8 *p = (const guint8 *) str;
+	guint8 valid = 0x10, sep = 1, hi, lo;
+	int i;
+
+	if (str == NULL || addr == NULL || strnlen(str, 18) != 17)
+		return FALSE;
+
+	for (i = 0; i < 6; i++) {
+		hi = hex_table[p[i * 3]];
+		lo = hex_table[p[i * 3 + 1]];
+
+		valid &= hi & lo;
+		addr->b[i] = (hi & 0xf) << 4 | (lo & 0xf);
+	}
+
+	for (i = 2; i < 17; i += 3)
+		sep &= sep_table[p[i]];
+
+	addr->type = BLUEZ_ADDR_PUBLIC;
+
+	return (valid >> 4) & sep;
+}
+
+void bluez_addr_format(const bluez_addr_t *addr,
+					gchar str[BLUEZ_ADDR_STRLEN])
+{
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		str[i * 3] = hex_upper[addr->b[i] >> 4];
+		str[i * 3 + 1] = hex_upper[addr->b[i] & 0xf];
+		str[i * 3 + 2] = ':';
+	}
+
+	str[17] = '\0';
+}
+
+gboolean bluez_addr_from_path(const gchar *path, bluez_addr_t *addr)
+{
+	const gchar *name;
+
+	if (path == NULL)
+		return FALSE;
+
+	name = strrchr(path, '/');
+	if (name == NULL || strncmp(name, "/dev_", 5))
+		return FALSE;
+
+	return bluez_addr_parse(name + 5, addr);
+}
+
+gboolean bluez_addr_equal(gconstpointer a, gconstpointer b)
+{
+	return memcmp(((const bluez_addr_t *) a)->b,
+				((const bluez_addr_t *) b)->b, 6) == 0;
+}
+
+guint bluez_addr_hash(gconstpointer data)
+{
+	const guint8 *b = ((const bluez_addr_t *) data)->b;
+
+	/* The low bytes vary the most, they go unmixed */
+	return (guint) b[2] << 24 ^ (guint) b[3] << 16 ^
+				(guint) (b[4] ^ b[0]) << 8 ^ (b[5] ^ b[1]);
+}
+
+gint bluez_addr_compare(const bluez_addr_t *a, const bluez_addr_t *b)
+{
+	return memcmp(a->b, b->b, 6);
+}
+
 gchar *get_addrstr_from_path(const gchar *path)
 {
-	gchar *temp, *str;
+	gchar str[BLUEZ_ADDR_STRLEN];
+	bluez_addr_t addr;
 
-	temp = g_strrstr(path, "/");
-	/* ignore '/dev_' */
-	str = g_strdup(temp + 5);
+	if (!bluez_addr_from_path(path, &addr))
+		return NULL;
 
-	g_strdelimit(str, "_", ':');
+	bluez_addr_format(&addr, str);
 
-	printf("str: %s\n", str);
-	return str;
+	return g_strdup(str);
 }
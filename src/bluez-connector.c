@@ -0,0 +1,404 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-adapter.h"
+#include "bluez-device.h"
+#include "bluez-snapshot.h"
+#include "bluez-connector.h"
+#include "bluez-timer.h"
+
+enum connect_state {
+	CONNECT_QUEUED,
+	CONNECT_ISSUED,				/* call in flight */
+	CONNECT_WAITING,			/* InProgress, watching Connected */
+	CONNECT_DONE,
+};
+
+struct connect_entry {
+	bluez_handle_t handle;
+	enum connect_state state;
+	struct bluez_adapter *adapter;		/* while issued or waiting */
+	gint64 deadline;
+	struct bluez_timer *wait;		/* while waiting */
+	struct bluez_connect_job *job;
+};
+
+struct bluez_connect_job {
+	gint ref_count;
+	struct bluez_manager *manager;		/* NULL once freed */
+	struct bluez_connect_options options;
+	bluez_connect_cb func;
+	bluez_connect_done_cb done;
+	gpointer user_data;
+
+	struct connect_entry *entries;
+	guint n_entries;
+	guint next;				/* first possibly queued */
+	GHashTable *by_handle;			/* handle -> entry */
+	GHashTable *adapter_active;		/* adapter -> count */
+
+	struct bluez_timers *timers;
+	struct bluez_connect_stats stats;
+};
+
+struct connect_call {
+	struct bluez_connect_job *job;
+	struct connect_entry *entry;
+};
+
+#define DEFAULT_CONNECT_PER_ADAPTER 3
+#define DEFAULT_CONNECT_TIMEOUT 30000
+
+static void job_unref(struct bluez_connect_job *job)
+{
+	if (--job->ref_count > 0)
+		return;
+
+	g_free((gchar *) job->options.profile);
+	g_free((gpointer) job->options.retry);
+	g_hash_table_unref(job->by_handle);
+	g_hash_table_unref(job->adapter_active);
+	g_free(job->entries);
+	g_free(job);
+}
+
+static guint adapter_active(struct bluez_connect_job *job,
+					struct bluez_adapter *adapter)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup(job->adapter_active,
+								adapter));
+}
+
+static void set_adapter_active(struct bluez_connect_job *job,
+				struct bluez_adapter *adapter, guint n)
+{
+	if (n)
+		g_hash_table_replace(job->adapter_active, adapter,
+						GUINT_TO_POINTER(n));
+	else
+		g_hash_table_remove(job->adapter_active, adapter);
+}
+
+static void job_issue(struct bluez_connect_job *job);
+
+/*
+ * Reports one device, the last one completes the job. Callers issue more
+ * calls afterwards unless the callbacks freed the job.
+ */
+static void entry_finish(struct bluez_connect_job *job,
+			struct connect_entry *entry, BTResult result)
+{
+	struct bluez_manager *manager = job->manager;
+
+	if (entry->state == CONNECT_DONE)
+		return;
+
+	if (entry->adapter)
+		set_adapter_active(job, entry->adapter,
+				adapter_active(job, entry->adapter) - 1);
+
+	entry->state = CONNECT_DONE;
+	entry->adapter = NULL;
+
+	bluez_timers_cancel(job->timers, entry->wait);
+	entry->wait = NULL;
+
+	job->stats.pending--;
+	if (result == BT_RESULT_OK)
+		job->stats.connected++;
+	else
+		job->stats.failed++;
+
+	job->stats.elapsed = g_get_monotonic_time() - job->stats.start_time;
+
+	if (job->func)
+		job->func(manager, entry->handle, result, job->user_data);
+
+	if (job->manager && job->stats.pending == 0 && job->done)
+		job->done(manager, &job->stats, job->user_data);
+}
+
+static void entry_wait_timeout(gpointer user_data)
+{
+	struct connect_entry *entry = user_data;
+	struct bluez_connect_job *job = entry->job;
+
+	entry->wait = NULL;
+
+	job->ref_count++;
+
+	entry_finish(job, entry, BT_RESULT_TIMEOUT);
+
+	if (job->manager)
+		job_issue(job);
+
+	job_unref(job);
+}
+
+static void connect_reply(BTResult ret, GVariant *data, void *user_data)
+{
+	struct connect_call *call = user_data;
+	struct bluez_connect_job *job = call->job;
+	struct connect_entry *entry = call->entry;
+
+	g_free(call);
+
+	if (job->manager == NULL || entry->state != CONNECT_ISSUED) {
+		job_unref(job);
+		return;
+	}
+
+	switch (ret) {
+	case BT_RESULT_OK:
+	case BT_RESULT_ALREADY_CONNECTED:
+		entry_finish(job, entry, BT_RESULT_OK);
+		break;
+	case BT_RESULT_IN_PROGRESS:
+		/* Someone else is connecting it, Connected tells the outcome */
+		entry->state = CONNECT_WAITING;
+		entry->wait = bluez_timers_add(job->timers,
+			MAX(entry->deadline - g_get_monotonic_time(), 0) / 1000,
+			entry_wait_timeout, entry);
+		break;
+	default:
+		entry_finish(job, entry, ret);
+		break;
+	}
+
+	if (job->manager)
+		job_issue(job);
+
+	job_unref(job);
+}
+
+static void entry_issue(struct bluez_connect_job *job,
+			struct connect_entry *entry,
+			struct bluez_device *device,
+			struct bluez_adapter *adapter)
+{
+	struct connect_call *call;
+	gint64 now = g_get_monotonic_time();
+
+	call = g_try_new0(struct connect_call, 1);
+	if (!call) {
+		entry_finish(job, entry, BT_RESULT_FAILED);
+		return;
+	}
+
+	call->job = job;
+	call->entry = entry;
+
+	entry->state = CONNECT_ISSUED;
+	entry->adapter = adapter;
+	entry->deadline = now + (gint64) job->options.timeout_ms * 1000;
+	set_adapter_active(job, adapter, adapter_active(job, adapter) + 1);
+
+	job->ref_count++;
+
+	/* Shares the call with connects other components queued */
+	bluez_device_submit(device, job->options.profile ?
+				BLUEZ_DEVICE_OP_CONNECT_PROFILE :
+				BLUEZ_DEVICE_OP_CONNECT,
+				job->options.profile, job->options.klass,
+				job->options.timeout_ms, job->options.retry,
+				connect_reply, call);
+}
+
+static gboolean device_connected(struct bluez_device *device)
+{
+	struct bluez_device_info info;
+
+	bluez_device_get_info(device, &info);
+
+	return info.connected;
+}
+
+/*
+ * Walks queued devices in order, a device whose adapter is busy waits
+ * while devices on other adapters go ahead.
+ */
+static void job_issue(struct bluez_connect_job *job)
+{
+	struct connect_entry *entry;
+	struct bluez_adapter *adapter;
+	struct bluez_device *device;
+	gboolean skipped = FALSE;
+	guint i;
+
+	for (i = job->next; i < job->n_entries && job->manager; i++) {
+		entry = &job->entries[i];
+		if (entry->state != CONNECT_QUEUED)
+			continue;
+
+		device = bluez_manager_resolve_device(job->manager,
+							entry->handle);
+		if (!device) {
+			entry_finish(job, entry, BT_RESULT_NOT_EXIST);
+			continue;
+		}
+
+		/* Profile connects still go out for connected devices */
+		if (!job->options.profile && device_connected(device)) {
+			entry_finish(job, entry, BT_RESULT_OK);
+			continue;
+		}
+
+		adapter = bluez_manager_get_device_adapter(job->manager,
+								device);
+		if (!adapter) {
+			entry_finish(job, entry, BT_RESULT_NO_ADAPTER);
+			continue;
+		}
+
+		if (adapter_active(job, adapter) >= job->options.per_adapter) {
+			if (!skipped)
+				job->next = i;
+			skipped = TRUE;
+			continue;
+		}
+
+		entry_issue(job, entry, device, adapter);
+	}
+
+	if (!skipped)
+		job->next = i;
+}
+
+void bluez_connect_job_device_changed(struct bluez_connect_job *job,
+				bluez_handle_t handle,
+				struct bluez_device *device)
+{
+	struct connect_entry *entry;
+
+	entry = g_hash_table_lookup(job->by_handle, &handle);
+	if (!entry || entry->state == CONNECT_DONE)
+		return;
+
+	/* A pending profile connect still has to answer */
+	if (device && (!device_connected(device) ||
+		(entry->state == CONNECT_ISSUED && job->options.profile)))
+		return;
+
+	job->ref_count++;
+
+	entry_finish(job, entry, device ? BT_RESULT_OK : BT_RESULT_NOT_EXIST);
+
+	if (job->manager)
+		job_issue(job);
+
+	job_unref(job);
+}
+
+struct bluez_connect_job *bluez_connect_job_new(
+				struct bluez_manager *manager,
+				const bluez_handle_t *handles, guint n_handles,
+				const struct bluez_connect_options *options,
+				bluez_connect_cb func, bluez_connect_done_cb done,
+				gpointer user_data, struct bluez_timers *timers)
+{
+	struct bluez_connect_job *job;
+	guint i, n = 0;
+
+	job = g_try_new0(struct bluez_connect_job, 1);
+	if (!job)
+		return NULL;
+
+	job->ref_count = 1;
+	job->manager = manager;
+	job->options = *options;
+	job->options.profile = g_strdup(options->profile);
+	if (options->retry) {
+		job->options.retry = g_new(struct bluez_retry_policy, 1);
+		memcpy((gpointer) job->options.retry, options->retry,
+						sizeof(*options->retry));
+	}
+	job->func = func;
+	job->done = done;
+	job->user_data = user_data;
+
+	if (job->options.per_adapter == 0)
+		job->options.per_adapter = DEFAULT_CONNECT_PER_ADAPTER;
+	if (job->options.timeout_ms == 0)
+		job->options.timeout_ms = DEFAULT_CONNECT_TIMEOUT;
+
+	job->entries = g_new0(struct connect_entry, n_handles);
+	job->by_handle = g_hash_table_new(g_int64_hash, g_int64_equal);
+	job->adapter_active = g_hash_table_new(g_direct_hash,
+							g_direct_equal);
+
+	/* Duplicates would be reported twice */
+	for (i = 0; i < n_handles; i++) {
+		if (g_hash_table_contains(job->by_handle, &handles[i]))
+			continue;
+
+		job->entries[n].handle = handles[i];
+		job->entries[n].job = job;
+		g_hash_table_insert(job->by_handle, &job->entries[n].handle,
+							&job->entries[n]);
+		n++;
+	}
+
+	job->n_entries = n;
+	job->stats.total = n;
+	job->stats.pending = n;
+	job->stats.start_time = g_get_monotonic_time();
+
+	job->timers = timers;
+
+	return job;
+}
+
+void bluez_connect_job_start(struct bluez_connect_job *job)
+{
+	job->ref_count++;
+
+	if (job->stats.pending == 0 && job->done)
+		job->done(job->manager, &job->stats, job->user_data);
+	else
+		job_issue(job);
+
+	job_unref(job);
+}
+
+void bluez_connect_job_free(struct bluez_connect_job *job)
+{
+	guint i;
+
+	if (!job)
+		return;
+
+	for (i = 0; i < job->n_entries; i++) {
+		bluez_timers_cancel(job->timers, job->entries[i].wait);
+		job->entries[i].wait = NULL;
+	}
+
+	job->manager = NULL;
+
+	job_unref(job);
+}
+
+void bluez_connect_job_get_stats(struct bluez_connect_job *job,
+				struct bluez_connect_stats *stats)
+{
+	*stats = job->stats;
+}
@@ -0,0 +1,59 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_CONNECTOR_H__
+#define __BLUEZ_CONNECTOR_H__
+
+#include <glib.h>
+
+#include "bluez-manager.h"
+
+/*
+ * Connects a set of devices, a bounded number at a time per adapter. A
+ * device counts as connected once Connect succeeds, BlueZ reports it
+ * already connected, or its Connected property turns true, which also
+ * covers calls answered with InProgress. Jobs are owned by the manager,
+ * which feeds them Connected changes and device removals.
+ */
+struct bluez_connect_job;
+struct bluez_timers;
+
+struct bluez_connect_job *bluez_connect_job_new(
+				struct bluez_manager *manager,
+				const bluez_handle_t *handles, guint n_handles,
+				const struct bluez_connect_options *options,
+				bluez_connect_cb func, bluez_connect_done_cb done,
+				gpointer user_data,
+				struct bluez_timers *timers);
+
+/* Issues the first calls, callbacks may run before it returns */
+void bluez_connect_job_start(struct bluez_connect_job *job);
+
+/* Stops issuing calls, replies still in flight are dropped */
+void bluez_connect_job_free(struct bluez_connect_job *job);
+
+/* device is NULL once removed */
+void bluez_connect_job_device_changed(struct bluez_connect_job *job,
+				bluez_handle_t handle,
+				struct bluez_device *device);
+
+void bluez_connect_job_get_stats(struct bluez_connect_job *job,
+				struct bluez_connect_stats *stats);
+
+#endif
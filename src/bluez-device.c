@@ -20,17 +20,44 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "bluez-device.h"
+#include "bluez-opqueue.h"
+#include "bluez-pool.h"
+#include "bluez-scheduler.h"
+#include "bluez-snapshot.h"
+#include "bluez-uuid.h"
 
 struct bluez_device {
+	GDBusObject *object;
 	GDBusProxy *device_proxy;
 	GDBusProxy *properties_proxy;
 
 	device_property_watch property_func;
 	gpointer property_data;
+
+	/* Library internal watch, e.g. the owning manager */
+	device_changed_notify changed_func;
+	gpointer changed_data;
+
+	bluez_handle_t handle;
+
+	struct bluez_scheduler *scheduler;	/* NULL calls directly */
+
+	/* Asynchronous operations, one D-Bus call at a time */
+	struct bluez_op_queue ops;
+
+	bluez_addr_t addr;			/* parsed from the path */
+
+	gchar **uuids;				/* interned, on demand */
+	struct bluez_uuid_set uuid_set;
+	gboolean uuid_set_valid;
 };
 
+static struct bluez_pool device_pool = BLUEZ_POOL_INIT("device",
+					sizeof(struct bluez_device), 64);
+
 void bluez_device_set_properties_watch(struct bluez_device *device,
 				device_property_watch func, gpointer user_data)
 {
@@ -38,6 +65,33 @@ void bluez_device_set_properties_watch(struct bluez_device *device,
 	device->property_data = user_data;
 }
 
+void bluez_device_set_changed_notify(struct bluez_device *device,
+			device_changed_notify func, gpointer user_data)
+{
+	device->changed_func = func;
+	device->changed_data = user_data;
+}
+
+void bluez_device_set_scheduler(struct bluez_device *device,
+				struct bluez_scheduler *scheduler)
+{
+	device->scheduler = scheduler;
+}
+
+void bluez_device_set_handle(struct bluez_device *device,
+						bluez_handle_t handle)
+{
+	device->handle = handle;
+}
+
+bluez_handle_t bluez_device_get_handle(struct bluez_device *device)
+{
+	if (device == NULL)
+		return BLUEZ_HANDLE_INVALID;
+
+	return device->handle;
+}
+
 BTResult bluez_device_connect(struct bluez_device *device)
 {
 	return proxy_method_call(device->device_proxy, "Connect", NULL);
@@ -70,11 +124,74 @@ BTResult bluez_device_disconnect_profile(struct bluez_device *device,
 					"DisconnectProfile", parameter);
 }
 
+void bluez_device_call_with_reply(struct bluez_device *device,
+				const gchar *name, GVariant *parameter,
+				enum bluez_call_class klass, guint timeout_ms,
+				bluez_response_cb cb, void *user_data)
+{
+	bluez_scheduler_call(device->scheduler, device->device_proxy, name,
+			parameter, klass, timeout_ms, cb, user_data);
+}
+
+static void device_op_start(const gchar *method, GVariant *parameter,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *cb_data,
+				gpointer user_data)
+{
+	struct bluez_device *device = user_data;
+
+	bluez_scheduler_call_with_retry(device->scheduler,
+				device->device_proxy, method, parameter,
+				klass, timeout_ms, retry, cb, cb_data);
+}
+
+void bluez_device_submit(struct bluez_device *device,
+				enum bluez_device_op type, const gchar *uuid,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *user_data)
+{
+	bluez_op_queue_submit(&device->ops, type, uuid, klass, timeout_ms,
+						retry, cb, user_data);
+}
+
+void bluez_device_connect_with_reply(struct bluez_device *device,
+					bluez_response_cb cb, void *user_data)
+{
+	bluez_device_submit(device, BLUEZ_DEVICE_OP_CONNECT, NULL,
+				BLUEZ_CALL_NORMAL, 0, NULL, cb, user_data);
+}
+
+void bluez_device_disconnect_with_reply(struct bluez_device *device,
+					bluez_response_cb cb, void *user_data)
+{
+	bluez_device_submit(device, BLUEZ_DEVICE_OP_DISCONNECT, NULL,
+				BLUEZ_CALL_NORMAL, 0, NULL, cb, user_data);
+}
+
+void bluez_device_connect_profile_with_reply(struct bluez_device *device,
+				const gchar *uuid,
+				bluez_response_cb cb, void *user_data)
+{
+	bluez_device_submit(device, BLUEZ_DEVICE_OP_CONNECT_PROFILE, uuid,
+				BLUEZ_CALL_NORMAL, 0, NULL, cb, user_data);
+}
+
+void bluez_device_disconnect_profile_with_reply(struct bluez_device *device,
+				const gchar *uuid,
+				bluez_response_cb cb, void *user_data)
+{
+	bluez_device_submit(device, BLUEZ_DEVICE_OP_DISCONNECT_PROFILE, uuid,
+				BLUEZ_CALL_NORMAL, 0, NULL, cb, user_data);
+}
+
+/* Pairing usually has a user waiting on a passkey */
 void bluez_device_pair_with_reply(struct bluez_device *device,
 					bluez_response_cb cb, void *user_data)
 {
-	return proxy_method_call_with_reply(device->device_proxy,
-						"Pair", NULL, cb, user_data);
+	bluez_device_submit(device, BLUEZ_DEVICE_OP_PAIR, NULL,
+				BLUEZ_CALL_INTERACTIVE, 0, NULL, cb, user_data);
 }
 
 BTResult bluez_device_cancel_pair(struct bluez_device *device)
@@ -114,7 +231,16 @@ gchar *bluez_device_get_alias(struct bluez_device *device)
 
 gchar *bluez_device_get_address(struct bluez_device *device)
 {
-	return property_get_string(device->device_proxy, "Address");
+	gchar str[BLUEZ_ADDR_STRLEN];
+
+	bluez_addr_format(&device->addr, str);
+
+	return g_strdup(str);
+}
+
+const bluez_addr_t *bluez_device_get_addr(struct bluez_device *device)
+{
+	return &device->addr;
 }
 
 void bluez_device_get_class(struct bluez_device *device, guint32 *class)
@@ -133,6 +259,11 @@ void bluez_device_get_connected(struct bluez_device *device,
 	property_get_boolean(device->device_proxy, "Connected", connected);
 }
 
+void bluez_device_get_trusted(struct bluez_device *device, gboolean *trusted)
+{
+	property_get_boolean(device->device_proxy, "Trusted", trusted);
+}
+
 void bluez_device_get_rssi(struct bluez_device *device, gint16 *rssi)
 {
 	property_get_int16(device->device_proxy, "RSSI", rssi);
@@ -143,36 +274,254 @@ gchar **bluez_device_get_uuids(struct bluez_device *device)
 	return property_get_strings(device->device_proxy, "UUIDs");
 }
 
+const gchar * const *bluez_device_peek_uuids(struct bluez_device *device)
+{
+	if (device->uuids == NULL && device->device_proxy)
+		device->uuids = property_get_interned_strings(
+					device->device_proxy, "UUIDs");
+
+	return (const gchar * const *) device->uuids;
+}
+
+static void drop_uuids(struct bluez_device *device)
+{
+	bluez_intern_strv_free(device->uuids);
+	device->uuids = NULL;
+
+	bluez_uuid_set_clear(&device->uuid_set);
+	device->uuid_set_valid = FALSE;
+}
+
+const struct bluez_uuid_set *bluez_device_get_uuid_set(
+					struct bluez_device *device)
+{
+	if (!device->uuid_set_valid) {
+		bluez_uuid_set_parse(&device->uuid_set,
+				(gchar **) bluez_device_peek_uuids(device));
+		device->uuid_set_valid = TRUE;
+	}
+
+	return &device->uuid_set;
+}
+
+gboolean bluez_device_has_uuid(struct bluez_device *device,
+					const bluez_uuid_t *uuid)
+{
+	if (device == NULL || uuid == NULL)
+		return FALSE;
+
+	return bluez_uuid_set_contains(bluez_device_get_uuid_set(device),
+									uuid);
+}
+
+/* The byte array of a data dictionary value, shared with the cache */
+static gboolean peek_bytes(GVariant *value, struct bluez_bytes *view)
+{
+	GVariant *bytes;
+
+	bytes = g_variant_get_variant(value);
+	if (!g_variant_is_of_type(bytes, G_VARIANT_TYPE_BYTESTRING)) {
+		g_variant_unref(bytes);
+		return FALSE;
+	}
+
+	view->data = g_variant_get_fixed_array(bytes, &view->len, 1);
+	g_variant_unref(bytes);
+
+	return TRUE;
+}
+
+guint bluez_device_peek_manufacturer_data(struct bluez_device *device,
+				guint16 *companies, struct bluez_bytes *views,
+				guint max)
+{
+	GVariantIter iter;
+	GVariant *dict, *value;
+	guint16 company;
+	guint n = 0;
+
+	if (device->device_proxy == NULL)
+		return 0;
+
+	dict = g_dbus_proxy_get_cached_property(device->device_proxy,
+						"ManufacturerData");
+	if (dict == NULL)
+		return 0;
+
+	g_variant_iter_init(&iter, dict);
+	while (g_variant_iter_next(&iter, "{q@v}", &company, &value)) {
+		if (n >= max) {
+			n++;
+		} else if (peek_bytes(value, &views[n])) {
+			companies[n] = company;
+			n++;
+		}
+		g_variant_unref(value);
+	}
+
+	g_variant_unref(dict);
+
+	return n;
+}
+
+guint bluez_device_peek_service_data(struct bluez_device *device,
+				bluez_uuid_t *uuids, struct bluez_bytes *views,
+				guint max)
+{
+	GVariantIter iter;
+	GVariant *dict, *value;
+	const gchar *uuid;
+	guint n = 0;
+
+	if (device->device_proxy == NULL)
+		return 0;
+
+	dict = g_dbus_proxy_get_cached_property(device->device_proxy,
+						"ServiceData");
+	if (dict == NULL)
+		return 0;
+
+	g_variant_iter_init(&iter, dict);
+	while (g_variant_iter_next(&iter, "{&s@v}", &uuid, &value)) {
+		if (n >= max) {
+			n++;
+		} else if (bluez_uuid_parse(uuid, &uuids[n]) &&
+						peek_bytes(value, &views[n])) {
+			n++;
+		}
+		g_variant_unref(value);
+	}
+
+	g_variant_unref(dict);
+
+	return n;
+}
+
+gboolean bluez_device_get_tx_power(struct bluez_device *device,
+							gint16 *tx_power)
+{
+	GVariant *value;
+
+	if (device->device_proxy == NULL)
+		return FALSE;
+
+	value = g_dbus_proxy_get_cached_property(device->device_proxy,
+								"TxPower");
+	if (value == NULL)
+		return FALSE;
+
+	*tx_power = g_variant_get_int16(value);
+	g_variant_unref(value);
+
+	return TRUE;
+}
+
 const gchar *bluez_device_get_path(struct bluez_device *device)
 {
 	return g_dbus_proxy_get_object_path(device->device_proxy);
 }
 
+static gboolean cached_boolean(GDBusProxy *proxy, const gchar *name)
+{
+	GVariant *value;
+	gboolean ret;
+
+	value = g_dbus_proxy_get_cached_property(proxy, name);
+	if (value == NULL)
+		return FALSE;
+
+	ret = g_variant_get_boolean(value);
+
+	g_variant_unref(value);
+
+	return ret;
+}
+
+/*
+ * Strings point into the proxy property cache, they stay valid until
+ * the next property change is processed, copy them if needed longer.
+ */
+void bluez_device_get_info(struct bluez_device *device,
+					struct bluez_device_info *info)
+{
+	GDBusProxy *proxy = device->device_proxy;
+	GVariant *value;
+
+	memset(info, 0, sizeof(*info));
+	info->rssi = BLUEZ_RSSI_UNKNOWN;
+	info->handle = device->handle;
+	info->addr = device->addr;
+
+	if (proxy == NULL)
+		return;
+
+	info->path = g_dbus_proxy_get_object_path(proxy);
+	info->address = property_peek_string(proxy, "Address");
+	info->name = property_peek_string(proxy, "Name");
+	info->alias = property_peek_string(proxy, "Alias");
+	info->connected = cached_boolean(proxy, "Connected");
+	info->paired = cached_boolean(proxy, "Paired");
+	info->trusted = cached_boolean(proxy, "Trusted");
+	info->blocked = cached_boolean(proxy, "Blocked");
+
+	value = g_dbus_proxy_get_cached_property(proxy, "RSSI");
+	if (value) {
+		info->rssi = g_variant_get_int16(value);
+		g_variant_unref(value);
+	}
+}
+
+gsize bluez_device_get_footprint(struct bluez_device *device)
+{
+	GDBusProxy *proxy = device->device_proxy;
+	gsize size = sizeof(*device);
+	GVariant *value;
+	gchar **names;
+	int i;
+
+	if (proxy == NULL)
+		return size;
+
+	size += strlen(g_dbus_proxy_get_object_path(proxy)) + 1;
+
+	names = g_dbus_proxy_get_cached_property_names(proxy);
+	if (names == NULL)
+		return size;
+
+	for (i = 0; names[i]; i++) {
+		value = g_dbus_proxy_get_cached_property(proxy, names[i]);
+		if (value == NULL)
+			continue;
+
+		size += strlen(names[i]) + 1 + g_variant_get_size(value);
+		g_variant_unref(value);
+	}
+
+	g_strfreev(names);
+
+	return size;
+}
+
 static void device_properties_changed(GDBusProxy *proxy,
 					GVariant *changed_properties,
 					GStrv *invalidated_properties,
 					gpointer user_data)
 {
 	struct bluez_device *device = (struct bluez_device *) user_data;
-	GVariantIter iter;
-	gchar *key;
-	GPtrArray *p;
 	gchar **prop_names;
 
-	p = g_ptr_array_new();
+	prop_names = bluez_intern_property_names(changed_properties);
 
-	g_variant_iter_init(&iter, changed_properties);
-	while (g_variant_iter_next(&iter, "{sv}", &key, NULL))
-		g_ptr_array_add(p, key);
+	if (bluez_property_mask(prop_names) & BLUEZ_PROPERTY_UUIDS)
+		drop_uuids(device);
 
-	g_ptr_array_add(p, NULL);
-
-	prop_names = (gchar **) g_ptr_array_free(p, FALSE);
+	if (device->changed_func)
+		device->changed_func(device, prop_names, device->changed_data);
 
 	if (device->property_func)
 		device->property_func(device, prop_names);
 
-	g_strfreev(prop_names);
+	bluez_intern_strv_free(prop_names);
 }
 
 static void device_interface_added(GDBusObject *object,
@@ -184,10 +533,14 @@ static void device_interface_added(GDBusObject *object,
 
 	name = g_dbus_proxy_get_interface_name(proxy);
 	if (g_strcmp0(name, DEVICE_INTERFACE) == 0) {
-		if (device->device_proxy)
+		if (device->device_proxy) {
+			g_signal_handlers_disconnect_by_data(device->device_proxy,
+								device);
 			g_object_unref(device->device_proxy);
+		}
 
 		device->device_proxy = g_object_ref(proxy);
+		drop_uuids(device);
 
 		/* connect signal */
 		g_signal_connect(device->device_proxy, "g-properties-changed",
@@ -210,8 +563,11 @@ static void device_interface_removed(GDBusObject *object,
 	name = g_dbus_proxy_get_interface_name(proxy);
 	if (g_strcmp0(name, DEVICE_INTERFACE) == 0) {
 		if (device->device_proxy) {
+			g_signal_handlers_disconnect_by_data(device->device_proxy,
+								device);
 			g_object_unref(device->device_proxy);
 			device->device_proxy = NULL;
+			drop_uuids(device);
 		}
 	} else if (g_strcmp0(name, PROPERTIES_INTERFACE) == 0) {
 		if (device->properties_proxy) {
@@ -227,13 +583,22 @@ struct bluez_device *bluez_device_new(GDBusObject *object)
 	GDBusInterface *interface;
 	GDBusProxy *proxy;
 
-	device = g_try_new0(struct bluez_device, 1);
+	device = bluez_pool_alloc0(&device_pool);
 	if (!device)
 		return NULL;
 
 	interface = g_dbus_object_get_interface(object, DEVICE_INTERFACE);
 	proxy = G_DBUS_PROXY(interface);
 	device->device_proxy = proxy;
+	bluez_op_queue_init(&device->ops, device_op_start, device);
+
+	if (!bluez_addr_from_path(g_dbus_object_get_object_path(object),
+							&device->addr))
+		printf("No address in device path %s\n",
+				g_dbus_object_get_object_path(object));
+
+	if (!g_strcmp0(property_peek_string(proxy, "AddressType"), "random"))
+		device->addr.type = BLUEZ_ADDR_RANDOM;
 
 	interface = g_dbus_object_get_interface(object, PROPERTIES_INTERFACE);
 	proxy = G_DBUS_PROXY(interface);
@@ -243,6 +608,7 @@ struct bluez_device *bluez_device_new(GDBusObject *object)
 	g_signal_connect(device->device_proxy, "g-properties-changed",
 			G_CALLBACK(device_properties_changed), device);
 
+	device->object = g_object_ref(object);
 	g_signal_connect(object, "interface-added",
 			G_CALLBACK(device_interface_added), device);
 	g_signal_connect(object, "interface-removed",
@@ -256,10 +622,22 @@ void bluez_device_free(struct bluez_device *device)
 	if (!device)
 		return;
 
-	if (device->device_proxy)
+	/* The object and proxies may outlive us, stop their callbacks */
+	if (device->object) {
+		g_signal_handlers_disconnect_by_data(device->object, device);
+		g_object_unref(device->object);
+	}
+
+	if (device->device_proxy) {
+		g_signal_handlers_disconnect_by_data(device->device_proxy, device);
 		g_object_unref(device->device_proxy);
+	}
 	if (device->properties_proxy)
 		g_object_unref(device->properties_proxy);
 
-	g_free(device);
+	drop_uuids(device);
+
+	bluez_op_queue_clear(&device->ops);
+
+	bluez_pool_free(&device_pool, device);
 }
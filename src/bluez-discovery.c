@@ -0,0 +1,692 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-adapter.h"
+#include "bluez-discovery.h"
+#include "bluez-timer.h"
+#include "bluez-uuid.h"
+
+/* A filter with its own copies of the strings */
+struct owned_filter {
+	struct bluez_discovery_filter filter;
+	gboolean set;				/* FALSE matches all */
+	gchar **uuids;
+	gchar *pattern;
+};
+
+struct bluez_discovery_session {
+	struct bluez_discovery *discovery;
+	guint scan_ms;
+	guint period_ms;
+	struct owned_filter filter;
+	GList link;
+};
+
+enum discovery_call {
+	CALL_START,
+	CALL_STOP,
+	CALL_FILTER,
+};
+
+struct bluez_discovery {
+	gint ref_count;
+	gboolean closed;
+	struct bluez_timers *timers;
+	struct bluez_adapter *adapter;		/* NULL while gone */
+
+	GQueue sessions;
+
+	/* Duty cycle, the timer flips between the two phases */
+	struct bluez_timer *phase_timer;
+	gboolean on_phase;
+
+	/* Union of the session filters, sent before starting */
+	struct owned_filter filter;
+	struct bluez_uuid_set uuid_set;		/* filter.uuids parsed */
+	gboolean filter_dirty;
+	gboolean filter_relaxed;		/* until taken */
+
+	gboolean scanning;			/* as far as we know */
+	gboolean call_pending;
+	enum discovery_call call;
+	struct bluez_adapter *call_adapter;	/* adapter of that call */
+
+	gint64 window_start;			/* monotonic, usec */
+	struct bluez_discovery_stats stats;
+};
+
+static const struct bluez_retry_policy start_retry = {
+	.retry_on = BLUEZ_RETRY_TRANSIENT,
+};
+
+static void owned_filter_set(struct owned_filter *owned,
+				const struct bluez_discovery_filter *filter,
+				gchar **uuids)
+{
+	g_strfreev(owned->uuids);
+	g_free(owned->pattern);
+	memset(owned, 0, sizeof(*owned));
+
+	if (filter == NULL)
+		return;
+
+	owned->filter = *filter;
+	owned->set = TRUE;
+	owned->uuids = uuids;
+	owned->pattern = g_strdup(filter->pattern);
+	owned->filter.uuids = (const gchar **) owned->uuids;
+	owned->filter.pattern = owned->pattern;
+}
+
+static gboolean owned_filter_equal(const struct owned_filter *a,
+					const struct owned_filter *b)
+{
+	guint i;
+
+	if (a->set != b->set || a->filter.rssi != b->filter.rssi ||
+			a->filter.pathloss != b->filter.pathloss ||
+			a->filter.transport != b->filter.transport ||
+			a->filter.filter_duplicates !=
+					b->filter.filter_duplicates ||
+			g_strcmp0(a->pattern, b->pattern))
+		return FALSE;
+
+	if (a->uuids == NULL || b->uuids == NULL)
+		return a->uuids == b->uuids;
+
+	for (i = 0; a->uuids[i] && b->uuids[i]; i++) {
+		if (strcmp(a->uuids[i], b->uuids[i]))
+			return FALSE;
+	}
+
+	return a->uuids[i] == b->uuids[i];
+}
+
+/* Whether b passes a device a rejects, by the rules of the match below */
+static gboolean owned_filter_relaxed(const struct owned_filter *a,
+					const struct bluez_uuid_set *a_uuids,
+					const struct owned_filter *b)
+{
+	const struct bluez_discovery_filter *old = &a->filter;
+	const struct bluez_discovery_filter *new = &b->filter;
+	bluez_uuid_t uuid;
+	guint i;
+
+	if (!a->set || !b->set)
+		return a->set;
+
+	if (old->uuids) {
+		if (new->uuids == NULL)
+			return TRUE;
+
+		for (i = 0; new->uuids[i]; i++) {
+			if (bluez_uuid_parse(new->uuids[i], &uuid) &&
+				!bluez_uuid_set_contains(a_uuids, &uuid))
+				return TRUE;
+		}
+	}
+
+	if (old->rssi) {
+		if (new->rssi == 0 || new->rssi < old->rssi)
+			return TRUE;
+	} else if (old->pathloss) {
+		if (new->rssi || new->pathloss == 0 ||
+					new->pathloss > old->pathloss)
+			return TRUE;
+	}
+
+	/* A shorter prefix of the old pattern only passes more */
+	return old->pattern && (new->pattern == NULL ||
+			!g_str_has_prefix(old->pattern, new->pattern));
+}
+
+static void discovery_unref(struct bluez_discovery *discovery)
+{
+	if (--discovery->ref_count > 0)
+		return;
+
+	owned_filter_set(&discovery->filter, NULL, NULL);
+	bluez_uuid_set_clear(&discovery->uuid_set);
+	g_free(discovery);
+}
+
+/*
+ * The loosest filter letting through what any session asks for, BlueZ
+ * keeps a single one per client. A session without a filter, or mixing
+ * RSSI and pathloss thresholds, lifts the affected criteria altogether.
+ */
+static void merge_filters(struct bluez_discovery *discovery)
+{
+	struct bluez_discovery_filter merged = { 0 };
+	struct owned_filter old = discovery->filter;
+	gboolean any_uuid = FALSE, same_pattern = TRUE;
+	gboolean all_rssi = TRUE, all_pathloss = TRUE;
+	GPtrArray *uuids;
+	GList *list;
+	guint i;
+
+	memset(&discovery->filter, 0, sizeof(discovery->filter));
+
+	uuids = g_ptr_array_new_with_free_func(g_free);
+
+	for (list = discovery->sessions.head; list; list = list->next) {
+		struct bluez_discovery_session *session = list->data;
+		const struct bluez_discovery_filter *filter =
+						&session->filter.filter;
+
+		if (!session->filter.set) {
+			g_ptr_array_free(uuids, TRUE);
+			goto done;
+		}
+
+		if (list == discovery->sessions.head) {
+			merged = *filter;
+			merged.uuids = NULL;
+		}
+
+		if (filter->uuids == NULL)
+			any_uuid = TRUE;
+		for (i = 0; !any_uuid && filter->uuids[i]; i++) {
+			gchar *uuid = g_ascii_strdown(filter->uuids[i], -1);
+
+			if (g_ptr_array_find_with_equal_func(uuids, uuid,
+						g_str_equal, NULL))
+				g_free(uuid);
+			else
+				g_ptr_array_add(uuids, uuid);
+		}
+
+		all_rssi &= filter->rssi != 0;
+		all_pathloss &= filter->rssi == 0 && filter->pathloss != 0;
+		merged.rssi = MIN(merged.rssi, filter->rssi);
+		merged.pathloss = MAX(merged.pathloss, filter->pathloss);
+
+		if (merged.transport != filter->transport)
+			merged.transport = BLUEZ_TRANSPORT_AUTO;
+
+		merged.filter_duplicates &= filter->filter_duplicates;
+
+		same_pattern &= !g_strcmp0(merged.pattern, filter->pattern);
+	}
+
+	if (g_queue_is_empty(&discovery->sessions)) {
+		g_ptr_array_free(uuids, TRUE);
+		goto done;
+	}
+
+	if (!all_rssi)
+		merged.rssi = 0;
+	if (!all_pathloss)
+		merged.pathloss = 0;
+	if (!same_pattern)
+		merged.pattern = NULL;
+
+	if (any_uuid) {
+		g_ptr_array_free(uuids, TRUE);
+		uuids = NULL;
+	} else {
+		g_ptr_array_add(uuids, NULL);
+	}
+
+	owned_filter_set(&discovery->filter, &merged, uuids ?
+			(gchar **) g_ptr_array_free(uuids, FALSE) : NULL);
+
+done:
+	if (owned_filter_relaxed(&old, &discovery->uuid_set,
+						&discovery->filter))
+		discovery->filter_relaxed = TRUE;
+
+	bluez_uuid_set_parse(&discovery->uuid_set, discovery->filter.uuids);
+
+	if (!owned_filter_equal(&old, &discovery->filter))
+		discovery->filter_dirty = TRUE;
+
+	owned_filter_set(&old, NULL, NULL);
+}
+
+/*
+ * Folds the sessions into one cycle: the shortest period at the highest
+ * duty ratio, so each session scans at least its share of time. Returns
+ * FALSE for a continuous scan or none at all.
+ */
+static gboolean duty_cycle(struct bluez_discovery *discovery,
+					guint *scan_ms, guint *period_ms)
+{
+	gdouble ratio = 0;
+	guint period = G_MAXUINT;
+	GList *list;
+
+	if (g_queue_is_empty(&discovery->sessions))
+		return FALSE;
+
+	for (list = discovery->sessions.head; list; list = list->next) {
+		struct bluez_discovery_session *session = list->data;
+
+		if (session->scan_ms == 0 ||
+				session->scan_ms >= session->period_ms)
+			return FALSE;
+
+		period = MIN(period, session->period_ms);
+		ratio = MAX(ratio, (gdouble) session->scan_ms /
+						session->period_ms);
+	}
+
+	*period_ms = period;
+	*scan_ms = MAX(1, (guint) (period * ratio + 0.5));
+
+	return *scan_ms < period;
+}
+
+static void window_begin(struct bluez_discovery *discovery)
+{
+	discovery->scanning = TRUE;
+	discovery->window_start = g_get_monotonic_time();
+	discovery->stats.windows++;
+	discovery->stats.current_window_devices = 0;
+}
+
+static void window_end(struct bluez_discovery *discovery)
+{
+	discovery->scanning = FALSE;
+	discovery->stats.scan_time += g_get_monotonic_time() -
+						discovery->window_start;
+	discovery->stats.last_window_devices =
+				discovery->stats.current_window_devices;
+	discovery->stats.current_window_devices = 0;
+}
+
+static void discovery_reconcile(struct bluez_discovery *discovery);
+
+static void discovery_reply(BTResult ret, GVariant *data, void *user_data)
+{
+	struct bluez_discovery *discovery = user_data;
+	gboolean started = discovery->call == CALL_START;
+
+	discovery->call_pending = FALSE;
+
+	if (discovery->closed) {
+		discovery_unref(discovery);
+		return;
+	}
+
+	/* The adapter went away meanwhile, its scan went with it */
+	if (discovery->call_adapter != discovery->adapter) {
+		discovery_reconcile(discovery);
+		discovery_unref(discovery);
+		return;
+	}
+
+	/* Without it BlueZ reports everything, the client side still filters */
+	if (discovery->call == CALL_FILTER) {
+		if (ret != BT_RESULT_OK)
+			printf("Set discovery filter failed: %s\n",
+							ret2str(ret));
+
+		discovery_reconcile(discovery);
+		discovery_unref(discovery);
+		return;
+	}
+
+	/*
+	 * Start failures are left to the retry policy and to the next
+	 * Powered change. BlueZ refuses a stop once it dropped our scan,
+	 * e.g. on power off, which leaves the scan stopped all the same.
+	 */
+	if (started && ret == BT_RESULT_OK)
+		window_begin(discovery);
+	else if (!started)
+		window_end(discovery);
+
+	if (ret != BT_RESULT_OK)
+		printf("%s discovery failed: %s\n", started ? "Start" : "Stop",
+							ret2str(ret));
+
+	if (!started || ret == BT_RESULT_OK)
+		discovery_reconcile(discovery);
+
+	discovery_unref(discovery);
+}
+
+static gboolean discovery_wanted(struct bluez_discovery *discovery)
+{
+	if (g_queue_is_empty(&discovery->sessions))
+		return FALSE;
+
+	return discovery->phase_timer == NULL || discovery->on_phase;
+}
+
+static void discovery_reconcile(struct bluez_discovery *discovery)
+{
+	gboolean wanted = discovery_wanted(discovery);
+
+	if (discovery->call_pending || discovery->adapter == NULL)
+		return;
+
+	if (!discovery->filter_dirty && wanted == discovery->scanning)
+		return;
+
+	discovery->call_pending = TRUE;
+	discovery->call_adapter = discovery->adapter;
+	discovery->ref_count++;
+	discovery->stats.calls++;
+
+	/* Ahead of a start, BlueZ applies it to a running scan as well */
+	if (discovery->filter_dirty) {
+		discovery->filter_dirty = FALSE;
+		discovery->call = CALL_FILTER;
+
+		bluez_adapter_set_discovery_filter_with_reply(
+				discovery->adapter, discovery->filter.set ?
+				&discovery->filter.filter : NULL,
+				BLUEZ_CALL_NORMAL, discovery_reply, discovery);
+		return;
+	}
+
+	discovery->call = wanted ? CALL_START : CALL_STOP;
+
+	if (wanted)
+		bluez_adapter_start_discovery_with_reply(discovery->adapter,
+					BLUEZ_CALL_NORMAL, &start_retry,
+					discovery_reply, discovery);
+	else
+		bluez_adapter_stop_discovery_with_reply(discovery->adapter,
+					BLUEZ_CALL_NORMAL,
+					discovery_reply, discovery);
+}
+
+static void phase_timeout(gpointer user_data)
+{
+	struct bluez_discovery *discovery = user_data;
+	guint scan_ms, period_ms;
+
+	discovery->phase_timer = NULL;
+
+	/* Sessions changing take effect from the next phase on */
+	if (duty_cycle(discovery, &scan_ms, &period_ms)) {
+		discovery->on_phase = !discovery->on_phase;
+		discovery->phase_timer = bluez_timers_add(discovery->timers,
+				discovery->on_phase ? scan_ms :
+						period_ms - scan_ms,
+				phase_timeout, discovery);
+	}
+
+	discovery_reconcile(discovery);
+}
+
+static void discovery_update(struct bluez_discovery *discovery)
+{
+	guint scan_ms, period_ms;
+
+	merge_filters(discovery);
+
+	if (!duty_cycle(discovery, &scan_ms, &period_ms)) {
+		bluez_timers_cancel(discovery->timers, discovery->phase_timer);
+		discovery->phase_timer = NULL;
+	} else if (discovery->phase_timer == NULL) {
+		discovery->on_phase = TRUE;
+		discovery->phase_timer = bluez_timers_add(discovery->timers,
+					scan_ms, phase_timeout, discovery);
+	}
+
+	discovery_reconcile(discovery);
+}
+
+struct bluez_discovery_session *bluez_discovery_acquire(
+			struct bluez_discovery *discovery,
+			const struct bluez_discovery_options *options)
+{
+	struct bluez_discovery_session *session;
+
+	session = g_try_new0(struct bluez_discovery_session, 1);
+	if (!session)
+		return NULL;
+
+	session->discovery = discovery;
+	session->link.data = session;
+
+	if (options && options->scan_ms && options->period_ms) {
+		session->scan_ms = options->scan_ms;
+		session->period_ms = options->period_ms;
+	}
+
+	if (options && options->filter)
+		owned_filter_set(&session->filter, options->filter,
+			g_strdupv((gchar **) options->filter->uuids));
+
+	g_queue_push_tail_link(&discovery->sessions, &session->link);
+
+	discovery_update(discovery);
+
+	return session;
+}
+
+void bluez_discovery_release(struct bluez_discovery_session *session)
+{
+	struct bluez_discovery *discovery = session->discovery;
+
+	g_queue_unlink(&discovery->sessions, &session->link);
+	owned_filter_set(&session->filter, NULL, NULL);
+	g_free(session);
+
+	discovery_update(discovery);
+}
+
+void bluez_discovery_set_adapter(struct bluez_discovery *discovery,
+					struct bluez_adapter *adapter)
+{
+	if (discovery->adapter == adapter)
+		return;
+
+	if (discovery->scanning)
+		window_end(discovery);
+
+	discovery->adapter = adapter;
+
+	/* A new adapter object starts out unfiltered */
+	discovery->filter_dirty = discovery->filter.set;
+
+	discovery_reconcile(discovery);
+}
+
+void bluez_discovery_adapter_changed(struct bluez_discovery *discovery,
+					guint32 properties)
+{
+	gboolean discovering;
+
+	if (discovery->adapter == NULL)
+		return;
+
+	/* Discovering is shared with other clients, only a stop is news */
+	if (properties & BLUEZ_PROPERTY_DISCOVERING && discovery->scanning &&
+						!discovery->call_pending) {
+		bluez_adapter_get_discovering(discovery->adapter,
+							&discovering);
+		if (!discovering)
+			window_end(discovery);
+	}
+
+	if (properties & (BLUEZ_PROPERTY_DISCOVERING | BLUEZ_PROPERTY_POWERED))
+		discovery_reconcile(discovery);
+}
+
+void bluez_discovery_device_found(struct bluez_discovery *discovery,
+							gint64 last_seen)
+{
+	if (!discovery->scanning || last_seen >= discovery->window_start)
+		return;
+
+	discovery->stats.current_window_devices++;
+	discovery->stats.devices_found++;
+}
+
+static gboolean lookup_flag(GVariant *properties, const gchar *name)
+{
+	gboolean value;
+
+	return g_variant_lookup(properties, name, "b", &value) && value;
+}
+
+static gboolean uuids_match(struct bluez_discovery *discovery,
+							const gchar **uuids)
+{
+	bluez_uuid_t uuid;
+
+	for (; *uuids; uuids++) {
+		if (bluez_uuid_parse(*uuids, &uuid) &&
+			bluez_uuid_set_contains(&discovery->uuid_set, &uuid))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+guint32 bluez_discovery_match(struct bluez_discovery *discovery,
+				GVariant *properties, gboolean partial)
+{
+	const struct bluez_discovery_filter *filter = &discovery->filter.filter;
+	const gchar **uuids, *address = NULL, *name = NULL;
+	gint16 rssi, tx_power;
+	gboolean has_rssi, has_tx_power;
+	guint32 failed = 0;
+
+	if (!discovery->filter.set)
+		return 0;
+
+	if (lookup_flag(properties, "Paired") ||
+			lookup_flag(properties, "Connected") ||
+			lookup_flag(properties, "Trusted"))
+		return 0;
+
+	if (filter->uuids) {
+		if (g_variant_lookup(properties, "UUIDs", "^a&s", &uuids)) {
+			if (!uuids_match(discovery, uuids))
+				failed |= BLUEZ_PROPERTY_UUIDS;
+			g_free(uuids);
+		} else if (!partial) {
+			failed |= BLUEZ_PROPERTY_UUIDS;
+		}
+	}
+
+	has_rssi = g_variant_lookup(properties, "RSSI", "n", &rssi);
+	has_tx_power = g_variant_lookup(properties, "TxPower", "n", &tx_power);
+
+	if (filter->rssi) {
+		if (has_rssi ? rssi < filter->rssi : !partial)
+			failed |= BLUEZ_PROPERTY_RSSI;
+	} else if (filter->pathloss) {
+		/* Unknown TxPower passes, as in BlueZ, but not on an update */
+		if (has_rssi && has_tx_power) {
+			if (tx_power - rssi > filter->pathloss)
+				failed |= BLUEZ_PROPERTY_RSSI |
+						BLUEZ_PROPERTY_TX_POWER;
+		} else if (partial) {
+			failed |= BLUEZ_PROPERTY_RSSI |
+						BLUEZ_PROPERTY_TX_POWER;
+		}
+	}
+
+	if (filter->pattern) {
+		g_variant_lookup(properties, "Address", "&s", &address);
+		g_variant_lookup(properties, "Name", "&s", &name);
+
+		if (!(address && g_str_has_prefix(address, filter->pattern)) &&
+			!(name && g_str_has_prefix(name, filter->pattern)) &&
+						(address || name || !partial))
+			failed |= BLUEZ_PROPERTY_ADDRESS | BLUEZ_PROPERTY_NAME;
+	}
+
+	/* Becoming one of the user's devices brings it back */
+	if (failed)
+		failed |= BLUEZ_PROPERTY_PAIRED | BLUEZ_PROPERTY_CONNECTED |
+						BLUEZ_PROPERTY_TRUSTED;
+
+	return failed;
+}
+
+gboolean bluez_discovery_take_relaxed(struct bluez_discovery *discovery)
+{
+	gboolean relaxed = discovery->filter_relaxed;
+
+	discovery->filter_relaxed = FALSE;
+
+	return relaxed;
+}
+
+void bluez_discovery_get_stats(struct bluez_discovery *discovery,
+				struct bluez_discovery_stats *stats)
+{
+	*stats = discovery->stats;
+	stats->sessions = discovery->sessions.length;
+	stats->scanning = discovery->scanning;
+
+	if (discovery->scanning)
+		stats->scan_time += g_get_monotonic_time() -
+						discovery->window_start;
+}
+
+struct bluez_discovery *bluez_discovery_new(struct bluez_timers *timers)
+{
+	struct bluez_discovery *discovery;
+
+	discovery = g_try_new0(struct bluez_discovery, 1);
+	if (!discovery)
+		return NULL;
+
+	discovery->ref_count = 1;
+	discovery->timers = timers;
+	g_queue_init(&discovery->sessions);
+	bluez_uuid_set_init(&discovery->uuid_set);
+
+	return discovery;
+}
+
+void bluez_discovery_free(struct bluez_discovery *discovery)
+{
+	GList *list;
+
+	if (!discovery)
+		return;
+
+	bluez_timers_cancel(discovery->timers, discovery->phase_timer);
+	discovery->phase_timer = NULL;
+
+	/*
+	 * A start still in flight is answered after the free, stop right
+	 * behind it on the same connection or the adapter keeps scanning.
+	 */
+	if (discovery->adapter && (discovery->scanning ||
+			(discovery->call_pending &&
+			discovery->call == CALL_START &&
+			discovery->call_adapter == discovery->adapter)))
+		bluez_adapter_stop_discovery(discovery->adapter);
+
+	while ((list = g_queue_pop_head_link(&discovery->sessions))) {
+		struct bluez_discovery_session *session = list->data;
+
+		owned_filter_set(&session->filter, NULL, NULL);
+		g_free(session);
+	}
+
+	discovery->closed = TRUE;
+	discovery_unref(discovery);
+}
@@ -0,0 +1,77 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_DISCOVERY_H__
+#define __BLUEZ_DISCOVERY_H__
+
+#include <glib.h>
+
+#include "bluez-manager.h"
+
+/*
+ * One adapter's share of discovery. Sessions are reference counted
+ * demand for a scan, the adapter scans while any is held and follows the
+ * most demanding duty cycle among them. Start and StopDiscovery are only
+ * issued when the wanted state differs from the believed one and no call
+ * is in flight, so users coming and going never restart the scan.
+ */
+struct bluez_discovery;
+struct bluez_timers;
+
+struct bluez_discovery *bluez_discovery_new(struct bluez_timers *timers);
+
+/* Stops a running scan and frees the sessions still held */
+void bluez_discovery_free(struct bluez_discovery *discovery);
+
+/* NULL while the adapter is gone, sessions are kept across */
+void bluez_discovery_set_adapter(struct bluez_discovery *discovery,
+					struct bluez_adapter *adapter);
+
+/* properties is a BLUEZ_PROPERTY_* mask of the adapter */
+void bluez_discovery_adapter_changed(struct bluez_discovery *discovery,
+					guint32 properties);
+
+struct bluez_discovery_session *bluez_discovery_acquire(
+			struct bluez_discovery *discovery,
+			const struct bluez_discovery_options *options);
+
+void bluez_discovery_release(struct bluez_discovery_session *session);
+
+/* A device of the adapter reported RSSI, last_seen is the previous update */
+void bluez_discovery_device_found(struct bluez_discovery *discovery,
+							gint64 last_seen);
+
+/*
+ * Client side stage of the merged filter, see bluez_client_filter_cb.
+ * Transport is left to BlueZ, no Device1 property tells it reliably.
+ * Paired, connected and trusted devices always pass.
+ */
+guint32 bluez_discovery_match(struct bluez_discovery *discovery,
+				GVariant *properties, gboolean partial);
+
+/*
+ * TRUE once after sessions coming or going let the merged filter pass
+ * devices it rejected before, the ones dropped meanwhile are missing.
+ */
+gboolean bluez_discovery_take_relaxed(struct bluez_discovery *discovery);
+
+void bluez_discovery_get_stats(struct bluez_discovery *discovery,
+				struct bluez_discovery_stats *stats);
+
+#endif
@@ -20,17 +20,38 @@
 #include <stdio.h>
 #include <glib.h>
 #include <gio/gio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
 
 #include "bluez-adapter.h"
 #include "bluez-device.h"
 #include "bluez-service.h"
 #include "bluez-manager.h"
+#include "bluez-snapshot.h"
+#include "bluez-shm.h"
+#include "bluez-changelog.h"
+#include "bluez-bitmap.h"
+#include "bluez-rssi.h"
+#include "bluez-search.h"
+#include "bluez-adv.h"
+#include "bluez-discovery.h"
+#include "bluez-monitor.h"
+#include "bluez-reaper.h"
+#include "bluez-reconnect.h"
+#include "bluez-scheduler.h"
+#include "bluez-connector.h"
+#include "bluez-timer.h"
+#include "bluez-client.h"
 
 struct bluez_manager {
 	GDBusConnection *conn;
-	GDBusObjectManager *object_manager;
-	GCancellable *get_managed_objects_call;
+	GMainContext *context;			/* context events are handled in */
+	struct bluez_client *client;
+	struct bluez_timers *timers;		/* all library timeouts */
+	struct bluez_scheduler *scheduler;	/* outgoing async calls */
 
 	GHashTable *adapters_hash;
 	GHashTable *devices_hash;
@@ -55,10 +76,100 @@ struct bluez_manager {
 	bluez_service_added_cb service_added;
 	bluez_service_removed_cb service_removed;
 	gpointer service_user_data;
+
+	struct bluez_snapshot_domain *snapshots;
+	GHashTable *snapshot_dirty;		/* devices changed since */
+	struct bluez_timer *snapshot_timer;	/* pending publish */
+	struct bluez_timer *reclaim_timer;
+
+	struct bluez_shm_publisher *shm;
+
+	/* Slot map behind device handles, free slots are chained */
+	struct device_slot *device_slots;
+	guint32 n_device_slots;
+	guint32 max_device_slots;
+	guint32 free_device_slot;
+	GHashTable *address_index;		/* bluez_addr_t -> GSList of
+						   devices, one per adapter */
+	GHashTable *uuid_index;			/* uuid -> GArray of handles */
+
+	/* Secondary indexes over slot indexes */
+	struct bluez_bitmap live_index;
+	struct bluez_bitmap state_index[BLUEZ_DEVICE_N_STATES];
+	GHashTable *adapter_index;		/* adapter name -> bitmap */
+
+	struct bluez_search_index *search_index;
+
+	/* Strongest devices, and the watched top-K set */
+	struct bluez_rssi_index *rssi_index;
+	guint rssi_max_age;			/* seconds */
+	guint top_k;
+	const gchar *top_adapter;		/* interned */
+	bluez_top_rssi_cb top_func;
+	gpointer top_data;
+	bluez_handle_t *top_handles;
+	guint32 *top_slots;			/* same members */
+	guint32 *top_scratch;
+	struct bluez_bitmap top_members;
+	gint16 top_floor;			/* at most the weakest member */
+	guint n_top;
+	struct bluez_timer *top_timer;
+
+	struct bluez_reaper *reaper;
+	GList *connect_jobs;
+	struct bluez_reconnect *reconnect;	/* created on first policy */
+	GHashTable *discoveries;		/* adapter name -> discovery */
+	struct bluez_monitor_app *monitors;	/* exported on first monitor */
+	struct bluez_adv_reporter *adv_reporter;
+
+	guint64 generation;			/* stamp of the last mutation */
+	struct bluez_change_log *changes;
+
+	/* Private context driven by an external event loop */
+	gboolean pollable;
+	int epoll_fd;
+	GPollFD *poll_fds;
+	gint n_poll_fds;
+	gint max_poll_fds;
+	GPollFD *epoll_fds;			/* fds registered in epoll_fd */
+	gint n_epoll_fds;
+	gint max_priority;
+	gint timeout;
+	gboolean prepared;
+};
+
+#define DEFAULT_CHANGE_LOG_SIZE 4096
+#define DEFAULT_RSSI_MAX_AGE 30
+
+/* Snapshot publication rate limit and retired snapshot reclaim period */
+#define SNAPSHOT_DELAY_MS 20
+#define SNAPSHOT_RECLAIM_MS 100
+
+#define NO_SLOT G_MAXUINT32
+
+struct device_slot {
+	struct bluez_device *device;		/* NULL while free */
+	struct bluez_uuid_set uuids;		/* as in uuid_index */
+	guint32 states;				/* as in state_index */
+	const gchar *adapter;			/* interned, adapter_index key */
+	gint64 last_seen;			/* monotonic, usec */
+	guint32 generation;
+	guint32 next_free;
 };
 
 static GDBusNodeInfo *node_info;
 
+/* Interfaces the manager handles, the rest is filtered by the bus */
+static const gchar *tracked_interfaces[] = {
+	ADAPTER_INTERFACE,
+	DEVICE_INTERFACE,
+	SERVICE_INTERFACE,
+	AGENT_INTERFACE,
+	PROFILE_INTERFACE,
+	MONITOR_MANAGER_INTERFACE,
+	NULL
+};
+
 static const gchar introspection_xml[] =
 	"<node>"
 	"  <interface name='org.bluez.Agent1'>"
@@ -97,6 +208,23 @@ static const gchar introspection_xml[] =
 	"  </interface>"
 	"</node>";
 
+/*
+ * A pollable manager's context is only the thread default while the
+ * library works in it, so that objects exported, signals subscribed and
+ * calls made on the way are bound to it.
+ */
+static void enter_context(struct bluez_manager *manager)
+{
+	if (manager->pollable)
+		g_main_context_push_thread_default(manager->context);
+}
+
+static void leave_context(struct bluez_manager *manager)
+{
+	if (manager->pollable)
+		g_main_context_pop_thread_default(manager->context);
+}
+
 static void passkey_reply(struct bluez_manager *manager,
 						int accept, uint8_t *code)
 {
@@ -207,7 +335,9 @@ static void handle_agent_method(GDBusConnection *conn, const gchar *sender,
 	void *request_data;
 	guint32 passkey;
 	guint16 entered;
-	gchar *address;
+	gchar str[BLUEZ_ADDR_STRLEN];
+	gchar *address = NULL;
+	bluez_addr_t addr;
 
 	if (manager->agent_cb == NULL) {
 		printf("Failed to auth request. No agent request callback\n");
@@ -232,145 +362,1576 @@ static void handle_agent_method(GDBusConnection *conn, const gchar *sender,
 	} else if (g_strcmp0(method, "RequestPinCode") == 0) {
 		g_variant_get(value, "(o)", &device_path);
 
-		type = AGENT_REQUEST_PINCODE;
-	} else if (g_strcmp0(method, "DisplayPasskey") == 0) {
-		g_variant_get(value, "(ouq)", &device_path,
-						&passkey, &entered);
+		type = AGENT_REQUEST_PINCODE;
+	} else if (g_strcmp0(method, "DisplayPasskey") == 0) {
+		g_variant_get(value, "(ouq)", &device_path,
+						&passkey, &entered);
+
+		type = AGENT_REQUEST_DISPLAY_PASSKEY;
+	} else if (g_strcmp0(method, "RequestPasskey") == 0) {
+		g_variant_get(value, "(o)", &device_path);
+
+		type = AGENT_REQUEST_PASSKEY;
+	} else if (g_strcmp0(method, "RequestConfirmation") == 0) {
+		g_variant_get(value, "(ou)", &device_path, &passkey);
+
+		type = AGENT_REQUEST_CONFIRMATION;
+		request_data = &passkey;
+	} else if (g_strcmp0(method, "RequestAuthorization") == 0) {
+		g_variant_get(value, "(o)", &device_path);
+
+		type = AGENT_REQUEST_AUTHORIZATION;
+	} else if (g_strcmp0(method, "AuthorizeService") == 0) {
+		g_variant_get(value, "(os)", &device_path, &uuid);
+
+		type = AGENT_REQUEST_AUTHORIZESERVICE;
+	} else if (g_strcmp0(method, "Cancel") == 0) {
+		type = AGENT_REQUEST_CANCEL;
+	} else {
+		type = AGENT_REQUEST_CANCEL;
+		printf("Agent Method: %s\n", method);
+	}
+
+	if (type != AGENT_REQUEST_CANCEL && type != AGENT_REQUEST_RELEASE &&
+				bluez_addr_from_path(device_path, &addr)) {
+		bluez_addr_format(&addr, str);
+		address = str;
+	}
+
+	manager->agent_cb(type, address, request_data,
+					manager->agent_user_data);
+
+	g_free(device_path);
+
+	if (pincode)
+		g_free(pincode);
+
+	if (uuid)
+		g_free(uuid);
+}
+
+static BTResult register_agent(struct bluez_manager *manager, const gchar *path)
+{
+	GVariant *parameter;
+
+	if (manager->agent_proxy == NULL)
+		return BT_RESULT_NOT_READY;
+
+	parameter = g_variant_new("(os)", path, "DisplayYesNo");
+
+	return proxy_method_call(manager->agent_proxy,
+					"RegisterAgent", parameter);
+}
+
+static BTResult set_default_agent(struct bluez_manager *manager,
+							const gchar *path)
+{
+	GVariant *parameter;
+
+	if (manager->agent_proxy == NULL)
+		return BT_RESULT_NOT_READY;
+
+	parameter = g_variant_new("(o)", path);
+
+	return proxy_method_call(manager->agent_proxy,
+					"RequestDefaultAgent", parameter);
+}
+
+static const GDBusInterfaceVTable interface_handle = {
+	handle_agent_method,
+	NULL,
+	NULL
+};
+
+gboolean bluez_manager_register_agent(struct bluez_manager *manager,
+					agent_request_cb cb, void *user_data)
+{
+	guint agent_id;
+
+	node_info = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+
+	enter_context(manager);
+	agent_id = g_dbus_connection_register_object(manager->conn, AGENT_PATH,
+				node_info->interfaces[0], &interface_handle,
+				manager, NULL, NULL);
+	leave_context(manager);
+
+	manager->agent_id = agent_id;
+	manager->agent_cb = cb;
+	manager->agent_user_data = user_data;
+
+	g_dbus_node_info_unref(node_info);
+
+	/* Register agent to BlueZ */
+	if (register_agent(manager, AGENT_PATH) != BT_RESULT_OK) {
+		printf("BlueZ Agent is not available, auto register later.\n");
+
+		return TRUE;
+	}
+
+	set_default_agent(manager, AGENT_PATH);
+
+	printf("BlueZ Agent register success\n");
+
+	return TRUE;
+}
+
+struct bluez_device *find_device_by_addr(struct bluez_manager *manager,
+						const bluez_addr_t *addr)
+{
+	GSList *devices;
+
+	if (manager == NULL || addr == NULL)
+		return NULL;
+
+	devices = g_hash_table_lookup(manager->address_index, addr);
+
+	return devices ? devices->data : NULL;
+}
+
+struct bluez_device *find_device_by_path(struct bluez_manager *manager,
+							const gchar *path)
+{
+	if (manager == NULL || path == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(manager->devices_hash, path);
+}
+
+/* Device path below the adapter, name: "hci0" or "/org/bluez/hci0" */
+static gboolean device_on_adapter(struct bluez_device *device,
+							const gchar *name)
+{
+	const gchar *path = bluez_device_get_path(device);
+	gsize len;
+
+	if (g_str_has_prefix(name, "/org/bluez/"))
+		name += strlen("/org/bluez/");
+
+	if (!g_str_has_prefix(path, "/org/bluez/"))
+		return FALSE;
+
+	path += strlen("/org/bluez/");
+	len = strlen(name);
+
+	return strncmp(path, name, len) == 0 && path[len] == '/';
+}
+
+struct bluez_device *find_adapter_device_by_addr(
+					struct bluez_manager *manager,
+					const gchar *adapter,
+					const bluez_addr_t *addr)
+{
+	GSList *list;
+
+	if (adapter == NULL)
+		return find_device_by_addr(manager, addr);
+
+	if (manager == NULL || addr == NULL)
+		return NULL;
+
+	list = g_hash_table_lookup(manager->address_index, addr);
+	for (; list; list = list->next) {
+		if (device_on_adapter(list->data, adapter))
+			return list->data;
+	}
+
+	return NULL;
+}
+
+guint find_devices_by_addr(struct bluez_manager *manager,
+				const bluez_addr_t *addr,
+				struct bluez_device **devices, guint max)
+{
+	GSList *list;
+	guint n = 0;
+
+	if (manager == NULL || addr == NULL)
+		return 0;
+
+	list = g_hash_table_lookup(manager->address_index, addr);
+	for (; list; list = list->next, n++) {
+		if (n < max)
+			devices[n] = list->data;
+	}
+
+	return n;
+}
+
+struct bluez_device *find_device_by_address(struct bluez_manager *manager,
+							const gchar *address)
+{
+	bluez_addr_t addr;
+
+	if (!bluez_addr_parse(address, &addr))
+		return NULL;
+
+	return find_device_by_addr(manager, &addr);
+}
+
+struct uuid_index_update {
+	struct bluez_manager *manager;
+	bluez_handle_t handle;
+};
+
+static void uuid_index_add(const bluez_uuid_t *uuid, gpointer user_data)
+{
+	struct uuid_index_update *update = user_data;
+	GHashTable *index = update->manager->uuid_index;
+	bluez_uuid_t *key;
+	GArray *handles;
+
+	handles = g_hash_table_lookup(index, uuid);
+	if (!handles) {
+		key = g_new(bluez_uuid_t, 1);
+		*key = *uuid;
+
+		handles = g_array_new(FALSE, FALSE, sizeof(bluez_handle_t));
+		g_hash_table_insert(index, key, handles);
+	}
+
+	g_array_append_val(handles, update->handle);
+}
+
+static void uuid_index_remove(const bluez_uuid_t *uuid, gpointer user_data)
+{
+	struct uuid_index_update *update = user_data;
+	GHashTable *index = update->manager->uuid_index;
+	GArray *handles;
+	guint i;
+
+	handles = g_hash_table_lookup(index, uuid);
+	if (!handles)
+		return;
+
+	for (i = 0; i < handles->len; i++) {
+		if (g_array_index(handles, bluez_handle_t, i) ==
+							update->handle) {
+			g_array_remove_index_fast(handles, i);
+			break;
+		}
+	}
+
+	if (handles->len == 0)
+		g_hash_table_remove(index, uuid);
+}
+
+static void index_device_uuids(struct bluez_manager *manager,
+				struct device_slot *slot, bluez_handle_t handle)
+{
+	struct uuid_index_update update = { manager, handle };
+
+	bluez_uuid_set_foreach(&slot->uuids, uuid_index_remove, &update);
+
+	if (slot->device)
+		bluez_uuid_set_copy(&slot->uuids,
+				bluez_device_get_uuid_set(slot->device));
+	else
+		bluez_uuid_set_clear(&slot->uuids);
+
+	bluez_uuid_set_foreach(&slot->uuids, uuid_index_add, &update);
+}
+
+guint bluez_manager_find_devices_by_uuid(struct bluez_manager *manager,
+				const bluez_uuid_t *uuid,
+				bluez_handle_t *handles, guint max_handles)
+{
+	GArray *array;
+
+	if (manager == NULL || uuid == NULL)
+		return 0;
+
+	array = g_hash_table_lookup(manager->uuid_index, uuid);
+	if (!array)
+		return 0;
+
+	if (handles)
+		memcpy(handles, array->data, MIN(array->len, max_handles) *
+							sizeof(bluez_handle_t));
+
+	return array->len;
+}
+
+static const gchar *adapter_from_path(const gchar *path)
+{
+	gchar name[32];
+	const gchar *start, *end;
+
+	if (path == NULL || !g_str_has_prefix(path, "/org/bluez/"))
+		return NULL;
+
+	start = path + strlen("/org/bluez/");
+	end = strchr(start, '/');
+	if (end == NULL || (gsize) (end - start) >= sizeof(name))
+		return NULL;
+
+	memcpy(name, start, end - start);
+	name[end - start] = '\0';
+
+	return bluez_intern(name);
+}
+
+static guint32 device_states(struct bluez_device *device)
+{
+	struct bluez_device_info info;
+
+	bluez_device_get_info(device, &info);
+
+	return (info.connected ? BLUEZ_DEVICE_CONNECTED : 0) |
+		(info.paired ? BLUEZ_DEVICE_PAIRED : 0) |
+		(info.trusted ? BLUEZ_DEVICE_TRUSTED : 0) |
+		(info.blocked ? BLUEZ_DEVICE_BLOCKED : 0);
+}
+
+static void index_device_states(struct bluez_manager *manager, guint32 index)
+{
+	struct device_slot *slot = &manager->device_slots[index];
+	guint32 states, changed;
+	int i;
+
+	states = slot->device ? device_states(slot->device) : 0;
+	changed = states ^ slot->states;
+
+	for (i = 0; i < BLUEZ_DEVICE_N_STATES; i++) {
+		if (changed & (1 << i))
+			bluez_bitmap_set(&manager->state_index[i], index,
+							states & (1 << i));
+	}
+
+	slot->states = states;
+}
+
+static void index_device_adapter(struct bluez_manager *manager,
+							guint32 index)
+{
+	struct device_slot *slot = &manager->device_slots[index];
+	struct bluez_bitmap *bitmap;
+
+	if (slot->adapter) {
+		bitmap = g_hash_table_lookup(manager->adapter_index,
+							slot->adapter);
+		bluez_bitmap_set(bitmap, index, FALSE);
+
+		bluez_intern_unref(slot->adapter);
+		slot->adapter = NULL;
+	}
+
+	if (slot->device == NULL)
+		return;
+
+	slot->adapter = adapter_from_path(bluez_device_get_path(slot->device));
+	if (slot->adapter == NULL)
+		return;
+
+	bitmap = g_hash_table_lookup(manager->adapter_index, slot->adapter);
+	if (!bitmap) {
+		bitmap = g_new0(struct bluez_bitmap, 1);
+		g_hash_table_insert(manager->adapter_index,
+				(gchar *) bluez_intern(slot->adapter), bitmap);
+	}
+
+	bluez_bitmap_set(bitmap, index, TRUE);
+}
+
+static void free_adapter_bitmap(gpointer data)
+{
+	bluez_bitmap_clear(data);
+	g_free(data);
+}
+
+static gboolean query_match_seen(const struct bluez_device_query *query,
+					gint64 last_seen, gint64 now)
+{
+	if (query->seen_within &&
+		now - last_seen > (gint64) query->seen_within * G_USEC_PER_SEC)
+		return FALSE;
+
+	if (query->unseen_for &&
+		now - last_seen < (gint64) query->unseen_for * G_USEC_PER_SEC)
+		return FALSE;
+
+	return TRUE;
+}
+
+static gboolean query_match(struct bluez_manager *manager,
+				const struct bluez_device_query *query,
+				guint32 index, gint64 now)
+{
+	struct device_slot *slot = &manager->device_slots[index];
+
+	if ((slot->states & query->all_of) != query->all_of)
+		return FALSE;
+
+	if (slot->states & query->none_of)
+		return FALSE;
+
+	if (query->any_of && !(slot->states & query->any_of))
+		return FALSE;
+
+	if (query->adapter && g_strcmp0(slot->adapter, query->adapter))
+		return FALSE;
+
+	return query_match_seen(query, slot->last_seen, now);
+}
+
+static guint query_by_uuid(struct bluez_manager *manager,
+				const struct bluez_device_query *query,
+				bluez_handle_t *handles, guint max_handles)
+{
+	gint64 now = g_get_monotonic_time();
+	bluez_handle_t handle;
+	GArray *array;
+	guint i, n = 0;
+
+	array = g_hash_table_lookup(manager->uuid_index, query->uuid);
+	if (!array)
+		return 0;
+
+	for (i = 0; i < array->len; i++) {
+		handle = g_array_index(array, bluez_handle_t, i);
+
+		if (!query_match(manager, query, BLUEZ_HANDLE_INDEX(handle),
+									now))
+			continue;
+
+		if (handles && n < max_handles)
+			handles[n] = handle;
+		n++;
+	}
+
+	return n;
+}
+
+gboolean bluez_manager_device_matches(struct bluez_manager *manager,
+				const struct bluez_device_query *query,
+				bluez_handle_t handle)
+{
+	guint32 index = BLUEZ_HANDLE_INDEX(handle);
+
+	if (manager == NULL || query == NULL ||
+			bluez_manager_resolve_device(manager, handle) == NULL)
+		return FALSE;
+
+	if (query->uuid && !bluez_uuid_set_contains(
+				&manager->device_slots[index].uuids,
+				query->uuid))
+		return FALSE;
+
+	return query_match(manager, query, index, g_get_monotonic_time());
+}
+
+guint bluez_manager_query_devices(struct bluez_manager *manager,
+				const struct bluez_device_query *query,
+				bluez_handle_t *handles, guint max_handles)
+{
+	const struct bluez_bitmap *adapter = NULL;
+	gint64 now = g_get_monotonic_time();
+	guint64 word, any;
+	guint w, bit, index, n = 0;
+	int i;
+
+	if (manager == NULL || query == NULL)
+		return 0;
+
+	/* The UUID list is usually far shorter than the device table */
+	if (query->uuid)
+		return query_by_uuid(manager, query, handles, max_handles);
+
+	if (query->adapter) {
+		adapter = g_hash_table_lookup(manager->adapter_index,
+							query->adapter);
+		if (!adapter)
+			return 0;
+	}
+
+	for (w = 0; w < manager->live_index.n_words; w++) {
+		word = manager->live_index.words[w];
+		any = query->any_of ? 0 : ~G_GUINT64_CONSTANT(0);
+
+		for (i = 0; i < BLUEZ_DEVICE_N_STATES; i++) {
+			guint64 state = bluez_bitmap_word(
+						&manager->state_index[i], w);
+
+			if (query->all_of & (1 << i))
+				word &= state;
+			if (query->none_of & (1 << i))
+				word &= ~state;
+			if (query->any_of & (1 << i))
+				any |= state;
+		}
+
+		word &= any;
+		if (adapter)
+			word &= bluez_bitmap_word(adapter, w);
+
+		for (; word; word &= word - 1) {
+			bit = __builtin_ctzll(word);
+			index = w * BLUEZ_BITMAP_WORD_BITS + bit;
+
+			if (!query_match_seen(query,
+				manager->device_slots[index].last_seen, now))
+				continue;
+
+			if (handles && n < max_handles)
+				handles[n] = BLUEZ_HANDLE(index,
+				manager->device_slots[index].generation);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+static guint top_rssi(struct bluez_manager *manager, guint k,
+			const gchar *adapter, bluez_handle_t *handles)
+{
+	guint32 *slots;
+	gint64 min_time;
+	guint i, n;
+
+	slots = g_new(guint32, k);
+
+	min_time = g_get_monotonic_time() -
+			(gint64) manager->rssi_max_age * G_USEC_PER_SEC;
+	n = bluez_rssi_index_top(manager->rssi_index, k, adapter,
+							min_time, slots);
+
+	for (i = 0; i < n; i++)
+		handles[i] = BLUEZ_HANDLE(slots[i],
+				manager->device_slots[slots[i]].generation);
+
+	g_free(slots);
+
+	return n;
+}
+
+guint bluez_manager_top_rssi(struct bluez_manager *manager, guint k,
+				const gchar *adapter, bluez_handle_t *handles)
+{
+	if (manager == NULL || handles == NULL || k == 0)
+		return 0;
+
+	return top_rssi(manager, k, adapter, handles);
+}
+
+/*
+ * Recomputes the top-K set and notifies the watcher when devices entered
+ * or left it. Membership is compared through the per slot flags, no
+ * sorting and no allocation.
+ */
+static void check_top_rssi(struct bluez_manager *manager)
+{
+	guint32 *slots = manager->top_scratch;
+	gboolean changed;
+	gint64 min_time;
+	guint i, n;
+
+	if (manager->top_func == NULL)
+		return;
+
+	min_time = g_get_monotonic_time() -
+			(gint64) manager->rssi_max_age * G_USEC_PER_SEC;
+	n = bluez_rssi_index_top(manager->rssi_index, manager->top_k,
+				manager->top_adapter, min_time, slots);
+
+	changed = n != manager->n_top;
+	for (i = 0; i < n && !changed; i++)
+		changed = !bluez_bitmap_test(&manager->top_members, slots[i]);
+
+	for (i = 0; i < manager->n_top; i++)
+		bluez_bitmap_set(&manager->top_members,
+					manager->top_slots[i], FALSE);
+
+	/* Keep the current order either way */
+	for (i = 0; i < n; i++) {
+		bluez_bitmap_set(&manager->top_members, slots[i], TRUE);
+		manager->top_handles[i] = BLUEZ_HANDLE(slots[i],
+				manager->device_slots[slots[i]].generation);
+	}
+
+	manager->top_scratch = manager->top_slots;
+	manager->top_slots = slots;
+	manager->n_top = n;
+	manager->top_floor = n ? bluez_rssi_index_get(manager->rssi_index,
+							slots[n - 1]) : 0;
+
+	if (changed)
+		manager->top_func(manager, manager->top_handles,
+					manager->n_top, manager->top_data);
+}
+
+/*
+ * Whether moving one slot can change the top-K members. A member only
+ * matters when it falls below the floor, a non-member when it reaches
+ * the floor (newer entries win ties) or the set is not full.
+ */
+static gboolean top_may_change(struct bluez_manager *manager, guint32 index)
+{
+	struct device_slot *slot = &manager->device_slots[index];
+	gboolean member, eligible;
+	gint16 rssi;
+
+	rssi = bluez_rssi_index_get(manager->rssi_index, index);
+	eligible = rssi != BLUEZ_RSSI_UNKNOWN && (!manager->top_adapter ||
+			!g_strcmp0(slot->adapter, manager->top_adapter));
+	member = bluez_bitmap_test(&manager->top_members, index);
+
+	if (member)
+		return !eligible || rssi < manager->top_floor;
+
+	return eligible && (manager->n_top < manager->top_k ||
+					rssi >= manager->top_floor);
+}
+
+/* Devices going quiet age out without any event */
+static void top_rssi_timeout(gpointer user_data)
+{
+	struct bluez_manager *manager = user_data;
+
+	manager->top_timer = bluez_timers_add(manager->timers,
+				MAX(manager->rssi_max_age / 2, 1) * 1000,
+				top_rssi_timeout, manager);
+
+	check_top_rssi(manager);
+}
+
+static void index_device_rssi(struct bluez_manager *manager, guint32 index)
+{
+	struct device_slot *slot = &manager->device_slots[index];
+	gint16 rssi = BLUEZ_RSSI_UNKNOWN;
+
+	if (slot->device)
+		bluez_device_get_rssi(slot->device, &rssi);
+
+	bluez_rssi_index_update(manager->rssi_index, index, rssi,
+				slot->adapter, g_get_monotonic_time());
+
+	if (manager->top_func && top_may_change(manager, index))
+		check_top_rssi(manager);
+}
+
+BTResult bluez_manager_set_top_rssi_watch(struct bluez_manager *manager,
+				guint k, const gchar *adapter,
+				bluez_top_rssi_cb func, gpointer user_data)
+{
+	if (manager == NULL || (func && k == 0))
+		return BT_RESULT_INVALID_ARGS;
+
+	bluez_timers_cancel(manager->timers, manager->top_timer);
+	manager->top_timer = NULL;
+
+	bluez_intern_unref(manager->top_adapter);
+	g_free(manager->top_handles);
+	g_free(manager->top_slots);
+	g_free(manager->top_scratch);
+	bluez_bitmap_clear(&manager->top_members);
+
+	manager->top_k = k;
+	manager->top_adapter = bluez_intern(adapter);
+	manager->top_func = func;
+	manager->top_data = user_data;
+	manager->top_handles = func ? g_new(bluez_handle_t, k) : NULL;
+	manager->top_slots = func ? g_new(guint32, k) : NULL;
+	manager->top_scratch = func ? g_new(guint32, k) : NULL;
+	manager->n_top = 0;
+
+	if (func == NULL)
+		return BT_RESULT_OK;
+
+	top_rssi_timeout(manager);
+
+	return BT_RESULT_OK;
+}
+
+BTResult bluez_manager_set_rssi_max_age(struct bluez_manager *manager,
+							guint seconds)
+{
+	if (manager == NULL || seconds == 0)
+		return BT_RESULT_INVALID_ARGS;
+
+	manager->rssi_max_age = seconds;
+
+	return BT_RESULT_OK;
+}
+
+static void index_device_names(struct bluez_manager *manager, guint32 index)
+{
+	struct device_slot *slot = &manager->device_slots[index];
+	struct bluez_device_info info;
+
+	if (slot->device == NULL) {
+		bluez_search_index_update(manager->search_index, index,
+								NULL, NULL);
+		return;
+	}
+
+	bluez_device_get_info(slot->device, &info);
+	bluez_search_index_update(manager->search_index, index, info.name,
+								info.alias);
+}
+
+guint bluez_manager_search_devices(struct bluez_manager *manager,
+				const gchar *text, enum bluez_search_mode mode,
+				bluez_handle_t *handles, guint max_handles)
+{
+	guint32 *slots;
+	guint i, n;
+
+	if (manager == NULL || text == NULL)
+		return 0;
+
+	slots = handles ? g_new(guint32, max_handles) : NULL;
+
+	n = bluez_search_index_find(manager->search_index, text,
+				mode == BLUEZ_SEARCH_PREFIX, slots,
+				handles ? max_handles : 0);
+
+	for (i = 0; handles && i < MIN(n, max_handles); i++)
+		handles[i] = BLUEZ_HANDLE(slots[i],
+				manager->device_slots[slots[i]].generation);
+
+	g_free(slots);
+
+	return n;
+}
+
+static void reindex_device(struct bluez_manager *manager,
+				struct bluez_device *device, guint32 properties)
+{
+	bluez_handle_t handle = bluez_device_get_handle(device);
+	guint32 index = BLUEZ_HANDLE_INDEX(handle);
+
+	if (bluez_manager_resolve_device(manager, handle) != device)
+		return;
+
+	/* Any update from BlueZ means the device is around */
+	manager->device_slots[index].last_seen = g_get_monotonic_time();
+
+	if (properties & BLUEZ_PROPERTY_UUIDS)
+		index_device_uuids(manager, &manager->device_slots[index],
+									handle);
+
+	if (properties & (BLUEZ_PROPERTY_CONNECTED | BLUEZ_PROPERTY_PAIRED |
+			BLUEZ_PROPERTY_TRUSTED | BLUEZ_PROPERTY_BLOCKED))
+		index_device_states(manager, index);
+
+	if (properties & BLUEZ_PROPERTY_RSSI)
+		index_device_rssi(manager, index);
+
+	if (properties & (BLUEZ_PROPERTY_NAME | BLUEZ_PROPERTY_ALIAS))
+		index_device_names(manager, index);
+}
+
+static void address_index_add(struct bluez_manager *manager,
+						struct bluez_device *device)
+{
+	const bluez_addr_t *addr = bluez_device_get_addr(device);
+	GSList *devices;
+
+	devices = g_hash_table_lookup(manager->address_index, addr);
+	if (devices) {
+		/* The table holds the head link, it never changes */
+		devices->next = g_slist_prepend(devices->next, device);
+		return;
+	}
+
+	g_hash_table_insert(manager->address_index,
+				g_memdup(addr, sizeof(*addr)),
+				g_slist_prepend(NULL, device));
+}
+
+static void address_index_remove(struct bluez_manager *manager,
+						struct bluez_device *device)
+{
+	const bluez_addr_t *addr = bluez_device_get_addr(device);
+	GSList *devices;
+
+	devices = g_hash_table_lookup(manager->address_index, addr);
+	if (devices == NULL)
+		return;
+
+	if (devices->data != device) {
+		g_slist_remove(devices, device);
+	} else if (devices->next == NULL) {
+		g_hash_table_remove(manager->address_index, addr);
+	} else {
+		devices->data = devices->next->data;
+		devices->next = g_slist_delete_link(devices->next,
+							devices->next);
+	}
+}
+
+static bluez_handle_t alloc_device_handle(struct bluez_manager *manager,
+						struct bluez_device *device)
+{
+	struct device_slot *slot;
+	bluez_handle_t handle;
+	guint32 index;
+
+	if (manager->free_device_slot != NO_SLOT) {
+		index = manager->free_device_slot;
+		manager->free_device_slot =
+				manager->device_slots[index].next_free;
+	} else {
+		if (manager->n_device_slots == manager->max_device_slots) {
+			manager->max_device_slots =
+				MAX(16, manager->max_device_slots * 2);
+			manager->device_slots = g_renew(struct device_slot,
+						manager->device_slots,
+						manager->max_device_slots);
+		}
+
+		index = manager->n_device_slots++;
+		manager->device_slots[index].generation = 1;
+	}
+
+	slot = &manager->device_slots[index];
+	slot->device = device;
+	slot->next_free = NO_SLOT;
+	slot->states = 0;
+	slot->adapter = NULL;
+	slot->last_seen = g_get_monotonic_time();
+	bluez_uuid_set_init(&slot->uuids);
+
+	bluez_bitmap_set(&manager->live_index, index, TRUE);
+	index_device_states(manager, index);
+	index_device_adapter(manager, index);
+	index_device_rssi(manager, index);
+	index_device_names(manager, index);
+
+	address_index_add(manager, device);
+
+	handle = BLUEZ_HANDLE(index, slot->generation);
+	index_device_uuids(manager, slot, handle);
+
+	return handle;
+}
+
+static void notify_connect_jobs(struct bluez_manager *manager,
+				bluez_handle_t handle,
+				struct bluez_device *device)
+{
+	GList *list, *next;
+
+	/* A callback may free its job, and with it the list link */
+	for (list = manager->connect_jobs; list; list = next) {
+		next = list->next;
+		bluez_connect_job_device_changed(list->data, handle, device);
+	}
+}
+
+static void release_device_handle(struct bluez_manager *manager,
+						bluez_handle_t handle)
+{
+	struct device_slot *slot;
+	guint32 index = BLUEZ_HANDLE_INDEX(handle);
+
+	if (bluez_manager_resolve_device(manager, handle) == NULL)
+		return;
+
+	slot = &manager->device_slots[index];
+
+	address_index_remove(manager, slot->device);
+
+	/* Outstanding handles to this slot stop resolving */
+	slot->device = NULL;
+	index_device_uuids(manager, slot, handle);
+	index_device_states(manager, index);
+	bluez_rssi_index_remove(manager->rssi_index, index);
+	index_device_adapter(manager, index);
+	index_device_names(manager, index);
+	bluez_bitmap_set(&manager->live_index, index, FALSE);
+
+	slot->generation++;
+	if (slot->generation == 0)
+		slot->generation = 1;
+
+	slot->next_free = manager->free_device_slot;
+	manager->free_device_slot = index;
+
+	if (bluez_bitmap_test(&manager->top_members, index))
+		check_top_rssi(manager);
+	notify_connect_jobs(manager, handle, NULL);
+}
+
+struct bluez_device *bluez_manager_resolve_device(
+				struct bluez_manager *manager,
+				bluez_handle_t handle)
+{
+	struct device_slot *slot;
+	guint32 index = BLUEZ_HANDLE_INDEX(handle);
+
+	if (manager == NULL || index >= manager->n_device_slots)
+		return NULL;
+
+	slot = &manager->device_slots[index];
+	if (slot->generation != BLUEZ_HANDLE_GENERATION(handle))
+		return NULL;
+
+	return slot->device;
+}
+
+guint bluez_manager_get_device_slots(struct bluez_manager *manager)
+{
+	if (manager == NULL)
+		return 0;
+
+	return manager->n_device_slots;
+}
+
+/* Readers still picking up a replaced snapshot are gone long before */
+static void reclaim_snapshots(gpointer user_data)
+{
+	struct bluez_manager *manager = (struct bluez_manager *) user_data;
+
+	manager->reclaim_timer = NULL;
+
+	if (bluez_snapshot_domain_reclaim(manager->snapshots))
+		manager->reclaim_timer = bluez_timers_add(manager->timers,
+				SNAPSHOT_RECLAIM_MS, reclaim_snapshots,
+				manager);
+}
+
+/* Records of devices neither changed nor removed are carried forward */
+static gboolean snapshot_keep(const struct bluez_device_info *info,
+							gpointer user_data)
+{
+	struct bluez_manager *manager = (struct bluez_manager *) user_data;
+	struct bluez_device *device;
+
+	device = g_hash_table_lookup(manager->devices_hash, info->path);
+
+	return device && !g_hash_table_contains(manager->snapshot_dirty,
+								device);
+}
+
+static void publish_snapshot(gpointer user_data)
+{
+	struct bluez_manager *manager = (struct bluez_manager *) user_data;
+	struct bluez_snapshot *base, *snapshot;
+	struct bluez_device_info info;
+	GHashTableIter iter;
+	gpointer device;
+
+	manager->snapshot_timer = NULL;
+
+	base = bluez_snapshot_domain_acquire(manager->snapshots);
+	snapshot = bluez_snapshot_new_from(base, manager->generation,
+						snapshot_keep, manager);
+	bluez_snapshot_unref(base);
+	if (!snapshot)
+		return;
+
+	g_hash_table_iter_init(&iter, manager->snapshot_dirty);
+	while (g_hash_table_iter_next(&iter, &device, NULL)) {
+		bluez_device_get_info(device, &info);
+		bluez_snapshot_add_device(snapshot, &info);
+	}
+
+	g_hash_table_remove_all(manager->snapshot_dirty);
+
+	bluez_snapshot_seal(snapshot);
+
+	bluez_snapshot_domain_publish(manager->snapshots, snapshot);
+
+	if (!manager->reclaim_timer)
+		manager->reclaim_timer = bluez_timers_add(manager->timers,
+				SNAPSHOT_RECLAIM_MS, reclaim_snapshots,
+				manager);
+}
+
+/*
+ * Changes are coalesced, a snapshot is published at most once per
+ * SNAPSHOT_DELAY_MS no matter how many signals arrived in between.
+ * device is NULL when one went away.
+ */
+static void schedule_snapshot(struct bluez_manager *manager,
+					struct bluez_device *device)
+{
+	if (device)
+		g_hash_table_add(manager->snapshot_dirty, device);
+
+	if (manager->snapshot_timer)
+		return;
+
+	manager->snapshot_timer = bluez_timers_add(manager->timers,
+				SNAPSHOT_DELAY_MS, publish_snapshot, manager);
+}
+
+static void log_change(struct bluez_manager *manager,
+				enum bluez_change_type type,
+				enum bluez_object_type object,
+				bluez_handle_t handle,
+				const gchar *path, guint32 properties)
+{
+	manager->generation = bluez_change_log_append(manager->changes, type,
+					object, handle, path, properties);
+}
+
+guint64 bluez_manager_get_generation(struct bluez_manager *manager)
+{
+	if (manager == NULL)
+		return 0;
+
+	return manager->generation;
+}
+
+BTResult bluez_manager_changes_since(struct bluez_manager *manager,
+				guint64 generation,
+				struct bluez_change *changes,
+				guint max_changes, guint *n_changes)
+{
+	if (manager == NULL || n_changes == NULL ||
+				(changes == NULL && max_changes > 0))
+		return BT_RESULT_INVALID_ARGS;
+
+	return bluez_change_log_since(manager->changes, generation, changes,
+						max_changes, n_changes);
+}
+
+BTResult bluez_manager_set_change_log_size(struct bluez_manager *manager,
+								guint size)
+{
+	if (manager == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	return bluez_change_log_resize(manager->changes, size);
+}
+
+#define DISCOVERY_KEY_MAX 32
+
+/*
+ * Adapter name of "hci0" or an object path at or below the adapter, in
+ * key. Called for every device update, so nothing is allocated.
+ */
+static gboolean discovery_key(const gchar *adapter,
+					gchar key[DISCOVERY_KEY_MAX])
+{
+	gsize len;
+
+	if (g_str_has_prefix(adapter, "/org/bluez/"))
+		adapter += strlen("/org/bluez/");
+
+	len = strcspn(adapter, "/");
+	if (len >= DISCOVERY_KEY_MAX)
+		return FALSE;
+
+	memcpy(key, adapter, len);
+	key[len] = '\0';
+
+	return TRUE;
+}
+
+static struct bluez_discovery *find_discovery(struct bluez_manager *manager,
+							const gchar *adapter)
+{
+	gchar key[DISCOVERY_KEY_MAX];
+
+	if (manager->discoveries == NULL || adapter == NULL ||
+					!discovery_key(adapter, key))
+		return NULL;
+
+	return g_hash_table_lookup(manager->discoveries, key);
+}
+
+static gint64 device_last_seen(struct bluez_manager *manager,
+						struct bluez_device *device)
+{
+	bluez_handle_t handle = bluez_device_get_handle(device);
+
+	if (bluez_manager_resolve_device(manager, handle) != device)
+		return 0;
+
+	return manager->device_slots[BLUEZ_HANDLE_INDEX(handle)].last_seen;
+}
+
+static void notify_discovery(struct bluez_manager *manager,
+			struct bluez_device *device, gint64 last_seen)
+{
+	struct bluez_discovery *discovery;
+
+	discovery = find_discovery(manager, bluez_device_get_path(device));
+	if (discovery)
+		bluez_discovery_device_found(discovery, last_seen);
+}
+
+static guint32 device_filter(const gchar *path, GVariant *properties,
+					gboolean partial, gpointer user_data)
+{
+	struct bluez_manager *manager = (struct bluez_manager *) user_data;
+	struct bluez_discovery *discovery;
+
+	discovery = find_discovery(manager, path);
+	if (discovery == NULL)
+		return 0;
+
+	return bluez_discovery_match(discovery, properties, partial);
+}
+
+static void adapter_changed(struct bluez_adapter *adapter,
+				gchar **prop_names, gpointer user_data)
+{
+	struct bluez_manager *manager = (struct bluez_manager *) user_data;
+
+	guint32 mask = bluez_property_mask(prop_names);
+	struct bluez_discovery *discovery;
+
+	log_change(manager, BLUEZ_CHANGE_PROPERTIES, BLUEZ_OBJECT_ADAPTER,
+					BLUEZ_HANDLE_INVALID,
+					bluez_adapter_get_path(adapter), mask);
+
+	discovery = find_discovery(manager, bluez_adapter_get_path(adapter));
+	if (discovery)
+		bluez_discovery_adapter_changed(discovery, mask);
+}
+
+static void device_changed(struct bluez_device *device,
+				gchar **prop_names, gpointer user_data)
+{
+	struct bluez_manager *manager = (struct bluez_manager *) user_data;
+	guint32 mask = bluez_property_mask(prop_names);
+	gint64 last_seen = device_last_seen(manager, device);
+
+	log_change(manager, BLUEZ_CHANGE_PROPERTIES, BLUEZ_OBJECT_DEVICE,
+					bluez_device_get_handle(device),
+					bluez_device_get_path(device), mask);
+
+	reindex_device(manager, device, mask);
+
+	if (mask & BLUEZ_PROPERTY_RSSI)
+		notify_discovery(manager, device, last_seen);
+
+	if (mask & BLUEZ_PROPERTY_CONNECTED)
+		notify_connect_jobs(manager, bluez_device_get_handle(device),
+								device);
+
+	if (manager->reconnect)
+		bluez_reconnect_device_changed(manager->reconnect, device,
+								mask);
+
+	if (manager->adv_reporter)
+		bluez_adv_reporter_device_changed(manager->adv_reporter,
+								device, mask);
+
+	bluez_shm_publisher_update(manager->shm, device, manager->generation);
+	schedule_snapshot(manager, device);
+}
+
+static void service_changed(struct bluez_service *service,
+				gchar **prop_names, gpointer user_data)
+{
+	struct bluez_manager *manager = (struct bluez_manager *) user_data;
+
+	log_change(manager, BLUEZ_CHANGE_PROPERTIES, BLUEZ_OBJECT_SERVICE,
+					BLUEZ_HANDLE_INVALID,
+					bluez_service_get_path(service),
+					bluez_property_mask(prop_names));
+}
+
+static void publish_shm_device(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct bluez_manager *manager = user_data;
+
+	bluez_shm_publisher_update(manager->shm, value, manager->generation);
+}
+
+BTResult bluez_manager_publish_shm(struct bluez_manager *manager,
+					const gchar *name, guint capacity)
+{
+	if (manager == NULL || name == NULL || capacity == 0)
+		return BT_RESULT_INVALID_ARGS;
+
+	if (manager->shm)
+		return BT_RESULT_ALREADY_EXISTS;
+
+	manager->shm = bluez_shm_publisher_new(name, capacity,
+							manager->context);
+	if (!manager->shm)
+		return BT_RESULT_FAILED;
+
+	g_hash_table_foreach(manager->devices_hash, publish_shm_device,
+								manager);
+
+	return BT_RESULT_OK;
+}
+
+struct bluez_snapshot *bluez_manager_get_snapshot(
+					struct bluez_manager *manager)
+{
+	if (manager == NULL)
+		return NULL;
+
+	return bluez_snapshot_domain_acquire(manager->snapshots);
+}
+
+struct bluez_adapter *bluez_manager_get_device_adapter(
+					struct bluez_manager *manager,
+					struct bluez_device *device)
+{
+	gchar path[128];
+	const gchar *device_path;
+	gchar *sep;
+
+	if (manager == NULL || device == NULL)
+		return NULL;
+
+	device_path = bluez_device_get_path(device);
+	if (device_path == NULL || strlen(device_path) >= sizeof(path))
+		return NULL;
+
+	strcpy(path, device_path);
+
+	sep = strrchr(path, '/');
+	if (sep == NULL)
+		return NULL;
+
+	*sep = '\0';
+
+	return g_hash_table_lookup(manager->adapters_hash, path);
+}
+
+struct bluez_connect_job *bluez_manager_connect_devices(
+				struct bluez_manager *manager,
+				const bluez_handle_t *handles, guint n_handles,
+				const struct bluez_connect_options *options,
+				bluez_connect_cb func, bluez_connect_done_cb done,
+				gpointer user_data)
+{
+	struct bluez_connect_options defaults = { 0 };
+	struct bluez_connect_job *job;
+
+	if (manager == NULL || (handles == NULL && n_handles))
+		return NULL;
+
+	job = bluez_connect_job_new(manager, handles, n_handles,
+				options ? options : &defaults,
+				func, done, user_data, manager->timers);
+	if (job == NULL)
+		return NULL;
+
+	manager->connect_jobs = g_list_prepend(manager->connect_jobs, job);
+
+	bluez_connect_job_start(job);
+
+	return job;
+}
+
+BTResult bluez_manager_get_connect_stats(struct bluez_manager *manager,
+				struct bluez_connect_job *job,
+				struct bluez_connect_stats *stats)
+{
+	if (manager == NULL || job == NULL || stats == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	bluez_connect_job_get_stats(job, stats);
+
+	return BT_RESULT_OK;
+}
+
+void bluez_manager_free_connect_job(struct bluez_manager *manager,
+				struct bluez_connect_job *job)
+{
+	if (manager == NULL || job == NULL)
+		return;
+
+	manager->connect_jobs = g_list_remove(manager->connect_jobs, job);
+	bluez_connect_job_free(job);
+}
+
+struct bluez_scheduler *bluez_manager_get_scheduler(
+					struct bluez_manager *manager)
+{
+	if (manager == NULL)
+		return NULL;
+
+	return manager->scheduler;
+}
+
+BTResult bluez_manager_start_reaper(struct bluez_manager *manager,
+				const struct bluez_reaper_policy *policy)
+{
+	struct bluez_reaper_policy defaults = { 0 };
+
+	if (manager == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	bluez_manager_stop_reaper(manager);
+
+	manager->reaper = bluez_reaper_new(manager,
+				policy ? policy : &defaults, manager->timers);
+	if (manager->reaper == NULL)
+		return BT_RESULT_FAILED;
+
+	return BT_RESULT_OK;
+}
+
+void bluez_manager_stop_reaper(struct bluez_manager *manager)
+{
+	if (manager == NULL)
+		return;
+
+	bluez_reaper_free(manager->reaper);
+	manager->reaper = NULL;
+}
+
+BTResult bluez_manager_get_reaper_stats(struct bluez_manager *manager,
+				struct bluez_reaper_stats *stats)
+{
+	if (manager == NULL || stats == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	if (manager->reaper == NULL)
+		return BT_RESULT_NOT_READY;
+
+	bluez_reaper_get_stats(manager->reaper, stats);
+
+	return BT_RESULT_OK;
+}
+
+static struct bluez_reconnect *get_reconnect(struct bluez_manager *manager)
+{
+	if (manager->reconnect == NULL)
+		manager->reconnect = bluez_reconnect_new(manager,
+							manager->timers);
+
+	return manager->reconnect;
+}
+
+BTResult bluez_manager_set_reconnect_policy(struct bluez_manager *manager,
+				const bluez_addr_t *addr,
+				const struct bluez_reconnect_policy *policy)
+{
+	if (manager == NULL || addr == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	if (policy && (policy->window_start >= 24 * 60 ||
+					policy->window_end >= 24 * 60))
+		return BT_RESULT_INVALID_ARGS;
+
+	if (get_reconnect(manager) == NULL)
+		return BT_RESULT_FAILED;
+
+	bluez_reconnect_set_policy(manager->reconnect, addr, policy);
+
+	return BT_RESULT_OK;
+}
+
+BTResult bluez_manager_load_reconnect_policies(struct bluez_manager *manager,
+						const gchar *filename)
+{
+	if (manager == NULL || filename == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	if (get_reconnect(manager) == NULL)
+		return BT_RESULT_FAILED;
+
+	return bluez_reconnect_load(manager->reconnect, filename);
+}
+
+BTResult bluez_manager_save_reconnect_policies(struct bluez_manager *manager,
+						const gchar *filename)
+{
+	if (manager == NULL || filename == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	if (get_reconnect(manager) == NULL)
+		return BT_RESULT_FAILED;
+
+	return bluez_reconnect_save(manager->reconnect, filename);
+}
+
+BTResult bluez_manager_get_reconnect_stats(struct bluez_manager *manager,
+				struct bluez_reconnect_stats *stats)
+{
+	if (manager == NULL || stats == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	if (manager->reconnect == NULL) {
+		memset(stats, 0, sizeof(*stats));
+		return BT_RESULT_OK;
+	}
 
-		type = AGENT_REQUEST_DISPLAY_PASSKEY;
-	} else if (g_strcmp0(method, "RequestPasskey") == 0) {
-		g_variant_get(value, "(o)", &device_path);
+	bluez_reconnect_get_stats(manager->reconnect, stats);
 
-		type = AGENT_REQUEST_PASSKEY;
-	} else if (g_strcmp0(method, "RequestConfirmation") == 0) {
-		g_variant_get(value, "(ou)", &device_path, &passkey);
+	return BT_RESULT_OK;
+}
 
-		type = AGENT_REQUEST_CONFIRMATION;
-		request_data = &passkey;
-	} else if (g_strcmp0(method, "RequestAuthorization") == 0) {
-		g_variant_get(value, "(o)", &device_path);
+BTResult bluez_manager_set_adv_report_watch(struct bluez_manager *manager,
+				const struct bluez_adv_report_options *options,
+				bluez_adv_report_cb func, gpointer user_data)
+{
+	struct bluez_adv_reporter *reporter = NULL, *old;
 
-		type = AGENT_REQUEST_AUTHORIZATION;
-	} else if (g_strcmp0(method, "AuthorizeService") == 0) {
-		g_variant_get(value, "(os)", &device_path, &uuid);
+	if (manager == NULL)
+		return BT_RESULT_INVALID_ARGS;
 
-		type = AGENT_REQUEST_AUTHORIZESERVICE;
-	} else if (g_strcmp0(method, "Cancel") == 0) {
-		type = AGENT_REQUEST_CANCEL;
-	} else {
-		type = AGENT_REQUEST_CANCEL;
-		printf("Agent Method: %s\n", method);
+	if (func) {
+		reporter = bluez_adv_reporter_new(manager, options, func,
+						user_data, manager->timers);
+		if (reporter == NULL)
+			return BT_RESULT_FAILED;
 	}
 
-	if (type != AGENT_REQUEST_CANCEL && type != AGENT_REQUEST_RELEASE) {
-		address = g_strdup(g_strrstr(device_path, "dev_") + strlen("dev_"));
-		g_strdelimit(address, "_", ':');
-	} else
-		address = NULL;
+	/* Swapped first, the old callback may set another watch */
+	old = manager->adv_reporter;
+	manager->adv_reporter = reporter;
+	bluez_adv_reporter_free(old, TRUE);
 
-	manager->agent_cb(type, address, request_data,
-					manager->agent_user_data);
+	return BT_RESULT_OK;
+}
 
-	g_free(address);
-	g_free(device_path);
+BTResult bluez_manager_get_adv_report_stats(struct bluez_manager *manager,
+				struct bluez_adv_report_stats *stats)
+{
+	if (manager == NULL || stats == NULL)
+		return BT_RESULT_INVALID_ARGS;
 
-	if (pincode)
-		g_free(pincode);
+	if (manager->adv_reporter == NULL) {
+		memset(stats, 0, sizeof(*stats));
+		return BT_RESULT_OK;
+	}
 
-	if (uuid)
-		g_free(uuid);
+	bluez_adv_reporter_get_stats(manager->adv_reporter, stats);
+
+	return BT_RESULT_OK;
 }
 
-static BTResult register_agent(struct bluez_manager *manager, const gchar *path)
+/* Objects a merged filter dropped are fetched again once it got looser */
+static void refilter_relaxed(struct bluez_manager *manager)
 {
-	GVariant *parameter;
+	gboolean relaxed = FALSE;
+	GHashTableIter iter;
+	gpointer discovery;
 
-	if (manager->agent_proxy == NULL)
-		return BT_RESULT_NOT_READY;
+	g_hash_table_iter_init(&iter, manager->discoveries);
+	while (g_hash_table_iter_next(&iter, NULL, &discovery))
+		relaxed |= bluez_discovery_take_relaxed(discovery);
 
-	parameter = g_variant_new("(os)", path, "DisplayYesNo");
+	if (!relaxed)
+		return;
 
-	return proxy_method_call(manager->agent_proxy,
-					"RegisterAgent", parameter);
+	enter_context(manager);
+	bluez_client_refilter(manager->client);
+	leave_context(manager);
 }
 
-static BTResult set_default_agent(struct bluez_manager *manager,
-							const gchar *path)
+struct bluez_discovery_session *bluez_manager_acquire_discovery(
+			struct bluez_manager *manager, const gchar *adapter,
+			const struct bluez_discovery_options *options)
 {
-	GVariant *parameter;
+	struct bluez_discovery_session *session;
+	struct bluez_discovery *discovery;
+	gchar key[DISCOVERY_KEY_MAX], *path;
 
-	if (manager->agent_proxy == NULL)
-		return BT_RESULT_NOT_READY;
+	if (manager == NULL || adapter == NULL || !discovery_key(adapter, key))
+		return NULL;
 
-	parameter = g_variant_new("(o)", path);
+	if (manager->discoveries == NULL)
+		manager->discoveries = g_hash_table_new_full(g_str_hash,
+					g_str_equal, g_free,
+					(GDestroyNotify) bluez_discovery_free);
 
-	return proxy_method_call(manager->agent_proxy,
-					"RequestDefaultAgent", parameter);
-}
+	discovery = find_discovery(manager, adapter);
+	if (discovery == NULL) {
+		discovery = bluez_discovery_new(manager->timers);
+		if (discovery == NULL)
+			return NULL;
 
-static const GDBusInterfaceVTable interface_handle = {
-	handle_agent_method,
-	NULL,
-	NULL
-};
+		g_hash_table_insert(manager->discoveries, g_strdup(key),
+								discovery);
 
-gboolean bluez_manager_register_agent(struct bluez_manager *manager,
-					agent_request_cb cb, void *user_data)
+		path = g_strconcat("/org/bluez/", key, NULL);
+		bluez_discovery_set_adapter(discovery,
+			g_hash_table_lookup(manager->adapters_hash, path));
+		g_free(path);
+	}
+
+	session = bluez_discovery_acquire(discovery, options);
+
+	refilter_relaxed(manager);
+
+	return session;
+}
+
+void bluez_manager_release_discovery(struct bluez_manager *manager,
+			struct bluez_discovery_session *session)
 {
-	guint agent_id;
+	if (manager == NULL || session == NULL)
+		return;
 
-	node_info = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+	bluez_discovery_release(session);
 
-	agent_id = g_dbus_connection_register_object(manager->conn, AGENT_PATH,
-				node_info->interfaces[0], &interface_handle,
-				manager, NULL, NULL);
+	refilter_relaxed(manager);
+}
 
-	manager->agent_id = agent_id;
-	manager->agent_cb = cb;
-	manager->agent_user_data = user_data;
+struct bluez_monitor *bluez_manager_add_monitor(
+				struct bluez_manager *manager,
+				const struct bluez_monitor_options *options,
+				bluez_monitor_cb func, gpointer user_data)
+{
+	struct bluez_monitor *monitor = NULL;
+	GHashTableIter iter;
+	gpointer adapter;
 
-	g_dbus_node_info_unref(node_info);
+	if (manager == NULL || options == NULL)
+		return NULL;
 
-	/* Register agent to BlueZ */
-	if (register_agent(manager, AGENT_PATH) != BT_RESULT_OK) {
-		printf("BlueZ Agent is not available, auto register later.\n");
+	enter_context(manager);
 
-		return TRUE;
+	if (manager->monitors == NULL) {
+		manager->monitors = bluez_monitor_app_new(manager,
+						manager->conn, MONITOR_PATH);
+		if (manager->monitors == NULL)
+			goto done;
+
+		g_hash_table_iter_init(&iter, manager->adapters_hash);
+		while (g_hash_table_iter_next(&iter, NULL, &adapter))
+			bluez_monitor_app_register(manager->monitors, adapter);
 	}
 
-	set_default_agent(manager, AGENT_PATH);
+	monitor = bluez_monitor_app_add(manager->monitors, options,
+							func, user_data);
 
-	printf("BlueZ Agent register success\n");
+done:
+	leave_context(manager);
 
-	return TRUE;
+	return monitor;
 }
 
-struct bluez_device *find_device_by_address(struct bluez_manager *manager,
-							const gchar *address)
+void bluez_manager_remove_monitor(struct bluez_manager *manager,
+				struct bluez_monitor *monitor)
 {
-	GHashTableIter iter;
-	gpointer key, device;
-	gchar *path;
+	if (manager == NULL || monitor == NULL || manager->monitors == NULL)
+		return;
 
-	path = g_strdup(address);
-	g_strdelimit(path, ":", '_');
+	bluez_monitor_app_remove(manager->monitors, monitor);
+}
 
-	g_hash_table_iter_init(&iter, manager->devices_hash);
-	while (g_hash_table_iter_next(&iter, &key, &device)) {
-		if (g_strrstr(key, path)) {
-			g_free(path);
-			return device;
-		}
+BTResult bluez_manager_get_discovery_stats(struct bluez_manager *manager,
+			const gchar *adapter,
+			struct bluez_discovery_stats *stats)
+{
+	struct bluez_discovery *discovery;
+
+	if (manager == NULL || adapter == NULL || stats == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	discovery = find_discovery(manager, adapter);
+	if (discovery == NULL) {
+		memset(stats, 0, sizeof(*stats));
+		return BT_RESULT_OK;
 	}
 
-	g_free(path);
+	bluez_discovery_get_stats(discovery, stats);
 
-	return NULL;
+	return BT_RESULT_OK;
 }
 
 static gboolean add_bluez_adapter(struct bluez_manager* manager,
 						GDBusObject *object)
 {
+	struct bluez_discovery *discovery;
 	struct bluez_adapter *adapter;
 	const gchar *object_path;
 
@@ -386,7 +1947,19 @@ static gboolean add_bluez_adapter(struct bluez_manager* manager,
 		return FALSE;
 
 	g_hash_table_replace(manager->adapters_hash,
-				g_strdup(object_path), adapter);
+				(gchar *) bluez_intern(object_path), adapter);
+
+	bluez_adapter_set_changed_notify(adapter, adapter_changed, manager);
+	bluez_adapter_set_scheduler(adapter, manager->scheduler);
+	log_change(manager, BLUEZ_CHANGE_ADDED, BLUEZ_OBJECT_ADAPTER,
+					BLUEZ_HANDLE_INVALID, object_path, 0);
+
+	discovery = find_discovery(manager, object_path);
+	if (discovery)
+		bluez_discovery_set_adapter(discovery, adapter);
+
+	if (manager->monitors)
+		bluez_monitor_app_register(manager->monitors, adapter);
 
 	if (manager->adapter_added)
 		manager->adapter_added(adapter, manager->adapter_user_data);
@@ -397,6 +1970,7 @@ static gboolean add_bluez_adapter(struct bluez_manager* manager,
 static gboolean remove_bluez_adapter(struct bluez_manager *manager,
 						GDBusObject *object)
 {
+	struct bluez_discovery *discovery;
 	struct bluez_adapter *adapter;
 	const gchar *object_path;
 
@@ -410,6 +1984,16 @@ static gboolean remove_bluez_adapter(struct bluez_manager *manager,
 	if (manager->adapter_removed)
 		manager->adapter_removed(adapter, manager->adapter_user_data);
 
+	log_change(manager, BLUEZ_CHANGE_REMOVED, BLUEZ_OBJECT_ADAPTER,
+					BLUEZ_HANDLE_INVALID, object_path, 0);
+
+	discovery = find_discovery(manager, object_path);
+	if (discovery)
+		bluez_discovery_set_adapter(discovery, NULL);
+
+	if (manager->monitors)
+		bluez_monitor_app_adapter_removed(manager->monitors, adapter);
+
 	g_hash_table_remove(manager->adapters_hash, object_path);
 
 	return TRUE;
@@ -433,7 +2017,26 @@ static gboolean add_bluez_device(struct bluez_manager *manager,
 		return FALSE;
 
 	g_hash_table_replace(manager->devices_hash,
-				g_strdup(object_path), device);
+				(gchar *) bluez_intern(object_path), device);
+
+	bluez_device_set_handle(device, alloc_device_handle(manager, device));
+	bluez_device_set_changed_notify(device, device_changed, manager);
+	bluez_device_set_scheduler(device, manager->scheduler);
+	log_change(manager, BLUEZ_CHANGE_ADDED, BLUEZ_OBJECT_DEVICE,
+				bluez_device_get_handle(device), object_path, 0);
+	bluez_shm_publisher_update(manager->shm, device, manager->generation);
+	schedule_snapshot(manager, device);
+
+	notify_discovery(manager, device, 0);
+
+	if (manager->reconnect)
+		bluez_reconnect_device_changed(manager->reconnect, device,
+				BLUEZ_PROPERTY_CONNECTED | BLUEZ_PROPERTY_RSSI);
+
+	if (manager->adv_reporter)
+		bluez_adv_reporter_device_changed(manager->adv_reporter, device,
+					BLUEZ_PROPERTY_MANUFACTURER_DATA |
+					BLUEZ_PROPERTY_SERVICE_DATA);
 
 	if (manager->device_added)
 		manager->device_added(device, manager->device_user_data);
@@ -457,8 +2060,16 @@ static gboolean remove_bluez_device(struct bluez_manager *manager,
 	if (manager->device_removed)
 		manager->device_removed(device, manager->device_user_data);
 
+	log_change(manager, BLUEZ_CHANGE_REMOVED, BLUEZ_OBJECT_DEVICE,
+				bluez_device_get_handle(device), object_path, 0);
+	bluez_shm_publisher_remove(manager->shm, device, manager->generation);
+	release_device_handle(manager, bluez_device_get_handle(device));
+	g_hash_table_remove(manager->snapshot_dirty, device);
+
 	g_hash_table_remove(manager->devices_hash, object_path);
 
+	schedule_snapshot(manager, NULL);
+
 	return TRUE;
 }
 
@@ -480,7 +2091,11 @@ static gboolean add_bluez_service(struct bluez_manager *manager,
 		return FALSE;
 
 	g_hash_table_replace(manager->services_hash,
-					g_strdup(object_path), service);
+				(gchar *) bluez_intern(object_path), service);
+
+	bluez_service_set_changed_notify(service, service_changed, manager);
+	log_change(manager, BLUEZ_CHANGE_ADDED, BLUEZ_OBJECT_SERVICE,
+					BLUEZ_HANDLE_INVALID, object_path, 0);
 
 	if (manager->service_added)
 		manager->service_added(service, manager->service_user_data);
@@ -504,6 +2119,9 @@ static gboolean remove_bluez_service(struct bluez_manager *manager,
 	if (manager->service_removed)
 		manager->service_removed(service, manager->service_user_data);
 
+	log_change(manager, BLUEZ_CHANGE_REMOVED, BLUEZ_OBJECT_SERVICE,
+					BLUEZ_HANDLE_INVALID, object_path, 0);
+
 	g_hash_table_remove(manager->services_hash, object_path);
 
 	return TRUE;
@@ -628,14 +2246,12 @@ static void parse_bluez_object(struct bluez_manager *manager,
 	}
 }
 
-static void object_added(GDBusObjectManager *manager, GDBusObject *object,
-							gpointer user_data)
+static void object_added(GDBusObject *object, gpointer user_data)
 {
 	parse_bluez_object((struct bluez_manager *)user_data, object);
 }
 
-static void object_removed(GDBusObjectManager *manager, GDBusObject *object,
-							gpointer user_data)
+static void object_removed(GDBusObject *object, gpointer user_data)
 {
 	struct bluez_manager *bluez_manager = (struct bluez_manager *)user_data;
 
@@ -675,7 +2291,7 @@ static void parse_managed_objects(struct bluez_manager *manager)
 	GList *objects, *list, *next;
 	GDBusObject *object;
 
-	objects = g_dbus_object_manager_get_objects(manager->object_manager);
+	objects = bluez_client_get_objects(manager->client);
 	objects = g_list_sort(objects, (GCompareFunc) object_sort);
 
 	for  (list = objects; list; list = next) {
@@ -691,78 +2307,306 @@ static void parse_managed_objects(struct bluez_manager *manager)
 	g_list_free(objects);
 }
 
-static void get_managed_objects_reply(GObject *object, GAsyncResult *res,
-							gpointer user_data)
+static void client_ready(gpointer user_data)
 {
-	struct bluez_manager *bluez_manager = (struct bluez_manager *)user_data;
-	GDBusObjectManager *manager;
-	GError *error = NULL;
+	parse_managed_objects((struct bluez_manager *)user_data);
+}
+
+static void get_managed_objects(struct bluez_manager *manager)
+{
+	if (bluez_client_is_ready(manager->client))
+		return parse_managed_objects(manager);
+
+	bluez_client_start(manager->client);
+}
+
+struct bluez_manager *bluez_manager_new_for_connection(GDBusConnection *conn,
+						const gchar *path_namespace)
+{
+	struct bluez_manager *manager;
+	gchar *path;
+
+	if (conn == NULL)
+		return NULL;
+
+	if (path_namespace == NULL)
+		path = g_strdup(BLUEZ_MANAGER_PATH);
+	else if (g_str_has_prefix(path_namespace, "/"))
+		path = g_strdup(path_namespace);
+	else
+		path = g_strdup_printf("/org/bluez/%s", path_namespace);
 
-	manager = g_dbus_object_manager_client_new_for_bus_finish(res, &error);
-	if (manager == NULL) {
-		g_error_free(error);
-		goto done;
+	manager = g_try_new0(struct bluez_manager, 1);
+	if (!manager) {
+		g_free(path);
+		return NULL;
 	}
 
-	g_signal_connect(manager, "object-added",
-				G_CALLBACK(object_added), bluez_manager);
-	g_signal_connect(manager, "object-removed",
-				G_CALLBACK(object_removed), bluez_manager);
+	manager->conn = g_object_ref(conn);
+	manager->context = g_main_context_ref_thread_default();
+	manager->timers = bluez_timers_new(manager->context);
+	manager->scheduler = bluez_scheduler_new(manager->timers);
 
-	bluez_manager->object_manager = manager;
+	manager->client = bluez_client_new(conn, path, tracked_interfaces,
+					client_ready, object_added,
+					object_removed, manager);
+	g_free(path);
 
-	parse_managed_objects(bluez_manager);
+	/* Discovery session filters, cheap until a session sets one */
+	bluez_client_set_filter(manager->client, DEVICE_INTERFACE,
+						device_filter, manager);
 
-done:
-	g_object_unref(bluez_manager->get_managed_objects_call);
-	bluez_manager->get_managed_objects_call = NULL;
+	manager->adapters_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+					(GDestroyNotify) bluez_intern_unref,
+					(GDestroyNotify) bluez_adapter_free);
+	manager->devices_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+					(GDestroyNotify) bluez_intern_unref,
+					(GDestroyNotify) bluez_device_free);
+	manager->services_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
+					(GDestroyNotify) bluez_intern_unref,
+					(GDestroyNotify) bluez_service_free);
+
+	manager->snapshots = bluez_snapshot_domain_new();
+	manager->snapshot_dirty = g_hash_table_new(g_direct_hash,
+							g_direct_equal);
+
+	manager->free_device_slot = NO_SLOT;
+	manager->address_index = g_hash_table_new_full(bluez_addr_hash,
+					bluez_addr_equal, g_free,
+					(GDestroyNotify) g_slist_free);
+	manager->uuid_index = g_hash_table_new_full(bluez_uuid_hash,
+					bluez_uuid_equal, g_free,
+					(GDestroyNotify) g_array_unref);
+	manager->rssi_index = bluez_rssi_index_new();
+	manager->search_index = bluez_search_index_new();
+	manager->rssi_max_age = DEFAULT_RSSI_MAX_AGE;
+	manager->adapter_index = g_hash_table_new_full(g_str_hash,
+					g_str_equal,
+					(GDestroyNotify) bluez_intern_unref,
+					free_adapter_bitmap);
+
+	manager->changes = bluez_change_log_new(DEFAULT_CHANGE_LOG_SIZE);
+
+	manager->epoll_fd = -1;
+
+	return manager;
 }
 
-static void get_managed_objects(struct bluez_manager *manager)
+/* Mirror the fds of the private context into the epoll set */
+static void sync_epoll_fds(struct bluez_manager *manager)
 {
-	if (manager->object_manager)
-		return parse_managed_objects(manager);
+	struct epoll_event event;
+	gint i;
+
+	if (manager->epoll_fd < 0)
+		return;
 
-	if (manager->get_managed_objects_call)
+	if (manager->n_epoll_fds == manager->n_poll_fds &&
+			!memcmp(manager->epoll_fds, manager->poll_fds,
+				manager->n_poll_fds * sizeof(GPollFD)))
 		return;
 
-	manager->get_managed_objects_call = g_cancellable_new();
+	for (i = 0; i < manager->n_epoll_fds; i++)
+		epoll_ctl(manager->epoll_fd, EPOLL_CTL_DEL,
+					manager->epoll_fds[i].fd, NULL);
+
+	for (i = 0; i < manager->n_poll_fds; i++) {
+		memset(&event, 0, sizeof(event));
+
+		if (manager->poll_fds[i].events & G_IO_IN)
+			event.events |= EPOLLIN;
+		if (manager->poll_fds[i].events & G_IO_OUT)
+			event.events |= EPOLLOUT;
+		if (manager->poll_fds[i].events & G_IO_PRI)
+			event.events |= EPOLLPRI;
+
+		event.data.fd = manager->poll_fds[i].fd;
+
+		if (epoll_ctl(manager->epoll_fd, EPOLL_CTL_ADD,
+				manager->poll_fds[i].fd, &event) < 0 &&
+						errno != EEXIST)
+			printf("Failed to watch fd %d\n",
+						manager->poll_fds[i].fd);
+	}
 
-	g_dbus_object_manager_client_new(manager->conn, 0,
-					BLUEZ_SERVICE_NAME, BLUEZ_MANAGER_PATH,
-					NULL, NULL, NULL,
-					manager->get_managed_objects_call,
-					get_managed_objects_reply, manager);
+	manager->epoll_fds = g_renew(GPollFD, manager->epoll_fds,
+							manager->n_poll_fds);
+	memcpy(manager->epoll_fds, manager->poll_fds,
+				manager->n_poll_fds * sizeof(GPollFD));
+	manager->n_epoll_fds = manager->n_poll_fds;
 }
 
-struct bluez_manager *bluez_manager_new(void)
+static gboolean prepare_context(struct bluez_manager *manager)
+{
+	gboolean ready;
+	gint n;
+
+	if (!g_main_context_acquire(manager->context))
+		return FALSE;
+
+	ready = g_main_context_prepare(manager->context,
+						&manager->max_priority);
+
+	while ((n = g_main_context_query(manager->context,
+				manager->max_priority, &manager->timeout,
+				manager->poll_fds, manager->max_poll_fds)) >
+						manager->max_poll_fds) {
+		manager->max_poll_fds = n;
+		manager->poll_fds = g_renew(GPollFD, manager->poll_fds, n);
+	}
+
+	manager->n_poll_fds = n;
+
+	if (ready)
+		manager->timeout = 0;
+
+	manager->prepared = TRUE;
+
+	g_main_context_release(manager->context);
+
+	sync_epoll_fds(manager);
+
+	return TRUE;
+}
+
+struct bluez_manager *bluez_manager_new_pollable(void)
 {
 	struct bluez_manager *manager;
+	GMainContext *context;
+
+	context = g_main_context_new();
+
+	/* The manager binds itself to the thread default it is built in */
+	g_main_context_push_thread_default(context);
+	manager = bluez_manager_new();
+	g_main_context_pop_thread_default(context);
+
+	g_main_context_unref(context);
 
-	manager = g_try_new0(struct bluez_manager, 1);
 	if (!manager)
 		return NULL;
 
-	manager->conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, NULL);
+	manager->pollable = TRUE;
 
-	manager->adapters_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
-					g_free,
-					(GDestroyNotify) bluez_adapter_free);
-	manager->devices_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
-					g_free,
-					(GDestroyNotify) bluez_device_free);
-	manager->services_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
-					g_free,
-					(GDestroyNotify) bluez_service_free);
+	manager->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (manager->epoll_fd < 0) {
+		bluez_manager_free(manager);
+		return NULL;
+	}
+
+	prepare_context(manager);
+
+	return manager;
+}
+
+int bluez_manager_get_fd(struct bluez_manager *manager)
+{
+	if (manager == NULL || !manager->pollable)
+		return -1;
+
+	return manager->epoll_fd;
+}
+
+gint bluez_manager_next_timeout(struct bluez_manager *manager)
+{
+	if (manager == NULL || !manager->pollable)
+		return -1;
+
+	if (!prepare_context(manager))
+		return -1;
+
+	return manager->timeout;
+}
+
+guint bluez_manager_dispatch(struct bluez_manager *manager, guint max_batches)
+{
+	guint n;
+
+	if (manager == NULL || !manager->pollable)
+		return 0;
+
+	for (n = 0; n < max_batches; n++) {
+		if (!manager->prepared && !prepare_context(manager))
+			break;
+
+		manager->prepared = FALSE;
+
+		if (!g_main_context_acquire(manager->context))
+			break;
+
+		enter_context(manager);
+
+		/* The caller already waited, only collect readiness */
+		g_poll(manager->poll_fds, manager->n_poll_fds, 0);
+
+		if (!g_main_context_check(manager->context,
+					manager->max_priority,
+					manager->poll_fds,
+					manager->n_poll_fds)) {
+			leave_context(manager);
+			g_main_context_release(manager->context);
+			break;
+		}
+
+		g_main_context_dispatch(manager->context);
+
+		leave_context(manager);
+		g_main_context_release(manager->context);
+	}
+
+	return n;
+}
+
+struct bluez_manager *bluez_manager_new_for_adapter(const gchar *adapter)
+{
+	struct bluez_manager *manager;
+	GDBusConnection *conn;
+
+	conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, NULL);
+	if (conn == NULL)
+		return NULL;
+
+	manager = bluez_manager_new_for_connection(conn, adapter);
+
+	g_object_unref(conn);
 
 	return manager;
 }
 
+struct bluez_manager *bluez_manager_new(void)
+{
+	return bluez_manager_new_for_adapter(NULL);
+}
+
 void bluez_manager_free(struct bluez_manager *manager)
 {
+	guint32 i;
+
 	if (!manager)
 		return;
 
+	bluez_manager_stop_reaper(manager);
+
+	g_list_free_full(manager->connect_jobs,
+				(GDestroyNotify) bluez_connect_job_free);
+	manager->connect_jobs = NULL;
+
+	bluez_reconnect_free(manager->reconnect);
+	manager->reconnect = NULL;
+
+	if (manager->discoveries) {
+		g_hash_table_unref(manager->discoveries);
+		manager->discoveries = NULL;
+	}
+
+	bluez_monitor_app_free(manager->monitors);
+	manager->monitors = NULL;
+
+	bluez_adv_reporter_free(manager->adv_reporter, FALSE);
+	manager->adv_reporter = NULL;
+
+	bluez_shm_publisher_free(manager->shm);
+
 	if (manager->services_hash) {
 		g_hash_table_foreach_remove(manager->services_hash,
 					foreach_service_removed, manager);
@@ -781,11 +2625,37 @@ void bluez_manager_free(struct bluez_manager *manager)
 		g_hash_table_unref(manager->adapters_hash);
 	}
 
-	if (manager->get_managed_objects_call != NULL) {
-		g_cancellable_cancel(manager->get_managed_objects_call);
-		g_object_unref(manager->get_managed_objects_call);
+	bluez_timers_cancel(manager->timers, manager->snapshot_timer);
+	bluez_timers_cancel(manager->timers, manager->reclaim_timer);
+
+	if (manager->snapshot_dirty)
+		g_hash_table_unref(manager->snapshot_dirty);
+
+	bluez_snapshot_domain_free(manager->snapshots);
+
+	bluez_scheduler_free(manager->scheduler);
+
+	for (i = 0; i < manager->n_device_slots; i++) {
+		bluez_uuid_set_clear(&manager->device_slots[i].uuids);
+		bluez_intern_unref(manager->device_slots[i].adapter);
 	}
 
+	g_free(manager->device_slots);
+	g_hash_table_unref(manager->address_index);
+	g_hash_table_unref(manager->uuid_index);
+	g_hash_table_unref(manager->adapter_index);
+
+	bluez_manager_set_top_rssi_watch(manager, 0, NULL, NULL, NULL);
+	bluez_timers_free(manager->timers);
+	bluez_rssi_index_free(manager->rssi_index);
+	bluez_search_index_free(manager->search_index);
+
+	bluez_bitmap_clear(&manager->live_index);
+	for (i = 0; i < BLUEZ_DEVICE_N_STATES; i++)
+		bluez_bitmap_clear(&manager->state_index[i]);
+
+	bluez_change_log_free(manager->changes);
+
 	if (manager->agent_id)
 		g_dbus_connection_unregister_object(manager->conn,
 							manager->agent_id);
@@ -796,11 +2666,18 @@ void bluez_manager_free(struct bluez_manager *manager)
 	if (manager->profile_proxy)
 		g_object_unref(manager->profile_proxy);
 
-	if (manager->object_manager)
-		g_object_unref(manager->object_manager);
+	bluez_client_free(manager->client);
 
 	g_object_unref(manager->conn);
 
+	if (manager->epoll_fd >= 0)
+		close(manager->epoll_fd);
+
+	g_free(manager->poll_fds);
+	g_free(manager->epoll_fds);
+
+	g_main_context_unref(manager->context);
+
 	g_free(manager);
 }
 
@@ -854,5 +2731,7 @@ void bluez_manager_refresh_objects(struct bluez_manager *manager)
 	if (manager == NULL)
 		return;
 
+	enter_context(manager);
 	get_managed_objects(manager);
+	leave_context(manager);
 }
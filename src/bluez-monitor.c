@@ -0,0 +1,489 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "bluez-adapter.h"
+#include "bluez-device.h"
+#include "bluez-monitor.h"
+
+#define OBJECT_MANAGER_INTERFACE "org.freedesktop.DBus.ObjectManager"
+
+struct bluez_monitor {
+	struct bluez_monitor_app *app;
+	gchar *path;
+	guint id;				/* registered object */
+	struct bluez_monitor_options options;	/* patterns not kept */
+	GVariant *patterns;			/* a(yyay) */
+	gboolean active;
+	bluez_monitor_cb func;
+	gpointer user_data;
+};
+
+struct bluez_monitor_app {
+	gint ref_count;
+	struct bluez_manager *manager;		/* NULL once freed */
+	GDBusConnection *conn;
+	gchar *path;
+	GDBusNodeInfo *node_info;
+	guint root_id;
+	guint next_id;
+	GHashTable *monitors;			/* path -> monitor */
+	GHashTable *adapters;			/* registered adapters */
+};
+
+struct registration {
+	struct bluez_monitor_app *app;
+	struct bluez_adapter *adapter;
+};
+
+static const gchar monitor_xml[] =
+	"<node>"
+	"  <interface name='org.freedesktop.DBus.ObjectManager'>"
+	"    <method name='GetManagedObjects'>"
+	"      <arg type='a{oa{sa{sv}}}' direction='out'/>"
+	"    </method>"
+	"    <signal name='InterfacesAdded'>"
+	"      <arg type='o' name='object'/>"
+	"      <arg type='a{sa{sv}}' name='interfaces'/>"
+	"    </signal>"
+	"    <signal name='InterfacesRemoved'>"
+	"      <arg type='o' name='object'/>"
+	"      <arg type='as' name='interfaces'/>"
+	"    </signal>"
+	"  </interface>"
+	"  <interface name='org.bluez.AdvertisementMonitor1'>"
+	"    <method name='Release'>"
+	"    </method>"
+	"    <method name='Activate'>"
+	"    </method>"
+	"    <method name='DeviceFound'>"
+	"      <arg type='o' name='device' direction='in'/>"
+	"    </method>"
+	"    <method name='DeviceLost'>"
+	"      <arg type='o' name='device' direction='in'/>"
+	"    </method>"
+	"    <property name='Type' type='s' access='read'/>"
+	"    <property name='RSSILowThreshold' type='n' access='read'/>"
+	"    <property name='RSSIHighThreshold' type='n' access='read'/>"
+	"    <property name='RSSILowTimeout' type='q' access='read'/>"
+	"    <property name='RSSIHighTimeout' type='q' access='read'/>"
+	"    <property name='RSSISamplingPeriod' type='q' access='read'/>"
+	"    <property name='Patterns' type='a(yyay)' access='read'/>"
+	"  </interface>"
+	"</node>";
+
+static const gchar *monitor_properties[] = {
+	"Type",
+	"RSSILowThreshold",
+	"RSSIHighThreshold",
+	"RSSILowTimeout",
+	"RSSIHighTimeout",
+	"RSSISamplingPeriod",
+	"Patterns",
+	NULL
+};
+
+static void app_unref(gpointer data)
+{
+	struct bluez_monitor_app *app = data;
+
+	if (--app->ref_count > 0)
+		return;
+
+	g_hash_table_unref(app->monitors);
+	g_hash_table_unref(app->adapters);
+	g_dbus_node_info_unref(app->node_info);
+	g_object_unref(app->conn);
+	g_free(app->path);
+	g_free(app);
+}
+
+/* NULL for thresholds left to BlueZ */
+static GVariant *monitor_property(struct bluez_monitor *monitor,
+							const gchar *name)
+{
+	const struct bluez_monitor_options *options = &monitor->options;
+
+	if (!g_strcmp0(name, "Type"))
+		return g_variant_new_string("or_patterns");
+
+	if (!g_strcmp0(name, "Patterns"))
+		return g_variant_ref(monitor->patterns);
+
+	if (!options->rssi_low && !options->rssi_high)
+		return NULL;
+
+	if (!g_strcmp0(name, "RSSILowThreshold"))
+		return g_variant_new_int16(options->rssi_low);
+	if (!g_strcmp0(name, "RSSIHighThreshold"))
+		return g_variant_new_int16(options->rssi_high);
+	if (!g_strcmp0(name, "RSSILowTimeout") && options->rssi_low_timeout)
+		return g_variant_new_uint16(options->rssi_low_timeout);
+	if (!g_strcmp0(name, "RSSIHighTimeout") && options->rssi_high_timeout)
+		return g_variant_new_uint16(options->rssi_high_timeout);
+	if (!g_strcmp0(name, "RSSISamplingPeriod") &&
+					options->rssi_sampling_period)
+		return g_variant_new_uint16(options->rssi_sampling_period);
+
+	return NULL;
+}
+
+/* a{sa{sv}} of the monitor's interface */
+static GVariant *monitor_interfaces(struct bluez_monitor *monitor)
+{
+	GVariantBuilder builder, properties;
+	GVariant *value;
+	guint i;
+
+	g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
+
+	for (i = 0; monitor_properties[i]; i++) {
+		value = monitor_property(monitor, monitor_properties[i]);
+		if (value)
+			g_variant_builder_add(&properties, "{sv}",
+						monitor_properties[i], value);
+	}
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sa{sv}}"));
+	g_variant_builder_add(&builder, "{sa{sv}}", MONITOR_INTERFACE,
+								&properties);
+
+	return g_variant_builder_end(&builder);
+}
+
+static void notify(struct bluez_monitor *monitor,
+			enum bluez_monitor_event event, const gchar *device)
+{
+	struct bluez_manager *manager = monitor->app->manager;
+	bluez_handle_t handle = BLUEZ_HANDLE_INVALID;
+	struct bluez_device *record;
+	bluez_addr_t addr;
+
+	if (monitor->func == NULL)
+		return;
+
+	if (device == NULL) {
+		monitor->func(manager, monitor, event, NULL, handle,
+						monitor->user_data);
+		return;
+	}
+
+	if (!bluez_addr_from_path(device, &addr)) {
+		printf("Monitor event for invalid device %s\n", device);
+		return;
+	}
+
+	/* The path names the adapter, the address alone does not */
+	record = find_device_by_path(manager, device);
+	if (record)
+		handle = bluez_device_get_handle(record);
+
+	monitor->func(manager, monitor, event, &addr, handle,
+						monitor->user_data);
+}
+
+static void handle_monitor_method(GDBusConnection *conn, const gchar *sender,
+				const gchar *path, const gchar *interface,
+				const char *method, GVariant *value,
+				GDBusMethodInvocation *ivct, gpointer data)
+{
+	struct bluez_monitor_app *app = data;
+	struct bluez_monitor *monitor;
+	const gchar *device = NULL;
+
+	g_dbus_method_invocation_return_value(ivct, NULL);
+
+	monitor = g_hash_table_lookup(app->monitors, path);
+	if (monitor == NULL || app->manager == NULL)
+		return;
+
+	if (g_strcmp0(method, "Activate") == 0) {
+		monitor->active = TRUE;
+		notify(monitor, BLUEZ_MONITOR_ACTIVATED, NULL);
+	} else if (g_strcmp0(method, "Release") == 0) {
+		monitor->active = FALSE;
+		notify(monitor, BLUEZ_MONITOR_RELEASED, NULL);
+	} else if (g_strcmp0(method, "DeviceFound") == 0) {
+		g_variant_get(value, "(&o)", &device);
+		notify(monitor, BLUEZ_MONITOR_DEVICE_FOUND, device);
+	} else if (g_strcmp0(method, "DeviceLost") == 0) {
+		g_variant_get(value, "(&o)", &device);
+		notify(monitor, BLUEZ_MONITOR_DEVICE_LOST, device);
+	}
+}
+
+static GVariant *get_monitor_property(GDBusConnection *conn,
+				const gchar *sender, const gchar *path,
+				const gchar *interface, const gchar *name,
+				GError **error, gpointer data)
+{
+	struct bluez_monitor_app *app = data;
+	struct bluez_monitor *monitor;
+	GVariant *value = NULL;
+
+	monitor = g_hash_table_lookup(app->monitors, path);
+	if (monitor)
+		value = monitor_property(monitor, name);
+
+	if (value == NULL)
+		g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+						"No such property %s", name);
+
+	return value;
+}
+
+static void handle_root_method(GDBusConnection *conn, const gchar *sender,
+				const gchar *path, const gchar *interface,
+				const char *method, GVariant *value,
+				GDBusMethodInvocation *ivct, gpointer data)
+{
+	struct bluez_monitor_app *app = data;
+	struct bluez_monitor *monitor;
+	GHashTableIter iter;
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+
+	g_hash_table_iter_init(&iter, app->monitors);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &monitor))
+		g_variant_builder_add(&builder, "{o@a{sa{sv}}}",
+				monitor->path, monitor_interfaces(monitor));
+
+	g_dbus_method_invocation_return_value(ivct,
+				g_variant_new("(a{oa{sa{sv}}})", &builder));
+}
+
+static const GDBusInterfaceVTable root_handle = {
+	handle_root_method,
+	NULL,
+	NULL
+};
+
+static const GDBusInterfaceVTable monitor_handle = {
+	handle_monitor_method,
+	get_monitor_property,
+	NULL
+};
+
+static void register_reply(BTResult ret, GVariant *data, void *user_data)
+{
+	struct registration *registration = user_data;
+	struct bluez_monitor_app *app = registration->app;
+
+	if (app->manager && ret != BT_RESULT_OK) {
+		printf("Failed to register monitors: %s\n", ret2str(ret));
+
+		/* Tried again if the adapter comes back */
+		g_hash_table_remove(app->adapters, registration->adapter);
+	}
+
+	app_unref(app);
+	g_free(registration);
+}
+
+void bluez_monitor_app_register(struct bluez_monitor_app *app,
+					struct bluez_adapter *adapter)
+{
+	struct registration *registration;
+
+	if (!g_hash_table_add(app->adapters, adapter))
+		return;
+
+	registration = g_new0(struct registration, 1);
+	registration->app = app;
+	registration->adapter = adapter;
+	app->ref_count++;
+
+	bluez_adapter_register_monitor_with_reply(adapter, app->path,
+					register_reply, registration);
+}
+
+void bluez_monitor_app_adapter_removed(struct bluez_monitor_app *app,
+					struct bluez_adapter *adapter)
+{
+	g_hash_table_remove(app->adapters, adapter);
+}
+
+static gboolean patterns_valid(const struct bluez_monitor_options *options)
+{
+	guint i;
+
+	if (options->patterns == NULL || options->n_patterns == 0)
+		return FALSE;
+
+	for (i = 0; i < options->n_patterns; i++) {
+		const struct bluez_monitor_pattern *pattern =
+						&options->patterns[i];
+
+		if (pattern->value == NULL || pattern->len == 0 ||
+				pattern->len > 31 ||
+				pattern->start + pattern->len > 31)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+struct bluez_monitor *bluez_monitor_app_add(struct bluez_monitor_app *app,
+				const struct bluez_monitor_options *options,
+				bluez_monitor_cb func, gpointer user_data)
+{
+	struct bluez_monitor *monitor;
+	GVariantBuilder builder;
+	GError *error = NULL;
+	guint i;
+
+	if (!patterns_valid(options) ||
+			!options->rssi_low != !options->rssi_high) {
+		printf("Invalid advertisement monitor\n");
+		return NULL;
+	}
+
+	monitor = g_try_new0(struct bluez_monitor, 1);
+	if (!monitor)
+		return NULL;
+
+	monitor->app = app;
+	monitor->options = *options;
+	monitor->options.patterns = NULL;
+	monitor->func = func;
+	monitor->user_data = user_data;
+	monitor->path = g_strdup_printf("%s/monitor%u", app->path,
+							app->next_id++);
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(yyay)"));
+	for (i = 0; i < options->n_patterns; i++) {
+		const struct bluez_monitor_pattern *pattern =
+						&options->patterns[i];
+
+		g_variant_builder_add(&builder, "(yy@ay)", pattern->start,
+				pattern->ad_type,
+				g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+					pattern->value, pattern->len, 1));
+	}
+	monitor->patterns = g_variant_ref_sink(g_variant_builder_end(&builder));
+
+	monitor->id = g_dbus_connection_register_object(app->conn,
+				monitor->path, app->node_info->interfaces[1],
+				&monitor_handle, app, app_unref, &error);
+	if (monitor->id == 0) {
+		printf("Failed to export %s: %s\n", monitor->path,
+							error->message);
+		g_error_free(error);
+		g_variant_unref(monitor->patterns);
+		g_free(monitor->path);
+		g_free(monitor);
+		return NULL;
+	}
+
+	app->ref_count++;
+	g_hash_table_insert(app->monitors, monitor->path, monitor);
+
+	g_dbus_connection_emit_signal(app->conn, NULL, app->path,
+				OBJECT_MANAGER_INTERFACE, "InterfacesAdded",
+				g_variant_new("(o@a{sa{sv}})", monitor->path,
+						monitor_interfaces(monitor)),
+				NULL);
+
+	return monitor;
+}
+
+static void monitor_free(gpointer data)
+{
+	struct bluez_monitor *monitor = data;
+	struct bluez_monitor_app *app = monitor->app;
+	const gchar *interfaces[] = { MONITOR_INTERFACE, NULL };
+
+	g_dbus_connection_emit_signal(app->conn, NULL, app->path,
+				OBJECT_MANAGER_INTERFACE, "InterfacesRemoved",
+				g_variant_new("(o^as)", monitor->path,
+							interfaces),
+				NULL);
+
+	g_dbus_connection_unregister_object(app->conn, monitor->id);
+
+	g_variant_unref(monitor->patterns);
+	g_free(monitor->path);
+	g_free(monitor);
+}
+
+void bluez_monitor_app_remove(struct bluez_monitor_app *app,
+					struct bluez_monitor *monitor)
+{
+	g_hash_table_remove(app->monitors, monitor->path);
+}
+
+struct bluez_monitor_app *bluez_monitor_app_new(struct bluez_manager *manager,
+				GDBusConnection *conn, const gchar *path)
+{
+	struct bluez_monitor_app *app;
+	GError *error = NULL;
+
+	app = g_try_new0(struct bluez_monitor_app, 1);
+	if (!app)
+		return NULL;
+
+	app->ref_count = 1;
+	app->manager = manager;
+	app->conn = g_object_ref(conn);
+	app->path = g_strdup(path);
+	app->node_info = g_dbus_node_info_new_for_xml(monitor_xml, NULL);
+	app->monitors = g_hash_table_new_full(g_str_hash, g_str_equal,
+							NULL, monitor_free);
+	app->adapters = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	app->root_id = g_dbus_connection_register_object(conn, path,
+				app->node_info->interfaces[0], &root_handle,
+				app, app_unref, &error);
+	if (app->root_id == 0) {
+		printf("Failed to export %s: %s\n", path, error->message);
+		g_error_free(error);
+		app_unref(app);
+		return NULL;
+	}
+
+	app->ref_count++;
+
+	return app;
+}
+
+void bluez_monitor_app_free(struct bluez_monitor_app *app)
+{
+	GHashTableIter iter;
+	gpointer adapter;
+
+	if (!app)
+		return;
+
+	g_hash_table_iter_init(&iter, app->adapters);
+	while (g_hash_table_iter_next(&iter, &adapter, NULL))
+		bluez_adapter_unregister_monitor(adapter, app->path);
+
+	g_hash_table_remove_all(app->adapters);
+	g_hash_table_remove_all(app->monitors);
+
+	g_dbus_connection_unregister_object(app->conn, app->root_id);
+
+	app->manager = NULL;
+	app_unref(app);
+}
@@ -0,0 +1,56 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_MONITOR_H__
+#define __BLUEZ_MONITOR_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "bluez-manager.h"
+
+/*
+ * Advertisement monitor application: an object manager root exported on
+ * the connection with one AdvertisementMonitor1 child per monitor, as
+ * BlueZ expects from RegisterMonitor. Exported objects keep the app
+ * referenced, so method calls racing with its release are harmless.
+ */
+struct bluez_monitor_app;
+
+struct bluez_monitor_app *bluez_monitor_app_new(struct bluez_manager *manager,
+				GDBusConnection *conn, const gchar *path);
+
+/* Unregisters from the adapters still known and unexports everything */
+void bluez_monitor_app_free(struct bluez_monitor_app *app);
+
+/* Registers the app with the adapter's AdvertisementMonitorManager1 */
+void bluez_monitor_app_register(struct bluez_monitor_app *app,
+					struct bluez_adapter *adapter);
+
+void bluez_monitor_app_adapter_removed(struct bluez_monitor_app *app,
+					struct bluez_adapter *adapter);
+
+struct bluez_monitor *bluez_monitor_app_add(struct bluez_monitor_app *app,
+				const struct bluez_monitor_options *options,
+				bluez_monitor_cb func, gpointer user_data);
+
+void bluez_monitor_app_remove(struct bluez_monitor_app *app,
+					struct bluez_monitor *monitor);
+
+#endif
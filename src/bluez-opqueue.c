@@ -0,0 +1,244 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <glib.h>
+
+#include "bluez-common.h"
+#include "bluez-opqueue.h"
+
+struct op_waiter {
+	bluez_response_cb cb;
+	void *user_data;
+};
+
+struct device_op {
+	struct bluez_op_queue *queue;		/* NULL once it is cleared */
+	enum bluez_device_op type;
+	const gchar *uuid;			/* interned, profile ops */
+	enum bluez_call_class klass;
+	guint timeout_ms;
+	struct bluez_retry_policy retry;
+	gboolean has_retry;
+	GQueue waiters;
+};
+
+static const struct {
+	const gchar *method;
+	BTResult done;				/* error meaning success */
+} op_table[] = {
+	[BLUEZ_DEVICE_OP_CONNECT] = { "Connect", BT_RESULT_ALREADY_CONNECTED },
+	[BLUEZ_DEVICE_OP_DISCONNECT] = { "Disconnect", BT_RESULT_NOT_CONNECTED },
+	[BLUEZ_DEVICE_OP_CONNECT_PROFILE] = { "ConnectProfile",
+						BT_RESULT_ALREADY_CONNECTED },
+	[BLUEZ_DEVICE_OP_DISCONNECT_PROFILE] = { "DisconnectProfile",
+						BT_RESULT_NOT_CONNECTED },
+	[BLUEZ_DEVICE_OP_PAIR] = { "Pair", BT_RESULT_ALREADY_EXISTS },
+};
+
+void bluez_op_queue_init(struct bluez_op_queue *queue,
+				bluez_op_start_func start, gpointer user_data)
+{
+	g_queue_init(&queue->ops);
+	queue->running = NULL;
+	queue->start = start;
+	queue->start_data = user_data;
+}
+
+static void op_complete(struct device_op *op, BTResult ret)
+{
+	struct op_waiter *waiter;
+
+	while ((waiter = g_queue_pop_head(&op->waiters))) {
+		if (waiter->cb)
+			waiter->cb(ret, NULL, waiter->user_data);
+		g_free(waiter);
+	}
+
+	bluez_intern_unref(op->uuid);
+	g_free(op);
+}
+
+static gboolean op_same(struct device_op *op, enum bluez_device_op type,
+							const gchar *uuid)
+{
+	return op->type == type && op->uuid == uuid;
+}
+
+static gboolean op_opposes(struct device_op *op, enum bluez_device_op type,
+							const gchar *uuid)
+{
+	if (op->uuid != uuid)
+		return FALSE;
+
+	switch (op->type) {
+	case BLUEZ_DEVICE_OP_CONNECT:
+		return type == BLUEZ_DEVICE_OP_DISCONNECT;
+	case BLUEZ_DEVICE_OP_DISCONNECT:
+		return type == BLUEZ_DEVICE_OP_CONNECT;
+	case BLUEZ_DEVICE_OP_CONNECT_PROFILE:
+		return type == BLUEZ_DEVICE_OP_DISCONNECT_PROFILE;
+	case BLUEZ_DEVICE_OP_DISCONNECT_PROFILE:
+		return type == BLUEZ_DEVICE_OP_CONNECT_PROFILE;
+	default:
+		return FALSE;
+	}
+}
+
+static void op_add_waiter(struct device_op *op, bluez_response_cb cb,
+							void *user_data)
+{
+	struct op_waiter *waiter;
+
+	waiter = g_new0(struct op_waiter, 1);
+	waiter->cb = cb;
+	waiter->user_data = user_data;
+
+	g_queue_push_tail(&op->waiters, waiter);
+}
+
+static void queue_run(struct bluez_op_queue *queue);
+
+static void op_reply(BTResult ret, GVariant *data, void *user_data)
+{
+	struct device_op *op = user_data;
+	struct bluez_op_queue *queue = op->queue;
+
+	/* Waiters were cancelled with the queue */
+	if (queue == NULL) {
+		op_complete(op, ret);
+		return;
+	}
+
+	queue->running = NULL;
+
+	if (ret == op_table[op->type].done)
+		ret = BT_RESULT_OK;
+
+	op_complete(op, ret);
+
+	queue_run(queue);
+}
+
+static void queue_run(struct bluez_op_queue *queue)
+{
+	struct device_op *op;
+	GVariant *parameter = NULL;
+
+	if (queue->running)
+		return;
+
+	op = g_queue_pop_head(&queue->ops);
+	if (op == NULL)
+		return;
+
+	queue->running = op;
+
+	if (op->uuid)
+		parameter = g_variant_new("(s)", op->uuid);
+
+	queue->start(op_table[op->type].method, parameter, op->klass,
+				op->timeout_ms,
+				op->has_retry ? &op->retry : NULL,
+				op_reply, op, queue->start_data);
+}
+
+void bluez_op_queue_submit(struct bluez_op_queue *queue,
+				enum bluez_device_op type, const gchar *uuid,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *user_data)
+{
+	struct device_op *op;
+	const gchar *key;
+
+	if (type == BLUEZ_DEVICE_OP_CONNECT_PROFILE ||
+			type == BLUEZ_DEVICE_OP_DISCONNECT_PROFILE) {
+		if (uuid == NULL) {
+			if (cb)
+				cb(BT_RESULT_INVALID_ARGS, NULL, user_data);
+			return;
+		}
+		key = bluez_intern(uuid);
+	} else {
+		key = NULL;
+	}
+
+	/*
+	 * Only the latest queued intent counts: a repeat joins it, an
+	 * opposite one cancels it before it reaches BlueZ.
+	 */
+	while ((op = g_queue_peek_tail(&queue->ops))) {
+		if (!op_opposes(op, type, key))
+			break;
+
+		g_queue_pop_tail(&queue->ops);
+		op_complete(op, BT_RESULT_CANCELLED);
+	}
+
+	op = g_queue_peek_tail(&queue->ops);
+	if (op == NULL)
+		op = queue->running;
+
+	if (op && op_same(op, type, key)) {
+		bluez_intern_unref(key);
+
+		if (op != queue->running && klass < op->klass)
+			op->klass = klass;
+
+		op_add_waiter(op, cb, user_data);
+		return;
+	}
+
+	op = g_new0(struct device_op, 1);
+	op->queue = queue;
+	op->type = type;
+	op->uuid = key;
+	op->klass = klass;
+	op->timeout_ms = timeout_ms;
+	if (retry) {
+		op->retry = *retry;
+		op->has_retry = TRUE;
+	}
+	op_add_waiter(op, cb, user_data);
+
+	g_queue_push_tail(&queue->ops, op);
+
+	queue_run(queue);
+}
+
+void bluez_op_queue_clear(struct bluez_op_queue *queue)
+{
+	struct op_waiter *waiter;
+	struct device_op *op;
+
+	/* The running call's reply only frees it */
+	if (queue->running) {
+		queue->running->queue = NULL;
+		while ((waiter = g_queue_pop_head(&queue->running->waiters))) {
+			if (waiter->cb)
+				waiter->cb(BT_RESULT_CANCELLED, NULL,
+							waiter->user_data);
+			g_free(waiter);
+		}
+		queue->running = NULL;
+	}
+
+	while ((op = g_queue_pop_head(&queue->ops)))
+		op_complete(op, BT_RESULT_CANCELLED);
+}
@@ -0,0 +1,65 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_OPQUEUE_H__
+#define __BLUEZ_OPQUEUE_H__
+
+#include <glib.h>
+
+#include "bluez-device.h"
+#include "bluez-scheduler.h"
+
+/*
+ * The operations of one device, run one call at a time in the order
+ * they were submitted, with the merge and cancel rules described at
+ * bluez_device_submit(). Embedded in the device, which issues the calls.
+ */
+struct device_op;
+
+/* Issues the D-Bus call of an operation, cb must be called once */
+typedef void (*bluez_op_start_func) (const gchar *method,
+				GVariant *parameter,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *cb_data,
+				gpointer user_data);
+
+struct bluez_op_queue {
+	GQueue ops;
+	struct device_op *running;
+	bluez_op_start_func start;
+	gpointer start_data;
+};
+
+void bluez_op_queue_init(struct bluez_op_queue *queue,
+				bluez_op_start_func start, gpointer user_data);
+
+void bluez_op_queue_submit(struct bluez_op_queue *queue,
+				enum bluez_device_op type, const gchar *uuid,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *user_data);
+
+/*
+ * Completes every waiter with BT_RESULT_CANCELLED. The reply of the
+ * running call, still to come, is dropped.
+ */
+void bluez_op_queue_clear(struct bluez_op_queue *queue);
+
+#endif
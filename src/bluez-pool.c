@@ -0,0 +1,247 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-pool.h"
+
+#define POOL_ALIGN (2 * sizeof(gpointer))
+#define STRING_BLOCK_OBJECTS 128
+
+static GMutex registry_lock;
+static GSList *registry;
+static GHashTable *reservations;		/* name -> objects to reserve */
+
+static struct bluez_pool string_pools[] = {
+	BLUEZ_POOL_INIT("string-32", 32, STRING_BLOCK_OBJECTS),
+	BLUEZ_POOL_INIT("string-64", 64, STRING_BLOCK_OBJECTS),
+	BLUEZ_POOL_INIT("string-96", 96, STRING_BLOCK_OBJECTS),
+	BLUEZ_POOL_INIT("string-128", 128, STRING_BLOCK_OBJECTS),
+};
+
+static gsize pool_stride(struct bluez_pool *pool)
+{
+	gsize size = MAX(pool->object_size, sizeof(gpointer));
+
+	return (size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+}
+
+static gboolean pool_grow(struct bluez_pool *pool, guint n_objects)
+{
+	gsize stride = pool_stride(pool);
+	guint8 *block;
+	guint i;
+
+	block = g_try_malloc(stride * n_objects);
+	if (!block)
+		return FALSE;
+
+	pool->blocks = g_slist_prepend(pool->blocks, block);
+
+	for (i = 0; i < n_objects; i++) {
+		gpointer object = block + i * stride;
+
+		*(gpointer *) object = pool->free_list;
+		pool->free_list = object;
+	}
+
+	pool->capacity += n_objects;
+
+	return TRUE;
+}
+
+static void pool_reserve(struct bluez_pool *pool, guint n)
+{
+	g_mutex_lock(&pool->lock);
+
+	if (n > pool->capacity && !pool_grow(pool, n - pool->capacity))
+		pool->failures++;
+
+	g_mutex_unlock(&pool->lock);
+}
+
+static void pool_register(struct bluez_pool *pool)
+{
+	guint n = 0;
+
+	g_mutex_lock(&registry_lock);
+
+	if (!pool->registered) {
+		registry = g_slist_append(registry, pool);
+
+		if (reservations)
+			n = GPOINTER_TO_UINT(g_hash_table_lookup(reservations,
+								pool->name));
+
+		g_atomic_int_set(&pool->registered, TRUE);
+	}
+
+	g_mutex_unlock(&registry_lock);
+
+	if (n)
+		pool_reserve(pool, n);
+}
+
+gpointer bluez_pool_alloc0(struct bluez_pool *pool)
+{
+	gpointer object = NULL;
+
+	if (!g_atomic_int_get(&pool->registered))
+		pool_register(pool);
+
+	g_mutex_lock(&pool->lock);
+
+	if (pool->free_list == NULL &&
+			!pool_grow(pool, MAX(pool->block_objects, 1))) {
+		pool->failures++;
+		goto done;
+	}
+
+	object = pool->free_list;
+	pool->free_list = *(gpointer *) object;
+
+	pool->allocs++;
+	pool->in_use++;
+	if (pool->in_use > pool->peak)
+		pool->peak = pool->in_use;
+
+done:
+	g_mutex_unlock(&pool->lock);
+
+	if (object)
+		memset(object, 0, pool->object_size);
+
+	return object;
+}
+
+void bluez_pool_free(struct bluez_pool *pool, gpointer object)
+{
+	if (object == NULL)
+		return;
+
+	g_mutex_lock(&pool->lock);
+
+	*(gpointer *) object = pool->free_list;
+	pool->free_list = object;
+	pool->in_use--;
+
+	g_mutex_unlock(&pool->lock);
+}
+
+guint bluez_pool_get_stats(struct bluez_pool_stats *stats, guint max_stats)
+{
+	struct bluez_pool *pool;
+	GSList *list;
+	guint n = 0;
+
+	g_mutex_lock(&registry_lock);
+
+	for (list = registry; list; list = list->next, n++) {
+		if (stats == NULL || n >= max_stats)
+			continue;
+
+		pool = list->data;
+
+		g_mutex_lock(&pool->lock);
+
+		stats[n].name = pool->name;
+		stats[n].object_size = pool->object_size;
+		stats[n].blocks = g_slist_length(pool->blocks);
+		stats[n].capacity = pool->capacity;
+		stats[n].in_use = pool->in_use;
+		stats[n].peak = pool->peak;
+		stats[n].allocs = pool->allocs;
+		stats[n].failures = pool->failures;
+
+		g_mutex_unlock(&pool->lock);
+	}
+
+	g_mutex_unlock(&registry_lock);
+
+	return n;
+}
+
+BTResult bluez_pool_reserve(const gchar *name, guint n)
+{
+	struct bluez_pool *pool = NULL;
+	GSList *list;
+
+	if (name == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	g_mutex_lock(&registry_lock);
+
+	for (list = registry; list; list = list->next) {
+		if (!g_strcmp0(((struct bluez_pool *) list->data)->name, name)) {
+			pool = list->data;
+			break;
+		}
+	}
+
+	/* Pools register on first use, remember it until then */
+	if (pool == NULL) {
+		if (!reservations)
+			reservations = g_hash_table_new_full(g_str_hash,
+						g_str_equal, g_free, NULL);
+
+		g_hash_table_replace(reservations, g_strdup(name),
+							GUINT_TO_POINTER(n));
+	}
+
+	g_mutex_unlock(&registry_lock);
+
+	if (pool)
+		pool_reserve(pool, n);
+
+	return BT_RESULT_OK;
+}
+
+static struct bluez_pool *string_pool(gsize size)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(string_pools); i++) {
+		if (size <= string_pools[i].object_size)
+			return &string_pools[i];
+	}
+
+	return NULL;
+}
+
+gpointer bluez_pool_alloc_sized(gsize size)
+{
+	struct bluez_pool *pool = string_pool(size);
+
+	if (pool == NULL)
+		return g_try_malloc0(size);
+
+	return bluez_pool_alloc0(pool);
+}
+
+void bluez_pool_free_sized(gpointer object, gsize size)
+{
+	struct bluez_pool *pool = string_pool(size);
+
+	if (pool == NULL)
+		g_free(object);
+	else
+		bluez_pool_free(pool, object);
+}
@@ -0,0 +1,252 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-adapter.h"
+#include "bluez-device.h"
+#include "bluez-snapshot.h"
+#include "bluez-reaper.h"
+#include "bluez-timer.h"
+
+struct bluez_reaper {
+	gint ref_count;
+	struct bluez_manager *manager;		/* NULL once stopped */
+	struct bluez_reaper_policy policy;
+	struct bluez_timers *timers;
+	struct bluez_timer *tick;		/* every second */
+
+	/* Candidates of the last sweep, issued front to back */
+	bluez_handle_t *queue;
+	guint queue_len;
+	guint queue_pos;
+
+	guint budget;				/* calls left this second */
+	guint in_flight;
+	gint64 next_sweep;
+
+	struct bluez_reaper_stats stats;
+};
+
+struct reaper_call {
+	struct bluez_reaper *reaper;
+	gsize footprint;
+};
+
+/* Never reaped whatever the policy says */
+#define REAPER_KEEP_STATES (BLUEZ_DEVICE_CONNECTED | BLUEZ_DEVICE_PAIRED | \
+						BLUEZ_DEVICE_TRUSTED)
+
+#define DEFAULT_REAPER_UNSEEN_FOR 600
+#define DEFAULT_REAPER_MAX_IN_FLIGHT 8
+#define DEFAULT_REAPER_MAX_PER_SECOND 32
+#define DEFAULT_REAPER_INTERVAL 60
+
+static void reaper_unref(struct bluez_reaper *reaper)
+{
+	if (--reaper->ref_count > 0)
+		return;
+
+	g_free((gchar *) reaper->policy.adapter);
+	g_free(reaper->queue);
+	g_free(reaper);
+}
+
+static void reaper_query(struct bluez_reaper *reaper,
+					struct bluez_device_query *query)
+{
+	memset(query, 0, sizeof(*query));
+	query->none_of = reaper->policy.none_of;
+	query->adapter = reaper->policy.adapter;
+	query->unseen_for = reaper->policy.unseen_for;
+}
+
+static void reaper_sweep(struct bluez_reaper *reaper)
+{
+	struct bluez_device_query query;
+	guint n;
+
+	reaper_query(reaper, &query);
+
+	g_free(reaper->queue);
+	reaper->queue = NULL;
+	reaper->queue_len = 0;
+	reaper->queue_pos = 0;
+
+	n = bluez_manager_query_devices(reaper->manager, &query, NULL, 0);
+	if (n == 0)
+		return;
+
+	reaper->queue = g_new(bluez_handle_t, n);
+	reaper->queue_len = bluez_manager_query_devices(reaper->manager,
+						&query, reaper->queue, n);
+}
+
+/*
+ * Draining the queue can take minutes, the device may have been paired,
+ * connected or heard again since the sweep.
+ */
+static gboolean still_matches(struct bluez_reaper *reaper,
+						bluez_handle_t handle)
+{
+	struct bluez_device_query query;
+
+	reaper_query(reaper, &query);
+
+	return bluez_manager_device_matches(reaper->manager, &query, handle);
+}
+
+static void reaper_issue(struct bluez_reaper *reaper);
+
+static void remove_device_reply(BTResult ret, GVariant *data,
+							void *user_data)
+{
+	struct reaper_call *call = user_data;
+	struct bluez_reaper *reaper = call->reaper;
+
+	reaper->in_flight--;
+
+	if (ret == BT_RESULT_OK) {
+		reaper->stats.removed++;
+		reaper->stats.bytes += call->footprint;
+	} else if (ret != BT_RESULT_NOT_EXIST) {
+		reaper->stats.failed++;
+	}
+
+	g_free(call);
+
+	/* Keep the pipeline full within this second's budget */
+	if (reaper->manager)
+		reaper_issue(reaper);
+
+	reaper_unref(reaper);
+}
+
+static void reaper_issue(struct bluez_reaper *reaper)
+{
+	struct bluez_adapter *adapter;
+	struct bluez_device *device;
+	struct reaper_call *call;
+	bluez_handle_t handle;
+
+	while (reaper->budget > 0 &&
+			reaper->in_flight < reaper->policy.max_in_flight &&
+			reaper->queue_pos < reaper->queue_len) {
+		handle = reaper->queue[reaper->queue_pos++];
+
+		device = bluez_manager_resolve_device(reaper->manager,
+								handle);
+		if (!device || !still_matches(reaper, handle))
+			continue;
+
+		adapter = bluez_manager_get_device_adapter(reaper->manager,
+								device);
+		if (!adapter)
+			continue;
+
+		call = g_try_new0(struct reaper_call, 1);
+		if (!call)
+			return;
+
+		call->reaper = reaper;
+		call->footprint = bluez_device_get_footprint(device);
+
+		reaper->ref_count++;
+		reaper->in_flight++;
+		reaper->budget--;
+
+		bluez_adapter_remove_device_with_reply(adapter,
+					bluez_device_get_path(device),
+					BLUEZ_CALL_BACKGROUND,
+					remove_device_reply, call);
+	}
+}
+
+static void reaper_timeout(gpointer user_data)
+{
+	struct bluez_reaper *reaper = user_data;
+	gint64 now = g_get_monotonic_time();
+
+	reaper->tick = bluez_timers_add(reaper->timers, 1000,
+						reaper_timeout, reaper);
+
+	reaper->budget = reaper->policy.max_per_second;
+
+	if (reaper->queue_pos >= reaper->queue_len &&
+					now >= reaper->next_sweep) {
+		reaper_sweep(reaper);
+		reaper->next_sweep = now +
+			(gint64) reaper->policy.interval * G_USEC_PER_SEC;
+	}
+
+	reaper_issue(reaper);
+}
+
+struct bluez_reaper *bluez_reaper_new(struct bluez_manager *manager,
+				const struct bluez_reaper_policy *policy,
+				struct bluez_timers *timers)
+{
+	struct bluez_reaper *reaper;
+
+	reaper = g_try_new0(struct bluez_reaper, 1);
+	if (!reaper)
+		return NULL;
+
+	reaper->ref_count = 1;
+	reaper->manager = manager;
+	reaper->policy = *policy;
+	reaper->policy.adapter = g_strdup(policy->adapter);
+	reaper->policy.none_of |= REAPER_KEEP_STATES;
+
+	if (reaper->policy.unseen_for == 0)
+		reaper->policy.unseen_for = DEFAULT_REAPER_UNSEEN_FOR;
+	if (reaper->policy.max_in_flight == 0)
+		reaper->policy.max_in_flight = DEFAULT_REAPER_MAX_IN_FLIGHT;
+	if (reaper->policy.max_per_second == 0)
+		reaper->policy.max_per_second = DEFAULT_REAPER_MAX_PER_SECOND;
+	if (reaper->policy.interval == 0)
+		reaper->policy.interval = DEFAULT_REAPER_INTERVAL;
+
+	reaper->timers = timers;
+	reaper->tick = bluez_timers_add(timers, 1000, reaper_timeout, reaper);
+
+	return reaper;
+}
+
+void bluez_reaper_free(struct bluez_reaper *reaper)
+{
+	if (!reaper)
+		return;
+
+	bluez_timers_cancel(reaper->timers, reaper->tick);
+	reaper->tick = NULL;
+	reaper->manager = NULL;
+
+	reaper_unref(reaper);
+}
+
+void bluez_reaper_get_stats(struct bluez_reaper *reaper,
+				struct bluez_reaper_stats *stats)
+{
+	*stats = reaper->stats;
+	stats->in_flight = reaper->in_flight;
+	stats->queued = reaper->queue_len - reaper->queue_pos;
+}
@@ -0,0 +1,46 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_REAPER_H__
+#define __BLUEZ_REAPER_H__
+
+#include <glib.h>
+
+#include "bluez-manager.h"
+
+/*
+ * Removes devices matching a policy from BlueZ. Candidates come from
+ * the manager's query indexes, RemoveDevice calls are pipelined under a
+ * concurrency cap and a per-second budget. Replies may outlive the
+ * reaper's owner, so pending calls keep it referenced.
+ */
+struct bluez_reaper;
+struct bluez_timers;
+
+struct bluez_reaper *bluez_reaper_new(struct bluez_manager *manager,
+				const struct bluez_reaper_policy *policy,
+				struct bluez_timers *timers);
+
+/* Stops reaping, replies still in flight are accounted and dropped */
+void bluez_reaper_free(struct bluez_reaper *reaper);
+
+void bluez_reaper_get_stats(struct bluez_reaper *reaper,
+				struct bluez_reaper_stats *stats);
+
+#endif
@@ -0,0 +1,509 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-device.h"
+#include "bluez-snapshot.h"
+#include "bluez-reconnect.h"
+#include "bluez-timer.h"
+
+struct known_device {
+	bluez_addr_t addr;			/* key */
+	struct bluez_reconnect_policy policy;
+	gchar *adapter;				/* policy.adapter */
+	struct bluez_reconnect *reconnect;
+	guint attempt;				/* failures in a row */
+	gint64 next_time;			/* no attempt before, usec */
+	gboolean connecting;
+	gboolean forgotten;			/* freed by the reply */
+	struct bluez_timer *timer;		/* always mode only */
+};
+
+struct bluez_reconnect {
+	gint ref_count;
+	struct bluez_manager *manager;		/* NULL once freed */
+	struct bluez_timers *timers;
+	GHashTable *known;			/* addr -> known_device */
+	struct bluez_reconnect_stats stats;
+};
+
+#define DEFAULT_RECONNECT_INITIAL_DELAY 1000
+#define DEFAULT_RECONNECT_MAX_DELAY 300000
+#define RECONNECT_JITTER 50
+
+#define MINUTES_PER_DAY (24 * 60)
+
+/* Records of one address, one per adapter that has seen it */
+#define MAX_RECORDS 8
+
+static void reconnect_unref(struct bluez_reconnect *reconnect)
+{
+	if (--reconnect->ref_count > 0)
+		return;
+
+	g_hash_table_unref(reconnect->known);
+	g_free(reconnect);
+}
+
+static void known_device_free(gpointer data)
+{
+	struct known_device *known = data;
+
+	bluez_timers_cancel(known->reconnect->timers, known->timer);
+	known->timer = NULL;
+
+	/* The pending reply frees it */
+	if (known->connecting) {
+		known->forgotten = TRUE;
+		return;
+	}
+
+	g_free(known->adapter);
+	g_free(known);
+}
+
+static guint minutes_now(void)
+{
+	GDateTime *now = g_date_time_new_now_local();
+	guint minutes;
+
+	minutes = g_date_time_get_hour(now) * 60 + g_date_time_get_minute(now);
+	g_date_time_unref(now);
+
+	return minutes;
+}
+
+/* Minutes until the window opens, 0 inside it */
+static guint window_wait(const struct bluez_reconnect_policy *policy)
+{
+	guint start = policy->window_start, end = policy->window_end;
+	guint now;
+
+	if (start == end)
+		return 0;
+
+	now = minutes_now();
+
+	if (start < end ? (now >= start && now < end) :
+					(now >= start || now < end))
+		return 0;
+
+	return (start + MINUTES_PER_DAY - now) % MINUTES_PER_DAY;
+}
+
+static void known_device_check(struct known_device *known,
+				struct bluez_device *heard, gboolean fresh);
+
+static void known_device_timeout(gpointer user_data)
+{
+	struct known_device *known = user_data;
+
+	known->timer = NULL;
+	known_device_check(known, NULL, FALSE);
+}
+
+static void known_device_wait(struct known_device *known, guint64 delay_ms)
+{
+	struct bluez_reconnect *reconnect = known->reconnect;
+
+	bluez_timers_cancel(reconnect->timers, known->timer);
+	known->timer = bluez_timers_add(reconnect->timers,
+				MIN(delay_ms, G_MAXUINT), known_device_timeout,
+				known);
+}
+
+static void connect_reply(BTResult ret, GVariant *data, void *user_data)
+{
+	struct known_device *known = user_data;
+	struct bluez_reconnect *reconnect = known->reconnect;
+	guint delay;
+
+	known->connecting = FALSE;
+
+	if (known->forgotten || reconnect->manager == NULL) {
+		if (known->forgotten) {
+			g_free(known->adapter);
+			g_free(known);
+		}
+		reconnect_unref(reconnect);
+		return;
+	}
+
+	if (ret == BT_RESULT_OK) {
+		reconnect->stats.reconnected++;
+		known->attempt = 0;
+		known->next_time = 0;
+		reconnect_unref(reconnect);
+		return;
+	}
+
+	reconnect->stats.failed++;
+	known->attempt++;
+
+	delay = bluez_timer_backoff(known->policy.initial_delay_ms,
+				known->policy.max_delay_ms, known->attempt + 1,
+				RECONNECT_JITTER);
+	known->next_time = g_get_monotonic_time() + (gint64) delay * 1000;
+
+	/* In range devices wait for their next advertisement instead */
+	if (known->policy.mode == BLUEZ_RECONNECT_ALWAYS)
+		known_device_wait(known, delay);
+
+	reconnect_unref(reconnect);
+}
+
+/*
+ * The record to connect through: the policy's adapter, else the one
+ * just heard or the strongest. Connected through any record counts.
+ */
+static struct bluez_device *known_device_record(struct known_device *known,
+				struct bluez_device *heard,
+				struct bluez_device_info *info)
+{
+	struct bluez_manager *manager = known->reconnect->manager;
+	struct bluez_device *records[MAX_RECORDS], *device = NULL;
+	struct bluez_device_info record_info;
+	guint i, n;
+
+	if (known->adapter) {
+		device = find_adapter_device_by_addr(manager, known->adapter,
+								&known->addr);
+		if (device)
+			bluez_device_get_info(device, info);
+		return device;
+	}
+
+	n = find_devices_by_addr(manager, &known->addr, records, MAX_RECORDS);
+	n = MIN(n, MAX_RECORDS);
+
+	for (i = 0; i < n; i++) {
+		bluez_device_get_info(records[i], &record_info);
+
+		if (record_info.connected) {
+			*info = record_info;
+			return records[i];
+		}
+
+		/* The record just heard wins over the strongest */
+		if (device && device == heard)
+			continue;
+
+		if (device == NULL || records[i] == heard ||
+				(record_info.rssi != BLUEZ_RSSI_UNKNOWN &&
+				(info->rssi == BLUEZ_RSSI_UNKNOWN ||
+				record_info.rssi > info->rssi))) {
+			device = records[i];
+			*info = record_info;
+		}
+	}
+
+	return device;
+}
+
+/* fresh: the device was just heard from, through heard if not NULL */
+static void known_device_check(struct known_device *known,
+				struct bluez_device *heard, gboolean fresh)
+{
+	struct bluez_reconnect *reconnect = known->reconnect;
+	struct bluez_device_info info;
+	struct bluez_device *device;
+	gint64 now;
+	guint wait;
+
+	if (known->connecting)
+		return;
+
+	device = known_device_record(known, heard, &info);
+	if (device == NULL)
+		return;
+
+	/* Heard through another adapter than the policy's */
+	if (heard && heard != device)
+		fresh = FALSE;
+
+	if (info.connected) {
+		bluez_timers_cancel(reconnect->timers, known->timer);
+		known->timer = NULL;
+		known->attempt = 0;
+		known->next_time = 0;
+		return;
+	}
+
+	wait = window_wait(&known->policy);
+	if (wait) {
+		if (known->policy.mode == BLUEZ_RECONNECT_ALWAYS)
+			known_device_wait(known, (guint64) wait * 60 * 1000);
+		return;
+	}
+
+	if (known->policy.mode == BLUEZ_RECONNECT_IN_RANGE && (!fresh ||
+			info.rssi == BLUEZ_RSSI_UNKNOWN ||
+			(known->policy.min_rssi &&
+			info.rssi < known->policy.min_rssi)))
+		return;
+
+	now = g_get_monotonic_time();
+	if (now < known->next_time) {
+		if (known->policy.mode == BLUEZ_RECONNECT_ALWAYS &&
+							!known->timer)
+			known_device_wait(known,
+					(known->next_time - now + 999) / 1000);
+		return;
+	}
+
+	bluez_timers_cancel(reconnect->timers, known->timer);
+	known->timer = NULL;
+
+	known->connecting = TRUE;
+	reconnect->stats.attempts++;
+	reconnect->ref_count++;
+
+	bluez_device_submit(device, BLUEZ_DEVICE_OP_CONNECT, NULL,
+				BLUEZ_CALL_BACKGROUND, 0, NULL,
+				connect_reply, known);
+}
+
+void bluez_reconnect_device_changed(struct bluez_reconnect *reconnect,
+				struct bluez_device *device,
+				guint32 properties)
+{
+	struct known_device *known;
+
+	known = g_hash_table_lookup(reconnect->known,
+					bluez_device_get_addr(device));
+	if (known == NULL)
+		return;
+
+	if (properties & (BLUEZ_PROPERTY_CONNECTED | BLUEZ_PROPERTY_RSSI))
+		known_device_check(known, device,
+					properties & BLUEZ_PROPERTY_RSSI);
+}
+
+void bluez_reconnect_set_policy(struct bluez_reconnect *reconnect,
+				const bluez_addr_t *addr,
+				const struct bluez_reconnect_policy *policy)
+{
+	struct known_device *known;
+
+	if (policy == NULL) {
+		g_hash_table_remove(reconnect->known, addr);
+		return;
+	}
+
+	known = g_hash_table_lookup(reconnect->known, addr);
+	if (known == NULL) {
+		known = g_new0(struct known_device, 1);
+		known->addr = *addr;
+		known->reconnect = reconnect;
+		g_hash_table_insert(reconnect->known, &known->addr, known);
+	}
+
+	g_free(known->adapter);
+	known->adapter = g_strdup(policy->adapter);
+
+	known->policy = *policy;
+	known->policy.adapter = known->adapter;
+	if (known->policy.initial_delay_ms == 0)
+		known->policy.initial_delay_ms =
+					DEFAULT_RECONNECT_INITIAL_DELAY;
+	if (known->policy.max_delay_ms == 0)
+		known->policy.max_delay_ms = DEFAULT_RECONNECT_MAX_DELAY;
+
+	known_device_check(known, NULL, FALSE);
+}
+
+static guint16 parse_window_time(const gchar *str)
+{
+	guint hour, minute;
+
+	if (sscanf(str, "%u:%u", &hour, &minute) != 2 ||
+					hour > 23 || minute > 59)
+		return 0;
+
+	return hour * 60 + minute;
+}
+
+/*
+ * One group per device address:
+ *
+ *	[00:11:22:33:44:55]
+ *	Mode=always | in-range
+ *	Adapter=hci0
+ *	MinRSSI=-80
+ *	Window=08:00-18:00
+ *	InitialDelay=1000
+ *	MaxDelay=300000
+ */
+BTResult bluez_reconnect_load(struct bluez_reconnect *reconnect,
+						const gchar *filename)
+{
+	struct bluez_reconnect_policy policy;
+	GError *err = NULL;
+	bluez_addr_t addr;
+	GKeyFile *file;
+	gchar **groups, *str, *sep, *adapter;
+	gsize i, n;
+
+	file = g_key_file_new();
+
+	if (!g_key_file_load_from_file(file, filename, G_KEY_FILE_NONE,
+								&err)) {
+		printf("Failed to load %s: %s\n", filename, err->message);
+		g_error_free(err);
+		g_key_file_free(file);
+		return BT_RESULT_FAILED;
+	}
+
+	groups = g_key_file_get_groups(file, &n);
+
+	for (i = 0; i < n; i++) {
+		if (!bluez_addr_parse(groups[i], &addr)) {
+			printf("Invalid device address %s\n", groups[i]);
+			continue;
+		}
+
+		memset(&policy, 0, sizeof(policy));
+
+		str = g_key_file_get_string(file, groups[i], "Mode", NULL);
+		if (!g_strcmp0(str, "in-range"))
+			policy.mode = BLUEZ_RECONNECT_IN_RANGE;
+		g_free(str);
+
+		adapter = g_key_file_get_string(file, groups[i], "Adapter",
+									NULL);
+		policy.adapter = adapter;
+
+		policy.min_rssi = g_key_file_get_integer(file, groups[i],
+							"MinRSSI", NULL);
+		policy.initial_delay_ms = g_key_file_get_integer(file,
+					groups[i], "InitialDelay", NULL);
+		policy.max_delay_ms = g_key_file_get_integer(file,
+					groups[i], "MaxDelay", NULL);
+
+		str = g_key_file_get_string(file, groups[i], "Window", NULL);
+		sep = str ? strchr(str, '-') : NULL;
+		if (sep) {
+			*sep = '\0';
+			policy.window_start = parse_window_time(str);
+			policy.window_end = parse_window_time(sep + 1);
+		}
+		g_free(str);
+
+		bluez_reconnect_set_policy(reconnect, &addr, &policy);
+		g_free(adapter);
+	}
+
+	g_strfreev(groups);
+	g_key_file_free(file);
+
+	return BT_RESULT_OK;
+}
+
+BTResult bluez_reconnect_save(struct bluez_reconnect *reconnect,
+						const gchar *filename)
+{
+	gchar group[BLUEZ_ADDR_STRLEN], *window;
+	struct known_device *known;
+	GHashTableIter iter;
+	GError *err = NULL;
+	GKeyFile *file;
+	BTResult ret = BT_RESULT_OK;
+
+	file = g_key_file_new();
+
+	g_hash_table_iter_init(&iter, reconnect->known);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &known)) {
+		const struct bluez_reconnect_policy *policy = &known->policy;
+
+		bluez_addr_format(&known->addr, group);
+
+		g_key_file_set_string(file, group, "Mode",
+				policy->mode == BLUEZ_RECONNECT_IN_RANGE ?
+				"in-range" : "always");
+		if (policy->adapter)
+			g_key_file_set_string(file, group, "Adapter",
+							policy->adapter);
+		if (policy->min_rssi)
+			g_key_file_set_integer(file, group, "MinRSSI",
+							policy->min_rssi);
+		if (policy->window_start != policy->window_end) {
+			window = g_strdup_printf("%02u:%02u-%02u:%02u",
+					policy->window_start / 60,
+					policy->window_start % 60,
+					policy->window_end / 60,
+					policy->window_end % 60);
+			g_key_file_set_string(file, group, "Window", window);
+			g_free(window);
+		}
+		g_key_file_set_integer(file, group, "InitialDelay",
+						policy->initial_delay_ms);
+		g_key_file_set_integer(file, group, "MaxDelay",
+						policy->max_delay_ms);
+	}
+
+	if (!g_key_file_save_to_file(file, filename, &err)) {
+		printf("Failed to save %s: %s\n", filename, err->message);
+		g_error_free(err);
+		ret = BT_RESULT_FAILED;
+	}
+
+	g_key_file_free(file);
+
+	return ret;
+}
+
+void bluez_reconnect_get_stats(struct bluez_reconnect *reconnect,
+				struct bluez_reconnect_stats *stats)
+{
+	*stats = reconnect->stats;
+	stats->known = g_hash_table_size(reconnect->known);
+}
+
+struct bluez_reconnect *bluez_reconnect_new(struct bluez_manager *manager,
+					struct bluez_timers *timers)
+{
+	struct bluez_reconnect *reconnect;
+
+	reconnect = g_try_new0(struct bluez_reconnect, 1);
+	if (!reconnect)
+		return NULL;
+
+	reconnect->ref_count = 1;
+	reconnect->manager = manager;
+	reconnect->timers = timers;
+	reconnect->known = g_hash_table_new_full(bluez_addr_hash,
+				bluez_addr_equal, NULL, known_device_free);
+
+	return reconnect;
+}
+
+void bluez_reconnect_free(struct bluez_reconnect *reconnect)
+{
+	if (!reconnect)
+		return;
+
+	g_hash_table_remove_all(reconnect->known);
+	reconnect->manager = NULL;
+
+	reconnect_unref(reconnect);
+}
@@ -0,0 +1,63 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_RECONNECT_H__
+#define __BLUEZ_RECONNECT_H__
+
+#include <glib.h>
+
+#include "bluez-manager.h"
+
+/*
+ * Keeps known devices connected according to their policy. Attempts are
+ * triggered by the device dropping its connection, by fresh RSSI from
+ * advertisements and, for devices reconnected regardless of presence,
+ * by a backoff timer. Devices waiting for an advertisement hold no timer.
+ * Known devices are keyed by address, so a policy survives the device
+ * object being removed and discovered again.
+ */
+struct bluez_reconnect;
+struct bluez_timers;
+
+struct bluez_reconnect *bluez_reconnect_new(struct bluez_manager *manager,
+					struct bluez_timers *timers);
+
+/* Calls in flight finish without further attempts */
+void bluez_reconnect_free(struct bluez_reconnect *reconnect);
+
+/* A NULL policy forgets the device */
+void bluez_reconnect_set_policy(struct bluez_reconnect *reconnect,
+				const bluez_addr_t *addr,
+				const struct bluez_reconnect_policy *policy);
+
+/* properties is a BLUEZ_PROPERTY_* mask, a new device passes both */
+void bluez_reconnect_device_changed(struct bluez_reconnect *reconnect,
+				struct bluez_device *device,
+				guint32 properties);
+
+BTResult bluez_reconnect_load(struct bluez_reconnect *reconnect,
+						const gchar *filename);
+
+BTResult bluez_reconnect_save(struct bluez_reconnect *reconnect,
+						const gchar *filename);
+
+void bluez_reconnect_get_stats(struct bluez_reconnect *reconnect,
+				struct bluez_reconnect_stats *stats);
+
+#endif
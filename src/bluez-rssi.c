@@ -0,0 +1,166 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-device.h"
+#include "bluez-rssi.h"
+
+#define RSSI_MIN (-127)
+#define RSSI_MAX 20
+#define N_BUCKETS (RSSI_MAX - RSSI_MIN + 1)
+#define NO_ENTRY G_MAXUINT32
+
+struct rssi_entry {
+	gboolean linked;
+	guint16 bucket;
+	const gchar *adapter;
+	gint64 time;
+	guint32 prev;
+	guint32 next;
+};
+
+struct bluez_rssi_index {
+	guint32 buckets[N_BUCKETS];		/* list heads */
+	struct rssi_entry *entries;		/* by slot */
+	guint32 n_entries;
+};
+
+struct bluez_rssi_index *bluez_rssi_index_new(void)
+{
+	struct bluez_rssi_index *index;
+	int i;
+
+	index = g_try_new0(struct bluez_rssi_index, 1);
+	if (!index)
+		return NULL;
+
+	for (i = 0; i < N_BUCKETS; i++)
+		index->buckets[i] = NO_ENTRY;
+
+	return index;
+}
+
+void bluez_rssi_index_free(struct bluez_rssi_index *index)
+{
+	if (!index)
+		return;
+
+	g_free(index->entries);
+	g_free(index);
+}
+
+static void unlink_entry(struct bluez_rssi_index *index, guint32 slot)
+{
+	struct rssi_entry *entry = &index->entries[slot];
+
+	if (entry->prev != NO_ENTRY)
+		index->entries[entry->prev].next = entry->next;
+	else
+		index->buckets[entry->bucket] = entry->next;
+
+	if (entry->next != NO_ENTRY)
+		index->entries[entry->next].prev = entry->prev;
+
+	entry->linked = FALSE;
+}
+
+void bluez_rssi_index_remove(struct bluez_rssi_index *index, guint32 slot)
+{
+	if (slot < index->n_entries && index->entries[slot].linked)
+		unlink_entry(index, slot);
+}
+
+gint16 bluez_rssi_index_get(struct bluez_rssi_index *index, guint32 slot)
+{
+	if (slot >= index->n_entries || !index->entries[slot].linked)
+		return BLUEZ_RSSI_UNKNOWN;
+
+	return index->entries[slot].bucket + RSSI_MIN;
+}
+
+void bluez_rssi_index_update(struct bluez_rssi_index *index, guint32 slot,
+				gint16 rssi, const gchar *adapter, gint64 now)
+{
+	struct rssi_entry *entry;
+	guint32 n_entries;
+
+	if (rssi == BLUEZ_RSSI_UNKNOWN) {
+		bluez_rssi_index_remove(index, slot);
+		return;
+	}
+
+	if (slot >= index->n_entries) {
+		n_entries = MAX(slot + 1, index->n_entries * 2);
+		index->entries = g_renew(struct rssi_entry, index->entries,
+								n_entries);
+		memset(index->entries + index->n_entries, 0,
+			(n_entries - index->n_entries) *
+						sizeof(struct rssi_entry));
+		index->n_entries = n_entries;
+	}
+
+	entry = &index->entries[slot];
+	if (entry->linked)
+		unlink_entry(index, slot);
+
+	entry->bucket = CLAMP(rssi, RSSI_MIN, RSSI_MAX) - RSSI_MIN;
+	entry->adapter = adapter;
+	entry->time = now;
+
+	/* Newest first within a bucket */
+	entry->prev = NO_ENTRY;
+	entry->next = index->buckets[entry->bucket];
+	if (entry->next != NO_ENTRY)
+		index->entries[entry->next].prev = slot;
+	index->buckets[entry->bucket] = slot;
+
+	entry->linked = TRUE;
+}
+
+guint bluez_rssi_index_top(struct bluez_rssi_index *index, guint k,
+				const gchar *adapter, gint64 min_time,
+				guint32 *slots)
+{
+	struct rssi_entry *entry;
+	guint32 slot, next;
+	guint n = 0;
+	int b;
+
+	for (b = N_BUCKETS - 1; b >= 0 && n < k; b--) {
+		for (slot = index->buckets[b]; slot != NO_ENTRY && n < k;
+								slot = next) {
+			entry = &index->entries[slot];
+			next = entry->next;
+
+			if (entry->time < min_time) {
+				unlink_entry(index, slot);
+				continue;
+			}
+
+			if (adapter && g_strcmp0(entry->adapter, adapter))
+				continue;
+
+			slots[n++] = slot;
+		}
+	}
+
+	return n;
+}
@@ -0,0 +1,51 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_RSSI_H__
+#define __BLUEZ_RSSI_H__
+
+#include <glib.h>
+
+/*
+ * Device slots bucketed by RSSI, one bucket per dBm. Updates relink one
+ * entry, the strongest devices are read from the top buckets down.
+ * Entries not refreshed since a given time are dropped lazily when a
+ * query walks over them.
+ */
+struct bluez_rssi_index;
+
+struct bluez_rssi_index *bluez_rssi_index_new(void);
+
+void bluez_rssi_index_free(struct bluez_rssi_index *index);
+
+/* adapter must stay valid while indexed, BLUEZ_RSSI_UNKNOWN removes */
+void bluez_rssi_index_update(struct bluez_rssi_index *index, guint32 slot,
+				gint16 rssi, const gchar *adapter, gint64 now);
+
+void bluez_rssi_index_remove(struct bluez_rssi_index *index, guint32 slot);
+
+/* RSSI of the slot's bucket, BLUEZ_RSSI_UNKNOWN if not indexed */
+gint16 bluez_rssi_index_get(struct bluez_rssi_index *index, guint32 slot);
+
+/* Up to k slots strongest first, entries older than min_time expire */
+guint bluez_rssi_index_top(struct bluez_rssi_index *index, guint k,
+				const gchar *adapter, gint64 min_time,
+				guint32 *slots);
+
+#endif
@@ -0,0 +1,484 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "bluez-common.h"
+#include "bluez-scheduler.h"
+#include "bluez-timer.h"
+
+struct scheduled_call {
+	GList link;				/* in its class queue */
+	struct bluez_scheduler *scheduler;
+	GDBusProxy *proxy;
+	const gchar *name;			/* interned */
+	GVariant *parameter;
+	enum bluez_call_class klass;
+	const gchar *adapter;			/* interned adapter path */
+	gint64 queued_time;
+	gint64 deadline;			/* 0 never expires */
+	struct bluez_timer *expiry;		/* while queued */
+	guint timeout_ms;			/* per attempt */
+
+	/* Retries, policy.max_attempts is 0 without a policy */
+	struct bluez_retry_policy policy;
+	guint attempt;
+	gint64 final_deadline;			/* 0 unbounded */
+	struct bluez_timer *backoff;
+
+	bluez_response_cb func;
+	void *user_data;
+};
+
+struct bluez_scheduler {
+	gint ref_count;
+	gboolean closed;
+
+	guint max_in_flight;
+	guint max_per_adapter;
+
+	GQueue queues[BLUEZ_CALL_N_CLASSES];
+	GHashTable *adapter_in_flight;		/* adapter path -> count */
+
+	struct bluez_timers *timers;		/* shared, not owned */
+	GQueue backoff;				/* calls waiting to retry */
+
+	struct bluez_scheduler_stats stats;
+};
+
+#define DEFAULT_MAX_IN_FLIGHT 16
+#define DEFAULT_MAX_PER_ADAPTER 4
+
+#define DEFAULT_RETRY_ATTEMPTS 4
+#define DEFAULT_RETRY_INITIAL_DELAY 200
+#define DEFAULT_RETRY_MAX_DELAY 10000
+#define DEFAULT_RETRY_JITTER 50
+
+static void scheduler_unref(struct bluez_scheduler *scheduler)
+{
+	if (--scheduler->ref_count > 0)
+		return;
+
+	g_hash_table_unref(scheduler->adapter_in_flight);
+	g_free(scheduler);
+}
+
+/* "/org/bluez/hci0/dev_..." belongs to "/org/bluez/hci0" */
+static const gchar *adapter_path(GDBusProxy *proxy)
+{
+	const gchar *path = g_dbus_proxy_get_object_path(proxy);
+	const gchar *end = NULL;
+	const gchar *adapter;
+	gchar *prefix;
+
+	if (g_str_has_prefix(path, "/org/bluez/"))
+		end = strchr(path + sizeof("/org/bluez/") - 1, '/');
+
+	if (end == NULL)
+		return bluez_intern(path);
+
+	prefix = g_strndup(path, end - path);
+	adapter = bluez_intern(prefix);
+	g_free(prefix);
+
+	return adapter;
+}
+
+static guint adapter_in_flight(struct bluez_scheduler *scheduler,
+						const gchar *adapter)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup(
+				scheduler->adapter_in_flight, adapter));
+}
+
+static void set_adapter_in_flight(struct bluez_scheduler *scheduler,
+					const gchar *adapter, guint n)
+{
+	if (n)
+		g_hash_table_replace(scheduler->adapter_in_flight,
+				(gpointer) adapter, GUINT_TO_POINTER(n));
+	else
+		g_hash_table_remove(scheduler->adapter_in_flight, adapter);
+}
+
+static void call_finish(struct scheduled_call *call, BTResult ret,
+							GVariant *reply)
+{
+	if (call->func)
+		call->func(ret, reply, call->user_data);
+
+	if (call->parameter)
+		g_variant_unref(call->parameter);
+
+	bluez_intern_unref(call->name);
+	bluez_intern_unref(call->adapter);
+	g_object_unref(call->proxy);
+	g_free(call);
+}
+
+static void scheduler_dispatch(struct bluez_scheduler *scheduler);
+
+/* Deadline of the next attempt, bounded by the deadline of all of them */
+static void call_set_deadline(struct scheduled_call *call, gint64 now)
+{
+	call->queued_time = now;
+	call->deadline = 0;
+
+	if (call->timeout_ms)
+		call->deadline = now + (gint64) call->timeout_ms * 1000;
+
+	if (call->final_deadline && (call->deadline == 0 ||
+				call->final_deadline < call->deadline))
+		call->deadline = call->final_deadline;
+}
+
+static void call_expire(gpointer user_data)
+{
+	struct scheduled_call *call = user_data;
+	struct bluez_scheduler *scheduler = call->scheduler;
+
+	call->expiry = NULL;
+	g_queue_unlink(&scheduler->queues[call->klass], &call->link);
+
+	scheduler->stats.classes[call->klass].queued--;
+	scheduler->stats.classes[call->klass].expired++;
+
+	call_finish(call, BT_RESULT_TIMEOUT, NULL);
+}
+
+static void call_dequeue(struct bluez_scheduler *scheduler,
+					struct scheduled_call *call)
+{
+	g_queue_unlink(&scheduler->queues[call->klass], &call->link);
+	scheduler->stats.classes[call->klass].queued--;
+
+	bluez_timers_cancel(scheduler->timers, call->expiry);
+	call->expiry = NULL;
+}
+
+static void call_enqueue(struct bluez_scheduler *scheduler,
+					struct scheduled_call *call)
+{
+	struct bluez_scheduler_stats *stats = &scheduler->stats;
+	gint64 delay;
+
+	call->link.data = call;
+	g_queue_push_tail_link(&scheduler->queues[call->klass], &call->link);
+	if (++stats->classes[call->klass].queued >
+				stats->classes[call->klass].max_queued)
+		stats->classes[call->klass].max_queued =
+				stats->classes[call->klass].queued;
+
+	if (call->deadline) {
+		delay = MAX(call->deadline - call->queued_time, 0);
+		call->expiry = bluez_timers_add(scheduler->timers,
+					delay / 1000, call_expire, call);
+	}
+}
+
+static void call_backoff_done(gpointer user_data)
+{
+	struct scheduled_call *call = user_data;
+	struct bluez_scheduler *scheduler = call->scheduler;
+
+	call->backoff = NULL;
+	g_queue_remove(&scheduler->backoff, call);
+
+	call_set_deadline(call, g_get_monotonic_time());
+	call_enqueue(scheduler, call);
+	scheduler_dispatch(scheduler);
+}
+
+static gboolean call_retry(struct bluez_scheduler *scheduler,
+				struct scheduled_call *call, BTResult ret)
+{
+	guint delay;
+
+	if (ret >= 32 || !(call->policy.retry_on & BLUEZ_RETRY_ON(ret)))
+		return FALSE;
+
+	if (call->attempt >= call->policy.max_attempts)
+		return FALSE;
+
+	delay = bluez_timer_backoff(call->policy.initial_delay_ms,
+				call->policy.max_delay_ms, call->attempt + 1,
+				call->policy.jitter);
+
+	if (call->final_deadline && g_get_monotonic_time() +
+			(gint64) delay * 1000 >= call->final_deadline)
+		return FALSE;
+
+	call->attempt++;
+	scheduler->stats.classes[call->klass].retries++;
+
+	g_queue_push_tail(&scheduler->backoff, call);
+	call->backoff = bluez_timers_add(scheduler->timers, delay,
+						call_backoff_done, call);
+
+	return TRUE;
+}
+
+static void scheduled_call_reply(GObject *object, GAsyncResult *res,
+							gpointer user_data)
+{
+	struct scheduled_call *call = user_data;
+	struct bluez_scheduler *scheduler = call->scheduler;
+	GError *err = NULL;
+	GVariant *reply;
+	BTResult ret;
+
+	reply = g_dbus_proxy_call_finish(G_DBUS_PROXY(object), res, &err);
+
+	if (g_error_matches(err, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+		ret = BT_RESULT_TIMEOUT;
+	else
+		ret = error_to_result(err);
+
+	if (err != NULL)
+		g_error_free(err);
+
+	scheduler->stats.in_flight--;
+	scheduler->stats.classes[call->klass].in_flight--;
+	set_adapter_in_flight(scheduler, call->adapter,
+		adapter_in_flight(scheduler, call->adapter) - 1);
+
+	if (scheduler->closed || !call_retry(scheduler, call, ret))
+		call_finish(call, ret, reply);
+
+	if (reply)
+		g_variant_unref(reply);
+
+	if (!scheduler->closed)
+		scheduler_dispatch(scheduler);
+
+	scheduler_unref(scheduler);
+}
+
+static void call_start(struct bluez_scheduler *scheduler,
+				struct scheduled_call *call, gint64 now)
+{
+	GMainContext *context = bluez_timers_get_context(scheduler->timers);
+	gint timeout = -1;
+	guint64 wait = now - call->queued_time;
+
+	if (call->deadline)
+		timeout = MAX((call->deadline - now) / 1000, 1);
+
+	scheduler->stats.in_flight++;
+	scheduler->stats.classes[call->klass].in_flight++;
+	scheduler->stats.classes[call->klass].dispatched++;
+	scheduler->stats.classes[call->klass].wait_time += wait;
+	if (wait > scheduler->stats.classes[call->klass].max_wait_time)
+		scheduler->stats.classes[call->klass].max_wait_time = wait;
+
+	set_adapter_in_flight(scheduler, call->adapter,
+		adapter_in_flight(scheduler, call->adapter) + 1);
+
+	scheduler->ref_count++;
+
+	/*
+	 * Replies go to the thread default context of the caller, which
+	 * for calls queued outside dispatch may not be the manager's.
+	 */
+	g_main_context_push_thread_default(context);
+
+	/* The call keeps its own parameter reference for call_finish() */
+	g_dbus_proxy_call(call->proxy, call->name, call->parameter, 0,
+				timeout, NULL, scheduled_call_reply, call);
+
+	g_main_context_pop_thread_default(context);
+}
+
+/*
+ * Starts queued calls in class order. A call whose adapter is at its cap
+ * is skipped, calls behind it toward other adapters may still go.
+ */
+static void scheduler_dispatch(struct bluez_scheduler *scheduler)
+{
+	gint64 now = g_get_monotonic_time();
+	struct scheduled_call *call;
+	GList *link, *next;
+	int i;
+
+	for (i = 0; i < BLUEZ_CALL_N_CLASSES; i++) {
+		for (link = scheduler->queues[i].head; link; link = next) {
+			next = link->next;
+			call = link->data;
+
+			if (scheduler->stats.in_flight >=
+						scheduler->max_in_flight)
+				return;
+
+			if (adapter_in_flight(scheduler, call->adapter) >=
+						scheduler->max_per_adapter)
+				continue;
+
+			call_dequeue(scheduler, call);
+			call_start(scheduler, call, now);
+		}
+	}
+}
+
+void bluez_scheduler_call_with_retry(struct bluez_scheduler *scheduler,
+				GDBusProxy *proxy, const gchar *name,
+				GVariant *parameter,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *policy,
+				bluez_response_cb func, void *user_data)
+{
+	struct scheduled_call *call;
+	gint64 now = g_get_monotonic_time();
+
+	if (scheduler == NULL) {
+		proxy_method_call_with_reply(proxy, name, parameter,
+							func, user_data);
+		return;
+	}
+
+	if (klass >= BLUEZ_CALL_N_CLASSES)
+		klass = BLUEZ_CALL_NORMAL;
+
+	call = g_try_new0(struct scheduled_call, 1);
+	if (!call) {
+		if (parameter)
+			g_variant_unref(g_variant_ref_sink(parameter));
+		if (func)
+			func(BT_RESULT_FAILED, NULL, user_data);
+		return;
+	}
+
+	call->scheduler = scheduler;
+	call->proxy = g_object_ref(proxy);
+	call->name = bluez_intern(name);
+	call->parameter = parameter ? g_variant_ref_sink(parameter) : NULL;
+	call->klass = klass;
+	call->adapter = adapter_path(proxy);
+	call->timeout_ms = timeout_ms;
+	call->attempt = 1;
+	call->func = func;
+	call->user_data = user_data;
+
+	if (policy) {
+		call->policy = *policy;
+
+		if (!call->policy.retry_on)
+			call->policy.retry_on = BLUEZ_RETRY_TRANSIENT;
+		if (!call->policy.max_attempts)
+			call->policy.max_attempts = DEFAULT_RETRY_ATTEMPTS;
+		if (!call->policy.initial_delay_ms)
+			call->policy.initial_delay_ms =
+						DEFAULT_RETRY_INITIAL_DELAY;
+		if (!call->policy.max_delay_ms)
+			call->policy.max_delay_ms = DEFAULT_RETRY_MAX_DELAY;
+		if (!call->policy.jitter)
+			call->policy.jitter = DEFAULT_RETRY_JITTER;
+		if (call->policy.deadline_ms)
+			call->final_deadline = now +
+				(gint64) call->policy.deadline_ms * 1000;
+	}
+
+	call_set_deadline(call, now);
+	call_enqueue(scheduler, call);
+
+	scheduler_dispatch(scheduler);
+}
+
+void bluez_scheduler_call(struct bluez_scheduler *scheduler,
+				GDBusProxy *proxy, const gchar *name,
+				GVariant *parameter,
+				enum bluez_call_class klass, guint timeout_ms,
+				bluez_response_cb func, void *user_data)
+{
+	bluez_scheduler_call_with_retry(scheduler, proxy, name, parameter,
+				klass, timeout_ms, NULL, func, user_data);
+}
+
+BTResult bluez_scheduler_set_limits(struct bluez_scheduler *scheduler,
+				guint max_in_flight, guint max_per_adapter)
+{
+	if (scheduler == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	if (max_in_flight)
+		scheduler->max_in_flight = max_in_flight;
+	if (max_per_adapter)
+		scheduler->max_per_adapter = max_per_adapter;
+
+	scheduler_dispatch(scheduler);
+
+	return BT_RESULT_OK;
+}
+
+void bluez_scheduler_get_stats(struct bluez_scheduler *scheduler,
+				struct bluez_scheduler_stats *stats)
+{
+	*stats = scheduler->stats;
+}
+
+struct bluez_scheduler *bluez_scheduler_new(struct bluez_timers *timers)
+{
+	struct bluez_scheduler *scheduler;
+	int i;
+
+	scheduler = g_try_new0(struct bluez_scheduler, 1);
+	if (!scheduler)
+		return NULL;
+
+	scheduler->ref_count = 1;
+	scheduler->max_in_flight = DEFAULT_MAX_IN_FLIGHT;
+	scheduler->max_per_adapter = DEFAULT_MAX_PER_ADAPTER;
+
+	for (i = 0; i < BLUEZ_CALL_N_CLASSES; i++)
+		g_queue_init(&scheduler->queues[i]);
+
+	scheduler->adapter_in_flight = g_hash_table_new(g_direct_hash,
+							g_direct_equal);
+	scheduler->timers = timers;
+	g_queue_init(&scheduler->backoff);
+
+	return scheduler;
+}
+
+void bluez_scheduler_free(struct bluez_scheduler *scheduler)
+{
+	struct scheduled_call *call;
+	int i;
+
+	if (!scheduler)
+		return;
+
+	scheduler->closed = TRUE;
+
+	while ((call = g_queue_pop_head(&scheduler->backoff))) {
+		bluez_timers_cancel(scheduler->timers, call->backoff);
+		call_finish(call, BT_RESULT_CANCELLED, NULL);
+	}
+
+	for (i = 0; i < BLUEZ_CALL_N_CLASSES; i++) {
+		while ((call = g_queue_peek_head(&scheduler->queues[i]))) {
+			call_dequeue(scheduler, call);
+			call_finish(call, BT_RESULT_CANCELLED, NULL);
+		}
+	}
+
+	scheduler_unref(scheduler);
+}
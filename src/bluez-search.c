@@ -0,0 +1,244 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-search.h"
+
+struct search_entry {
+	gchar *name;				/* lowercased */
+	gchar *alias;				/* lowercased */
+};
+
+struct bluez_search_index {
+	struct search_entry *entries;		/* by slot */
+	guint32 n_entries;
+	GHashTable *postings;			/* trigram -> GArray of slots */
+};
+
+#define TRIGRAM(p) GUINT_TO_POINTER(((guint8) (p)[0] << 16 | \
+				(guint8) (p)[1] << 8 | (guint8) (p)[2]) + 1)
+
+struct bluez_search_index *bluez_search_index_new(void)
+{
+	struct bluez_search_index *index;
+
+	index = g_try_new0(struct bluez_search_index, 1);
+	if (!index)
+		return NULL;
+
+	index->postings = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					NULL, (GDestroyNotify) g_array_unref);
+
+	return index;
+}
+
+void bluez_search_index_free(struct bluez_search_index *index)
+{
+	guint32 i;
+
+	if (!index)
+		return;
+
+	for (i = 0; i < index->n_entries; i++) {
+		g_free(index->entries[i].name);
+		g_free(index->entries[i].alias);
+	}
+
+	g_free(index->entries);
+	g_hash_table_unref(index->postings);
+	g_free(index);
+}
+
+/* Distinct trigrams of the entry, an alias equal to the name adds none */
+static GHashTable *entry_trigrams(const struct search_entry *entry)
+{
+	const gchar *texts[2] = { entry->name, entry->alias };
+	GHashTable *trigrams;
+	gsize i, len;
+	int t;
+
+	trigrams = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for (t = 0; t < 2; t++) {
+		if (texts[t] == NULL)
+			continue;
+
+		len = strlen(texts[t]);
+		for (i = 0; i + 3 <= len; i++)
+			g_hash_table_add(trigrams, TRIGRAM(texts[t] + i));
+	}
+
+	return trigrams;
+}
+
+static void posting_add(struct bluez_search_index *index, gpointer trigram,
+							guint32 slot)
+{
+	GArray *slots;
+
+	slots = g_hash_table_lookup(index->postings, trigram);
+	if (!slots) {
+		slots = g_array_new(FALSE, FALSE, sizeof(guint32));
+		g_hash_table_insert(index->postings, trigram, slots);
+	}
+
+	g_array_append_val(slots, slot);
+}
+
+static void posting_remove(struct bluez_search_index *index,
+					gpointer trigram, guint32 slot)
+{
+	GArray *slots;
+	guint i;
+
+	slots = g_hash_table_lookup(index->postings, trigram);
+	if (!slots)
+		return;
+
+	for (i = 0; i < slots->len; i++) {
+		if (g_array_index(slots, guint32, i) == slot) {
+			g_array_remove_index_fast(slots, i);
+			break;
+		}
+	}
+
+	if (slots->len == 0)
+		g_hash_table_remove(index->postings, trigram);
+}
+
+static void entry_postings(struct bluez_search_index *index, guint32 slot,
+							gboolean add)
+{
+	GHashTableIter iter;
+	GHashTable *trigrams;
+	gpointer trigram;
+
+	trigrams = entry_trigrams(&index->entries[slot]);
+
+	g_hash_table_iter_init(&iter, trigrams);
+	while (g_hash_table_iter_next(&iter, &trigram, NULL)) {
+		if (add)
+			posting_add(index, trigram, slot);
+		else
+			posting_remove(index, trigram, slot);
+	}
+
+	g_hash_table_unref(trigrams);
+}
+
+void bluez_search_index_update(struct bluez_search_index *index,
+				guint32 slot, const gchar *name,
+				const gchar *alias)
+{
+	struct search_entry *entry;
+	guint32 n_entries;
+
+	if (slot >= index->n_entries) {
+		if (name == NULL && alias == NULL)
+			return;
+
+		n_entries = MAX(slot + 1, index->n_entries * 2);
+		index->entries = g_renew(struct search_entry, index->entries,
+								n_entries);
+		memset(index->entries + index->n_entries, 0,
+			(n_entries - index->n_entries) *
+						sizeof(struct search_entry));
+		index->n_entries = n_entries;
+	}
+
+	entry = &index->entries[slot];
+
+	entry_postings(index, slot, FALSE);
+
+	g_free(entry->name);
+	g_free(entry->alias);
+	entry->name = name ? g_utf8_strdown(name, -1) : NULL;
+	entry->alias = alias ? g_utf8_strdown(alias, -1) : NULL;
+
+	entry_postings(index, slot, TRUE);
+}
+
+static gboolean entry_matches(const struct search_entry *entry,
+				const gchar *text, gboolean prefix)
+{
+	if (prefix)
+		return (entry->name && g_str_has_prefix(entry->name, text)) ||
+			(entry->alias && g_str_has_prefix(entry->alias, text));
+
+	return (entry->name && strstr(entry->name, text)) ||
+			(entry->alias && strstr(entry->alias, text));
+}
+
+guint bluez_search_index_find(struct bluez_search_index *index,
+				const gchar *text, gboolean prefix,
+				guint32 *slots, guint max_slots)
+{
+	GArray *candidates = NULL, *posting;
+	gchar *lower;
+	gsize i, len;
+	guint32 slot;
+	guint n = 0;
+
+	lower = g_utf8_strdown(text, -1);
+	len = strlen(lower);
+
+	/* The rarest trigram bounds the candidates */
+	for (i = 0; i + 3 <= len; i++) {
+		posting = g_hash_table_lookup(index->postings,
+						TRIGRAM(lower + i));
+		if (!posting)
+			goto done;
+
+		if (!candidates || posting->len < candidates->len)
+			candidates = posting;
+	}
+
+	if (candidates) {
+		for (i = 0; i < candidates->len; i++) {
+			slot = g_array_index(candidates, guint32, i);
+
+			if (!entry_matches(&index->entries[slot], lower,
+								prefix))
+				continue;
+
+			if (slots && n < max_slots)
+				slots[n] = slot;
+			n++;
+		}
+
+		goto done;
+	}
+
+	/* Shorter than a trigram, check every entry */
+	for (slot = 0; slot < index->n_entries; slot++) {
+		if (!entry_matches(&index->entries[slot], lower, prefix))
+			continue;
+
+		if (slots && n < max_slots)
+			slots[n] = slot;
+		n++;
+	}
+
+done:
+	g_free(lower);
+
+	return n;
+}
@@ -0,0 +1,46 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_SEARCH_H__
+#define __BLUEZ_SEARCH_H__
+
+#include <glib.h>
+
+/*
+ * Case-insensitive text index over device names and aliases, keyed by
+ * device slot. Each slot's lowercased text is kept alongside posting
+ * lists of its trigrams; queries intersect through the rarest trigram
+ * and verify the candidates against the kept text.
+ */
+struct bluez_search_index;
+
+struct bluez_search_index *bluez_search_index_new(void);
+
+void bluez_search_index_free(struct bluez_search_index *index);
+
+/* Both NULL removes the slot */
+void bluez_search_index_update(struct bluez_search_index *index,
+				guint32 slot, const gchar *name,
+				const gchar *alias);
+
+guint bluez_search_index_find(struct bluez_search_index *index,
+				const gchar *text, gboolean prefix,
+				guint32 *slots, guint max_slots);
+
+#endif
@@ -20,15 +20,31 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include "bluez-service.h"
+#include "bluez-pool.h"
 
 struct bluez_service {
+	GDBusObject *object;
 	GDBusProxy *service_proxy;
 	GDBusProxy *properties_proxy;
 
 	service_property_watch property_func;
 	gpointer property_data;
+
+	/* Library internal watch, e.g. the owning manager */
+	service_changed_notify changed_func;
+	gpointer changed_data;
 };
 
+static struct bluez_pool service_pool = BLUEZ_POOL_INIT("service",
+					sizeof(struct bluez_service), 64);
+
+void bluez_service_set_changed_notify(struct bluez_service *service,
+			service_changed_notify func, gpointer user_data)
+{
+	service->changed_func = func;
+	service->changed_data = user_data;
+}
+
 void bluez_service_set_properties_watch(struct bluez_service *service,
 				service_property_watch func, gpointer user_data)
 {
@@ -66,31 +82,28 @@ gchar *bluez_service_get_remote_uuid(struct bluez_service *service)
 	return property_get_string(service->service_proxy, "RemoteUUID");
 }
 
+const gchar *bluez_service_get_path(struct bluez_service *service)
+{
+	return g_dbus_proxy_get_object_path(service->service_proxy);
+}
+
 static void service_properties_changed(GDBusProxy *proxy,
 						GVariant *changed_properties,
 						GStrv *invalidated_properties,
 						gpointer user_data)
 {
 	struct bluez_service *service = (struct bluez_service *) user_data;
-	GVariantIter iter;
-	gchar *key;
-	GPtrArray *p;
 	gchar **prop_names;
 
-	p = g_ptr_array_new();
+	prop_names = bluez_intern_property_names(changed_properties);
 
-	g_variant_iter_init(&iter, changed_properties);
-	while (g_variant_iter_next(&iter, "{sv}", &key, NULL))
-		g_ptr_array_add(p, key);
-
-	g_ptr_array_add(p, NULL);
-
-	prop_names = (gchar **) g_ptr_array_free(p, FALSE);
+	if (service->changed_func)
+		service->changed_func(service, prop_names, service->changed_data);
 
 	if (service->property_func)
 		service->property_func(service, prop_names);
 
-	g_strfreev(prop_names);
+	bluez_intern_strv_free(prop_names);
 }
 
 static void service_interface_added(GDBusObject *object,
@@ -102,8 +115,11 @@ static void service_interface_added(GDBusObject *object,
 
 	name = g_dbus_proxy_get_interface_name(proxy);
 	if (g_strcmp0(name, SERVICE_INTERFACE) == 0) {
-		if (service->service_proxy)
+		if (service->service_proxy) {
+			g_signal_handlers_disconnect_by_data(service->service_proxy,
+								service);
 			g_object_unref(service->service_proxy);
+		}
 
 		service->service_proxy = g_object_ref(proxy);
 
@@ -128,6 +144,8 @@ static void service_interface_removed(GDBusObject *object,
 	name = g_dbus_proxy_get_interface_name(proxy);
 	if (g_strcmp0(name, SERVICE_INTERFACE) == 0) {
 		if (service->service_proxy) {
+			g_signal_handlers_disconnect_by_data(service->service_proxy,
+								service);
 			g_object_unref(service->service_proxy);
 			service->service_proxy = NULL;
 		}
@@ -145,7 +163,7 @@ struct bluez_service *bluez_service_new(GDBusObject *object)
 	GDBusInterface *interface;
 	GDBusProxy *proxy;
 
-	service = g_try_new0(struct bluez_service, 1);
+	service = bluez_pool_alloc0(&service_pool);
 	if (!service)
 		return NULL;
 
@@ -161,6 +179,7 @@ struct bluez_service *bluez_service_new(GDBusObject *object)
 	g_signal_connect(service->service_proxy, "g-properties-changed",
 			G_CALLBACK(service_properties_changed), service);
 
+	service->object = g_object_ref(object);
 	g_signal_connect(object, "interface-added",
 			G_CALLBACK(service_interface_added), service);
 	g_signal_connect(object, "interface-removed",
@@ -174,10 +193,18 @@ void bluez_service_free(struct bluez_service *service)
 	if (!service)
 		return;
 
-	if (service->service_proxy)
+	/* The object and proxies may outlive us, stop their callbacks */
+	if (service->object) {
+		g_signal_handlers_disconnect_by_data(service->object, service);
+		g_object_unref(service->object);
+	}
+
+	if (service->service_proxy) {
+		g_signal_handlers_disconnect_by_data(service->service_proxy, service);
 		g_object_unref(service->service_proxy);
+	}
 	if (service->properties_proxy)
 		g_object_unref(service->properties_proxy);
 
-	g_free(service);
+	bluez_pool_free(&service_pool, service);
 }
@@ -0,0 +1,317 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "bluez-manager.h"
+#include "bluez-snapshot.h"
+#include "bluez-shard.h"
+
+struct bluez_shard {
+	gchar *path;
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+	GDBusConnection *conn;
+	struct bluez_manager *manager;
+
+	GMutex lock;
+	GCond cond;
+	gboolean started;
+};
+
+struct bluez_shard_set {
+	guint n_shards;
+	struct bluez_shard *shards;
+};
+
+/*
+ * Each shard opens a private connection, sharing one would put all
+ * adapters' signals back into a single dispatch queue.
+ */
+static GDBusConnection *shard_connection_new(void)
+{
+	GDBusConnection *conn;
+	GError *error = NULL;
+	gchar *address;
+
+	address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SYSTEM,
+								NULL, &error);
+	if (address == NULL) {
+		printf("No system bus address: %s\n", error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	conn = g_dbus_connection_new_for_address_sync(address,
+			G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+			G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+			NULL, NULL, &error);
+	if (conn == NULL) {
+		printf("Failed to connect system bus: %s\n", error->message);
+		g_error_free(error);
+	}
+
+	g_free(address);
+
+	return conn;
+}
+
+static gpointer shard_thread(gpointer data)
+{
+	struct bluez_shard *shard = data;
+
+	g_main_context_push_thread_default(shard->context);
+
+	shard->conn = shard_connection_new();
+	if (shard->conn)
+		shard->manager = bluez_manager_new_for_connection(shard->conn,
+								shard->path);
+
+	g_mutex_lock(&shard->lock);
+	shard->started = TRUE;
+	g_cond_signal(&shard->cond);
+	g_mutex_unlock(&shard->lock);
+
+	if (shard->manager)
+		g_main_loop_run(shard->loop);
+
+	bluez_manager_free(shard->manager);
+	shard->manager = NULL;
+
+	if (shard->conn) {
+		g_dbus_connection_close_sync(shard->conn, NULL, NULL);
+		g_object_unref(shard->conn);
+		shard->conn = NULL;
+	}
+
+	g_main_context_pop_thread_default(shard->context);
+
+	return NULL;
+}
+
+static gboolean shard_start(struct bluez_shard *shard, const gchar *adapter)
+{
+	if (g_str_has_prefix(adapter, "/"))
+		shard->path = g_strdup(adapter);
+	else
+		shard->path = g_strdup_printf("/org/bluez/%s", adapter);
+
+	shard->context = g_main_context_new();
+	shard->loop = g_main_loop_new(shard->context, FALSE);
+
+	g_mutex_init(&shard->lock);
+	g_cond_init(&shard->cond);
+
+	shard->thread = g_thread_new("bluez-shard", shard_thread, shard);
+
+	/* Wait for the manager so callers can set watches right away */
+	g_mutex_lock(&shard->lock);
+	while (!shard->started)
+		g_cond_wait(&shard->cond, &shard->lock);
+	g_mutex_unlock(&shard->lock);
+
+	return shard->manager != NULL;
+}
+
+static gboolean shard_quit(gpointer user_data)
+{
+	g_main_loop_quit(user_data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void shard_stop(struct bluez_shard *shard)
+{
+	/*
+	 * Quit from inside the loop, the thread may not have entered it
+	 * yet and g_main_loop_run() would forget an earlier quit.
+	 */
+	if (shard->thread) {
+		g_main_context_invoke(shard->context, shard_quit, shard->loop);
+		g_thread_join(shard->thread);
+	}
+
+	if (shard->loop)
+		g_main_loop_unref(shard->loop);
+
+	if (shard->context)
+		g_main_context_unref(shard->context);
+
+	g_mutex_clear(&shard->lock);
+	g_cond_clear(&shard->cond);
+
+	g_free(shard->path);
+}
+
+struct bluez_shard_set *bluez_shard_set_new(const gchar * const *adapters)
+{
+	struct bluez_shard_set *set;
+	guint i;
+
+	if (adapters == NULL || adapters[0] == NULL)
+		return NULL;
+
+	set = g_try_new0(struct bluez_shard_set, 1);
+	if (!set)
+		return NULL;
+
+	set->n_shards = g_strv_length((gchar **) adapters);
+	set->shards = g_try_new0(struct bluez_shard, set->n_shards);
+	if (!set->shards) {
+		g_free(set);
+		return NULL;
+	}
+
+	for (i = 0; i < set->n_shards; i++) {
+		if (!shard_start(&set->shards[i], adapters[i])) {
+			printf("Failed to start shard %s\n", adapters[i]);
+			set->n_shards = i + 1;
+			bluez_shard_set_free(set);
+			return NULL;
+		}
+	}
+
+	return set;
+}
+
+void bluez_shard_set_free(struct bluez_shard_set *set)
+{
+	guint i;
+
+	if (!set)
+		return;
+
+	for (i = 0; i < set->n_shards; i++)
+		shard_stop(&set->shards[i]);
+
+	g_free(set->shards);
+	g_free(set);
+}
+
+static gboolean shard_refresh(gpointer user_data)
+{
+	bluez_manager_refresh_objects(user_data);
+
+	return G_SOURCE_REMOVE;
+}
+
+void bluez_shard_set_start(struct bluez_shard_set *set)
+{
+	guint i;
+
+	if (set == NULL)
+		return;
+
+	for (i = 0; i < set->n_shards; i++)
+		bluez_shard_set_invoke(set, i, shard_refresh,
+						set->shards[i].manager);
+}
+
+guint bluez_shard_set_get_n_shards(struct bluez_shard_set *set)
+{
+	if (set == NULL)
+		return 0;
+
+	return set->n_shards;
+}
+
+struct bluez_manager *bluez_shard_set_get_manager(struct bluez_shard_set *set,
+								guint index)
+{
+	if (set == NULL || index >= set->n_shards)
+		return NULL;
+
+	return set->shards[index].manager;
+}
+
+void bluez_shard_set_invoke(struct bluez_shard_set *set, guint index,
+					GSourceFunc func, gpointer user_data)
+{
+	if (set == NULL || index >= set->n_shards)
+		return;
+
+	g_main_context_invoke(set->shards[index].context, func, user_data);
+}
+
+guint bluez_shard_set_get_n_devices(struct bluez_shard_set *set)
+{
+	struct bluez_snapshot *snapshot;
+	guint i, n = 0;
+
+	if (set == NULL)
+		return 0;
+
+	for (i = 0; i < set->n_shards; i++) {
+		snapshot = bluez_manager_get_snapshot(set->shards[i].manager);
+		n += bluez_snapshot_get_n_devices(snapshot);
+		bluez_snapshot_unref(snapshot);
+	}
+
+	return n;
+}
+
+struct bluez_snapshot *bluez_shard_set_find_device(
+				struct bluez_shard_set *set,
+				const gchar *address,
+				const struct bluez_device_info **info,
+				guint *index)
+{
+	bluez_addr_t addr;
+
+	if (!bluez_addr_parse(address, &addr))
+		return NULL;
+
+	return bluez_shard_set_find_device_addr(set, &addr, info, index);
+}
+
+struct bluez_snapshot *bluez_shard_set_find_device_addr(
+				struct bluez_shard_set *set,
+				const bluez_addr_t *addr,
+				const struct bluez_device_info **info,
+				guint *index)
+{
+	struct bluez_snapshot *snapshot;
+	const struct bluez_device_info *found;
+	guint i;
+
+	if (set == NULL || addr == NULL)
+		return NULL;
+
+	for (i = 0; i < set->n_shards; i++) {
+		snapshot = bluez_manager_get_snapshot(set->shards[i].manager);
+
+		found = bluez_snapshot_find_device_addr(snapshot, addr);
+		if (found) {
+			if (info)
+				*info = found;
+			if (index)
+				*index = i;
+
+			return snapshot;
+		}
+
+		bluez_snapshot_unref(snapshot);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,782 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "bluez-device.h"
+#include "bluez-snapshot.h"
+#include "bluez-shm.h"
+
+#define SHM_MAGIC 0x424c5a53			/* "BLZS" */
+#define SHM_VERSION 1
+
+/*
+ * Yields a reader spends on a record or table being rewritten before
+ * giving up, a publisher that died mid-write leaves it odd for good.
+ */
+#define READ_RETRIES 10000
+
+enum {
+	SLOT_EMPTY,
+	SLOT_USED,
+	SLOT_DELETED,
+};
+
+struct shm_header {
+	guint32 magic;
+	guint32 version;
+	guint32 capacity;
+	guint32 slot_size;
+	volatile gint table_seq;		/* odd while rehashing */
+	volatile gint count;
+};
+
+struct shm_slot {
+	volatile gint seq;			/* odd while being written */
+	guint32 state;
+	struct bluez_shm_device device;
+};
+
+struct bluez_shm_publisher {
+	int fd;
+	int reader_fd;				/* read-only, handed out */
+	int listen_fd;
+	GSource *listen_source;
+
+	struct shm_header *header;
+	struct shm_slot *slots;
+	gsize size;
+
+	GHashTable *device_slots;		/* device -> slot index + 1 */
+	struct bluez_device **slot_devices;
+	guint deleted;
+};
+
+struct bluez_shm_reader {
+	const struct shm_header *header;
+	const struct shm_slot *slots;
+	gsize size;
+};
+
+static void socket_address(const gchar *name, struct sockaddr_un *addr,
+							socklen_t *len)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	/* Abstract namespace, addr->sun_path[0] stays '\0' */
+	g_snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+							"bluez-shm-%s", name);
+
+	*len = offsetof(struct sockaddr_un, sun_path) + 1 +
+					strlen(addr->sun_path + 1);
+}
+
+static guint32 address_hash(const guint8 *address)
+{
+	guint32 hash = 2166136261u;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		hash = (hash ^ address[i]) * 16777619u;
+
+	return hash;
+}
+
+static void adapter_from_path(const gchar *path, gchar *adapter, gsize size)
+{
+	const gchar *start, *end;
+
+	adapter[0] = '\0';
+
+	if (path == NULL || !g_str_has_prefix(path, "/org/bluez/"))
+		return;
+
+	start = path + strlen("/org/bluez/");
+	end = strchr(start, '/');
+	if (end == NULL)
+		end = start + strlen(start);
+
+	if ((gsize) (end - start) >= size)
+		return;
+
+	memcpy(adapter, start, end - start);
+	adapter[end - start] = '\0';
+}
+
+static void slot_write(struct shm_slot *slot, guint32 state,
+				const struct bluez_shm_device *device)
+{
+	g_atomic_int_inc(&slot->seq);
+
+	slot->state = state;
+	if (device)
+		slot->device = *device;
+
+	g_atomic_int_inc(&slot->seq);
+}
+
+static gboolean slot_read(const struct shm_slot *slot, guint32 *state,
+					struct bluez_shm_device *device)
+{
+	guint retries;
+	gint seq;
+
+	for (retries = 0; retries < READ_RETRIES; retries++) {
+		seq = g_atomic_int_get(&slot->seq);
+		if (seq & 1) {
+			g_thread_yield();
+			continue;
+		}
+
+		*state = slot->state;
+		if (device)
+			memcpy(device, (const void *) &slot->device,
+							sizeof(*device));
+
+		if (g_atomic_int_get(&slot->seq) == seq)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Same user as this process, or root, checked on both ends */
+static gboolean peer_allowed(int sk)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(sk, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return FALSE;
+
+	return cred.uid == 0 || cred.uid == geteuid();
+}
+
+static gboolean serve_fd(gint fd, GIOCondition condition, gpointer user_data)
+{
+	struct bluez_shm_publisher *publisher = user_data;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char dummy = 0;
+	int client;
+
+	client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+	if (client < 0)
+		return G_SOURCE_CONTINUE;
+
+	if (!peer_allowed(client)) {
+		printf("Refused shared memory to foreign user\n");
+		close(client);
+		return G_SOURCE_CONTINUE;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+
+	iov.iov_base = &dummy;
+	iov.iov_len = 1;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &publisher->reader_fd, sizeof(int));
+
+	if (sendmsg(client, &msg, MSG_NOSIGNAL) < 0)
+		printf("Failed to send shared memory fd: %s\n",
+							strerror(errno));
+
+	close(client);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean publisher_listen(struct bluez_shm_publisher *publisher,
+				const gchar *name, GMainContext *context)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+
+	publisher->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC |
+							SOCK_NONBLOCK, 0);
+	if (publisher->listen_fd < 0)
+		return FALSE;
+
+	socket_address(name, &addr, &len);
+
+	if (bind(publisher->listen_fd, (struct sockaddr *) &addr, len) < 0 ||
+				listen(publisher->listen_fd, 16) < 0) {
+		printf("Failed to listen on %s: %s\n", addr.sun_path + 1,
+							strerror(errno));
+		return FALSE;
+	}
+
+	publisher->listen_source = g_unix_fd_source_new(publisher->listen_fd,
+								G_IO_IN);
+	g_source_set_callback(publisher->listen_source, (GSourceFunc) serve_fd,
+							publisher, NULL);
+	g_source_attach(publisher->listen_source, context);
+
+	return TRUE;
+}
+
+/*
+ * Readers get the memfd reopened read-only, mapping it writable then
+ * fails whatever seals the kernel supports.
+ */
+static int open_reader_fd(int fd)
+{
+	gchar path[32];
+
+	g_snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+struct bluez_shm_publisher *bluez_shm_publisher_new(const gchar *name,
+				guint capacity, GMainContext *context)
+{
+	struct bluez_shm_publisher *publisher;
+	void *map;
+
+	if (name == NULL || capacity == 0)
+		return NULL;
+
+	publisher = g_try_new0(struct bluez_shm_publisher, 1);
+	if (!publisher)
+		return NULL;
+
+	publisher->listen_fd = -1;
+	publisher->reader_fd = -1;
+	publisher->size = sizeof(struct shm_header) +
+				(gsize) capacity * sizeof(struct shm_slot);
+
+	publisher->fd = memfd_create("bluez-shm", MFD_CLOEXEC |
+							MFD_ALLOW_SEALING);
+	if (publisher->fd < 0)
+		goto failed;
+
+	if (ftruncate(publisher->fd, publisher->size) < 0)
+		goto failed;
+
+	map = mmap(NULL, publisher->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+							publisher->fd, 0);
+	if (map == MAP_FAILED)
+		goto failed;
+
+	publisher->header = map;
+	publisher->slots = (struct shm_slot *) (publisher->header + 1);
+
+	/* Readers may neither resize nor, where supported, map writable */
+	fcntl(publisher->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+#ifdef F_SEAL_FUTURE_WRITE
+							F_SEAL_FUTURE_WRITE |
+#endif
+							F_SEAL_SEAL);
+
+	/* Never share the writable descriptor itself */
+	publisher->reader_fd = open_reader_fd(publisher->fd);
+	if (publisher->reader_fd < 0)
+		goto failed;
+
+	publisher->header->capacity = capacity;
+	publisher->header->slot_size = sizeof(struct shm_slot);
+	publisher->header->version = SHM_VERSION;
+	g_atomic_int_set((gint *) &publisher->header->magic, SHM_MAGIC);
+
+	publisher->device_slots = g_hash_table_new(g_direct_hash,
+							g_direct_equal);
+	publisher->slot_devices = g_try_new0(struct bluez_device *, capacity);
+	if (!publisher->slot_devices)
+		goto failed;
+
+	if (!publisher_listen(publisher, name, context))
+		goto failed;
+
+	return publisher;
+
+failed:
+	printf("Failed to publish shared memory %s\n", name);
+	bluez_shm_publisher_free(publisher);
+
+	return NULL;
+}
+
+void bluez_shm_publisher_free(struct bluez_shm_publisher *publisher)
+{
+	if (!publisher)
+		return;
+
+	if (publisher->listen_source) {
+		g_source_destroy(publisher->listen_source);
+		g_source_unref(publisher->listen_source);
+	}
+
+	if (publisher->listen_fd >= 0)
+		close(publisher->listen_fd);
+
+	if (publisher->header)
+		munmap(publisher->header, publisher->size);
+
+	if (publisher->reader_fd >= 0)
+		close(publisher->reader_fd);
+
+	if (publisher->fd >= 0)
+		close(publisher->fd);
+
+	if (publisher->device_slots)
+		g_hash_table_unref(publisher->device_slots);
+
+	g_free(publisher->slot_devices);
+	g_free(publisher);
+}
+
+static gint find_free_slot(struct bluez_shm_publisher *publisher,
+							const guint8 *address)
+{
+	guint32 capacity = publisher->header->capacity;
+	guint32 i, index;
+
+	index = address_hash(address) % capacity;
+
+	for (i = 0; i < capacity; i++) {
+		if (publisher->slots[index].state != SLOT_USED)
+			return index;
+
+		index = (index + 1) % capacity;
+	}
+
+	return -1;
+}
+
+/*
+ * Deleted slots keep probe chains intact but make them longer, rebuild
+ * the table once they pile up. Readers retry while table_seq is odd.
+ */
+static void publisher_rehash(struct bluez_shm_publisher *publisher)
+{
+	guint32 capacity = publisher->header->capacity;
+	struct bluez_shm_device *devices;
+	struct bluez_device **owners;
+	guint32 i, n = 0;
+	gint index;
+
+	devices = g_new(struct bluez_shm_device, capacity);
+	owners = g_new(struct bluez_device *, capacity);
+
+	g_atomic_int_inc(&publisher->header->table_seq);
+
+	for (i = 0; i < capacity; i++) {
+		if (publisher->slots[i].state == SLOT_USED) {
+			devices[n] = publisher->slots[i].device;
+			owners[n++] = publisher->slot_devices[i];
+		}
+
+		slot_write(&publisher->slots[i], SLOT_EMPTY, NULL);
+		publisher->slot_devices[i] = NULL;
+	}
+
+	g_hash_table_remove_all(publisher->device_slots);
+
+	for (i = 0; i < n; i++) {
+		index = find_free_slot(publisher, devices[i].address);
+
+		slot_write(&publisher->slots[index], SLOT_USED, &devices[i]);
+		publisher->slot_devices[index] = owners[i];
+		g_hash_table_insert(publisher->device_slots, owners[i],
+						GINT_TO_POINTER(index + 1));
+	}
+
+	publisher->deleted = 0;
+
+	g_atomic_int_inc(&publisher->header->table_seq);
+
+	g_free(devices);
+	g_free(owners);
+}
+
+void bluez_shm_publisher_update(struct bluez_shm_publisher *publisher,
+				struct bluez_device *device,
+				guint64 generation)
+{
+	struct bluez_device_info info;
+	struct bluez_shm_device record;
+	gint index;
+
+	if (publisher == NULL)
+		return;
+
+	bluez_device_get_info(device, &info);
+
+	memset(&record, 0, sizeof(record));
+	memcpy(record.address, info.addr.b, sizeof(record.address));
+
+	record.rssi = info.rssi;
+	record.generation = generation;
+	record.flags = (info.connected ? BLUEZ_SHM_CONNECTED : 0) |
+			(info.paired ? BLUEZ_SHM_PAIRED : 0) |
+			(info.trusted ? BLUEZ_SHM_TRUSTED : 0) |
+			(info.blocked ? BLUEZ_SHM_BLOCKED : 0);
+
+	adapter_from_path(info.path, record.adapter, sizeof(record.adapter));
+
+	if (info.name)
+		g_strlcpy(record.name, info.name, sizeof(record.name));
+
+	index = GPOINTER_TO_INT(g_hash_table_lookup(publisher->device_slots,
+								device)) - 1;
+	if (index >= 0) {
+		slot_write(&publisher->slots[index], SLOT_USED, &record);
+		return;
+	}
+
+	if (publisher->deleted > publisher->header->capacity / 4)
+		publisher_rehash(publisher);
+
+	index = find_free_slot(publisher, record.address);
+	if (index < 0) {
+		printf("Shared memory table full\n");
+		return;
+	}
+
+	if (publisher->slots[index].state == SLOT_DELETED)
+		publisher->deleted--;
+
+	slot_write(&publisher->slots[index], SLOT_USED, &record);
+	publisher->slot_devices[index] = device;
+	g_hash_table_insert(publisher->device_slots, device,
+						GINT_TO_POINTER(index + 1));
+
+	g_atomic_int_inc(&publisher->header->count);
+}
+
+void bluez_shm_publisher_remove(struct bluez_shm_publisher *publisher,
+				struct bluez_device *device,
+				guint64 generation)
+{
+	gint index;
+
+	if (publisher == NULL)
+		return;
+
+	index = GPOINTER_TO_INT(g_hash_table_lookup(publisher->device_slots,
+								device)) - 1;
+	if (index < 0)
+		return;
+
+	slot_write(&publisher->slots[index], SLOT_DELETED, NULL);
+	publisher->slot_devices[index] = NULL;
+	publisher->deleted++;
+
+	g_hash_table_remove(publisher->device_slots, device);
+
+	g_atomic_int_add(&publisher->header->count, -1);
+}
+
+static int receive_fd(int sk)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char dummy;
+	int fd = -1;
+
+	memset(&msg, 0, sizeof(msg));
+
+	iov.iov_base = &dummy;
+	iov.iov_len = 1;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(sk, &msg, MSG_CMSG_CLOEXEC) < 0)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+					cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	return fd;
+}
+
+struct bluez_shm_reader *bluez_shm_reader_new(const gchar *name)
+{
+	struct bluez_shm_reader *reader;
+	struct sockaddr_un addr;
+	struct stat st;
+	socklen_t len;
+	void *map;
+	int sk, fd;
+
+	if (name == NULL)
+		return NULL;
+
+	sk = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return NULL;
+
+	socket_address(name, &addr, &len);
+
+	if (connect(sk, (struct sockaddr *) &addr, len) < 0) {
+		close(sk);
+		return NULL;
+	}
+
+	/* Anyone may bind the abstract name first, trust only our user */
+	if (!peer_allowed(sk)) {
+		printf("Refused shared memory from foreign user\n");
+		close(sk);
+		return NULL;
+	}
+
+	fd = receive_fd(sk);
+	close(sk);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(struct shm_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	reader = g_try_new0(struct bluez_shm_reader, 1);
+	if (!reader) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	reader->header = map;
+	reader->slots = (const struct shm_slot *) (reader->header + 1);
+	reader->size = st.st_size;
+
+	if (reader->header->magic != SHM_MAGIC ||
+			reader->header->version != SHM_VERSION ||
+			reader->header->slot_size != sizeof(struct shm_slot) ||
+			sizeof(struct shm_header) + (gsize)
+			reader->header->capacity * sizeof(struct shm_slot) >
+								reader->size) {
+		printf("Incompatible shared memory table %s\n", name);
+		bluez_shm_reader_free(reader);
+		return NULL;
+	}
+
+	return reader;
+}
+
+void bluez_shm_reader_free(struct bluez_shm_reader *reader)
+{
+	if (!reader)
+		return;
+
+	munmap((void *) reader->header, reader->size);
+
+	g_free(reader);
+}
+
+guint bluez_shm_reader_get_n_devices(struct bluez_shm_reader *reader)
+{
+	if (reader == NULL)
+		return 0;
+
+	return g_atomic_int_get(&reader->header->count);
+}
+
+static gboolean begin_table_read(struct bluez_shm_reader *reader,
+								gint *seq)
+{
+	guint retries;
+
+	for (retries = 0; retries < READ_RETRIES; retries++) {
+		*seq = g_atomic_int_get(&reader->header->table_seq);
+		if (!(*seq & 1))
+			return TRUE;
+
+		g_thread_yield();
+	}
+
+	return FALSE;
+}
+
+static gboolean end_table_read(struct bluez_shm_reader *reader, gint seq)
+{
+	return g_atomic_int_get(&reader->header->table_seq) == seq;
+}
+
+BTResult bluez_shm_reader_lookup(struct bluez_shm_reader *reader,
+				const gchar *adapter, const gchar *address,
+				struct bluez_shm_device *device)
+{
+	bluez_addr_t addr;
+
+	if (!bluez_addr_parse(address, &addr))
+		return BT_RESULT_INVALID_ARGS;
+
+	return bluez_shm_reader_lookup_addr(reader, adapter, &addr, device);
+}
+
+/*
+ * One pass over the probe chain, TRUE if it ran to its end. Records
+ * hash by address alone, the same address seen by another adapter sits
+ * further down the same chain.
+ */
+static gboolean lookup_slots(struct bluez_shm_reader *reader,
+				const gchar *adapter, const guint8 *key,
+				gboolean *found,
+				struct bluez_shm_device *device)
+{
+	struct bluez_shm_device record;
+	guint32 capacity, i, index, state;
+
+	capacity = reader->header->capacity;
+	index = address_hash(key) % capacity;
+	*found = FALSE;
+
+	for (i = 0; i < capacity; i++) {
+		if (!slot_read(&reader->slots[index], &state, &record))
+			return FALSE;
+
+		if (state == SLOT_EMPTY)
+			break;
+
+		if (state == SLOT_USED && !memcmp(record.address, key, 6) &&
+				(adapter == NULL ||
+				!strncmp(record.adapter, adapter,
+						sizeof(record.adapter)))) {
+			if (device)
+				*device = record;
+			*found = TRUE;
+			break;
+		}
+
+		index = (index + 1) % capacity;
+	}
+
+	return TRUE;
+}
+
+BTResult bluez_shm_reader_lookup_addr(struct bluez_shm_reader *reader,
+				const gchar *adapter, const bluez_addr_t *addr,
+				struct bluez_shm_device *device)
+{
+	gboolean found;
+	guint retries;
+	gint seq;
+
+	if (reader == NULL || addr == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	for (retries = 0; retries < READ_RETRIES; retries++) {
+		if (!begin_table_read(reader, &seq) ||
+				!lookup_slots(reader, adapter, addr->b,
+							&found, device))
+			return BT_RESULT_TIMEOUT;
+
+		/* A rehash may have moved the record past our probe */
+		if (end_table_read(reader, seq))
+			return found ? BT_RESULT_OK : BT_RESULT_NOT_EXIST;
+	}
+
+	return BT_RESULT_TIMEOUT;
+}
+
+BTResult bluez_shm_reader_foreach(struct bluez_shm_reader *reader,
+			bluez_shm_device_cb func, gpointer user_data,
+			guint *n_devices)
+{
+	struct bluez_shm_device *records;
+	guint32 capacity, i, state;
+	guint retries, n = 0;
+	gint seq;
+
+	if (reader == NULL || func == NULL)
+		return BT_RESULT_INVALID_ARGS;
+
+	capacity = reader->header->capacity;
+
+	records = g_try_new(struct bluez_shm_device, capacity);
+	if (!records)
+		return BT_RESULT_FAILED;
+
+	/*
+	 * Copied out first and delivered only once a pass saw no rehash,
+	 * so a restart never hands func the same device twice.
+	 */
+	for (retries = 0; retries < READ_RETRIES; retries++) {
+		if (!begin_table_read(reader, &seq))
+			break;
+
+		for (i = 0, n = 0; i < capacity; i++) {
+			if (!slot_read(&reader->slots[i], &state, &records[n]))
+				break;
+
+			if (state == SLOT_USED)
+				n++;
+		}
+
+		if (i < capacity)
+			break;
+
+		if (end_table_read(reader, seq)) {
+			for (i = 0; i < n; i++)
+				func(&records[i], user_data);
+
+			g_free(records);
+
+			if (n_devices)
+				*n_devices = n;
+
+			return BT_RESULT_OK;
+		}
+	}
+
+	g_free(records);
+
+	return BT_RESULT_TIMEOUT;
+}
@@ -0,0 +1,393 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-snapshot.h"
+
+/*
+ * Records are immutable and shared by every snapshot they are carried
+ * forward into, so publishing a change copies pointers, not devices.
+ */
+struct bluez_snapshot_record {
+	volatile gint ref_count;
+	struct bluez_device_info info;
+	gchar strings[];		/* info strings point in here */
+};
+
+struct bluez_snapshot {
+	volatile gint ref_count;
+	guint64 version;
+	guint draining;			/* reader counters left, once retired */
+
+	GPtrArray *records;		/* sorted by address once sealed */
+	guint n_sorted;			/* leading records already in order */
+};
+
+struct bluez_snapshot_domain {
+	struct bluez_snapshot *current;
+
+	/*
+	 * Readers announce themselves in the counter of the epoch they
+	 * entered. A reader holding a retired snapshot entered before it
+	 * was replaced, in either counter, so the snapshot is dropped once
+	 * both counters have been seen empty since.
+	 */
+	volatile gint epoch;
+	volatile gint readers[2];
+	GSList *retired;
+};
+
+static struct bluez_snapshot_record *record_ref(
+				struct bluez_snapshot_record *record)
+{
+	g_atomic_int_inc(&record->ref_count);
+
+	return record;
+}
+
+static void record_unref(struct bluez_snapshot_record *record)
+{
+	if (g_atomic_int_dec_and_test(&record->ref_count))
+		g_free(record);
+}
+
+static struct bluez_snapshot *snapshot_new(guint64 version, guint reserved)
+{
+	struct bluez_snapshot *snapshot;
+
+	snapshot = g_try_new0(struct bluez_snapshot, 1);
+	if (!snapshot)
+		return NULL;
+
+	snapshot->ref_count = 1;
+	snapshot->version = version;
+	snapshot->records = g_ptr_array_sized_new(reserved);
+	g_ptr_array_set_free_func(snapshot->records,
+					(GDestroyNotify) record_unref);
+
+	return snapshot;
+}
+
+struct bluez_snapshot *bluez_snapshot_new(guint64 version)
+{
+	return snapshot_new(version, 0);
+}
+
+struct bluez_snapshot *bluez_snapshot_new_from(struct bluez_snapshot *base,
+				guint64 version, bluez_snapshot_keep_func keep,
+				gpointer user_data)
+{
+	struct bluez_snapshot_record *record;
+	struct bluez_snapshot *snapshot;
+	guint i;
+
+	snapshot = snapshot_new(version, base ? base->records->len : 0);
+	if (!snapshot || base == NULL)
+		return snapshot;
+
+	/* A sealed base stays in order with records dropped from it */
+	for (i = 0; i < base->records->len; i++) {
+		record = g_ptr_array_index(base->records, i);
+		if (keep(&record->info, user_data))
+			g_ptr_array_add(snapshot->records, record_ref(record));
+	}
+
+	snapshot->n_sorted = snapshot->records->len;
+
+	return snapshot;
+}
+
+static gsize string_size(const gchar *str)
+{
+	return str ? strlen(str) + 1 : 0;
+}
+
+static const gchar *record_strdup(gchar **pos, const gchar *str)
+{
+	gchar *copy = *pos;
+	gsize size = string_size(str);
+
+	if (str == NULL)
+		return NULL;
+
+	memcpy(copy, str, size);
+	*pos += size;
+
+	return copy;
+}
+
+void bluez_snapshot_add_device(struct bluez_snapshot *snapshot,
+				const struct bluez_device_info *info)
+{
+	struct bluez_snapshot_record *record;
+	gchar *pos;
+
+	/* One block for the record and its strings */
+	record = g_malloc(sizeof(*record) + string_size(info->path) +
+			string_size(info->address) + string_size(info->name) +
+			string_size(info->alias));
+	record->ref_count = 1;
+	record->info = *info;
+
+	pos = record->strings;
+	record->info.path = record_strdup(&pos, info->path);
+	record->info.address = record_strdup(&pos, info->address);
+	record->info.name = record_strdup(&pos, info->name);
+	record->info.alias = record_strdup(&pos, info->alias);
+
+	g_ptr_array_add(snapshot->records, record);
+}
+
+static gint record_compare(gconstpointer a, gconstpointer b)
+{
+	const struct bluez_snapshot_record *record_a =
+				*(const struct bluez_snapshot_record **) a;
+	const struct bluez_snapshot_record *record_b =
+				*(const struct bluez_snapshot_record **) b;
+
+	return bluez_addr_compare(&record_a->info.addr,
+						&record_b->info.addr);
+}
+
+/*
+ * Only the records added since bluez_snapshot_new_from are sorted, then
+ * merged with the ones carried forward: O(n + k log k) for k changes.
+ */
+void bluez_snapshot_seal(struct bluez_snapshot *snapshot)
+{
+	GPtrArray *records = snapshot->records;
+	GPtrArray *merged;
+	guint i, j, n_sorted = snapshot->n_sorted;
+
+	if (n_sorted == records->len)
+		return;
+
+	qsort(records->pdata + n_sorted, records->len - n_sorted,
+					sizeof(gpointer), record_compare);
+
+	snapshot->n_sorted = records->len;
+
+	if (n_sorted == 0)
+		return;
+
+	merged = g_ptr_array_sized_new(records->len);
+	g_ptr_array_set_free_func(merged, (GDestroyNotify) record_unref);
+
+	for (i = 0, j = n_sorted; i < n_sorted || j < records->len;) {
+		if (j == records->len || (i < n_sorted &&
+				record_compare(&records->pdata[i],
+						&records->pdata[j]) <= 0))
+			g_ptr_array_add(merged, records->pdata[i++]);
+		else
+			g_ptr_array_add(merged, records->pdata[j++]);
+	}
+
+	/* The references moved over */
+	g_ptr_array_set_free_func(records, NULL);
+	g_ptr_array_free(records, TRUE);
+
+	snapshot->records = merged;
+}
+
+struct bluez_snapshot *bluez_snapshot_ref(struct bluez_snapshot *snapshot)
+{
+	if (snapshot == NULL)
+		return NULL;
+
+	g_atomic_int_inc(&snapshot->ref_count);
+
+	return snapshot;
+}
+
+void bluez_snapshot_unref(struct bluez_snapshot *snapshot)
+{
+	if (snapshot == NULL)
+		return;
+
+	if (!g_atomic_int_dec_and_test(&snapshot->ref_count))
+		return;
+
+	g_ptr_array_free(snapshot->records, TRUE);
+
+	g_free(snapshot);
+}
+
+guint64 bluez_snapshot_get_version(struct bluez_snapshot *snapshot)
+{
+	if (snapshot == NULL)
+		return 0;
+
+	return snapshot->version;
+}
+
+guint bluez_snapshot_get_n_devices(struct bluez_snapshot *snapshot)
+{
+	if (snapshot == NULL)
+		return 0;
+
+	return snapshot->records->len;
+}
+
+const struct bluez_device_info *bluez_snapshot_get_device(
+			struct bluez_snapshot *snapshot, guint index)
+{
+	struct bluez_snapshot_record *record;
+
+	if (snapshot == NULL || index >= snapshot->records->len)
+		return NULL;
+
+	record = g_ptr_array_index(snapshot->records, index);
+
+	return &record->info;
+}
+
+static gint record_addr_compare(gconstpointer key, gconstpointer member)
+{
+	const struct bluez_snapshot_record *record =
+				*(const struct bluez_snapshot_record **) member;
+
+	return bluez_addr_compare(key, &record->info.addr);
+}
+
+const struct bluez_device_info *bluez_snapshot_find_device_addr(
+			struct bluez_snapshot *snapshot, const bluez_addr_t *addr)
+{
+	struct bluez_snapshot_record **record;
+
+	if (snapshot == NULL || addr == NULL)
+		return NULL;
+
+	record = bsearch(addr, snapshot->records->pdata,
+				snapshot->records->len, sizeof(gpointer),
+				record_addr_compare);
+
+	return record ? &(*record)->info : NULL;
+}
+
+const struct bluez_device_info *bluez_snapshot_find_device(
+			struct bluez_snapshot *snapshot, const gchar *address)
+{
+	bluez_addr_t addr;
+
+	if (!bluez_addr_parse(address, &addr))
+		return NULL;
+
+	return bluez_snapshot_find_device_addr(snapshot, &addr);
+}
+
+struct bluez_snapshot_domain *bluez_snapshot_domain_new(void)
+{
+	struct bluez_snapshot_domain *domain;
+
+	domain = g_try_new0(struct bluez_snapshot_domain, 1);
+	if (!domain)
+		return NULL;
+
+	/* Readers never see a NULL snapshot */
+	domain->current = bluez_snapshot_new(0);
+	bluez_snapshot_seal(domain->current);
+
+	return domain;
+}
+
+gboolean bluez_snapshot_domain_reclaim(struct bluez_snapshot_domain *domain)
+{
+	struct bluez_snapshot *snapshot;
+	guint drained = 0;
+	GSList *list, *next;
+	gint i;
+
+	for (i = 0; i < 2; i++) {
+		if (g_atomic_int_get(&domain->readers[i]) == 0)
+			drained |= 1 << i;
+	}
+
+	for (list = domain->retired; list; list = next) {
+		next = list->next;
+		snapshot = list->data;
+
+		snapshot->draining &= ~drained;
+		if (snapshot->draining)
+			continue;
+
+		domain->retired = g_slist_delete_link(domain->retired, list);
+		bluez_snapshot_unref(snapshot);
+	}
+
+	return domain->retired != NULL;
+}
+
+void bluez_snapshot_domain_publish(struct bluez_snapshot_domain *domain,
+					struct bluez_snapshot *snapshot)
+{
+	struct bluez_snapshot *old;
+
+	old = domain->current;
+	g_atomic_pointer_set(&domain->current, snapshot);
+
+	/* Counters read from here on only cover readers that may hold old */
+	old->draining = 1 << 0 | 1 << 1;
+	domain->retired = g_slist_prepend(domain->retired, old);
+	g_atomic_int_inc(&domain->epoch);
+
+	bluez_snapshot_domain_reclaim(domain);
+}
+
+struct bluez_snapshot *bluez_snapshot_domain_acquire(
+				struct bluez_snapshot_domain *domain)
+{
+	struct bluez_snapshot *snapshot;
+	gint epoch;
+
+	while (TRUE) {
+		epoch = g_atomic_int_get(&domain->epoch);
+		g_atomic_int_inc(&domain->readers[epoch & 1]);
+
+		if (g_atomic_int_get(&domain->epoch) == epoch)
+			break;
+
+		/* Raced with a publish, announce in the new epoch */
+		g_atomic_int_add(&domain->readers[epoch & 1], -1);
+	}
+
+	snapshot = g_atomic_pointer_get(&domain->current);
+	bluez_snapshot_ref(snapshot);
+
+	g_atomic_int_add(&domain->readers[epoch & 1], -1);
+
+	return snapshot;
+}
+
+void bluez_snapshot_domain_free(struct bluez_snapshot_domain *domain)
+{
+	if (!domain)
+		return;
+
+	/* Caller guarantees no reader is left inside acquire */
+	g_slist_free_full(domain->retired,
+				(GDestroyNotify) bluez_snapshot_unref);
+
+	bluez_snapshot_unref(domain->current);
+
+	g_free(domain);
+}
@@ -0,0 +1,332 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <glib.h>
+
+#include "bluez-timer.h"
+
+/*
+ * Hierarchical timing wheel: BLUEZ_TIMER_LEVELS wheels of 64 slots, each
+ * slot of a level spanning a whole turn of the level below. A timer goes
+ * to the lowest level whose turn reaches its expiry and moves down when
+ * the wheel gets to its slot. Slots are intrusive lists, so adding and
+ * cancelling are O(1). Per level occupancy words tell which slot is due
+ * next, the GSource sleeps until then.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_NONE G_MAXUINT64
+
+#define LEVEL_SHIFT(level) ((level) * WHEEL_BITS)
+
+#define TICK_USEC (BLUEZ_TIMER_TICK_MS * 1000)
+
+#define TIMER_EXPIRING 0xff			/* level while on expiring */
+
+struct bluez_timer {
+	struct bluez_timer *next;
+	struct bluez_timer **pprev;
+	guint64 expires;			/* tick */
+	guint8 level;
+	guint8 slot;
+	bluez_timer_func func;
+	gpointer user_data;
+};
+
+struct bluez_timers {
+	GSource *source;
+	gint64 base;				/* monotonic time of tick 0 */
+	guint64 cur;				/* next tick to process */
+	struct bluez_timer *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+	guint64 occupied[WHEEL_LEVELS];
+	struct bluez_timer *expiring;		/* due, callbacks pending */
+};
+
+static guint64 now_tick(struct bluez_timers *timers)
+{
+	return (g_get_monotonic_time() - timers->base) / TICK_USEC;
+}
+
+static void timer_link(struct bluez_timer **head, struct bluez_timer *timer)
+{
+	timer->next = *head;
+	if (timer->next)
+		timer->next->pprev = &timer->next;
+	*head = timer;
+	timer->pprev = head;
+}
+
+static void timer_unlink(struct bluez_timers *timers,
+					struct bluez_timer *timer)
+{
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+
+	if (timer->level != TIMER_EXPIRING &&
+			!timers->wheel[timer->level][timer->slot])
+		timers->occupied[timer->level] &=
+					~(G_GUINT64_CONSTANT(1) << timer->slot);
+}
+
+static void timer_insert(struct bluez_timers *timers,
+					struct bluez_timer *timer)
+{
+	guint64 delta = timer->expires - timers->cur;
+	guint64 expires = timer->expires;
+	guint level;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < (G_GUINT64_CONSTANT(1) <<
+					LEVEL_SHIFT(level + 1)))
+			break;
+	}
+
+	/* Beyond the top level's turn, park in its farthest slot */
+	if (level == WHEEL_LEVELS - 1 &&
+		delta >= (G_GUINT64_CONSTANT(1) << LEVEL_SHIFT(WHEEL_LEVELS)))
+		expires = timers->cur + ((guint64) (WHEEL_SLOTS - 1) <<
+							LEVEL_SHIFT(level));
+
+	timer->level = level;
+	timer->slot = (expires >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+
+	timer_link(&timers->wheel[level][timer->slot], timer);
+	timers->occupied[level] |= G_GUINT64_CONSTANT(1) << timer->slot;
+}
+
+/* First tick from cur on where a non-empty slot comes up */
+static guint64 next_tick(struct bluez_timers *timers)
+{
+	guint64 best = WHEEL_NONE, block, tick, word;
+	guint level, offset;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		word = timers->occupied[level];
+		if (!word)
+			continue;
+
+		block = (timers->cur + (G_GUINT64_CONSTANT(1) <<
+				LEVEL_SHIFT(level)) - 1) >> LEVEL_SHIFT(level);
+		offset = block & WHEEL_MASK;
+
+		/* Rotate so the slot of block is bit 0 */
+		if (offset)
+			word = word >> offset | word << (WHEEL_SLOTS - offset);
+
+		tick = (block + __builtin_ctzll(word)) << LEVEL_SHIFT(level);
+		if (tick < best)
+			best = tick;
+	}
+
+	return best;
+}
+
+/* Moves timers down from the levels due at tick, collects level 0 */
+static void process_tick(struct bluez_timers *timers, guint64 tick)
+{
+	struct bluez_timer *timer, *list;
+	guint slot;
+	int level;
+
+	timers->cur = tick;
+
+	for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+		if (tick & ((G_GUINT64_CONSTANT(1) << LEVEL_SHIFT(level)) - 1))
+			continue;
+
+		slot = (tick >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+		list = timers->wheel[level][slot];
+		timers->wheel[level][slot] = NULL;
+		timers->occupied[level] &= ~(G_GUINT64_CONSTANT(1) << slot);
+
+		while ((timer = list)) {
+			list = timer->next;
+			timer_insert(timers, timer);
+		}
+	}
+
+	slot = tick & WHEEL_MASK;
+	while ((timer = timers->wheel[0][slot])) {
+		timer_unlink(timers, timer);
+		timer->level = TIMER_EXPIRING;
+		timer_link(&timers->expiring, timer);
+	}
+
+	timers->cur = tick + 1;
+}
+
+static void timers_arm(struct bluez_timers *timers)
+{
+	guint64 tick = next_tick(timers);
+
+	if (tick == WHEEL_NONE) {
+		g_source_set_ready_time(timers->source, -1);
+		return;
+	}
+
+	g_source_set_ready_time(timers->source, timers->base +
+					(gint64) tick * TICK_USEC);
+}
+
+static gboolean timers_expire(gpointer user_data)
+{
+	struct bluez_timers *timers = user_data;
+	struct bluez_timer *timer;
+	guint64 now, tick;
+
+	for (;;) {
+		now = now_tick(timers);
+
+		while ((tick = next_tick(timers)) <= now)
+			process_tick(timers, tick);
+
+		if (timers->cur <= now)
+			timers->cur = now + 1;
+
+		if (!timers->expiring)
+			break;
+
+		/* The whole batch, callbacks may cancel timers in it */
+		while ((timer = timers->expiring)) {
+			timer_unlink(timers, timer);
+			timer->func(timer->user_data);
+			g_free(timer);
+		}
+	}
+
+	timers_arm(timers);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean timers_dispatch(GSource *source, GSourceFunc callback,
+							gpointer user_data)
+{
+	return callback(user_data);
+}
+
+static GSourceFuncs timers_funcs = {
+	.dispatch = timers_dispatch,
+};
+
+struct bluez_timers *bluez_timers_new(GMainContext *context)
+{
+	struct bluez_timers *timers;
+
+	timers = g_try_new0(struct bluez_timers, 1);
+	if (!timers)
+		return NULL;
+
+	timers->base = g_get_monotonic_time();
+
+	timers->source = g_source_new(&timers_funcs, sizeof(GSource));
+	g_source_set_callback(timers->source, timers_expire, timers, NULL);
+	g_source_set_ready_time(timers->source, -1);
+	g_source_attach(timers->source, context);
+
+	return timers;
+}
+
+GMainContext *bluez_timers_get_context(struct bluez_timers *timers)
+{
+	return g_source_get_context(timers->source);
+}
+
+void bluez_timers_free(struct bluez_timers *timers)
+{
+	struct bluez_timer *timer;
+	guint level, slot;
+
+	if (!timers)
+		return;
+
+	g_source_destroy(timers->source);
+	g_source_unref(timers->source);
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < WHEEL_SLOTS; slot++) {
+			while ((timer = timers->wheel[level][slot])) {
+				timers->wheel[level][slot] = timer->next;
+				g_free(timer);
+			}
+		}
+	}
+
+	while ((timer = timers->expiring)) {
+		timers->expiring = timer->next;
+		g_free(timer);
+	}
+
+	g_free(timers);
+}
+
+struct bluez_timer *bluez_timers_add(struct bluez_timers *timers,
+				guint delay_ms, bluez_timer_func func,
+				gpointer user_data)
+{
+	struct bluez_timer *timer;
+	gint64 expires;
+
+	timer = g_new0(struct bluez_timer, 1);
+	timer->func = func;
+	timer->user_data = user_data;
+
+	/* Never early, a partial tick rounds up */
+	expires = g_get_monotonic_time() - timers->base +
+			(gint64) delay_ms * 1000 + TICK_USEC - 1;
+	timer->expires = MAX(expires / TICK_USEC, timers->cur);
+
+	timer_insert(timers, timer);
+	timers_arm(timers);
+
+	return timer;
+}
+
+void bluez_timers_cancel(struct bluez_timers *timers,
+					struct bluez_timer *timer)
+{
+	if (!timer)
+		return;
+
+	timer_unlink(timers, timer);
+	g_free(timer);
+
+	timers_arm(timers);
+}
+
+guint bluez_timer_backoff(guint initial_ms, guint max_ms, guint attempt,
+							guint jitter)
+{
+	guint64 delay = initial_ms;
+	guint i, cut;
+
+	for (i = 2; i < attempt && delay < max_ms; i++)
+		delay *= 2;
+
+	delay = MIN(delay, max_ms);
+
+	cut = delay * MIN(jitter, 100) / 100;
+	if (cut)
+		delay -= g_random_int_range(0, cut + 1);
+
+	return delay;
+}
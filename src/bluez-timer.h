@@ -0,0 +1,62 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef __BLUEZ_TIMER_H__
+#define __BLUEZ_TIMER_H__
+
+#include <glib.h>
+
+/*
+ * Many one-shot timers behind a single GSource on a hierarchical timing
+ * wheel. Adding and cancelling are O(1) and all timers due together run
+ * in one dispatch, so thousands of devices waiting on a timer cost one
+ * main loop source. Expiry is rounded up to BLUEZ_TIMER_TICK_MS.
+ */
+struct bluez_timers;
+struct bluez_timer;
+
+#define BLUEZ_TIMER_TICK_MS 10
+
+typedef void (*bluez_timer_func) (gpointer user_data);
+
+struct bluez_timers *bluez_timers_new(GMainContext *context);
+
+/* Pending timers are dropped without being called */
+void bluez_timers_free(struct bluez_timers *timers);
+
+/* The timer is freed once it fires, cancelling it then is invalid */
+struct bluez_timer *bluez_timers_add(struct bluez_timers *timers,
+				guint delay_ms, bluez_timer_func func,
+				gpointer user_data);
+
+void bluez_timers_cancel(struct bluez_timers *timers,
+					struct bluez_timer *timer);
+
+/* The context the timers run in */
+GMainContext *bluez_timers_get_context(struct bluez_timers *timers);
+
+/*
+ * Exponential backoff before attempt (2 and up) doubling from initial_ms
+ * up to max_ms, minus a random cut of up to jitter percent so that many
+ * waiters spread out.
+ */
+guint bluez_timer_backoff(guint initial_ms, guint max_ms, guint attempt,
+							guint jitter);
+
+#endif
@@ -0,0 +1,407 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-uuid.h"
+
+/* Tail of 0000xxxx-0000-1000-8000-00805F9B34FB */
+static const guint8 base_uuid_tail[12] = {
+	0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
+	0x00, 0x80, 0x5f, 0x9b, 0x34, 0xfb
+};
+
+/* Sorted, at most 64 entries, one bit each in bluez_uuid_set */
+static const guint16 well_known[] = {
+	0x1101,		/* Serial Port */
+	0x1103,		/* Dialup Networking */
+	0x1105,		/* OBEX Object Push */
+	0x1106,		/* OBEX File Transfer */
+	0x1108,		/* Headset */
+	0x110a,		/* Audio Source */
+	0x110b,		/* Audio Sink */
+	0x110c,		/* A/V Remote Control Target */
+	0x110d,		/* Advanced Audio Distribution */
+	0x110e,		/* A/V Remote Control */
+	0x110f,		/* A/V Remote Control Controller */
+	0x1112,		/* Headset AG */
+	0x1115,		/* PANU */
+	0x1116,		/* NAP */
+	0x1117,		/* GN */
+	0x111e,		/* Handsfree */
+	0x111f,		/* Handsfree Audio Gateway */
+	0x1124,		/* Human Interface Device */
+	0x112d,		/* SIM Access */
+	0x112f,		/* Phonebook Access Server */
+	0x1132,		/* Message Access Server */
+	0x1133,		/* Message Notification Server */
+	0x1200,		/* PnP Information */
+	0x1203,		/* Generic Audio */
+	0x1800,		/* Generic Access */
+	0x1801,		/* Generic Attribute */
+	0x1802,		/* Immediate Alert */
+	0x1803,		/* Link Loss */
+	0x1804,		/* Tx Power */
+	0x1805,		/* Current Time */
+	0x1808,		/* Glucose */
+	0x1809,		/* Health Thermometer */
+	0x180a,		/* Device Information */
+	0x180d,		/* Heart Rate */
+	0x180f,		/* Battery */
+	0x1810,		/* Blood Pressure */
+	0x1812,		/* Human Interface Device over GATT */
+	0x1813,		/* Scan Parameters */
+	0x1814,		/* Running Speed and Cadence */
+	0x1816,		/* Cycling Speed and Cadence */
+	0x1818,		/* Cycling Power */
+	0x1819,		/* Location and Navigation */
+	0x181a,		/* Environmental Sensing */
+	0x181c,		/* User Data */
+	0x1822,		/* Pulse Oximeter */
+	0x1826,		/* Fitness Machine */
+	0x1844,		/* Volume Control */
+	0x184e,		/* Audio Stream Control */
+	0x184f,		/* Broadcast Audio Scan */
+	0x1850,		/* Published Audio Capabilities */
+	0x1853,		/* Common Audio */
+	0xfd6f,		/* Exposure Notification */
+	0xfe2c,		/* Fast Pair */
+	0xfeaa,		/* Eddystone */
+};
+
+G_STATIC_ASSERT(G_N_ELEMENTS(well_known) <= 64);
+
+static const gchar hex_digits[] = "0123456789abcdef";
+
+static gint well_known_bit(guint16 value)
+{
+	guint low = 0, high = G_N_ELEMENTS(well_known), mid;
+
+	while (low < high) {
+		mid = (low + high) / 2;
+
+		if (well_known[mid] == value)
+			return mid;
+
+		if (well_known[mid] < value)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return -1;
+}
+
+void bluez_uuid_from_16(bluez_uuid_t *uuid, guint16 value)
+{
+	memset(uuid, 0, sizeof(*uuid));
+	uuid->type = BLUEZ_UUID_16;
+	uuid->value.u16 = value;
+}
+
+static void uuid_from_32(bluez_uuid_t *uuid, guint32 value)
+{
+	if (value <= G_MAXUINT16) {
+		bluez_uuid_from_16(uuid, value);
+		return;
+	}
+
+	memset(uuid, 0, sizeof(*uuid));
+	uuid->type = BLUEZ_UUID_32;
+	uuid->value.u32 = value;
+}
+
+static gboolean parse_hex(const gchar *str, gsize len, guint8 *out)
+{
+	gsize i;
+	gint hi, lo;
+
+	for (i = 0; i < len / 2; i++) {
+		hi = g_ascii_xdigit_value(str[i * 2]);
+		lo = g_ascii_xdigit_value(str[i * 2 + 1]);
+		if (hi < 0 || lo < 0)
+			return FALSE;
+
+		out[i] = hi << 4 | lo;
+	}
+
+	return TRUE;
+}
+
+gboolean bluez_uuid_parse(const gchar *str, bluez_uuid_t *uuid)
+{
+	guint8 bytes[16];
+	gchar hex[32];
+	gsize len;
+	int i, n = 0;
+
+	if (str == NULL || uuid == NULL)
+		return FALSE;
+
+	if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+		str += 2;
+
+	len = strlen(str);
+
+	if (len == 4 || len == 8) {
+		if (!parse_hex(str, len, bytes))
+			return FALSE;
+
+		if (len == 4)
+			bluez_uuid_from_16(uuid, bytes[0] << 8 | bytes[1]);
+		else
+			uuid_from_32(uuid, (guint32) bytes[0] << 24 |
+					bytes[1] << 16 | bytes[2] << 8 |
+					bytes[3]);
+
+		return TRUE;
+	}
+
+	if (len != 36)
+		return FALSE;
+
+	for (i = 0; i < 36; i++) {
+		if (i == 8 || i == 13 || i == 18 || i == 23) {
+			if (str[i] != '-')
+				return FALSE;
+			continue;
+		}
+
+		hex[n++] = str[i];
+	}
+
+	if (!parse_hex(hex, sizeof(hex), bytes))
+		return FALSE;
+
+	if (!memcmp(bytes + 4, base_uuid_tail, sizeof(base_uuid_tail))) {
+		uuid_from_32(uuid, (guint32) bytes[0] << 24 | bytes[1] << 16 |
+						bytes[2] << 8 | bytes[3]);
+		return TRUE;
+	}
+
+	memset(uuid, 0, sizeof(*uuid));
+	uuid->type = BLUEZ_UUID_128;
+	memcpy(uuid->value.u128, bytes, sizeof(bytes));
+
+	return TRUE;
+}
+
+static void uuid_to_128(const bluez_uuid_t *uuid, guint8 *bytes)
+{
+	guint32 value;
+
+	if (uuid->type == BLUEZ_UUID_128) {
+		memcpy(bytes, uuid->value.u128, 16);
+		return;
+	}
+
+	value = uuid->type == BLUEZ_UUID_16 ? uuid->value.u16 :
+							uuid->value.u32;
+
+	bytes[0] = value >> 24;
+	bytes[1] = value >> 16;
+	bytes[2] = value >> 8;
+	bytes[3] = value;
+	memcpy(bytes + 4, base_uuid_tail, sizeof(base_uuid_tail));
+}
+
+void bluez_uuid_to_string(const bluez_uuid_t *uuid,
+					gchar str[BLUEZ_UUID_STRLEN])
+{
+	guint8 bytes[16];
+	int i, n = 0;
+
+	uuid_to_128(uuid, bytes);
+
+	for (i = 0; i < 16; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			str[n++] = '-';
+
+		str[n++] = hex_digits[bytes[i] >> 4];
+		str[n++] = hex_digits[bytes[i] & 0xf];
+	}
+
+	str[n] = '\0';
+}
+
+gint bluez_uuid_compare(const bluez_uuid_t *a, const bluez_uuid_t *b)
+{
+	if (a->type != b->type)
+		return a->type < b->type ? -1 : 1;
+
+	switch (a->type) {
+	case BLUEZ_UUID_16:
+		return (gint) a->value.u16 - (gint) b->value.u16;
+	case BLUEZ_UUID_32:
+		if (a->value.u32 == b->value.u32)
+			return 0;
+		return a->value.u32 < b->value.u32 ? -1 : 1;
+	default:
+		return memcmp(a->value.u128, b->value.u128, 16);
+	}
+}
+
+gboolean bluez_uuid_equal(gconstpointer a, gconstpointer b)
+{
+	return bluez_uuid_compare(a, b) == 0;
+}
+
+guint bluez_uuid_hash(gconstpointer data)
+{
+	const bluez_uuid_t *uuid = data;
+	guint hash = 2166136261u;
+	int i;
+
+	switch (uuid->type) {
+	case BLUEZ_UUID_16:
+		return uuid->value.u16;
+	case BLUEZ_UUID_32:
+		return uuid->value.u32;
+	default:
+		for (i = 0; i < 16; i++)
+			hash = (hash ^ uuid->value.u128[i]) * 16777619u;
+		return hash;
+	}
+}
+
+void bluez_uuid_set_init(struct bluez_uuid_set *set)
+{
+	memset(set, 0, sizeof(*set));
+}
+
+void bluez_uuid_set_clear(struct bluez_uuid_set *set)
+{
+	g_free(set->others);
+	bluez_uuid_set_init(set);
+}
+
+static int uuid_qsort_compare(const void *a, const void *b)
+{
+	return bluez_uuid_compare(a, b);
+}
+
+void bluez_uuid_set_parse(struct bluez_uuid_set *set, gchar **strv)
+{
+	bluez_uuid_t uuid;
+	guint n = 0, i;
+	gint bit;
+
+	bluez_uuid_set_clear(set);
+
+	if (strv == NULL)
+		return;
+
+	for (i = 0; strv[i]; i++) {
+		if (!bluez_uuid_parse(strv[i], &uuid))
+			continue;
+
+		bit = uuid.type == BLUEZ_UUID_16 ?
+				well_known_bit(uuid.value.u16) : -1;
+		if (bit >= 0) {
+			set->well_known |= G_GUINT64_CONSTANT(1) << bit;
+			continue;
+		}
+
+		if (set->others == NULL)
+			set->others = g_new(bluez_uuid_t, g_strv_length(strv));
+
+		set->others[n++] = uuid;
+	}
+
+	if (n == 0)
+		return;
+
+	qsort(set->others, n, sizeof(bluez_uuid_t), uuid_qsort_compare);
+
+	/* Drop duplicates */
+	set->n_others = 1;
+	for (i = 1; i < n; i++) {
+		if (bluez_uuid_compare(&set->others[i],
+				&set->others[set->n_others - 1]))
+			set->others[set->n_others++] = set->others[i];
+	}
+}
+
+void bluez_uuid_set_copy(struct bluez_uuid_set *dest,
+				const struct bluez_uuid_set *src)
+{
+	bluez_uuid_set_clear(dest);
+
+	dest->well_known = src->well_known;
+	dest->n_others = src->n_others;
+
+	if (src->n_others) {
+		dest->others = g_new(bluez_uuid_t, src->n_others);
+		memcpy(dest->others, src->others,
+				src->n_others * sizeof(bluez_uuid_t));
+	}
+}
+
+gboolean bluez_uuid_set_contains(const struct bluez_uuid_set *set,
+					const bluez_uuid_t *uuid)
+{
+	gint bit;
+
+	if (set == NULL || uuid == NULL)
+		return FALSE;
+
+	if (uuid->type == BLUEZ_UUID_16) {
+		bit = well_known_bit(uuid->value.u16);
+		if (bit >= 0)
+			return (set->well_known >> bit) & 1;
+	}
+
+	if (set->n_others == 0)
+		return FALSE;
+
+	return bsearch(uuid, set->others, set->n_others, sizeof(bluez_uuid_t),
+					uuid_qsort_compare) != NULL;
+}
+
+guint bluez_uuid_set_size(const struct bluez_uuid_set *set)
+{
+	guint64 bits = set->well_known;
+	guint n = set->n_others;
+
+	for (; bits; bits &= bits - 1)
+		n++;
+
+	return n;
+}
+
+void bluez_uuid_set_foreach(const struct bluez_uuid_set *set,
+		void (*func) (const bluez_uuid_t *uuid, gpointer user_data),
+		gpointer user_data)
+{
+	bluez_uuid_t uuid;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(well_known); i++) {
+		if (!((set->well_known >> i) & 1))
+			continue;
+
+		bluez_uuid_from_16(&uuid, well_known[i]);
+		func(&uuid, user_data);
+	}
+
+	for (i = 0; i < set->n_others; i++)
+		func(&set->others[i], user_data);
+}
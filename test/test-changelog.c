@@ -0,0 +1,205 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <glib.h>
+
+#include "bluez-changelog.h"
+
+#define DEV_A "/org/bluez/hci0/dev_00_00_00_00_00_0A"
+#define DEV_B "/org/bluez/hci0/dev_00_00_00_00_00_0B"
+
+static guint64 added(struct bluez_change_log *log, const gchar *path)
+{
+	return bluez_change_log_append(log, BLUEZ_CHANGE_ADDED,
+					BLUEZ_OBJECT_DEVICE, 0, path, 0);
+}
+
+static guint64 changed(struct bluez_change_log *log, const gchar *path,
+							guint32 properties)
+{
+	return bluez_change_log_append(log, BLUEZ_CHANGE_PROPERTIES,
+				BLUEZ_OBJECT_DEVICE, 0, path, properties);
+}
+
+static void test_since(void)
+{
+	struct bluez_change_log *log;
+	struct bluez_change changes[8];
+	guint n;
+
+	log = bluez_change_log_new(8);
+
+	g_assert_cmpuint(bluez_change_log_since(log, 0, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 0);
+
+	g_assert_cmpuint(added(log, DEV_A), ==, 1);
+	g_assert_cmpuint(added(log, DEV_B), ==, 2);
+	g_assert_cmpuint(changed(log, DEV_A, BLUEZ_PROPERTY_RSSI), ==, 3);
+
+	/* Oldest first, only what is newer than the generation given */
+	g_assert_cmpuint(bluez_change_log_since(log, 0, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 3);
+	g_assert_cmpuint(changes[0].generation, ==, 1);
+	g_assert_cmpstr(changes[0].path, ==, DEV_A);
+	g_assert_cmpuint(changes[2].type, ==, BLUEZ_CHANGE_PROPERTIES);
+	g_assert_cmpuint(changes[2].properties, ==, BLUEZ_PROPERTY_RSSI);
+
+	g_assert_cmpuint(bluez_change_log_since(log, 2, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 1);
+	g_assert_cmpuint(changes[0].generation, ==, 3);
+
+	g_assert_cmpuint(bluez_change_log_since(log, 3, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 0);
+
+	/* Paged by max_changes */
+	g_assert_cmpuint(bluez_change_log_since(log, 0, changes, 2, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 2);
+	g_assert_cmpuint(changes[1].generation, ==, 2);
+
+	/* From the future */
+	g_assert_cmpuint(bluez_change_log_since(log, 4, changes, 8, &n), ==,
+							BT_RESULT_INVALID_ARGS);
+
+	bluez_change_log_free(log);
+}
+
+static void test_fold(void)
+{
+	struct bluez_change_log *log;
+	struct bluez_change changes[8];
+	guint n;
+
+	log = bluez_change_log_new(8);
+
+	added(log, DEV_A);
+	changed(log, DEV_A, BLUEZ_PROPERTY_RSSI);
+	changed(log, DEV_A, BLUEZ_PROPERTY_NAME);
+
+	/* A burst on the newest record's object folds into it */
+	g_assert_cmpuint(bluez_change_log_get_generation(log), ==, 3);
+	g_assert_cmpuint(bluez_change_log_since(log, 0, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 2);
+	g_assert_cmpuint(changes[1].generation, ==, 3);
+	g_assert_cmpuint(changes[1].properties, ==,
+				BLUEZ_PROPERTY_RSSI | BLUEZ_PROPERTY_NAME);
+
+	/* A poller at the folded generation still sees the fold */
+	g_assert_cmpuint(bluez_change_log_since(log, 2, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 1);
+
+	/* Another object in between starts a new record */
+	changed(log, DEV_B, BLUEZ_PROPERTY_RSSI);
+	changed(log, DEV_A, BLUEZ_PROPERTY_RSSI);
+	g_assert_cmpuint(bluez_change_log_since(log, 0, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 4);
+
+	bluez_change_log_free(log);
+}
+
+static void test_eviction(void)
+{
+	struct bluez_change_log *log;
+	struct bluez_change changes[8];
+	gchar path[64];
+	guint i, n;
+
+	log = bluez_change_log_new(4);
+
+	for (i = 1; i <= 6; i++) {
+		g_snprintf(path, sizeof(path), "/org/bluez/hci0/dev_%u", i);
+		g_assert_cmpuint(added(log, path), ==, i);
+	}
+
+	/* 1 and 2 were overwritten, a poller that saw only 1 lost 2 */
+	g_assert_cmpuint(bluez_change_log_since(log, 0, changes, 8, &n), ==,
+						BT_RESULT_NOT_AVAILABLE);
+	g_assert_cmpuint(bluez_change_log_since(log, 1, changes, 8, &n), ==,
+						BT_RESULT_NOT_AVAILABLE);
+	g_assert_cmpuint(n, ==, 0);
+
+	/* The ring wrapped, the rest is still in order */
+	g_assert_cmpuint(bluez_change_log_since(log, 2, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 4);
+	for (i = 0; i < n; i++)
+		g_assert_cmpuint(changes[i].generation, ==, i + 3);
+	g_assert_cmpstr(changes[3].path, ==, "/org/bluez/hci0/dev_6");
+
+	g_assert_cmpuint(bluez_change_log_since(log, 4, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 2);
+	g_assert_cmpuint(changes[0].generation, ==, 5);
+
+	/* Resizing drops the records, everyone resyncs once */
+	g_assert_cmpuint(bluez_change_log_resize(log, 0), ==,
+							BT_RESULT_INVALID_ARGS);
+	g_assert_cmpuint(bluez_change_log_resize(log, 16), ==, BT_RESULT_OK);
+	g_assert_cmpuint(bluez_change_log_since(log, 5, changes, 8, &n), ==,
+						BT_RESULT_NOT_AVAILABLE);
+	g_assert_cmpuint(bluez_change_log_since(log, 6, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 0);
+
+	g_assert_cmpuint(added(log, DEV_A), ==, 7);
+	g_assert_cmpuint(bluez_change_log_since(log, 6, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 1);
+
+	bluez_change_log_free(log);
+}
+
+static void test_empty(void)
+{
+	struct bluez_change_log *log;
+	struct bluez_change changes[8];
+	guint n;
+
+	/* Nothing kept, generations still count */
+	log = bluez_change_log_new(0);
+
+	g_assert_cmpuint(added(log, DEV_A), ==, 1);
+	g_assert_cmpuint(added(log, DEV_B), ==, 2);
+	g_assert_cmpuint(bluez_change_log_since(log, 1, changes, 8, &n), ==,
+						BT_RESULT_NOT_AVAILABLE);
+	g_assert_cmpuint(bluez_change_log_since(log, 2, changes, 8, &n), ==,
+								BT_RESULT_OK);
+	g_assert_cmpuint(n, ==, 0);
+
+	bluez_change_log_free(log);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/changelog/since", test_since);
+	g_test_add_func("/changelog/fold", test_fold);
+	g_test_add_func("/changelog/eviction", test_eviction);
+	g_test_add_func("/changelog/empty", test_empty);
+
+	return g_test_run();
+}
@@ -0,0 +1,261 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <glib.h>
+
+#include "bluez-adapter.h"
+#include "bluez-discovery.h"
+#include "bluez-timer.h"
+
+/*
+ * Sessions are merged without an adapter, nothing goes to BlueZ and
+ * the merged filter is observed through the client side match.
+ */
+static struct bluez_timers *timers;
+static struct bluez_discovery *discovery;
+
+static void setup(void)
+{
+	timers = bluez_timers_new(NULL);
+	discovery = bluez_discovery_new(timers);
+}
+
+static void teardown(void)
+{
+	bluez_discovery_free(discovery);
+	bluez_timers_free(timers);
+}
+
+static struct bluez_discovery_session *acquire(
+			const struct bluez_discovery_filter *filter)
+{
+	struct bluez_discovery_options options = { .filter = filter };
+
+	return bluez_discovery_acquire(discovery, filter ? &options : NULL);
+}
+
+static guint32 match(const gchar *properties, gboolean partial)
+{
+	GVariant *variant;
+	guint32 failed;
+
+	variant = g_variant_ref_sink(g_variant_new_parsed(properties));
+	failed = bluez_discovery_match(discovery, variant, partial);
+	g_variant_unref(variant);
+
+	return failed;
+}
+
+static void test_uuids_rssi(void)
+{
+	const gchar *hr[] = { "180d", NULL };
+	const gchar *battery[] = { "0000180F-0000-1000-8000-00805F9B34FB",
+									NULL };
+	struct bluez_discovery_filter a = { .uuids = hr, .rssi = -60 };
+	struct bluez_discovery_filter b = { .uuids = battery, .rssi = -80 };
+	struct bluez_discovery_filter any = { 0 };
+	struct bluez_discovery_session *session;
+
+	setup();
+
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>}", FALSE), ==, 0);
+
+	acquire(&a);
+	acquire(&b);
+
+	/* The UUIDs add up, the weakest RSSI wins */
+	g_assert_cmpuint(match("{'RSSI': <int16 -70>, 'UUIDs': "
+			"<['0000180f-0000-1000-8000-00805f9b34fb']>}", FALSE),
+									==, 0);
+	g_assert_cmpuint(match("{'RSSI': <int16 -80>, 'UUIDs': <['180d']>}",
+								FALSE), ==, 0);
+	g_assert_cmpuint(match("{'RSSI': <int16 -81>, 'UUIDs': <['180d']>}",
+				FALSE) & BLUEZ_PROPERTY_RSSI, !=, 0);
+	g_assert_cmpuint(match("{'RSSI': <int16 -50>, 'UUIDs': <['1812']>}",
+				FALSE) & BLUEZ_PROPERTY_UUIDS, !=, 0);
+
+	/* Missing properties fail a full match only */
+	g_assert_cmpuint(match("{'RSSI': <int16 -50>}", TRUE), ==, 0);
+	g_assert_cmpuint(match("{'RSSI': <int16 -50>}", FALSE), ==,
+				BLUEZ_PROPERTY_UUIDS | BLUEZ_PROPERTY_PAIRED |
+				BLUEZ_PROPERTY_CONNECTED |
+				BLUEZ_PROPERTY_TRUSTED);
+
+	/* The user's own devices always pass */
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>, 'Paired': <true>}",
+								FALSE), ==, 0);
+
+	/* A session wanting any UUID and RSSI lifts both */
+	session = acquire(&any);
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>, 'UUIDs': <['1812']>}",
+								FALSE), ==, 0);
+	bluez_discovery_release(session);
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>, 'UUIDs': <['1812']>}",
+							FALSE), !=, 0);
+
+	/* So does one without a filter at all */
+	session = acquire(NULL);
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>}", FALSE), ==, 0);
+	bluez_discovery_release(session);
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>}", FALSE), !=, 0);
+
+	teardown();
+}
+
+static void test_pathloss(void)
+{
+	struct bluez_discovery_filter a = { .pathloss = 50 };
+	struct bluez_discovery_filter b = { .pathloss = 70 };
+	struct bluez_discovery_filter rssi = { .rssi = -60 };
+	struct bluez_discovery_session *session;
+
+	setup();
+
+	acquire(&a);
+	acquire(&b);
+
+	/* The largest pathloss wins */
+	g_assert_cmpuint(match("{'RSSI': <int16 -66>, 'TxPower': <int16 4>}",
+								FALSE), ==, 0);
+	g_assert_cmpuint(match("{'RSSI': <int16 -67>, 'TxPower': <int16 4>}",
+				FALSE) & BLUEZ_PROPERTY_TX_POWER, !=, 0);
+
+	/* Unknown TxPower passes, but an update without it does not */
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>}", FALSE), ==, 0);
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>}", TRUE), !=, 0);
+
+	/* RSSI and pathloss sessions together keep neither */
+	session = acquire(&rssi);
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>, 'TxPower': <int16 4>}",
+								FALSE), ==, 0);
+	bluez_discovery_release(session);
+	g_assert_cmpuint(match("{'RSSI': <int16 -100>, 'TxPower': <int16 4>}",
+							FALSE), !=, 0);
+
+	teardown();
+}
+
+static void test_pattern(void)
+{
+	struct bluez_discovery_filter a = { .pattern = "00:1A" };
+	struct bluez_discovery_filter b = { .pattern = "00:1A" };
+	struct bluez_discovery_filter other = { .pattern = "Sensor" };
+	struct bluez_discovery_session *session;
+
+	setup();
+
+	acquire(&a);
+	acquire(&b);
+
+	/* Shared by all sessions, it matches the address or the name */
+	g_assert_cmpuint(match("{'Address': <'00:1A:7D:DA:71:0F'>}", FALSE),
+									==, 0);
+	g_assert_cmpuint(match("{'Address': <'11:22:33:44:55:66'>, "
+				"'Name': <'00:1A thermometer'>}", FALSE),
+									==, 0);
+	g_assert_cmpuint(match("{'Address': <'11:22:33:44:55:66'>, "
+				"'Name': <'Sensor'>}", FALSE) &
+				BLUEZ_PROPERTY_ADDRESS, !=, 0);
+
+	/* Patterns that differ are dropped */
+	session = acquire(&other);
+	g_assert_cmpuint(match("{'Address': <'11:22:33:44:55:66'>}", FALSE),
+									==, 0);
+	bluez_discovery_release(session);
+	g_assert_cmpuint(match("{'Address': <'11:22:33:44:55:66'>}", FALSE),
+									!=, 0);
+
+	teardown();
+}
+
+static void test_relaxed(void)
+{
+	const gchar *hr[] = { "180d", NULL };
+	const gchar *both[] = { "0x180D", "180f", NULL };
+	struct bluez_discovery_filter a = { .uuids = hr, .rssi = -60,
+							.pattern = "00:1A" };
+	struct bluez_discovery_filter tighter = { .uuids = hr, .rssi = -50,
+							.pattern = "00:1A" };
+	struct bluez_discovery_filter uuids = { .uuids = both, .rssi = -60,
+							.pattern = "00:1A" };
+	struct bluez_discovery_filter rssi = { .uuids = hr, .rssi = -70,
+							.pattern = "00:1A" };
+	struct bluez_discovery_filter pattern = { .uuids = hr, .rssi = -60,
+							.pattern = "00:1A:7D" };
+	struct bluez_discovery_filter pathloss = { .uuids = hr,
+							.pathloss = 30 };
+	struct bluez_discovery_session *first, *session;
+
+	setup();
+
+	/* From nothing to a filter only drops devices */
+	first = acquire(&a);
+	g_assert_false(bluez_discovery_take_relaxed(discovery));
+
+	session = acquire(&tighter);
+	g_assert_false(bluez_discovery_take_relaxed(discovery));
+	bluez_discovery_release(session);
+	g_assert_false(bluez_discovery_take_relaxed(discovery));
+
+	/* Each criterion getting looser counts, once */
+	session = acquire(&uuids);
+	g_assert_true(bluez_discovery_take_relaxed(discovery));
+	g_assert_false(bluez_discovery_take_relaxed(discovery));
+	bluez_discovery_release(session);
+	g_assert_false(bluez_discovery_take_relaxed(discovery));
+
+	session = acquire(&rssi);
+	g_assert_true(bluez_discovery_take_relaxed(discovery));
+	bluez_discovery_release(session);
+	g_assert_false(bluez_discovery_take_relaxed(discovery));
+
+	/* Patterns that differ are dropped from the merge */
+	session = acquire(&pattern);
+	g_assert_true(bluez_discovery_take_relaxed(discovery));
+	bluez_discovery_release(session);
+	g_assert_false(bluez_discovery_take_relaxed(discovery));
+
+	session = acquire(&pathloss);
+	g_assert_true(bluez_discovery_take_relaxed(discovery));
+	bluez_discovery_release(session);
+	g_assert_false(bluez_discovery_take_relaxed(discovery));
+
+	/* No filter left at all */
+	session = acquire(NULL);
+	g_assert_true(bluez_discovery_take_relaxed(discovery));
+	bluez_discovery_release(session);
+	g_assert_false(bluez_discovery_take_relaxed(discovery));
+
+	bluez_discovery_release(first);
+	g_assert_true(bluez_discovery_take_relaxed(discovery));
+
+	teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/discovery/uuids-rssi", test_uuids_rssi);
+	g_test_add_func("/discovery/pathloss", test_pathloss);
+	g_test_add_func("/discovery/pattern", test_pattern);
+	g_test_add_func("/discovery/relaxed", test_relaxed);
+
+	return g_test_run();
+}
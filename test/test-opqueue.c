@@ -0,0 +1,265 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-opqueue.h"
+
+#define HID "00001124-0000-1000-8000-00805f9b34fb"
+#define A2DP "0000110d-0000-1000-8000-00805f9b34fb"
+
+/*
+ * Calls are not issued but kept as the one started, the check replies
+ * to it with the result it wants.
+ */
+struct started {
+	gint count;
+	gchar method[32];
+	gchar uuid[40];
+	enum bluez_call_class klass;
+	bluez_response_cb cb;
+	void *cb_data;
+};
+
+static struct started started;
+
+static void fake_start(const gchar *method, GVariant *parameter,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *cb_data,
+				gpointer user_data)
+{
+	const gchar *uuid = "";
+
+	g_assert_null(started.cb);
+
+	started.count++;
+	g_strlcpy(started.method, method, sizeof(started.method));
+	started.klass = klass;
+	started.cb = cb;
+	started.cb_data = cb_data;
+
+	if (parameter) {
+		g_variant_ref_sink(parameter);
+		g_variant_get(parameter, "(&s)", &uuid);
+	}
+	g_strlcpy(started.uuid, uuid, sizeof(started.uuid));
+
+	if (parameter)
+		g_variant_unref(parameter);
+}
+
+static void reply(BTResult ret)
+{
+	bluez_response_cb cb = started.cb;
+
+	g_assert_nonnull(cb);
+	started.cb = NULL;
+	cb(ret, NULL, started.cb_data);
+}
+
+struct result {
+	gint called;
+	BTResult ret;
+};
+
+static void result_cb(BTResult ret, GVariant *data, void *user_data)
+{
+	struct result *result = user_data;
+
+	result->called++;
+	result->ret = ret;
+}
+
+static struct bluez_op_queue queue;
+
+static void setup(void)
+{
+	memset(&started, 0, sizeof(started));
+	bluez_op_queue_init(&queue, fake_start, NULL);
+}
+
+static void submit(enum bluez_device_op type, const gchar *uuid,
+			enum bluez_call_class klass, struct result *result)
+{
+	bluez_op_queue_submit(&queue, type, uuid, klass, 0, NULL,
+							result_cb, result);
+}
+
+static void test_serial(void)
+{
+	struct result connect = { 0 }, pair = { 0 };
+
+	setup();
+
+	submit(BLUEZ_DEVICE_OP_CONNECT, NULL, BLUEZ_CALL_NORMAL, &connect);
+	submit(BLUEZ_DEVICE_OP_PAIR, NULL, BLUEZ_CALL_NORMAL, &pair);
+
+	/* One call at a time, in submission order */
+	g_assert_cmpint(started.count, ==, 1);
+	g_assert_cmpstr(started.method, ==, "Connect");
+
+	/* Already in the requested state counts as done */
+	reply(BT_RESULT_ALREADY_CONNECTED);
+	g_assert_cmpint(connect.called, ==, 1);
+	g_assert_cmpuint(connect.ret, ==, BT_RESULT_OK);
+
+	g_assert_cmpint(started.count, ==, 2);
+	g_assert_cmpstr(started.method, ==, "Pair");
+
+	reply(BT_RESULT_FAILED);
+	g_assert_cmpint(pair.called, ==, 1);
+	g_assert_cmpuint(pair.ret, ==, BT_RESULT_FAILED);
+	g_assert_null(queue.running);
+}
+
+static void test_merge(void)
+{
+	struct result r[4] = { { 0 } };
+
+	setup();
+
+	/* A repeat of the running operation shares its call */
+	submit(BLUEZ_DEVICE_OP_CONNECT, NULL, BLUEZ_CALL_NORMAL, &r[0]);
+	submit(BLUEZ_DEVICE_OP_CONNECT, NULL, BLUEZ_CALL_NORMAL, &r[1]);
+	g_assert_cmpint(started.count, ==, 1);
+
+	/* So does a repeat of the last queued one, raising its class */
+	submit(BLUEZ_DEVICE_OP_PAIR, NULL, BLUEZ_CALL_BACKGROUND, &r[2]);
+	submit(BLUEZ_DEVICE_OP_PAIR, NULL, BLUEZ_CALL_INTERACTIVE, &r[3]);
+
+	reply(BT_RESULT_OK);
+	g_assert_cmpint(r[0].called, ==, 1);
+	g_assert_cmpint(r[1].called, ==, 1);
+	g_assert_cmpuint(r[1].ret, ==, BT_RESULT_OK);
+
+	g_assert_cmpint(started.count, ==, 2);
+	g_assert_cmpstr(started.method, ==, "Pair");
+	g_assert_cmpuint(started.klass, ==, BLUEZ_CALL_INTERACTIVE);
+
+	reply(BT_RESULT_OK);
+	g_assert_cmpint(r[2].called, ==, 1);
+	g_assert_cmpint(r[3].called, ==, 1);
+	g_assert_cmpint(started.count, ==, 2);
+}
+
+static void test_cancel(void)
+{
+	struct result pair = { 0 }, connect = { 0 }, disconnect = { 0 };
+	struct result again = { 0 };
+
+	setup();
+
+	submit(BLUEZ_DEVICE_OP_PAIR, NULL, BLUEZ_CALL_NORMAL, &pair);
+	submit(BLUEZ_DEVICE_OP_CONNECT, NULL, BLUEZ_CALL_NORMAL, &connect);
+
+	/* The opposite cancels the queued one before it reaches BlueZ */
+	submit(BLUEZ_DEVICE_OP_DISCONNECT, NULL, BLUEZ_CALL_NORMAL,
+								&disconnect);
+	g_assert_cmpint(connect.called, ==, 1);
+	g_assert_cmpuint(connect.ret, ==, BT_RESULT_CANCELLED);
+	g_assert_cmpint(disconnect.called, ==, 0);
+
+	reply(BT_RESULT_OK);
+	g_assert_cmpstr(started.method, ==, "Disconnect");
+
+	/* A running call is never cancelled, the opposite queues behind */
+	submit(BLUEZ_DEVICE_OP_CONNECT, NULL, BLUEZ_CALL_NORMAL, &again);
+	g_assert_cmpint(disconnect.called, ==, 0);
+
+	reply(BT_RESULT_NOT_CONNECTED);
+	g_assert_cmpint(disconnect.called, ==, 1);
+	g_assert_cmpuint(disconnect.ret, ==, BT_RESULT_OK);
+	g_assert_cmpstr(started.method, ==, "Connect");
+
+	reply(BT_RESULT_OK);
+	g_assert_cmpint(again.called, ==, 1);
+	g_assert_cmpint(started.count, ==, 3);
+}
+
+static void test_profiles(void)
+{
+	struct result busy = { 0 }, hid = { 0 }, a2dp = { 0 }, off = { 0 };
+	struct result invalid = { 0 };
+
+	setup();
+
+	submit(BLUEZ_DEVICE_OP_CONNECT, NULL, BLUEZ_CALL_NORMAL, &busy);
+
+	/* Profile operations only merge or cancel for the same UUID */
+	submit(BLUEZ_DEVICE_OP_CONNECT_PROFILE, HID, BLUEZ_CALL_NORMAL, &hid);
+	submit(BLUEZ_DEVICE_OP_DISCONNECT_PROFILE, A2DP, BLUEZ_CALL_NORMAL,
+									&a2dp);
+	g_assert_cmpint(hid.called, ==, 0);
+
+	submit(BLUEZ_DEVICE_OP_CONNECT_PROFILE, A2DP, BLUEZ_CALL_NORMAL, &off);
+	g_assert_cmpint(a2dp.called, ==, 1);
+	g_assert_cmpuint(a2dp.ret, ==, BT_RESULT_CANCELLED);
+	g_assert_cmpint(hid.called, ==, 0);
+
+	submit(BLUEZ_DEVICE_OP_CONNECT_PROFILE, NULL, BLUEZ_CALL_NORMAL,
+								&invalid);
+	g_assert_cmpint(invalid.called, ==, 1);
+	g_assert_cmpuint(invalid.ret, ==, BT_RESULT_INVALID_ARGS);
+
+	reply(BT_RESULT_OK);
+	g_assert_cmpstr(started.method, ==, "ConnectProfile");
+	g_assert_cmpstr(started.uuid, ==, HID);
+
+	reply(BT_RESULT_OK);
+	g_assert_cmpstr(started.uuid, ==, A2DP);
+
+	reply(BT_RESULT_OK);
+	g_assert_cmpint(hid.called + off.called, ==, 2);
+}
+
+static void test_clear(void)
+{
+	struct result running = { 0 }, queued = { 0 };
+
+	setup();
+
+	submit(BLUEZ_DEVICE_OP_CONNECT, NULL, BLUEZ_CALL_NORMAL, &running);
+	submit(BLUEZ_DEVICE_OP_PAIR, NULL, BLUEZ_CALL_NORMAL, &queued);
+
+	bluez_op_queue_clear(&queue);
+	g_assert_cmpint(running.called, ==, 1);
+	g_assert_cmpuint(running.ret, ==, BT_RESULT_CANCELLED);
+	g_assert_cmpint(queued.called, ==, 1);
+	g_assert_cmpuint(queued.ret, ==, BT_RESULT_CANCELLED);
+
+	/* The late reply frees the operation, nobody hears of it twice */
+	reply(BT_RESULT_OK);
+	g_assert_cmpint(running.called, ==, 1);
+	g_assert_cmpint(started.count, ==, 1);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/opqueue/serial", test_serial);
+	g_test_add_func("/opqueue/merge", test_merge);
+	g_test_add_func("/opqueue/cancel", test_cancel);
+	g_test_add_func("/opqueue/profiles", test_profiles);
+	g_test_add_func("/opqueue/clear", test_clear);
+
+	return g_test_run();
+}
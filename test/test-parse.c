@@ -0,0 +1,316 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "bluez-common.h"
+#include "bluez-uuid.h"
+#include "bluez-beacon.h"
+
+static const guint8 nus_uuid[16] = {
+	0x6e, 0x40, 0x00, 0x01, 0xb5, 0xa3, 0xf3, 0x93,
+	0xe0, 0xa9, 0xe5, 0x0e, 0x24, 0xdc, 0xca, 0x9e
+};
+
+static void check_uuid(const gchar *str, enum bluez_uuid_type type,
+					guint32 value, const gchar *full)
+{
+	gchar out[BLUEZ_UUID_STRLEN];
+	bluez_uuid_t uuid, again;
+
+	g_assert_true(bluez_uuid_parse(str, &uuid));
+	g_assert_cmpint(uuid.type, ==, type);
+
+	if (type == BLUEZ_UUID_16)
+		g_assert_cmpuint(uuid.value.u16, ==, value);
+	else if (type == BLUEZ_UUID_32)
+		g_assert_cmpuint(uuid.value.u32, ==, value);
+	else
+		g_assert_cmpmem(uuid.value.u128, 16, nus_uuid, 16);
+
+	/* The full form reads back to an equal value */
+	bluez_uuid_to_string(&uuid, out);
+	g_assert_cmpstr(out, ==, full);
+
+	g_assert_true(bluez_uuid_parse(out, &again));
+	g_assert_true(bluez_uuid_equal(&uuid, &again));
+	g_assert_cmpuint(bluez_uuid_hash(&uuid), ==, bluez_uuid_hash(&again));
+}
+
+static void test_uuid(void)
+{
+	static const gchar *invalid[] = {
+		"", "0x", "18d", "180g", "0x180d0", "1234567",
+		"0000180d-0000-1000-8000-00805f9b34f",
+		"0000180d-0000-1000-8000-00805f9b34fbb",
+		"0000180d00000-1000-8000-00805f9b34fb",
+		"0000180d-0000-1000-8000-00805f9b34fg",
+	};
+	bluez_uuid_t uuid;
+	guint i;
+
+	check_uuid("180d", BLUEZ_UUID_16, 0x180d,
+				"0000180d-0000-1000-8000-00805f9b34fb");
+	check_uuid("0x180D", BLUEZ_UUID_16, 0x180d,
+				"0000180d-0000-1000-8000-00805f9b34fb");
+	check_uuid("0000180D-0000-1000-8000-00805F9B34FB", BLUEZ_UUID_16,
+			0x180d, "0000180d-0000-1000-8000-00805f9b34fb");
+
+	/* The short form is the shortest one the value fits */
+	check_uuid("0000fe2c", BLUEZ_UUID_16, 0xfe2c,
+				"0000fe2c-0000-1000-8000-00805f9b34fb");
+	check_uuid("0x12345678", BLUEZ_UUID_32, 0x12345678,
+				"12345678-0000-1000-8000-00805f9b34fb");
+	check_uuid("12345678-0000-1000-8000-00805f9b34fb", BLUEZ_UUID_32,
+			0x12345678, "12345678-0000-1000-8000-00805f9b34fb");
+
+	/* Off the base UUID by a single byte, kept in full */
+	check_uuid("6E400001-B5A3-F393-E0A9-E50E24DCCA9E", BLUEZ_UUID_128, 0,
+				"6e400001-b5a3-f393-e0a9-e50e24dcca9e");
+
+	for (i = 0; i < G_N_ELEMENTS(invalid); i++)
+		g_assert_false(bluez_uuid_parse(invalid[i], &uuid));
+
+	g_assert_false(bluez_uuid_parse(NULL, &uuid));
+}
+
+static void test_uuid_set(void)
+{
+	gchar *strv[] = {
+		"180d", "0000180F-0000-1000-8000-00805F9B34FB",
+		"6e400001-b5a3-f393-e0a9-e50e24dcca9e",
+		"6E400001-B5A3-F393-E0A9-E50E24DCCA9E",
+		"0x12345678", "not a uuid", "0x180d", NULL
+	};
+	struct bluez_uuid_set set;
+	bluez_uuid_t uuid;
+
+	bluez_uuid_set_init(&set);
+	bluez_uuid_set_parse(&set, strv);
+
+	/* Duplicates in either form count once, the unparsable not at all */
+	g_assert_cmpuint(bluez_uuid_set_size(&set), ==, 4);
+
+	bluez_uuid_from_16(&uuid, 0x180d);
+	g_assert_true(bluez_uuid_set_contains(&set, &uuid));
+	bluez_uuid_from_16(&uuid, 0x180f);
+	g_assert_true(bluez_uuid_set_contains(&set, &uuid));
+	bluez_uuid_from_16(&uuid, 0x1812);
+	g_assert_false(bluez_uuid_set_contains(&set, &uuid));
+
+	g_assert_true(bluez_uuid_parse("12345678", &uuid));
+	g_assert_true(bluez_uuid_set_contains(&set, &uuid));
+	g_assert_true(bluez_uuid_parse(strv[2], &uuid));
+	g_assert_true(bluez_uuid_set_contains(&set, &uuid));
+	g_assert_true(bluez_uuid_parse("12345679", &uuid));
+	g_assert_false(bluez_uuid_set_contains(&set, &uuid));
+
+	bluez_uuid_set_clear(&set);
+	g_assert_cmpuint(bluez_uuid_set_size(&set), ==, 0);
+}
+
+static void test_addr(void)
+{
+	static const guint8 bytes[6] = { 0x00, 0x1a, 0x7d, 0xda, 0x71, 0x0f };
+	static const gchar *invalid[] = {
+		"", "00:1A:7D:DA:71:0", "00:1A:7D:DA:71:0FF",
+		"00-1A-7D-DA-71-0F", "00:1A:7D:DA:71:0G", "0:01A:7D:DA:71:0F",
+		"00:1A:7D:DA:71:0F ",
+	};
+	gchar out[BLUEZ_ADDR_STRLEN];
+	bluez_addr_t addr, again;
+	guint i;
+
+	g_assert_true(bluez_addr_parse("00:1a:7D:dA:71:0f", &addr));
+	g_assert_cmpmem(addr.b, 6, bytes, 6);
+	g_assert_cmpint(addr.type, ==, BLUEZ_ADDR_PUBLIC);
+
+	bluez_addr_format(&addr, out);
+	g_assert_cmpstr(out, ==, "00:1A:7D:DA:71:0F");
+
+	/* Object path separators and the device path component */
+	g_assert_true(bluez_addr_parse("00_1A_7D_DA_71_0F", &again));
+	g_assert_true(bluez_addr_equal(&addr, &again));
+	g_assert_cmpuint(bluez_addr_hash(&addr), ==, bluez_addr_hash(&again));
+
+	g_assert_true(bluez_addr_from_path(
+			"/org/bluez/hci0/dev_00_1A_7D_DA_71_0F", &again));
+	g_assert_true(bluez_addr_equal(&addr, &again));
+	g_assert_false(bluez_addr_from_path("/org/bluez/hci0", &again));
+	g_assert_false(bluez_addr_from_path(
+			"/org/bluez/hci0/dev_00_1A_7D_DA_71_0F/service0001",
+			&again));
+
+	for (i = 0; i < G_N_ELEMENTS(invalid); i++)
+		g_assert_false(bluez_addr_parse(invalid[i], &addr));
+
+	g_assert_false(bluez_addr_parse(NULL, &addr));
+}
+
+static void test_ibeacon(void)
+{
+	guint8 data[23] = { 0x02, 0x15 };
+	struct bluez_ibeacon beacon;
+
+	memcpy(data + 2, nus_uuid, 16);
+	data[18] = 0x12;
+	data[19] = 0x34;
+	data[20] = 0xab;
+	data[21] = 0xcd;
+	data[22] = 0xc5;
+
+	g_assert_true(bluez_beacon_parse_ibeacon(data, sizeof(data), &beacon));
+	g_assert_cmpmem(beacon.uuid, 16, nus_uuid, 16);
+	g_assert_cmpuint(beacon.major, ==, 0x1234);
+	g_assert_cmpuint(beacon.minor, ==, 0xabcd);
+	g_assert_cmpint(beacon.measured_power, ==, -59);
+
+	/* Short, or another Apple type */
+	g_assert_false(bluez_beacon_parse_ibeacon(data, sizeof(data) - 1,
+								&beacon));
+	data[0] = 0x10;
+	g_assert_false(bluez_beacon_parse_ibeacon(data, sizeof(data), &beacon));
+	g_assert_false(bluez_beacon_parse_ibeacon(NULL, 0, &beacon));
+}
+
+static void test_eddystone_uid(void)
+{
+	guint8 data[20] = { BLUEZ_EDDYSTONE_UID, 0xee };
+	struct bluez_eddystone beacon;
+	guint i;
+
+	for (i = 2; i < 18; i++)
+		data[i] = i;
+
+	g_assert_true(bluez_beacon_parse_eddystone(data, sizeof(data),
+								&beacon));
+	g_assert_cmpint(beacon.frame, ==, BLUEZ_EDDYSTONE_UID);
+	g_assert_cmpint(beacon.tx_power, ==, -18);
+	g_assert_cmpmem(beacon.value.uid.namespace_id, 10, data + 2, 10);
+	g_assert_cmpmem(beacon.value.uid.instance_id, 6, data + 12, 6);
+
+	/* The reserved bytes are optional, the ids are not */
+	g_assert_true(bluez_beacon_parse_eddystone(data, 18, &beacon));
+	g_assert_false(bluez_beacon_parse_eddystone(data, 17, &beacon));
+}
+
+static void test_eddystone_url(void)
+{
+	guint8 data[20] = { BLUEZ_EDDYSTONE_URL, 0xeb, 0x00,
+			'g', 'o', 'o', 'g', 'l', 'e', 0x07 };
+	guint8 longer[21] = { BLUEZ_EDDYSTONE_URL, 0xeb, 0x02 };
+	struct bluez_eddystone beacon;
+	gchar url[BLUEZ_EDDYSTONE_URL_MAX];
+	guint i;
+
+	g_assert_true(bluez_beacon_parse_eddystone(data, 10, &beacon));
+	g_assert_cmpint(beacon.frame, ==, BLUEZ_EDDYSTONE_URL);
+	g_assert_cmpint(beacon.tx_power, ==, -21);
+	g_assert_cmpstr(beacon.value.url, ==, "http://www.google.com");
+
+	/* The longest expansion fills the buffer exactly */
+	data[2] = 0x01;
+	for (i = 3; i < sizeof(data); i++)
+		data[i] = 0x04;
+
+	g_assert_true(bluez_beacon_parse_eddystone(data, sizeof(data),
+								&beacon));
+	strcpy(url, "https://www.");
+	for (i = 3; i < sizeof(data); i++)
+		strcat(url, ".info/");
+	g_assert_cmpstr(beacon.value.url, ==, url);
+	g_assert_cmpuint(strlen(beacon.value.url), ==,
+					BLUEZ_EDDYSTONE_URL_MAX - 1);
+
+	/* Too long, unknown scheme, control or reserved bytes, empty */
+	for (i = 3; i < sizeof(longer); i++)
+		longer[i] = 'a';
+	g_assert_false(bluez_beacon_parse_eddystone(longer, sizeof(longer),
+								&beacon));
+
+	data[2] = 0x04;
+	g_assert_false(bluez_beacon_parse_eddystone(data, 4, &beacon));
+	data[2] = 0x00;
+	data[3] = 0x20;
+	g_assert_false(bluez_beacon_parse_eddystone(data, 4, &beacon));
+	data[3] = 0x0e;
+	g_assert_false(bluez_beacon_parse_eddystone(data, 4, &beacon));
+	g_assert_false(bluez_beacon_parse_eddystone(data, 2, &beacon));
+}
+
+static void test_eddystone_tlm(void)
+{
+	guint8 data[14] = { BLUEZ_EDDYSTONE_TLM, 0x00, 0x0b, 0xb8, 0xff,
+				0x80, 0x00, 0x01, 0x00, 0x00, 0x80, 0x00,
+				0x00, 0x09 };
+	struct bluez_eddystone beacon;
+
+	g_assert_true(bluez_beacon_parse_eddystone(data, sizeof(data),
+								&beacon));
+	g_assert_cmpint(beacon.frame, ==, BLUEZ_EDDYSTONE_TLM);
+	g_assert_cmpint(beacon.tx_power, ==, 0);
+	g_assert_cmpuint(beacon.value.tlm.battery, ==, 3000);
+	g_assert_cmpint(beacon.value.tlm.temperature, ==, -128);
+	g_assert_cmpuint(beacon.value.tlm.adv_count, ==, 0x10000);
+	g_assert_cmpuint(beacon.value.tlm.uptime, ==, 0x80000009);
+
+	/* Short, or the encrypted version */
+	g_assert_false(bluez_beacon_parse_eddystone(data, sizeof(data) - 1,
+								&beacon));
+	data[1] = 0x01;
+	g_assert_false(bluez_beacon_parse_eddystone(data, sizeof(data),
+								&beacon));
+}
+
+static void test_eddystone_eid(void)
+{
+	guint8 data[10] = { BLUEZ_EDDYSTONE_EID, 0x00,
+				1, 2, 3, 4, 5, 6, 7, 8 };
+	struct bluez_eddystone beacon;
+
+	g_assert_true(bluez_beacon_parse_eddystone(data, sizeof(data),
+								&beacon));
+	g_assert_cmpint(beacon.frame, ==, BLUEZ_EDDYSTONE_EID);
+	g_assert_cmpmem(beacon.value.eid, 8, data + 2, 8);
+
+	g_assert_false(bluez_beacon_parse_eddystone(data, sizeof(data) - 1,
+								&beacon));
+
+	/* Unknown frame types */
+	data[0] = 0x40;
+	g_assert_false(bluez_beacon_parse_eddystone(data, sizeof(data),
+								&beacon));
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/parse/uuid", test_uuid);
+	g_test_add_func("/parse/uuid-set", test_uuid_set);
+	g_test_add_func("/parse/addr", test_addr);
+	g_test_add_func("/beacon/ibeacon", test_ibeacon);
+	g_test_add_func("/beacon/eddystone-uid", test_eddystone_uid);
+	g_test_add_func("/beacon/eddystone-url", test_eddystone_url);
+	g_test_add_func("/beacon/eddystone-tlm", test_eddystone_tlm);
+	g_test_add_func("/beacon/eddystone-eid", test_eddystone_eid);
+
+	return g_test_run();
+}
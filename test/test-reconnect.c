@@ -0,0 +1,430 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+/*
+ * The reconnect engine is built in against fake device records and a
+ * fake clock. Connect calls are recorded and answered by hand.
+ */
+static gint64 fake_now = 1000000;
+
+static gint64 fake_monotonic_time(void)
+{
+	return fake_now;
+}
+
+#define g_get_monotonic_time fake_monotonic_time
+#include "bluez-timer.c"
+#include "bluez-reconnect.c"
+#undef g_get_monotonic_time
+
+#define MAX_DEVICES 4
+
+struct bluez_device {
+	const gchar *adapter;
+	struct bluez_device_info info;
+};
+
+struct bluez_manager {
+	struct bluez_device devices[MAX_DEVICES];
+	guint n_devices;
+};
+
+static struct {
+	guint count;
+	struct bluez_device *device;
+	bluez_response_cb cb;
+	void *user_data;
+} submitted;
+
+struct bluez_device *find_adapter_device_by_addr(
+					struct bluez_manager *manager,
+					const gchar *adapter,
+					const bluez_addr_t *addr)
+{
+	guint i;
+
+	for (i = 0; i < manager->n_devices; i++) {
+		struct bluez_device *device = &manager->devices[i];
+
+		if (bluez_addr_equal(&device->info.addr, addr) &&
+				(!adapter || !strcmp(device->adapter, adapter)))
+			return device;
+	}
+
+	return NULL;
+}
+
+guint find_devices_by_addr(struct bluez_manager *manager,
+				const bluez_addr_t *addr,
+				struct bluez_device **devices, guint max)
+{
+	guint i, n = 0;
+
+	for (i = 0; i < manager->n_devices; i++) {
+		if (!bluez_addr_equal(&manager->devices[i].info.addr, addr))
+			continue;
+
+		if (n < max)
+			devices[n] = &manager->devices[i];
+		n++;
+	}
+
+	return n;
+}
+
+void bluez_device_get_info(struct bluez_device *device,
+					struct bluez_device_info *info)
+{
+	*info = device->info;
+}
+
+const bluez_addr_t *bluez_device_get_addr(struct bluez_device *device)
+{
+	return &device->info.addr;
+}
+
+void bluez_device_submit(struct bluez_device *device,
+				enum bluez_device_op type, const gchar *uuid,
+				enum bluez_call_class klass, guint timeout_ms,
+				const struct bluez_retry_policy *retry,
+				bluez_response_cb cb, void *user_data)
+{
+	g_assert_cmpint(type, ==, BLUEZ_DEVICE_OP_CONNECT);
+	g_assert_null(submitted.cb);
+
+	submitted.count++;
+	submitted.device = device;
+	submitted.cb = cb;
+	submitted.user_data = user_data;
+}
+
+static void reply(BTResult ret)
+{
+	bluez_response_cb cb = submitted.cb;
+
+	g_assert_nonnull(cb);
+	submitted.cb = NULL;
+	cb(ret, NULL, submitted.user_data);
+}
+
+static struct bluez_manager manager;
+static struct bluez_timers *timers;
+static struct bluez_reconnect *reconnect;
+
+static struct bluez_device *add_device(const gchar *adapter, gint16 rssi)
+{
+	struct bluez_device *device = &manager.devices[manager.n_devices++];
+
+	device->adapter = adapter;
+	bluez_addr_parse("00:1A:7D:DA:71:0F", &device->info.addr);
+	device->info.rssi = rssi;
+
+	return device;
+}
+
+static void setup(void)
+{
+	memset(&manager, 0, sizeof(manager));
+	memset(&submitted, 0, sizeof(submitted));
+
+	timers = bluez_timers_new(NULL);
+	reconnect = bluez_reconnect_new(&manager, timers);
+}
+
+static void teardown(void)
+{
+	bluez_reconnect_free(reconnect);
+	bluez_timers_free(timers);
+}
+
+static void set_policy(enum bluez_reconnect_mode mode, const gchar *adapter,
+							gint16 min_rssi)
+{
+	struct bluez_reconnect_policy policy = {
+		.mode = mode,
+		.adapter = adapter,
+		.min_rssi = min_rssi,
+	};
+
+	bluez_reconnect_set_policy(reconnect, &manager.devices[0].info.addr,
+								&policy);
+}
+
+static void heard(struct bluez_device *device, gint16 rssi)
+{
+	device->info.rssi = rssi;
+	bluez_reconnect_device_changed(reconnect, device,
+						BLUEZ_PROPERTY_RSSI);
+}
+
+static void test_in_range(void)
+{
+	struct bluez_device *device;
+	struct bluez_reconnect_stats stats;
+
+	setup();
+	device = add_device("hci0", -90);
+
+	/* Without a threshold any advertisement will do */
+	set_policy(BLUEZ_RECONNECT_IN_RANGE, NULL, 0);
+	g_assert_cmpuint(submitted.count, ==, 0);
+
+	heard(device, -90);
+	g_assert_cmpuint(submitted.count, ==, 1);
+	reply(BT_RESULT_OK);
+
+	/* Neither below the threshold nor without an RSSI */
+	set_policy(BLUEZ_RECONNECT_IN_RANGE, NULL, -60);
+	heard(device, -70);
+	heard(device, BLUEZ_RSSI_UNKNOWN);
+	g_assert_cmpuint(submitted.count, ==, 1);
+
+	heard(device, -60);
+	g_assert_cmpuint(submitted.count, ==, 2);
+	g_assert_true(submitted.device == device);
+
+	/* One attempt at a time */
+	heard(device, -50);
+	g_assert_cmpuint(submitted.count, ==, 2);
+	reply(BT_RESULT_OK);
+
+	/* Connected, nothing to do */
+	device->info.connected = TRUE;
+	heard(device, -40);
+	g_assert_cmpuint(submitted.count, ==, 2);
+
+	bluez_reconnect_get_stats(reconnect, &stats);
+	g_assert_cmpuint(stats.known, ==, 1);
+	g_assert_cmpuint(stats.attempts, ==, 2);
+	g_assert_cmpuint(stats.reconnected, ==, 2);
+
+	teardown();
+}
+
+static void test_backoff(void)
+{
+	struct bluez_reconnect_stats stats;
+
+	setup();
+	add_device("hci0", BLUEZ_RSSI_UNKNOWN);
+
+	/* Regardless of presence, right away */
+	set_policy(BLUEZ_RECONNECT_ALWAYS, NULL, 0);
+	g_assert_cmpuint(submitted.count, ==, 1);
+
+	/* The first retry waits up to the initial delay, minus jitter */
+	reply(BT_RESULT_FAILED);
+	fake_now += (DEFAULT_RECONNECT_INITIAL_DELAY / 2 - 10) * 1000;
+	timers_expire(timers);
+	g_assert_cmpuint(submitted.count, ==, 1);
+
+	fake_now += (DEFAULT_RECONNECT_INITIAL_DELAY / 2 + 20) * 1000;
+	timers_expire(timers);
+	g_assert_cmpuint(submitted.count, ==, 2);
+
+	/* The second one up to twice that */
+	reply(BT_RESULT_TIMEOUT);
+	fake_now += (DEFAULT_RECONNECT_INITIAL_DELAY - 10) * 1000;
+	timers_expire(timers);
+	g_assert_cmpuint(submitted.count, ==, 2);
+
+	fake_now += (DEFAULT_RECONNECT_INITIAL_DELAY + 20) * 1000;
+	timers_expire(timers);
+	g_assert_cmpuint(submitted.count, ==, 3);
+
+	reply(BT_RESULT_OK);
+
+	bluez_reconnect_get_stats(reconnect, &stats);
+	g_assert_cmpuint(stats.failed, ==, 2);
+	g_assert_cmpuint(stats.reconnected, ==, 1);
+
+	teardown();
+}
+
+static void test_in_range_backoff(void)
+{
+	struct bluez_device *device;
+
+	setup();
+	device = add_device("hci0", -50);
+
+	set_policy(BLUEZ_RECONNECT_IN_RANGE, NULL, 0);
+	heard(device, -50);
+	g_assert_cmpuint(submitted.count, ==, 1);
+
+	/* Failed, advertisements within the backoff are ignored */
+	reply(BT_RESULT_FAILED);
+	heard(device, -50);
+	g_assert_cmpuint(submitted.count, ==, 1);
+
+	fake_now += (DEFAULT_RECONNECT_INITIAL_DELAY + 10) * 1000;
+	heard(device, -50);
+	g_assert_cmpuint(submitted.count, ==, 2);
+	reply(BT_RESULT_OK);
+
+	teardown();
+}
+
+static void test_adapter(void)
+{
+	struct bluez_device *hci0, *hci1;
+
+	setup();
+	hci0 = add_device("hci0", -40);
+	hci1 = add_device("hci1", -80);
+
+	/* Heard through another adapter than the policy's */
+	set_policy(BLUEZ_RECONNECT_IN_RANGE, "hci1", 0);
+	heard(hci0, -40);
+	g_assert_cmpuint(submitted.count, ==, 0);
+
+	heard(hci1, -80);
+	g_assert_cmpuint(submitted.count, ==, 1);
+	g_assert_true(submitted.device == hci1);
+	reply(BT_RESULT_OK);
+
+	/* Any adapter: connected through one counts for all */
+	set_policy(BLUEZ_RECONNECT_ALWAYS, NULL, 0);
+	g_assert_cmpuint(submitted.count, ==, 2);
+	g_assert_true(submitted.device == hci0);
+	reply(BT_RESULT_OK);
+
+	hci1->info.connected = TRUE;
+	bluez_reconnect_device_changed(reconnect, hci0,
+						BLUEZ_PROPERTY_CONNECTED);
+	g_assert_cmpuint(submitted.count, ==, 2);
+
+	teardown();
+}
+
+static void test_forget(void)
+{
+	struct bluez_reconnect_stats stats;
+
+	setup();
+	add_device("hci0", -50);
+
+	set_policy(BLUEZ_RECONNECT_ALWAYS, NULL, 0);
+	g_assert_cmpuint(submitted.count, ==, 1);
+
+	/* Forgotten while connecting, the reply frees it */
+	bluez_reconnect_set_policy(reconnect, &manager.devices[0].info.addr,
+									NULL);
+	bluez_reconnect_get_stats(reconnect, &stats);
+	g_assert_cmpuint(stats.known, ==, 0);
+	reply(BT_RESULT_FAILED);
+
+	/* Freed while connecting, the reply only drops its reference */
+	set_policy(BLUEZ_RECONNECT_ALWAYS, NULL, 0);
+	g_assert_cmpuint(submitted.count, ==, 2);
+	bluez_reconnect_free(reconnect);
+	reconnect = NULL;
+	reply(BT_RESULT_OK);
+
+	bluez_timers_free(timers);
+}
+
+static void test_load(void)
+{
+	static const gchar *contents =
+		"[00:1A:7D:DA:71:0F]\n"
+		"Mode=in-range\n"
+		"Adapter=hci0\n"
+		"InitialDelay=500\n"
+		"[11:22:33:44:55:66]\n"
+		"Mode=in-range\n"
+		"MinRSSI=-70\n"
+		"Window=08:30-17:45\n"
+		"[not an address]\n"
+		"Mode=always\n";
+	gchar *filename, *saved;
+	struct bluez_reconnect_stats stats;
+	struct bluez_device *device;
+	GKeyFile *file;
+	gint fd;
+
+	setup();
+	device = add_device("hci0", -95);
+
+	fd = g_file_open_tmp("test-reconnect-XXXXXX", &filename, NULL);
+	g_assert_cmpint(fd, >=, 0);
+	close(fd);
+	g_assert_true(g_file_set_contents(filename, contents, -1, NULL));
+
+	g_assert_cmpint(bluez_reconnect_load(reconnect, filename), ==,
+							BT_RESULT_OK);
+	bluez_reconnect_get_stats(reconnect, &stats);
+	g_assert_cmpuint(stats.known, ==, 2);
+
+	/* A missing MinRSSI takes any advertisement */
+	heard(device, -95);
+	g_assert_cmpuint(submitted.count, ==, 1);
+	reply(BT_RESULT_OK);
+
+	/* What was loaded is saved back, defaults filled in */
+	g_assert_cmpint(bluez_reconnect_save(reconnect, filename), ==,
+							BT_RESULT_OK);
+	file = g_key_file_new();
+	g_assert_true(g_key_file_load_from_file(file, filename,
+						G_KEY_FILE_NONE, NULL));
+
+	saved = g_key_file_get_string(file, "00:1A:7D:DA:71:0F", "Adapter",
+									NULL);
+	g_assert_cmpstr(saved, ==, "hci0");
+	g_free(saved);
+	g_assert_false(g_key_file_has_key(file, "00:1A:7D:DA:71:0F",
+							"MinRSSI", NULL));
+	g_assert_cmpint(g_key_file_get_integer(file, "00:1A:7D:DA:71:0F",
+					"InitialDelay", NULL), ==, 500);
+	g_assert_cmpint(g_key_file_get_integer(file, "00:1A:7D:DA:71:0F",
+					"MaxDelay", NULL), ==,
+					DEFAULT_RECONNECT_MAX_DELAY);
+
+	g_assert_cmpint(g_key_file_get_integer(file, "11:22:33:44:55:66",
+					"MinRSSI", NULL), ==, -70);
+	saved = g_key_file_get_string(file, "11:22:33:44:55:66", "Window",
+									NULL);
+	g_assert_cmpstr(saved, ==, "08:30-17:45");
+	g_free(saved);
+
+	g_key_file_free(file);
+	unlink(filename);
+	g_free(filename);
+
+	teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/reconnect/in-range", test_in_range);
+	g_test_add_func("/reconnect/backoff", test_backoff);
+	g_test_add_func("/reconnect/in-range-backoff", test_in_range_backoff);
+	g_test_add_func("/reconnect/adapter", test_adapter);
+	g_test_add_func("/reconnect/forget", test_forget);
+	g_test_add_func("/reconnect/load", test_load);
+
+	return g_test_run();
+}
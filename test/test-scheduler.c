@@ -0,0 +1,397 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "bluez-common.h"
+#include "bluez-scheduler.h"
+#include "bluez-timer.h"
+
+/*
+ * The scheduler and its timers are built in with the clock and the
+ * D-Bus proxy replaced. Calls handed to D-Bus wait in a list until a
+ * check answers them with the result it wants.
+ */
+static gint64 fake_now = 1000000;
+
+static gint64 fake_monotonic_time(void)
+{
+	return fake_now;
+}
+
+struct fake_proxy {
+	const gchar *path;
+};
+
+struct sent_call {
+	GDBusProxy *proxy;
+	const gchar *name;
+	gint timeout;
+	GAsyncReadyCallback callback;
+	gpointer user_data;
+};
+
+static GArray *sent;
+static BTResult reply_result;
+
+static void fake_proxy_call(GDBusProxy *proxy, const gchar *name,
+				GVariant *parameter, GDBusCallFlags flags,
+				gint timeout, GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	struct sent_call call = { proxy, name, timeout, callback, user_data };
+
+	g_array_append_val(sent, call);
+}
+
+static GVariant *fake_proxy_call_finish(GDBusProxy *proxy,
+					GAsyncResult *res, GError **error)
+{
+	return NULL;
+}
+
+static const gchar *fake_proxy_get_object_path(GDBusProxy *proxy)
+{
+	return ((struct fake_proxy *) proxy)->path;
+}
+
+static BTResult fake_error_to_result(GError *error)
+{
+	return reply_result;
+}
+
+#define g_get_monotonic_time fake_monotonic_time
+#define g_dbus_proxy_call fake_proxy_call
+#define g_dbus_proxy_call_finish fake_proxy_call_finish
+#define g_dbus_proxy_get_object_path fake_proxy_get_object_path
+#define error_to_result fake_error_to_result
+#define g_object_ref(object) (object)
+#define g_object_unref(object) ((void) 0)
+#undef G_DBUS_PROXY
+#define G_DBUS_PROXY(object) ((GDBusProxy *) (object))
+#include "bluez-timer.c"
+#include "bluez-scheduler.c"
+#undef g_get_monotonic_time
+
+static struct fake_proxy hci0_dev = { "/org/bluez/hci0/dev_00_00_00_00_00_01" };
+static struct fake_proxy hci0 = { "/org/bluez/hci0" };
+static struct fake_proxy hci1_dev = { "/org/bluez/hci1/dev_00_00_00_00_00_02" };
+
+#define HCI0_DEV ((GDBusProxy *) &hci0_dev)
+#define HCI0 ((GDBusProxy *) &hci0)
+#define HCI1_DEV ((GDBusProxy *) &hci1_dev)
+
+struct result {
+	gint called;
+	BTResult ret;
+	gint64 at;
+};
+
+static void result_cb(BTResult ret, GVariant *reply, void *user_data)
+{
+	struct result *result = user_data;
+
+	result->called++;
+	result->ret = ret;
+	result->at = fake_now;
+}
+
+static struct bluez_timers *timers;
+static struct bluez_scheduler *scheduler;
+
+static void setup(guint max_in_flight, guint max_per_adapter)
+{
+	sent = g_array_new(FALSE, FALSE, sizeof(struct sent_call));
+	timers = bluez_timers_new(NULL);
+	scheduler = bluez_scheduler_new(timers);
+	bluez_scheduler_set_limits(scheduler, max_in_flight, max_per_adapter);
+}
+
+static void teardown(void)
+{
+	bluez_scheduler_free(scheduler);
+	g_assert_cmpuint(sent->len, ==, 0);
+	bluez_timers_free(timers);
+	g_array_free(sent, TRUE);
+}
+
+static void advance(guint64 ms)
+{
+	fake_now += ms * 1000;
+	timers_expire(timers);
+}
+
+/*
+ * Answers the call sent index-th among those still in flight, returns
+ * its name, which the reply may free, copied.
+ */
+static const gchar *reply(guint index, BTResult ret)
+{
+	static gchar name[32];
+	struct sent_call call;
+
+	g_assert_cmpuint(index, <, sent->len);
+	call = g_array_index(sent, struct sent_call, index);
+	g_array_remove_index(sent, index);
+	g_strlcpy(name, call.name, sizeof(name));
+
+	reply_result = ret;
+	call.callback((GObject *) call.proxy, NULL, call.user_data);
+
+	return name;
+}
+
+static const gchar *sent_name(guint index)
+{
+	g_assert_cmpuint(index, <, sent->len);
+
+	return g_array_index(sent, struct sent_call, index).name;
+}
+
+static void call(GDBusProxy *proxy, const gchar *name,
+			enum bluez_call_class klass, guint timeout_ms,
+			struct result *result)
+{
+	bluez_scheduler_call(scheduler, proxy, name, NULL, klass,
+					timeout_ms, result_cb, result);
+}
+
+static void test_class_order(void)
+{
+	struct result r[4] = { { 0 } };
+	struct bluez_scheduler_stats stats;
+
+	setup(1, 4);
+
+	call(HCI0_DEV, "Busy", BLUEZ_CALL_BACKGROUND, 0, &r[0]);
+	call(HCI0_DEV, "Background", BLUEZ_CALL_BACKGROUND, 0, &r[1]);
+	call(HCI0_DEV, "Normal", BLUEZ_CALL_NORMAL, 0, &r[2]);
+	call(HCI0_DEV, "Interactive", BLUEZ_CALL_INTERACTIVE, 0, &r[3]);
+
+	g_assert_cmpuint(sent->len, ==, 1);
+	bluez_scheduler_get_stats(scheduler, &stats);
+	g_assert_cmpuint(stats.in_flight, ==, 1);
+	g_assert_cmpuint(stats.classes[BLUEZ_CALL_BACKGROUND].queued, ==, 1);
+	g_assert_cmpuint(stats.classes[BLUEZ_CALL_NORMAL].queued, ==, 1);
+	g_assert_cmpuint(stats.classes[BLUEZ_CALL_INTERACTIVE].queued, ==, 1);
+
+	/* Strict class order once a slot frees, whatever the queue order */
+	g_assert_cmpstr(reply(0, BT_RESULT_OK), ==, "Busy");
+	g_assert_cmpint(r[0].called, ==, 1);
+	g_assert_cmpuint(r[0].ret, ==, BT_RESULT_OK);
+
+	g_assert_cmpstr(reply(0, BT_RESULT_OK), ==, "Interactive");
+	g_assert_cmpstr(reply(0, BT_RESULT_OK), ==, "Normal");
+	g_assert_cmpstr(reply(0, BT_RESULT_OK), ==, "Background");
+	g_assert_cmpuint(sent->len, ==, 0);
+
+	bluez_scheduler_get_stats(scheduler, &stats);
+	g_assert_cmpuint(stats.in_flight, ==, 0);
+	g_assert_cmpuint(stats.classes[BLUEZ_CALL_BACKGROUND].dispatched, ==,
+									2);
+	g_assert_cmpuint(stats.classes[BLUEZ_CALL_INTERACTIVE].dispatched, ==,
+									1);
+
+	teardown();
+}
+
+static void test_adapter_cap(void)
+{
+	struct result r[4] = { { 0 } };
+
+	setup(4, 1);
+
+	/* A device and its adapter count toward the same cap */
+	call(HCI0_DEV, "First", BLUEZ_CALL_NORMAL, 0, &r[0]);
+	call(HCI0, "Second", BLUEZ_CALL_NORMAL, 0, &r[1]);
+	g_assert_cmpuint(sent->len, ==, 1);
+
+	/* Calls to another adapter overtake the one held back */
+	call(HCI1_DEV, "Other", BLUEZ_CALL_NORMAL, 0, &r[2]);
+	g_assert_cmpuint(sent->len, ==, 2);
+	g_assert_cmpstr(sent_name(1), ==, "Other");
+
+	g_assert_cmpstr(reply(0, BT_RESULT_OK), ==, "First");
+	g_assert_cmpuint(sent->len, ==, 2);
+	g_assert_cmpstr(sent_name(1), ==, "Second");
+
+	/* Raising the cap dispatches right away */
+	call(HCI0_DEV, "Third", BLUEZ_CALL_NORMAL, 0, &r[3]);
+	g_assert_cmpuint(sent->len, ==, 2);
+	bluez_scheduler_set_limits(scheduler, 0, 2);
+	g_assert_cmpuint(sent->len, ==, 3);
+
+	while (sent->len)
+		reply(0, BT_RESULT_OK);
+
+	g_assert_cmpint(r[0].called + r[1].called + r[2].called + r[3].called,
+								==, 4);
+
+	teardown();
+}
+
+static void test_deadline(void)
+{
+	struct result busy = { 0 }, late = { 0 }, waiting = { 0 };
+	struct bluez_scheduler_stats stats;
+
+	setup(1, 4);
+
+	call(HCI0_DEV, "Busy", BLUEZ_CALL_NORMAL, 0, &busy);
+	call(HCI0_DEV, "Late", BLUEZ_CALL_NORMAL, 100, &late);
+	call(HCI0_DEV, "Waiting", BLUEZ_CALL_NORMAL, 500, &waiting);
+
+	/* Dropped on its deadline while still queued */
+	advance(90);
+	g_assert_cmpint(late.called, ==, 0);
+	advance(20);
+	g_assert_cmpint(late.called, ==, 1);
+	g_assert_cmpuint(late.ret, ==, BT_RESULT_TIMEOUT);
+
+	bluez_scheduler_get_stats(scheduler, &stats);
+	g_assert_cmpuint(stats.classes[BLUEZ_CALL_NORMAL].expired, ==, 1);
+	g_assert_cmpuint(stats.classes[BLUEZ_CALL_NORMAL].queued, ==, 1);
+
+	/* The D-Bus timeout is what is left of the deadline */
+	advance(90);
+	reply(0, BT_RESULT_OK);
+	g_assert_cmpuint(sent->len, ==, 1);
+	g_assert_cmpint(g_array_index(sent, struct sent_call, 0).timeout, ==,
+									300);
+
+	/* Dispatched, its expiry timer is gone */
+	advance(1000);
+	g_assert_cmpint(waiting.called, ==, 0);
+	reply(0, BT_RESULT_OK);
+	g_assert_cmpint(waiting.called, ==, 1);
+	g_assert_cmpuint(waiting.ret, ==, BT_RESULT_OK);
+
+	teardown();
+}
+
+static void test_retry(void)
+{
+	struct bluez_retry_policy policy = {
+		.retry_on = BLUEZ_RETRY_ON(BT_RESULT_NOT_READY),
+		.max_attempts = 3,
+		.initial_delay_ms = 100,
+	};
+	struct bluez_scheduler_stats stats;
+	struct result r = { 0 };
+
+	setup(4, 4);
+
+	bluez_scheduler_call_with_retry(scheduler, HCI0_DEV, "Retried", NULL,
+				BLUEZ_CALL_NORMAL, 0, &policy, result_cb, &r);
+
+	/* Not answered, waits out a backoff of at most 100 ms */
+	reply(0, BT_RESULT_NOT_READY);
+	g_assert_cmpint(r.called, ==, 0);
+	g_assert_cmpuint(sent->len, ==, 0);
+
+	advance(100 + BLUEZ_TIMER_TICK_MS);
+	g_assert_cmpuint(sent->len, ==, 1);
+
+	/* Then at most 200 ms */
+	reply(0, BT_RESULT_NOT_READY);
+	advance(200 + BLUEZ_TIMER_TICK_MS);
+	g_assert_cmpuint(sent->len, ==, 1);
+
+	/* The last attempt's result is final */
+	reply(0, BT_RESULT_NOT_READY);
+	g_assert_cmpint(r.called, ==, 1);
+	g_assert_cmpuint(r.ret, ==, BT_RESULT_NOT_READY);
+
+	bluez_scheduler_get_stats(scheduler, &stats);
+	g_assert_cmpuint(stats.classes[BLUEZ_CALL_NORMAL].retries, ==, 2);
+	g_assert_cmpuint(stats.classes[BLUEZ_CALL_NORMAL].dispatched, ==, 3);
+
+	/* Results outside retry_on are final at once */
+	memset(&r, 0, sizeof(r));
+	bluez_scheduler_call_with_retry(scheduler, HCI0_DEV, "Failed", NULL,
+				BLUEZ_CALL_NORMAL, 0, &policy, result_cb, &r);
+	reply(0, BT_RESULT_NOT_EXIST);
+	g_assert_cmpint(r.called, ==, 1);
+	g_assert_cmpuint(r.ret, ==, BT_RESULT_NOT_EXIST);
+
+	/* So is a failure whose backoff would end past the deadline */
+	memset(&r, 0, sizeof(r));
+	policy.deadline_ms = 40;
+	bluez_scheduler_call_with_retry(scheduler, HCI0_DEV, "Bounded", NULL,
+				BLUEZ_CALL_NORMAL, 0, &policy, result_cb, &r);
+	reply(0, BT_RESULT_NOT_READY);
+	g_assert_cmpint(r.called, ==, 1);
+	g_assert_cmpuint(r.ret, ==, BT_RESULT_NOT_READY);
+
+	teardown();
+}
+
+static void test_free(void)
+{
+	struct bluez_retry_policy policy = { .max_attempts = 2 };
+	struct result flying = { 0 }, queued = { 0 }, backoff = { 0 };
+	struct sent_call flight;
+
+	setup(1, 4);
+
+	bluez_scheduler_call_with_retry(scheduler, HCI0_DEV, "Backoff", NULL,
+			BLUEZ_CALL_NORMAL, 0, &policy, result_cb, &backoff);
+	reply(0, BT_RESULT_FAILED);
+
+	call(HCI0_DEV, "Flying", BLUEZ_CALL_NORMAL, 0, &flying);
+	call(HCI0_DEV, "Queued", BLUEZ_CALL_NORMAL, 0, &queued);
+
+	/* Keep the call in flight past the free */
+	flight = g_array_index(sent, struct sent_call, 0);
+	g_array_set_size(sent, 0);
+
+	bluez_scheduler_free(scheduler);
+
+	/* Queued and backing off calls are cancelled, not retryable */
+	g_assert_cmpint(queued.called, ==, 1);
+	g_assert_cmpuint(queued.ret, ==, BT_RESULT_CANCELLED);
+	g_assert_cmpint(backoff.called, ==, 1);
+	g_assert_cmpuint(backoff.ret, ==, BT_RESULT_CANCELLED);
+
+	/* The reply of the one in flight still arrives, and is not retried */
+	g_assert_cmpint(flying.called, ==, 0);
+	reply_result = BT_RESULT_FAILED;
+	flight.callback((GObject *) flight.proxy, NULL, flight.user_data);
+	g_assert_cmpint(flying.called, ==, 1);
+	g_assert_cmpuint(flying.ret, ==, BT_RESULT_FAILED);
+
+	bluez_timers_free(timers);
+	g_array_free(sent, TRUE);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/scheduler/class-order", test_class_order);
+	g_test_add_func("/scheduler/adapter-cap", test_adapter_cap);
+	g_test_add_func("/scheduler/deadline", test_deadline);
+	g_test_add_func("/scheduler/retry", test_retry);
+	g_test_add_func("/scheduler/free", test_free);
+
+	return g_test_run();
+}
@@ -0,0 +1,214 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+/*
+ * Built in so that a reader caught inside acquire can be faked by
+ * raising its epoch counter, no second thread needed.
+ */
+#include "bluez-snapshot.c"
+
+static void add(struct bluez_snapshot *snapshot, const gchar *address,
+							const gchar *name)
+{
+	struct bluez_device_info info;
+	gchar path[64], *p;
+
+	memset(&info, 0, sizeof(info));
+	g_assert_true(bluez_addr_parse(address, &info.addr));
+
+	g_snprintf(path, sizeof(path), "/org/bluez/hci0/dev_%s", address);
+	for (p = path; *p; p++)
+		if (*p == ':')
+			*p = '_';
+
+	info.path = path;
+	info.address = address;
+	info.name = name;
+
+	bluez_snapshot_add_device(snapshot, &info);
+
+	/* The snapshot keeps its own copy */
+	memset(path, 0, sizeof(path));
+}
+
+static void assert_sorted(struct bluez_snapshot *snapshot)
+{
+	const struct bluez_device_info *prev = NULL, *info;
+	guint i;
+
+	for (i = 0; i < bluez_snapshot_get_n_devices(snapshot); i++) {
+		info = bluez_snapshot_get_device(snapshot, i);
+		if (prev)
+			g_assert_cmpint(bluez_addr_compare(&prev->addr,
+						&info->addr), <, 0);
+		prev = info;
+	}
+}
+
+static gboolean keep_unnamed(const struct bluez_device_info *info,
+							gpointer user_data)
+{
+	const gchar *drop = user_data;
+
+	return g_strcmp0(info->name, drop) != 0;
+}
+
+static void test_incremental(void)
+{
+	const struct bluez_device_info *info, *kept;
+	struct bluez_snapshot *base, *next;
+
+	base = bluez_snapshot_new(1);
+	add(base, "00:00:00:00:00:30", "c");
+	add(base, "00:00:00:00:00:10", "a");
+	add(base, "00:00:00:00:00:20", "b");
+	bluez_snapshot_seal(base);
+
+	g_assert_cmpuint(bluez_snapshot_get_n_devices(base), ==, 3);
+	assert_sorted(base);
+
+	info = bluez_snapshot_find_device(base, "00:00:00:00:00:20");
+	g_assert_nonnull(info);
+	g_assert_cmpstr(info->name, ==, "b");
+	g_assert_cmpstr(info->path, ==,
+				"/org/bluez/hci0/dev_00_00_00_00_00_20");
+
+	/* b changes, d and e are new */
+	next = bluez_snapshot_new_from(base, 2, keep_unnamed, "b");
+	add(next, "00:00:00:00:00:40", "d");
+	add(next, "00:00:00:00:00:20", "b2");
+	add(next, "00:00:00:00:00:05", "e");
+	bluez_snapshot_seal(next);
+
+	g_assert_cmpuint(bluez_snapshot_get_version(next), ==, 2);
+	g_assert_cmpuint(bluez_snapshot_get_n_devices(next), ==, 5);
+	assert_sorted(next);
+
+	g_assert_cmpstr(bluez_snapshot_find_device(next,
+				"00:00:00:00:00:20")->name, ==, "b2");
+	g_assert_cmpstr(bluez_snapshot_get_device(next, 0)->name, ==, "e");
+	g_assert_cmpstr(bluez_snapshot_get_device(next, 4)->name, ==, "d");
+
+	/* Unchanged records are shared, not copied */
+	kept = bluez_snapshot_find_device(next, "00:00:00:00:00:10");
+	g_assert_true(kept == bluez_snapshot_find_device(base,
+							"00:00:00:00:00:10"));
+
+	/* The base is left as it was */
+	g_assert_cmpstr(bluez_snapshot_find_device(base,
+				"00:00:00:00:00:20")->name, ==, "b");
+	g_assert_null(bluez_snapshot_find_device(base, "00:00:00:00:00:40"));
+
+	/* Shared records live on in next */
+	bluez_snapshot_unref(base);
+	g_assert_cmpstr(kept->name, ==, "a");
+	g_assert_null(bluez_snapshot_find_device(next, "00:00:00:00:00:99"));
+
+	bluez_snapshot_unref(next);
+}
+
+static void test_remove_only(void)
+{
+	struct bluez_snapshot *base, *next;
+
+	base = bluez_snapshot_new(1);
+	add(base, "00:00:00:00:00:10", "a");
+	add(base, "00:00:00:00:00:20", "b");
+	bluez_snapshot_seal(base);
+
+	next = bluez_snapshot_new_from(base, 2, keep_unnamed, "a");
+	bluez_snapshot_seal(next);
+
+	g_assert_cmpuint(bluez_snapshot_get_n_devices(next), ==, 1);
+	g_assert_cmpstr(bluez_snapshot_get_device(next, 0)->name, ==, "b");
+
+	bluez_snapshot_unref(next);
+	bluez_snapshot_unref(base);
+}
+
+static struct bluez_snapshot *publish(struct bluez_snapshot_domain *domain,
+							guint64 version)
+{
+	struct bluez_snapshot *snapshot;
+
+	snapshot = bluez_snapshot_new(version);
+	bluez_snapshot_seal(snapshot);
+	bluez_snapshot_domain_publish(domain, snapshot);
+
+	return snapshot;
+}
+
+static void test_reclaim(void)
+{
+	struct bluez_snapshot_domain *domain;
+	struct bluez_snapshot *held;
+	gint epoch;
+
+	domain = bluez_snapshot_domain_new();
+
+	/* Nobody inside acquire, replaced snapshots go right away */
+	publish(domain, 1);
+	g_assert_null(domain->retired);
+	g_assert_false(bluez_snapshot_domain_reclaim(domain));
+
+	/* A reference taken before outlives the retirement */
+	held = bluez_snapshot_domain_acquire(domain);
+	g_assert_cmpuint(bluez_snapshot_get_version(held), ==, 1);
+
+	/* A reader caught between its counter and the pointer load */
+	epoch = domain->epoch;
+	domain->readers[epoch & 1]++;
+
+	publish(domain, 2);
+	g_assert_nonnull(domain->retired);
+	g_assert_true(bluez_snapshot_domain_reclaim(domain));
+
+	/* The reader may have loaded 2 as well, both stay */
+	publish(domain, 3);
+	g_assert_cmpuint(g_slist_length(domain->retired), ==, 2);
+	g_assert_true(bluez_snapshot_domain_reclaim(domain));
+
+	/* Once it left, the next reclaim drops both */
+	domain->readers[epoch & 1]--;
+	g_assert_false(bluez_snapshot_domain_reclaim(domain));
+	g_assert_null(domain->retired);
+
+	g_assert_cmpuint(bluez_snapshot_get_version(held), ==, 1);
+	bluez_snapshot_unref(held);
+
+	held = bluez_snapshot_domain_acquire(domain);
+	g_assert_cmpuint(bluez_snapshot_get_version(held), ==, 3);
+	bluez_snapshot_unref(held);
+
+	bluez_snapshot_domain_free(domain);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/snapshot/incremental", test_incremental);
+	g_test_add_func("/snapshot/remove-only", test_remove_only);
+	g_test_add_func("/snapshot/reclaim", test_reclaim);
+
+	return g_test_run();
+}
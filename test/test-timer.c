@@ -0,0 +1,358 @@
+/*
+ * BlueZ-Lib - C API library for BlueZ
+ *
+ * Copyright (c) 2013-2016 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *              http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+
+/*
+ * The wheel is built in with the clock replaced, time only moves when a
+ * check says so and expiry is run by hand instead of by the main loop.
+ */
+static gint64 fake_now = 1000000;
+
+static gint64 fake_monotonic_time(void)
+{
+	return fake_now;
+}
+
+#define g_get_monotonic_time fake_monotonic_time
+#include "bluez-timer.c"
+#undef g_get_monotonic_time
+
+#define TICK_MS BLUEZ_TIMER_TICK_MS
+
+struct fired {
+	struct bluez_timers *timers;
+	gint64 at;			/* fake_now when called, -1 before */
+	guint count;
+	struct bluez_timer *cancel;	/* cancelled from the callback */
+	guint add_ms;			/* re-added from the callback */
+	struct fired *add_data;
+};
+
+static void fired_init(struct fired *fired, struct bluez_timers *timers)
+{
+	memset(fired, 0, sizeof(*fired));
+	fired->timers = timers;
+	fired->at = -1;
+}
+
+static void fired_cb(gpointer user_data)
+{
+	struct fired *fired = user_data;
+
+	fired->at = fake_now;
+	fired->count++;
+
+	if (fired->cancel) {
+		bluez_timers_cancel(fired->timers, fired->cancel);
+		fired->cancel = NULL;
+	}
+
+	if (fired->add_data) {
+		bluez_timers_add(fired->timers, fired->add_ms, fired_cb,
+							fired->add_data);
+		fired->add_data = NULL;
+	}
+}
+
+static void advance(struct bluez_timers *timers, guint64 ms)
+{
+	fake_now += ms * 1000;
+	timers_expire(timers);
+}
+
+/* Checks a timer fires on the tick its delay rounds up to, not before */
+static void check_delay(guint delay_ms)
+{
+	struct bluez_timers *timers = bluez_timers_new(NULL);
+	struct fired fired;
+	gint64 start = fake_now;
+	guint64 due = (delay_ms + TICK_MS - 1) / TICK_MS * TICK_MS;
+
+	fired_init(&fired, timers);
+	bluez_timers_add(timers, delay_ms, fired_cb, &fired);
+
+	if (due) {
+		advance(timers, due - TICK_MS);
+		g_assert_cmpuint(fired.count, ==, 0);
+		advance(timers, TICK_MS);
+	} else {
+		advance(timers, 0);
+	}
+
+	g_assert_cmpuint(fired.count, ==, 1);
+	g_assert_cmpint(fired.at, ==, start + (gint64) due * 1000);
+
+	bluez_timers_free(timers);
+}
+
+static void test_levels(void)
+{
+	/* Level 0, then the first slot of each level above and the last */
+	check_delay(0);
+	check_delay(TICK_MS);
+	check_delay(TICK_MS * 63);
+	check_delay(TICK_MS * 64);
+	check_delay(TICK_MS * 64 * 64 - 1);
+	check_delay(TICK_MS * 64 * 64);
+	check_delay(TICK_MS * 64 * 64 * 64 + 5);
+	check_delay(TICK_MS * 64 * 64 * 64 * 63);
+}
+
+static void test_cascade(void)
+{
+	struct bluez_timers *timers = bluez_timers_new(NULL);
+	struct fired fired[3];
+	gint64 start = fake_now;
+	guint delays[3] = { 700, 45000, 3000000 };
+	guint64 elapsed;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(fired); i++) {
+		fired_init(&fired[i], timers);
+		bluez_timers_add(timers, delays[i], fired_cb, &fired[i]);
+	}
+
+	g_assert(timers->occupied[1] && timers->occupied[2] &&
+							timers->occupied[3]);
+
+	/* One tick at a time, every cascade on the way is processed */
+	for (elapsed = 0; elapsed < delays[2]; elapsed += TICK_MS) {
+		advance(timers, TICK_MS);
+
+		for (i = 0; i < G_N_ELEMENTS(fired); i++)
+			g_assert_cmpuint(fired[i].count, ==,
+					elapsed + TICK_MS >= delays[i]);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(fired); i++)
+		g_assert_cmpint(fired[i].at, ==,
+				start + (gint64) delays[i] * 1000);
+
+	for (i = 0; i < WHEEL_LEVELS; i++)
+		g_assert_cmpuint(timers->occupied[i], ==, 0);
+
+	bluez_timers_free(timers);
+}
+
+static void test_park(void)
+{
+	struct bluez_timers *timers = bluez_timers_new(NULL);
+	guint64 turn_ms = (G_GUINT64_CONSTANT(1) <<
+				LEVEL_SHIFT(WHEEL_LEVELS)) * TICK_MS;
+	guint delay_ms = turn_ms * 2 + 12340;
+	struct bluez_timer *timer;
+	struct fired fired;
+	gint64 start = fake_now;
+
+	fired_init(&fired, timers);
+	timer = bluez_timers_add(timers, delay_ms, fired_cb, &fired);
+
+	/* Beyond a whole turn of the top level, parked in its last slot */
+	g_assert_cmpuint(timers->cur, ==, 0);
+	g_assert_cmpuint(timer->level, ==, WHEEL_LEVELS - 1);
+	g_assert_cmpuint(timer->slot, ==, WHEEL_MASK);
+
+	/* Parked twice over, never early */
+	advance(timers, turn_ms);
+	g_assert_cmpuint(fired.count, ==, 0);
+	advance(timers, turn_ms);
+	g_assert_cmpuint(fired.count, ==, 0);
+	advance(timers, 12340 - TICK_MS);
+	g_assert_cmpuint(fired.count, ==, 0);
+	advance(timers, TICK_MS);
+	g_assert_cmpuint(fired.count, ==, 1);
+	g_assert_cmpint(fired.at, ==, start + (gint64) delay_ms * 1000);
+
+	bluez_timers_free(timers);
+}
+
+static void test_stale_cur(void)
+{
+	struct bluez_timers *timers = bluez_timers_new(NULL);
+	struct fired early, late;
+	gint64 start = fake_now;
+
+	fired_init(&early, timers);
+	fired_init(&late, timers);
+
+	bluez_timers_add(timers, 10000, fired_cb, &late);
+
+	/* The loop did not run meanwhile, cur is 5 s behind the clock */
+	fake_now += 5000 * 1000;
+	bluez_timers_add(timers, 100, fired_cb, &early);
+	g_assert_cmpuint(timers->cur, ==, 0);
+
+	advance(timers, 90);
+	g_assert_cmpuint(early.count, ==, 0);
+	advance(timers, 10);
+	g_assert_cmpuint(early.count, ==, 1);
+	g_assert_cmpint(early.at, ==, start + 5100 * 1000);
+	g_assert_cmpuint(late.count, ==, 0);
+
+	/* Caught up, a timer added now is not delayed by the backlog */
+	g_assert_cmpuint(timers->cur, ==, now_tick(timers) + 1);
+
+	advance(timers, 4890);
+	g_assert_cmpuint(late.count, ==, 0);
+	g_assert_cmpuint(timers->cur, ==, now_tick(timers) + 1);
+	advance(timers, 10);
+	g_assert_cmpuint(late.count, ==, 1);
+	g_assert_cmpint(late.at, ==, start + 10000 * 1000);
+
+	/* A long jump runs everything due on the way */
+	fired_init(&early, timers);
+	fired_init(&late, timers);
+	bluez_timers_add(timers, 20, fired_cb, &early);
+	bluez_timers_add(timers, 50000, fired_cb, &late);
+	advance(timers, 60000);
+	g_assert_cmpuint(early.count, ==, 1);
+	g_assert_cmpuint(late.count, ==, 1);
+
+	bluez_timers_free(timers);
+}
+
+static void test_callbacks(void)
+{
+	struct bluez_timers *timers = bluez_timers_new(NULL);
+	struct fired first, second, again;
+
+	fired_init(&first, timers);
+	fired_init(&second, timers);
+	fired_init(&again, timers);
+
+	/* Whichever runs first cancels the other of the same batch */
+	first.cancel = bluez_timers_add(timers, 100, fired_cb, &second);
+	second.cancel = bluez_timers_add(timers, 100, fired_cb, &first);
+	advance(timers, 100);
+	g_assert_cmpuint(first.count + second.count, ==, 1);
+
+	/* Added from a callback, even undelayed it waits for the next tick */
+	fired_init(&first, timers);
+	first.add_ms = 0;
+	first.add_data = &again;
+	bluez_timers_add(timers, 30, fired_cb, &first);
+	advance(timers, 30);
+	g_assert_cmpuint(first.count, ==, 1);
+	g_assert_cmpuint(again.count, ==, 0);
+	advance(timers, TICK_MS);
+	g_assert_cmpuint(again.count, ==, 1);
+
+	/* Cancelling before expiry clears the slot */
+	fired_init(&first, timers);
+	bluez_timers_cancel(timers, bluez_timers_add(timers, 2000, fired_cb,
+								&first));
+	g_assert_cmpuint(timers->occupied[1], ==, 0);
+	advance(timers, 2000);
+	g_assert_cmpuint(first.count, ==, 0);
+
+	bluez_timers_free(timers);
+}
+
+#define RANDOM_TIMERS 256
+
+/* Each fired one is checked on the first run at or after its tick */
+static guint check_fired(struct fired *fired, const gint64 *due,
+							guint64 step_ms)
+{
+	guint i, n = 0;
+
+	for (i = 0; i < RANDOM_TIMERS; i++) {
+		if (fired[i].at != fake_now)
+			continue;
+
+		g_assert_cmpint(due[i], <=, fake_now);
+		g_assert_cmpint(due[i], >, fake_now - (gint64) step_ms * 1000);
+		g_assert_cmpuint(fired[i].count, ==, 1);
+		n++;
+	}
+
+	return n;
+}
+
+static void test_random(void)
+{
+	struct bluez_timers *timers = bluez_timers_new(NULL);
+	struct fired fired[RANDOM_TIMERS];
+	gint64 due[RANDOM_TIMERS];
+	GRand *rand = g_rand_new_with_seed(45);
+	guint i, delay, step, left = RANDOM_TIMERS;
+
+	/* Up to level 3, added while the wheel turns */
+	for (i = 0; i < RANDOM_TIMERS; i++) {
+		delay = g_rand_int_range(rand, TICK_MS, 3000000);
+
+		fired_init(&fired[i], timers);
+		bluez_timers_add(timers, delay, fired_cb, &fired[i]);
+		due[i] = fake_now + (gint64) (delay + TICK_MS - 1) /
+						TICK_MS * TICK_MS * 1000;
+
+		step = g_rand_int_range(rand, 0, 3) * TICK_MS;
+		advance(timers, step);
+		left -= check_fired(fired, due, MAX(step, TICK_MS));
+	}
+
+	while (left) {
+		step = g_rand_int_range(rand, 1, 500) * TICK_MS;
+		advance(timers, step);
+		left -= check_fired(fired, due, step);
+	}
+
+	for (i = 0; i < WHEEL_LEVELS; i++)
+		g_assert_cmpuint(timers->occupied[i], ==, 0);
+
+	g_rand_free(rand);
+	bluez_timers_free(timers);
+}
+
+static void test_backoff(void)
+{
+	guint attempt, delay;
+
+	g_assert_cmpuint(bluez_timer_backoff(100, 1000, 1, 0), ==, 100);
+	g_assert_cmpuint(bluez_timer_backoff(100, 1000, 2, 0), ==, 100);
+	g_assert_cmpuint(bluez_timer_backoff(100, 1000, 3, 0), ==, 200);
+	g_assert_cmpuint(bluez_timer_backoff(100, 1000, 5, 0), ==, 800);
+	g_assert_cmpuint(bluez_timer_backoff(100, 1000, 6, 0), ==, 1000);
+	g_assert_cmpuint(bluez_timer_backoff(100, 1000, 1000, 0), ==, 1000);
+
+	for (attempt = 2; attempt < 10; attempt++) {
+		delay = bluez_timer_backoff(100, 1000, attempt, 50);
+		g_assert_cmpuint(delay, <=, bluez_timer_backoff(100, 1000,
+								attempt, 0));
+		g_assert_cmpuint(delay * 2, >=, bluez_timer_backoff(100, 1000,
+								attempt, 0));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/timer/levels", test_levels);
+	g_test_add_func("/timer/cascade", test_cascade);
+	g_test_add_func("/timer/park", test_park);
+	g_test_add_func("/timer/stale-cur", test_stale_cur);
+	g_test_add_func("/timer/callbacks", test_callbacks);
+	g_test_add_func("/timer/random", test_random);
+	g_test_add_func("/timer/backoff", test_backoff);
+
+	return g_test_run();
+}